@@ -74,6 +74,12 @@ private:
     smpr_ft post_smoother;
     void * smoother_data;
 
+    // persistent vectors, so Mult does not allocate
+    mfem::Vector * res;
+    mfem::HypreParVector * RESC;
+    mfem::HypreParVector * XC;
+    mfem::HypreParVector * RESC2;
+
     mfem::Solver * inner_solver; // originally this has been CorrectNullspace
     mfem::Solver * outer_solver; // originally this has been a VCycleSolver
 };
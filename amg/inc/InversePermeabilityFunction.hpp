@@ -55,13 +55,22 @@ public:
 
     static void ReadPermeabilityFile(const std::string fileName);
     static void ReadPermeabilityFile(const std::string fileName, MPI_Comm comm);
+
+    /// Collective MPI-IO read of a binary permeability file, where each
+    /// process loads only the box of cells touched by its part of the mesh.
+    static void ReadPermeabilityFile(const std::string fileName, MPI_Comm comm,
+                                     const mfem::Mesh & mesh);
+    static bool IsBinaryPermeabilityFile(const std::string fileName);
+    /// Converts the SPE10 text file (60x220x85 cells) to the binary format.
+    static void ConvertPermeabilityFile(const std::string textFileName,
+                                        const std::string binaryFileName);
     static void SetConstantInversePermeability(
         double ipx, double ipy, double ipz);
 
     template<class F>
     static void Transform(const F & f)
     {
-        for (int i = 0; i < 3*Nx*Ny*Nz; ++i)
+        for (int i = 0; i < 3*ni*nj*nk; ++i)
             inversePermeability[i] = f(inversePermeability[i]);
     }
 
@@ -92,6 +101,19 @@ private:
     static double hz;
     static double * inversePermeability;
 
+    /// The box of cells held in inversePermeability, the whole
+    /// Nx x Ny x Nz domain unless read with the mesh.
+    static int i0;
+    static int j0;
+    static int k0;
+    static int ni;
+    static int nj;
+    static int nk;
+
+    static void SetWholeBox();
+    static void Locate(const double * x, int & i, int & j, int & k);
+    static int Index(int i, int j, int k);
+
     static SliceOrientation orientation;
     static int npos;
 };
@@ -129,6 +129,35 @@ public:
     */
     T** Collect();
 
+    /**
+       Split version of Collect() that lets the caller work on entities
+       as their data arrive. Returns the same array as Collect(), but
+       as soon as the receives are posted: only the entities for which
+       Completed() is true are filled in yet, the others as
+       CollectSome() reports them. CollectEnd() must be called before
+       anything else is done with this object.
+    */
+    T** CollectBegin();
+
+    /**
+       Whether this processor owns entity and has all of its data,
+       only valid between CollectBegin() and CollectEnd().
+    */
+    bool Completed(int entity) const
+    {return entity_master[entity] == comm_rank && 0 == entity_pending[entity];}
+
+    /**
+       Waits until at least one more owned entity has all of its data
+       and appends these entities to completed. Returns false, without
+       waiting, when no data are outstanding.
+    */
+    bool CollectSome(std::vector<int>& completed);
+
+    /**
+       Completes the communication started by CollectBegin().
+    */
+    void CollectEnd();
+
     /**
        Does everything to Broadcast DenseMatrix from master to slave.
        data[] should be size num_entities. The array entries where this
@@ -240,6 +269,12 @@ private:
 
     int * entity_slaveid;
 
+    // owned entity of each data receive, and how many of them each owned
+    // entity is waiting for, between CollectBegin() and CollectEnd()
+    int * data_receive_entity;
+    int * entity_pending;
+    int receives_pending;
+
     int num_entities;
     int send_counter;
     int num_slave_comms; // where this processor plays role of slave
@@ -279,6 +314,9 @@ template <class T>
 void SharedEntityCommunication<T>::Initialize()
 {
     preparing_to_reduce = false;
+    data_receive_entity = NULL;
+    entity_pending = NULL;
+    receives_pending = 0;
 
     num_entities = entity_proc->Size();
 
@@ -746,6 +784,14 @@ void SharedEntityCommunication<T>::ReduceSend(int entity, const T& mat)
 
 template <class T>
 T ** SharedEntityCommunication<T>::Collect()
+{
+    T ** out = CollectBegin();
+    CollectEnd();
+    return out;
+}
+
+template <class T>
+T ** SharedEntityCommunication<T>::CollectBegin()
 {
     MFEM_ASSERT(send_counter == num_slave_comms, 
                 "Have not called ReduceSend() for every entity!");
@@ -755,6 +801,9 @@ T ** SharedEntityCommunication<T>::Collect()
     delete [] header_requests;
     delete [] header_statuses;
 
+    data_receive_entity = new int[num_master_comms];
+    entity_pending = new int[num_entities];
+    std::memset(entity_pending, 0, sizeof(int) * num_entities);
     int data_receive_counter = 0;
     std::vector<int> received_entities(num_entities);
     for (int i=0; i<num_entities; ++i)
@@ -780,6 +829,8 @@ T ** SharedEntityCommunication<T>::Collect()
                                 neighbor_row[neighbor], ENTITY_MESSAGE_TAG,
                                 &data_requests[num_slave_comms + data_receive_counter]);
                     received_entities[entity]++;
+                    data_receive_entity[data_receive_counter] = entity;
+                    entity_pending[entity]++;
                     data_receive_counter++;
                 }
             }
@@ -789,20 +840,53 @@ T ** SharedEntityCommunication<T>::Collect()
             MFEM_ASSERT(reduce_receive_buffer[i] == NULL, "reduce_receive_buffer not null!");
         }
     }
+    receives_pending = data_receive_counter;
 
     delete [] send_headers;
     delete [] receive_headers;
 
+    return reduce_receive_buffer;
+}
+
+template <class T>
+bool SharedEntityCommunication<T>::CollectSome(std::vector<int>& completed)
+{
+    MFEM_ASSERT(preparing_to_reduce, "Must call CollectBegin() first!");
+    if (0 == receives_pending)
+        return false;
+
+    int outcount;
+    std::vector<int> indices(num_master_comms);
+    std::vector<MPI_Status> statuses(num_master_comms);
+    MPI_Waitsome(num_master_comms, data_requests + num_slave_comms, &outcount,
+                 &indices[0], &statuses[0]);
+    MFEM_ASSERT(outcount != MPI_UNDEFINED, "No receive was active!");
+    for (int k=0; k<outcount; ++k)
+    {
+        const int entity = data_receive_entity[indices[k]];
+        receives_pending--;
+        if (0 == --entity_pending[entity])
+            completed.push_back(entity);
+    }
+    return true;
+}
+
+template <class T>
+void SharedEntityCommunication<T>::CollectEnd()
+{
+    MFEM_ASSERT(preparing_to_reduce, "Must call CollectBegin() first!");
+
     MPI_Status * data_statuses = new MPI_Status[num_slave_comms + num_master_comms];
     MPI_Waitall(num_slave_comms + num_master_comms, data_requests, data_statuses);
     delete [] data_requests;
     delete [] data_statuses;
 
     delete [] reduce_send_buffer;
+    delete [] data_receive_entity;
+    delete [] entity_pending;
+    receives_pending = 0;
 
     preparing_to_reduce = false;
-
-    return reduce_receive_buffer;
 }
 
 template <class T>
@@ -292,6 +292,55 @@ mfem::SparseMatrix *agg_build_AE_stiffm(
     int part, const agg_partitioning_relations_t& agg_part_rels,
     const ElementMatrixProvider *data);
 
+/*! \brief Assembles the local stiffness matrix for an AE from stored element
+           matrices.
+
+    Same as \b agg_build_AE_stiffm, but the element matrices are read from
+    a contiguous arena and the local (in the AE) indices of the element DoFs
+    are precomputed, so no lookups or sparse insertions are done. The rows
+    are accumulated directly into CSR arrays.
+
+    \param part (IN) The id (number) of the AE in question.
+    \param agg_part_rels (IN) The partitioning relations.
+    \param arena (IN) The dense element matrices, stored column-major one
+                      after another.
+    \param arena_offsets (IN) The offset of each element matrix in \a arena.
+    \param elem_AE_dofs (IN) For every entry of \b elem_to_dof, the local
+                             index of the DoF in the AE that contains the
+                             element.
+    \param symmetrize (IN) Whether to use the upper triangle of the
+                           assembled matrix for the lower one as well.
+
+    \returns The local stiffness matrix for the AE in question.
+
+    \warning The returned sparse matrix must be freed by the caller.
+*/
+mfem::SparseMatrix *agg_build_AE_stiffm_from_arena(
+    int part, const agg_partitioning_relations_t& agg_part_rels,
+    const double *arena, const int *arena_offsets, const int *elem_AE_dofs,
+    bool symmetrize);
+
+/*! \brief Assembles the local stiffness matrix for an AE, using the global
+           stiffness matrix and stored element matrices.
+
+    Produces the same matrix as \b agg_build_AE_stiffm_with_global, with the
+    entries between AEs taken from \b agg_build_AE_stiffm_from_arena instead
+    of being assembled value by value.
+
+    \param glob_to_AE (IN/OUT) Work array of size \b ND filled with -1. It
+                               is filled with -1 again on return.
+
+    See \b agg_build_AE_stiffm_with_global and
+    \b agg_build_AE_stiffm_from_arena for the other parameters.
+
+    \warning The returned sparse matrix must be freed by the caller.
+*/
+mfem::SparseMatrix *agg_build_AE_stiffm_with_global_from_arena(
+    const mfem::SparseMatrix& A, int part,
+    const agg_partitioning_relations_t& agg_part_rels,
+    const double *arena, const int *arena_offsets, const int *elem_AE_dofs,
+    int *glob_to_AE, bool bdr_cond_imposed, bool assemble_ess_diag);
+
 /*! \brief Restricts a group of vectors to an aggregate.
 
     Restricts a group of vectors presented as a dense matrix (each column is a
@@ -441,6 +490,20 @@ void agg_create_rels_except_elem_coarse(
     const agg_partitioning_relations_t& agg_part_rels_fine,
     mfem::HypreParMatrix * interp);
 
+/*! \brief Sends the tentative interpolants of the MISes to all processes
+           sharing them.
+
+    Afterwards \a mis_tent_interps and \a mis_numcoarsedof are set for the
+    shared MISes that this process does not own too.
+
+    \param agg_part_rels_fine (IN) The relations of the level of the MISes.
+    \param mis_numcoarsedof (IN/OUT) Number of coarse DoFs of every MIS.
+    \param mis_tent_interps (IN/OUT) Tentative interpolant of every MIS.
+*/
+void agg_broadcast_mis_tent_interps(
+    const agg_partitioning_relations_t &agg_part_rels_fine,
+    int * mis_numcoarsedof, mfem::DenseMatrix ** mis_tent_interps);
+
 void agg_build_coarse_Dof_TrueDof(agg_partitioning_relations_t &agg_part_rels_coarse,
                                   const agg_partitioning_relations_t &agg_part_rels_fine,
                                   int coarse_truedof_offset, int * mis_numcoarsedof,
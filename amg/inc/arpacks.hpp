@@ -67,6 +67,10 @@ namespace saamge
                     Value of 0 means to use some default value in ARPACK++.
     \param tol (IN) The tolerance in ARPACK. Value of 0.0 means to use some
                     default value in ARPACK++.
+    \param resid (IN/OUT) If not NULL, the starting vector for the Arnoldi
+                          process, of size A.Size(). ARPACK uses it as its
+                          residual workspace, so it is overwritten. Value of
+                          NULL means a random starting vector.
 
     \returns The number of eigenvalues and eigenvectors computed.
 
@@ -78,7 +82,7 @@ int arpacks_calc_portion_eigens_sparse_diag(const mfem::SparseMatrix& Ain,
                                             const mfem::SparseMatrix& Bin,
                                             int num_evects, bool lower=true,
                                             int max_iters=0, int ncv=0,
-                                            int tol=0.);
+                                            int tol=0., double *resid=NULL);
 
 }
 
@@ -36,9 +36,11 @@
 
 #include "common.hpp"
 #include <mfem.hpp>
+#include <vector>
 #include "aggregates.hpp"
 
 #include "SharedEntityCommunication.hpp"
+#include "xpacks.hpp"
 
 namespace saamge
 {
@@ -176,6 +178,16 @@ private:
         mfem::DenseMatrix * const *cut_evects_arr,
         SharedEntityCommunication<mfem::DenseMatrix>& sec);
 
+    /**
+       The sending half of CommunicateEigenvectors(): restricts the
+       vectors to the MISes and sends them to the owners of the MISes with
+       SharedEntityCommunication::ReduceSend(). The caller collects.
+    */
+    void SendEigenvectors(
+        const agg_partitioning_relations_t& agg_part_rels,
+        mfem::DenseMatrix * const *cut_evects_arr,
+        SharedEntityCommunication<mfem::DenseMatrix>& sec);
+
     /**
        Given a received_mats array, either from CommunicateEigenvectors() or
        possibly basically empty, add constant functions to it.
@@ -215,6 +227,40 @@ private:
                    mfem::DenseMatrix ** received_mats, int * row_sizes,
                    bool scaling_P);
 
+    /**
+       Allocates mis_tent_interps (empty) and mis_numcoarsedof for all
+       MISes, the first step of SVDInsert().
+    */
+    void InitMISTentInterps(const agg_partitioning_relations_t& agg_part_rels);
+
+    /**
+       For one owned MIS, deals with essential boundary conditions and does
+       the SVD of the row_size received matrices in mats, giving
+       mis_tent_interps[mis]. Deletes mats. The MISes can be done in any
+       order and, each with its own ws, concurrently.
+    */
+    void MISTentInterp(const agg_partitioning_relations_t& agg_part_rels,
+                       int mis, mfem::DenseMatrix * mats, int row_size,
+                       XpacksSVDWorkspace& ws);
+
+    /**
+       MISTentInterp() for a batch of owned MISes, sorted by shape so the
+       SVD workspaces are reused, and threaded when OpenMP is enabled.
+       row_sizes is indexed by MIS.
+    */
+    void MISTentInterps(const agg_partitioning_relations_t& agg_part_rels,
+                        const std::vector<int>& mises,
+                        mfem::DenseMatrix ** received_mats,
+                        const int * row_sizes);
+
+    /**
+       Inserts mis_tent_interps into the tentative prolongator in MIS order,
+       which is the order of the coarse DoFs, and sets mis_numcoarsedof and
+       coarse_truedof_offset.
+    */
+    void InsertMISTentInterps(const agg_partitioning_relations_t& agg_part_rels,
+                              bool scaling_P);
+
     /*! building coarse_one_representation on the fly (we are going to just
       copy this pointer to interp_data) */
     mfem::Array<double> * local_coarse_one_representation; 
@@ -99,7 +99,7 @@ public:
     virtual mfem::SparseMatrix * BuildAEStiff(int elno) const;
     mfem::ParBilinearForm* GetParBilinearForm() const {return form;}
     void SetBdrCondImposed(bool val) {bdr_cond_imposed_ = val;}
-private:
+protected:
     mfem::ParBilinearForm* form;
     mfem::SparseMatrix& assembled_processor_matrix_;
     /**
@@ -113,6 +113,37 @@ private:
     bool assemble_ess_diag_;
 };
 
+/**
+   Fine level elmat that computes all element matrices once, in the
+   constructor, and keeps them in one contiguous arena.
+
+   GetMatrix returns views into the arena, and BuildAEStiff uses
+   agg_build_AE_stiffm_with_global_from_arena with element-to-AE index maps
+   precomputed here, so the element matrices are not recomputed for every
+   pair of DoFs between AEs.
+
+   Costs the memory of all element matrices.
+*/
+class ElementMatrixCachedGeometric : public ElementMatrixStandardGeometric
+{
+public:
+    ElementMatrixCachedGeometric(
+        const agg_partitioning_relations_t& agg_part_rels,
+        mfem::SparseMatrix& assembled_processor_matrix,
+        mfem::ParBilinearForm* form);
+    virtual ~ElementMatrixCachedGeometric();
+    virtual mfem::Matrix * GetMatrix(int elno, bool& free_matr) const;
+    virtual mfem::SparseMatrix * BuildAEStiff(int elno) const;
+private:
+    double *arena;
+    int *arena_offsets;
+    /// local (in the AE) index for every entry of elem_to_dof
+    int *elem_AE_dofs;
+    /// work array for BuildAEStiff, all -1 between calls
+    int *glob_to_AE;
+    mfem::Array<mfem::DenseMatrix *> elem_views;
+};
+
 /**
    Standard elmat for coarse level.
 
@@ -417,12 +417,55 @@ fem_create_partitioning(mfem::HypreParMatrix& A, mfem::ParFiniteElementSpace& fe
                         const agg_dof_status_t *bdr_dofs, int *nparts,
                         bool do_aggregates);
 
+/*! \brief Creates a partitioning for an algebraic problem (no mesh).
+
+    Every row of \a A is a cell with a single DoF, and cells are connected
+    as the rows of \a A are. The cells are partitioned with METIS into the
+    AEs.
+
+    \param A (IN) The (serial) matrix of the problem.
+    \param nparts (IN/OUT) The number of AEs, as in
+                           \b fem_create_partitioning.
+    \param dof_truedof (IN) The DoF to true DoF relation, the identity.
+    \param isolated_cells (IN) Cells that get an AE of their own.
+
+    \returns A structure with the partitioning relations.
+
+    \warning The returned structure must be freed by the caller by calling
+             \b agg_free_partitioning.
+*/
 agg_partitioning_relations_t *
 fem_create_partitioning_from_matrix(const mfem::SparseMatrix& A,
                                     int *nparts,
                                     mfem::HypreParMatrix *dof_truedof,
                                     mfem::Array<int>& isolated_cells);
 
+/*! \brief Creates a partitioning for a distributed algebraic problem.
+
+    The same as the serial version, but the cells are the local rows of the
+    parallel matrix \a A. Every process partitions its own cells along the
+    connections in the diagonal block of \a A, so the AEs do not cross
+    process boundaries, while the couplings across them stay in \a A and
+    are seen by the AE matrices through \b ExtendedLocalMatrix.
+
+    \param A (IN) The parallel matrix of the problem.
+    \param nparts (IN/OUT) The number of AEs on this process, as in
+                           \b fem_create_partitioning.
+    \param dof_truedof (IN) The DoF to true DoF relation, the identity with
+                            the row partitioning of \a A.
+    \param isolated_cells (IN) Local cells that get an AE of their own.
+
+    \returns A structure with the partitioning relations.
+
+    \warning The returned structure must be freed by the caller by calling
+             \b agg_free_partitioning.
+*/
+agg_partitioning_relations_t *
+fem_create_partitioning_from_matrix(mfem::HypreParMatrix& A,
+                                    int *nparts,
+                                    mfem::HypreParMatrix *dof_truedof,
+                                    mfem::Array<int>& isolated_cells);
+
 /* Function Templates Definitions */
 template <class T>
 mfem::ParBilinearForm *fem_assemble_stiffness(
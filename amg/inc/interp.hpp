@@ -60,6 +60,10 @@ typedef struct {
     /** See \b interp_sparse_tent_build. These are the \em cut_evects used for
         building the current hierarchy. */
     mfem::DenseMatrix **cut_evects_arr; 
+    /** The \em cut_evects of the hierarchy before the last
+        \b interp_reset_data, kept if \em reuse_evects is set. The
+        eigensolves use them to skip or to start (see Eigensolver::Solve). */
+    mfem::DenseMatrix **prev_evects_arr;
     /** See \b interp_sparse_tent_build. Here the local stiffness matrices are
         saved and if necessary reused. */
     mfem::SparseMatrix **AEs_stiffm;
@@ -97,6 +101,12 @@ typedef struct {
        on accuracy, 1.e-3 is a typical number.
     */
     double drop_tol;
+
+    bool reuse_evects; /*!< Whether \b interp_reset_data keeps the
+                            \em cut_evects in \em prev_evects_arr. */
+    double reuse_tol; /*!< See Eigensolver::SetReuseTolerance. */
+    int lobpcg_threshold; /*!< If positive, the local eigenproblems larger
+                               than this are solved by LOBPCG. */
 } interp_data_t;
 
 /* Options */
@@ -113,8 +123,16 @@ const double INTERP_LINEAR_TOLERANCE = 1.e-12;
     \f$ \prod_i \left( I + \frac{1}{\tau_i}S \right) P \f$, where P is the
     tentative interpolant.
 
+    Each factor is applied to the current interpolant row by row with a
+    reused sparse accumulator, so neither S nor the factors are formed and
+    every factor costs a single product with the off-processor rows of P
+    exchanged once.
+
     \param degree (IN) The degree of the polynomial smoother.
     \param roots (IN) The roots of the polynomial smoother.
+    \param drop_tol (IN) Entries not larger than this in absolute value are
+                         dropped from the result of every factor as it is
+                         formed. Nothing is dropped when 0.
     \param times_apply_smoother (IN) How many times the prolongator smoother is
                                      to be applied.
     \param A (IN) The global (among all processes) stiffness matrix.
@@ -162,6 +180,18 @@ interp_data_t *interp_init_data(
 void interp_free_data(interp_data_t *interp_data,
                       bool doing_spectral, double theta);
 
+/*! \brief Drops everything computed from the matrix values.
+
+    The agglomerate matrices, the local eigenvectors and the MIS tentative
+    interpolants are freed, so the coarse space can be built again, as from
+    scratch, for new values of the same matrix. The parameters (smoother,
+    scaling_P, drop tolerance) are kept. If \em reuse_evects is set, the
+    local eigenvectors are moved to \em prev_evects_arr instead.
+
+    \param interp_data (IN/OUT) The interpolant data.
+*/
+void interp_reset_data(interp_data_t& interp_data);
+
 /*! \brief Copies interpolant data.
 
     \param src (IN) To be copied.
@@ -0,0 +1,101 @@
+/*! \file
+    \brief LOBPCG for the local eigenvalue problems with a diagonal right-hand side.
+
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef _LOBPCG_HPP
+#define _LOBPCG_HPP
+
+#include "common.hpp"
+#include <mfem.hpp>
+
+namespace saamge
+{
+
+/* Functions */
+/*! \brief B-orthonormalizes columns of a dense matrix (modified Gram-Schmidt).
+
+    Columns \a first to \a last - 1 are orthogonalized (twice) against the
+    preceding ones and normalized in the inner product given by the diagonal
+    matrix B. Columns that become (numerically) dependent are dropped and the
+    remaining ones are moved to the left.
+
+    \param diagB (IN) The diagonal of the s.p.d. matrix B.
+    \param S (IN/OUT) The vectors as columns. Columns 0 to \a first - 1 must
+                      already be B-orthonormal.
+    \param first (IN) The first column to orthonormalize.
+    \param last (IN) One past the last column to orthonormalize.
+
+    \returns The number of B-orthonormal columns now at the start of \a S.
+*/
+int lobpcg_b_orthonormalize(const mfem::Vector& diagB, mfem::DenseMatrix& S,
+                            int first, int last);
+
+/*! \brief Fills columns of a dense matrix with pseudo-random values.
+
+    The values only depend on the row and column, so the result does not
+    depend on threads or on other calls.
+
+    \param X (IN/OUT) The matrix.
+    \param first (IN) Columns from \a first on are filled.
+*/
+void lobpcg_fill_random(mfem::DenseMatrix& X, int first);
+
+/*! \brief Computes the lowest eigenpairs of a sparse matrix by LOBPCG.
+
+    The eigenvalue problem is \f$ A\mathbf{x} = \lambda B \mathbf{x}\f$, where
+    A is sparse symmetric and B is s.p.d. and DIAGONAL. \f$ B^{-1} \f$ is the
+    preconditioner, which for the weighted l1-smoother as B is the natural
+    choice. The block size is the width of \a evects on entry.
+
+    \param A (IN) This is A.
+    \param diagB (IN) The diagonal of B.
+    \param evects (IN/OUT) On entry the starting block, whose columns must be
+                           linearly independent. On exit the B-orthonormal Ritz
+                           vectors.
+    \param evals (OUT) The Ritz values, in increasing order.
+    \param max_iters (IN) The maximal number of iterations.
+    \param tol (IN) A Ritz pair is converged once its residual, in the
+                    \f$ B^{-1} \f$ norm, is at most \a tol.
+
+    \returns The number of iterations performed.
+
+    \warning A is symmetric and B is s.p.d and DIAGONAL.
+*/
+int lobpcg_calc_lower_eigens_sparse_diag(const mfem::SparseMatrix& A,
+                                         const mfem::Vector& diagB,
+                                         mfem::DenseMatrix& evects,
+                                         mfem::Vector& evals,
+                                         int max_iters, double tol);
+
+} // namespace saamge
+
+#endif // _LOBPCG_HPP
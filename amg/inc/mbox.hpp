@@ -171,6 +171,21 @@ typedef double (*mbox_norm_ft)(const mfem::Matrix& A, const mfem::Vector& x);
 typedef double (*mbox_inner_prod_ft)(const mfem::Matrix& A, const mfem::Vector& x,
                                      const mfem::Vector& y);
 
+/*! \brief A private, copy-on-write memory mapping of a whole file.
+
+    Filled in by the \b mbox_map_* functions and released by the matching
+    \b mbox_unmap_* ones.
+*/
+typedef struct {
+    void *addr;
+    size_t size;
+} mbox_mapping_t;
+
+/* Options */
+
+/*! Version of the memory-mappable binary format, see \b mbox_map_sparse_matr. */
+const int MBOX_MAPPED_VERSION = 1;
+
 /* Functions */
 
 void hypre_par_matrix_ownership(
@@ -516,6 +531,117 @@ mfem::DenseMatrix **mbox_read_dense_matr_arr(const char *filename, int *n);
 void mbox_write_dense_matr_arr(const char *filename, mfem::DenseMatrix **arr,
                                int n);
 
+/*! \brief Checks whether a file is in the memory-mappable binary format.
+
+    \param filename (IN) The name of the file.
+
+    \returns Whether the file starts with the header written by the
+             \b mbox_write_mapped_* functions.
+*/
+bool mbox_is_mapped_format(const char *filename);
+
+/*! \brief Maps a finalized sparse matrix from a file without copying it.
+
+    \a filename is a binary file with format:
+    <64-byte header><the I array><the J array><the A array>, where every
+    array starts at an 8-byte boundary. The returned matrix uses the mapped
+    arrays directly. The mapping is private, so modifying the matrix (e.g. by
+    hypre reordering its rows) does not touch the file.
+
+    \param filename (IN) The name of the file with the sparse matrix.
+    \param mapping (OUT) The mapping backing the matrix.
+
+    \returns The mapped sparse matrix.
+
+    \warning The returned sparse matrix must be freed by the caller using
+             \b mbox_unmap_sparse_matr, after everything sharing its arrays is
+             gone.
+*/
+mfem::SparseMatrix *mbox_map_sparse_matr(const char *filename,
+                                         mbox_mapping_t& mapping);
+
+/*! \brief Frees a sparse matrix returned by \b mbox_map_sparse_matr.
+*/
+void mbox_unmap_sparse_matr(mfem::SparseMatrix *spm, mbox_mapping_t& mapping);
+
+/*! \brief Writes a finalized sparse matrix in the memory-mappable format.
+
+    See \b mbox_map_sparse_matr.
+
+    \warning \a spm must be finalized.
+*/
+void mbox_write_mapped_sparse_matr(const char *filename,
+                                   const mfem::SparseMatrix& spm);
+
+/*! \brief Maps a table from a file without copying it.
+
+    \a filename is a binary file with format:
+    <64-byte header><the I array><the J array>.
+
+    \param filename (IN) The name of the file with the table.
+    \param mapping (OUT) The mapping backing the table.
+
+    \returns The mapped table.
+
+    \warning The returned table must be freed by the caller using
+             \b mbox_unmap_table.
+*/
+mfem::Table *mbox_map_table(const char *filename, mbox_mapping_t& mapping);
+
+/*! \brief Frees a table returned by \b mbox_map_table.
+*/
+void mbox_unmap_table(mfem::Table *tbl, mbox_mapping_t& mapping);
+
+/*! \brief Writes a table in the memory-mappable format.
+
+    See \b mbox_map_table.
+*/
+void mbox_write_mapped_table(const char *filename, const mfem::Table& tbl);
+
+/*! \brief Maps an array of dense matrices from a file without copying them.
+
+    \a filename is a binary file with format:
+    <64-byte header><n pairs (height, width)><the data of all matrices>.
+
+    \param filename (IN) The name of the file with the array.
+    \param n (OUT) The number of dense matrices in the array.
+    \param mapping (OUT) The mapping backing the matrices.
+
+    \returns The array of pointers to dense matrices using the mapped data.
+
+    \warning The returned array must be freed by the caller using
+             \b mbox_unmap_dense_matr_arr.
+*/
+mfem::DenseMatrix **mbox_map_dense_matr_arr(const char *filename, int *n,
+                                            mbox_mapping_t& mapping);
+
+/*! \brief Frees an array returned by \b mbox_map_dense_matr_arr.
+*/
+void mbox_unmap_dense_matr_arr(mfem::DenseMatrix **arr, int n,
+                               mbox_mapping_t& mapping);
+
+/*! \brief Writes an array of dense matrices in the memory-mappable format.
+
+    See \b mbox_map_dense_matr_arr.
+*/
+void mbox_write_mapped_dense_matr_arr(const char *filename,
+                                      mfem::DenseMatrix **arr, int n);
+
+/*! \brief Loads a sparse matrix from a hypre IJ text file.
+
+    \a filename is a text file with a first line <row0> <row1> <col0> <col1>
+    followed by <i> <j> <value> lines, as written by hypre for a single
+    process. Repeated entries are summed and zeros off the diagonal are
+    dropped. This is the slow text fallback for \b mbox_map_sparse_matr.
+
+    \param filename (IN) The name of the text file.
+
+    \returns The loaded sparse matrix, finalized and with sorted rows.
+
+    \warning The returned sparse matrix must be freed by the caller.
+*/
+mfem::SparseMatrix *mbox_read_ij_sparse_matr(const char *filename);
+
 /*! \brief Generates (converts) a dense matrix from a sparse matrix.
 
     \param Sp (IN) The sparse matrix to be copied (converted).
@@ -1381,6 +1507,34 @@ void mbox_project_parallel(mfem::HypreParMatrix& interp, mfem::HypreParVector& v
 void mbox_project_parallel(mfem::HypreParMatrix& A, mfem::HypreParMatrix& interp,
                            mfem::HypreParVector& v);
 
+/*! \brief Multiplies a parallel matrix with a block of vectors.
+
+    Computes \a Y = \a alpha * \a A * \a X + \a beta * \a Y, where the local
+    parts of the vectors are the columns of \a X and \a Y. The halo of all
+    vectors is exchanged in one message per neighbouring process and every
+    matrix entry is read once for all of them.
+
+    \param A (IN) The parallel matrix.
+    \param X (IN) The local parts of the vectors to multiply, one per column.
+    \param Y (IN/OUT) The local parts of the results. Must have as many rows as
+                      \a A has in this process and as many columns as \a X.
+    \param alpha (IN) The scaling of the product.
+    \param beta (IN) The scaling of the old \a Y. If 0, \a Y is not read.
+*/
+void mbox_block_mult_parallel(mfem::HypreParMatrix& A, const mfem::DenseMatrix& X,
+                              mfem::DenseMatrix& Y, double alpha, double beta);
+
+/*! \brief Computes the dot products of the columns of two blocks of parallel
+           vectors with a single reduction.
+
+    \param X (IN) The local parts of the first vectors, one per column.
+    \param Y (IN) The local parts of the second vectors, one per column.
+    \param dots (OUT) Array of \a X.Width() entries. Entry \em v is the dot
+                      product of the columns \em v of \a X and \a Y.
+*/
+void mbox_block_inner_products_parallel(const mfem::DenseMatrix& X,
+                                        const mfem::DenseMatrix& Y, double *dots);
+
 /* Inline Functions */
 /*! \brief A wrapper of \b mbox_orthogonalize for sparse \a D.
 
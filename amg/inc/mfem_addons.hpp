@@ -253,10 +253,49 @@ void construct_elem_to_vert(mfem::Mesh& mesh, mfem::Table& elem_to_vert);
 */
 mfem::HypreParMatrix * FakeParallelMatrix(const mfem::SparseMatrix *A);
 
+/**
+   Distributes the square matrix A, which every process has in full, by
+   contiguous blocks of rows. This process gets rows [row_begin, row_end),
+   the blocks of the processes must follow each other in rank order and
+   cover all of A.
+
+   Unlike FakeParallelMatrix() the returned matrix owns all of its data.
+   This is collective on PROC_COMM.
+
+   Since every process reads and holds all of A first, the peak memory of
+   each process does not go down with more processes and A has to fit on
+   one node.
+*/
+mfem::HypreParMatrix * DistributeSparseMatrix(const mfem::SparseMatrix& A,
+                                              int row_begin, int row_end);
+
+/**
+   The local rows of the square parallel matrix A together with the rows
+   that the local rows couple to on other processes, as one local matrix.
+
+   With n local rows and the off-processor columns numbered as in the
+   column map of A, local row or column i < n is the i-th local row of A
+   and n + k is the k-th off-processor column of A. Rows n and up are the
+   rows of A for the off-processor columns, restricted to the columns that
+   are numbered here. So the first n rows are complete, which is what the
+   algebraic AE matrices (ExtractSubMatrices(), WindowSubMatrices()) need
+   from their Alocal in parallel. In serial this is just a copy of A.
+
+   This is collective on the communicator of A.
+*/
+mfem::SparseMatrix * ExtendedLocalMatrix(mfem::HypreParMatrix& A);
+
 /*! \brief PCG solver.
 
     This is a slightly modified version of the PCG implementation in MFEM.
 
+    With \a flexible set it is Notay's flexible CG with one stored
+    direction: the step length uses \f$ (\mathbf{d}, \mathbf{r}) \f$ and
+    every new direction is explicitly A-orthogonalized against the previous
+    one. That stays correct when \a B is nonlinear or changes from call to
+    call, e.g. the K-cycle, at the price of one more vector and inner
+    product per iteration.
+
     \param A (IN) The matrix of the system being solved (usually the global
                   stiffness matrix).
     \param B (IN) Preconditioner.
@@ -269,13 +308,34 @@ mfem::HypreParMatrix * FakeParallelMatrix(const mfem::SparseMatrix *A);
     \param ATOLERANCE (IN) Absolute tolerance.
     \param zero_rhs (IN) If it is \em true, it outputs more error-related
                          information.
+    \param flexible (IN) Whether to use the flexible variant.
 
     \returns The number of iterations done. If a solution was not successfully
              computed, then this number is negative.
 */
 int kalchev_pcg(const mfem::HypreParMatrix &A, const mfem::Operator &B, const mfem::HypreParVector &b,
                 mfem::HypreParVector &x, int print_iter/*=0*/, int max_num_iter/*=1000*/, double RTOLERANCE/*=10e-12*/,
-                double ATOLERANCE/*=10e-24*/, bool zero_rhs/*=false*/);
+                double ATOLERANCE/*=10e-24*/, bool zero_rhs/*=false*/,
+                bool flexible=false);
+
+/*! \brief Pipelined PCG solver.
+
+    The Ghysels-Vanroose variant of \b kalchev_pcg, with the same arguments,
+    output and stopping criteria. The inner products of every iteration
+    (and \f$ \| \mathbf{x} \|_A \f$ when \a zero_rhs is set) are combined
+    into a single nonblocking reduction that overlaps the application of
+    \a B and \a A. This costs four extra vectors, and the last iteration
+    applies \a B and \a A once more than \b kalchev_pcg does. The
+    recurrences are a little less stable, so the attainable accuracy can be
+    slightly lower.
+
+    \returns The number of iterations done. If a solution was not successfully
+             computed, then this number is negative.
+*/
+int pipelined_pcg(const mfem::HypreParMatrix &A, const mfem::Operator &B,
+                  const mfem::HypreParVector &b, mfem::HypreParVector &x,
+                  int print_iter, int max_num_iter, double RTOLERANCE,
+                  double ATOLERANCE, bool zero_rhs);
 
 mfem::SparseMatrix * IdentitySparseMatrix(int n);
 
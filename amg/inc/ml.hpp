@@ -49,6 +49,18 @@
 namespace saamge
 {
 
+/*! \brief The shape of the multilevel cycle (see \b ml_cycle).
+*/
+typedef enum {
+    ML_CYCLE_V, /*!< One visit of the coarse level per visit of the fine. */
+    ML_CYCLE_W, /*!< \em cycle_mu visits of the coarse level. */
+    ML_CYCLE_F, /*!< An F-cycle followed by a V-cycle on the coarse level. */
+    ML_CYCLE_K, /*!< Up to \em cycle_mu iterations of flexible CG on the
+                     coarse level, preconditioned by the K-cycle there. */
+
+    ML_CYCLE_MAX /*!< Sentinel. */
+} ml_cycle_t;
+
 /*! \brief Multilevel parameters
 
   This is just a way to pass a bunch of parameters down
@@ -91,12 +103,50 @@ public:
     bool get_avoid_ess_bdr_dofs() const {return avoid_ess_bdr_dofs;}
     bool get_use_double_cycle() const {return use_double_cycle;}
     double get_smooth_drop_tol() const {return smooth_drop_tol;}
+    smpr_relax_t get_relaxation(int j) const {return relaxation[j];}
+    int get_cycle_mu(int j) const {return cycle_mu[j];}
+    int get_coarse_redist_threshold() const {return coarse_redist_threshold;}
+    int get_coarse_redist_rows() const {return coarse_redist_rows;}
+    bool get_reuse_evects() const {return reuse_evects;}
+    double get_reuse_tol() const {return reuse_tol;}
+    int get_lobpcg_threshold() const {return lobpcg_threshold;}
 
     void set_polynomial_coarse_space(int j, int val) {polynomial_coarse_space[j] = val;}
     void set_use_double_cycle(bool use) {use_double_cycle = use;}
     bool get_coarse_direct() const {return coarse_direct;}
     void set_coarse_direct(bool cd) {coarse_direct = cd;}
     void set_smooth_drop_tol(double tol) {smooth_drop_tol = tol;}
+    void set_relaxation(int j, smpr_relax_t relax) {relaxation[j] = relax;}
+    /// same relaxation on every level
+    void set_relaxation(smpr_relax_t relax);
+    /// coarse-level visits of the W- and K-cycles for coarsening j
+    void set_cycle_mu(int j, int mu) {cycle_mu[j] = mu;}
+    /**
+       Once the coarsest operator has fewer than \a threshold global
+       rows, move it and the coarse solver onto as many processes as
+       give about \a rows_per_proc rows each (see RedistributedSolver).
+       This includes the CorrectNullspace solver. Only the coarsest solve
+       moves; the finer levels run on all processes. A \a threshold of 0
+       turns this off.
+    */
+    void set_coarse_redistribution(int threshold, int rows_per_proc)
+    {
+        coarse_redist_threshold = threshold;
+        coarse_redist_rows = rows_per_proc;
+    }
+    /**
+       In ml_update_coefficients, keep the local eigenvectors of the old
+       coefficients to warm-start the new eigensolves, and skip those
+       agglomerates whose old vectors pass the Rayleigh-Ritz test with
+       tolerance \a tol (see Eigensolver::SetReuseTolerance, 0 never skips).
+    */
+    void set_eigenvector_reuse(bool reuse, double tol)
+    {
+        reuse_evects = reuse;
+        reuse_tol = tol;
+    }
+    /// local eigenproblems larger than this use LOBPCG, 0 turns it off
+    void set_lobpcg_threshold(int size) {lobpcg_threshold = size;}
 private:
     int num_coarsenings;
     int * nparts_arr;
@@ -104,12 +154,19 @@ private:
     int * nu_relax;
     double * theta;
     int * polynomial_coarse_space;
+    smpr_relax_t * relaxation;
+    int * cycle_mu;
     bool use_correct_nullspace;
     bool use_arpack;
     bool do_aggregates;
     bool avoid_ess_bdr_dofs;
     bool use_double_cycle;
     bool coarse_direct; // use direct solver on coarsest level
+    int coarse_redist_threshold; // redistribute coarsest level below this size
+    int coarse_redist_rows; // target rows per process after redistribution
+    bool reuse_evects; // warm-start eigensolves when updating coefficients
+    double reuse_tol; // Rayleigh-Ritz tolerance to skip them altogether
+    int lobpcg_threshold; // LOBPCG for local eigenproblems above this size
     double smooth_drop_tol;
 };
 
@@ -183,6 +240,53 @@ double ml_print_data(mfem::HypreParMatrix& A, const ml_data_t& ml_data);
 
 void ml_impose_cycle(ml_data_t& ml_data, bool Wcycle);
 
+/*! \brief Makes sure the cycle workspace of every level is there.
+
+    \param ml_data (IN/OUT) Multilevel data.
+    \param cycle (IN) The cycle that is going to be used.
+*/
+void ml_init_cycle_workspace(ml_data_t& ml_data, ml_cycle_t cycle);
+
+/*! \brief Applies one multilevel cycle starting at \a level.
+
+    It computes \f$\mathbf{x} += B^{-1}(\mathbf{b} - A\mathbf{x})\f$, where B
+    is the cycle of shape \a cycle. The coarse levels are visited
+    recursively as given by \a cycle and the \em cycle_mu of every level;
+    the coarsest level uses its \em coarse_solver. Only the vectors prepared
+    by \b ml_init_cycle_workspace are used.
+
+    \param level (IN) The level to start at.
+    \param A (IN) The operator of \a level.
+    \param b (IN) The right-hand side.
+    \param x (IN/OUT) The current iterate as input and the next iterate as
+                      output.
+    \param cycle (IN) The shape of the cycle.
+
+    \warning With \a cycle \b ML_CYCLE_K the inner flexible CG makes the
+             cycle nonlinear, different on every call, and the F-cycle is not
+             symmetric. Neither may be used as a fixed s.p.d. preconditioner
+             in plain CG (e.g. \b kalchev_pcg or mfem::CGSolver); use a
+             flexible method such as \b kalchev_pcg with \a flexible set.
+*/
+void ml_cycle(levels_level_t *level, mfem::HypreParMatrix& A,
+              const mfem::Vector& b, mfem::Vector& x, ml_cycle_t cycle);
+
+/*! \brief Predicts the work of one cycle.
+
+    Sums the operator complexities of the levels (see
+    \b ml_compute_OC_for_level), each weighted by the number of times the
+    cycle visits the level. For a V-cycle this is the usual operator
+    complexity. For the K-cycle it is an upper bound.
+
+    \param A (IN) The finest operator.
+    \param ml_data (IN) Multilevel data.
+    \param cycle (IN) The shape of the cycle.
+
+    \returns The work relative to the nonzeros of \a A.
+*/
+double ml_predict_cycle_work(mfem::HypreParMatrix& A, const ml_data_t& ml_data,
+                             ml_cycle_t cycle);
+
 /*!
   Fill in the ml_data data structure with all the many parameters.
 
@@ -193,6 +297,32 @@ ml_data_t * ml_produce_data(
     mfem::HypreParMatrix& Ag, agg_partitioning_relations_t *agg_part_rels, 
     ElementMatrixProvider *elem_data_finest, const MultilevelParameters &mlp);
 
+/*! \brief Updates the hierarchy for new values of the same matrix.
+
+    For coefficient changes on the same mesh (Monte Carlo samples,
+    optimization loops). The partitioning, the MISes and all the
+    relations and communication patterns in \em agg_part_rels are kept;
+    only the agglomerate matrices, the local eigenproblems, the
+    interpolants and the coarse operators are computed again. If the
+    coarse space of some level changes size (the spectral tolerance picks
+    a different number of vectors), the levels below it are built again
+    from scratch.
+
+    Solvers that keep the old finest operator need SetOperator() again.
+
+    \param Ag (IN) The finest operator with the new values.
+    \param ml_data (IN/OUT) A hierarchy from \b ml_produce_data for the
+                            same \a mlp.
+    \param elem_data_finest (IN) Element matrices for the new values. It
+                                 may be the one given to
+                                 \b ml_produce_data, if that one gives the
+                                 new values, otherwise the old one is freed.
+    \param mlp (IN) The parameters used for building \a ml_data.
+*/
+void ml_update_coefficients(
+    mfem::HypreParMatrix& Ag, ml_data_t& ml_data,
+    ElementMatrixProvider *elem_data_finest, const MultilevelParameters &mlp);
+
 void ml_free_data(ml_data_t *ml_data);
 
 } // namespace saamge
@@ -0,0 +1,120 @@
+/*
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   Persistent on-disk cache of a built multilevel hierarchy.
+
+   Every MPI process writes (and later maps with mmap) its own binary shard
+   <dir>/saamge_ml_<key>.<rank>. The key is a hash of the finest operator,
+   the finest partitioning and the multilevel parameters, so a changed
+   problem simply misses the cache.
+*/
+
+#pragma once
+#ifndef _MLCACHE_HPP
+#define _MLCACHE_HPP
+
+#include "common.hpp"
+#include <mfem.hpp>
+#include "aggregates.hpp"
+#include "ml.hpp"
+
+namespace saamge
+{
+
+/* Options */
+
+/*! Bumped whenever the shard layout changes; older shards are ignored. */
+const int MLCACHE_VERSION = 1;
+
+/* Functions */
+/*! \brief Computes the cache key of a hierarchy.
+
+    Hashes the local CSR structure and values of \a Ag, the row and column
+    partitioning, the finest AE-to-DoF relation and all multilevel parameters.
+    The local hashes are combined among all processes, so the result is the
+    same everywhere.
+
+    \param Ag (IN) The finest (global) operator.
+    \param agg_part_rels (IN) The finest partitioning relations.
+    \param mlp (IN) The multilevel parameters.
+
+    \returns The key.
+*/
+unsigned long long mlcache_key(
+    mfem::HypreParMatrix& Ag, const agg_partitioning_relations_t& agg_part_rels,
+    const MultilevelParameters& mlp);
+
+/*! \brief Writes a built hierarchy to the cache.
+
+    Collective. Every process writes its own shard to a temporary file and
+    renames it in place, so readers never see a partially written shard.
+
+    \param dir (IN) The cache directory (must exist).
+    \param Ag (IN) The finest (global) operator.
+    \param agg_part_rels (IN) The finest partitioning relations.
+    \param mlp (IN) The multilevel parameters the hierarchy was built with.
+    \param ml_data (IN) The hierarchy as returned by \b ml_produce_data.
+
+    \returns Whether all processes wrote their shards successfully.
+*/
+bool mlcache_write(
+    const char *dir, mfem::HypreParMatrix& Ag,
+    const agg_partitioning_relations_t& agg_part_rels,
+    const MultilevelParameters& mlp, const ml_data_t& ml_data);
+
+/*! \brief Restores a hierarchy from the cache, skipping the setup.
+
+    Collective. If the shard of any process is missing, stale or corrupted,
+    all processes return \em NULL and the caller should build the hierarchy
+    with \b ml_produce_data.
+
+    The restored hierarchy is ready to be used in the cycles. The local
+    eigenproblems and element matrices are not stored, so it cannot be
+    adapted or coarsened further.
+
+    \param dir (IN) The cache directory.
+    \param Ag (IN) The finest (global) operator.
+    \param agg_part_rels (IN) The finest partitioning relations. As with
+                              \b ml_produce_data, they are still owned by the
+                              caller.
+    \param mlp (IN) The multilevel parameters.
+
+    \returns The hierarchy or \em NULL. Free it with \b ml_free_data.
+*/
+ml_data_t *mlcache_read(
+    const char *dir, mfem::HypreParMatrix& Ag,
+    agg_partitioning_relations_t *agg_part_rels,
+    const MultilevelParameters& mlp);
+
+} // namespace saamge
+
+#endif // _MLCACHE_HPP
@@ -0,0 +1,155 @@
+/*
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   Hierarchical profiling of the setup and solve phases.
+
+   Regions are nested scopes identified by name below their parent, so the
+   same code reached from different places (e.g. on different levels) is
+   accounted separately. Every region accumulates wall time, number of
+   entries and named counters. The data are reduced over all processes
+   (min/max/avg per region) when printed or exported to JSON.
+
+   Profiling is off until prof_enable is called, and then the cost of a
+   region is two MPI_Wtime calls and a short search among the children of
+   the current region. Regions entered from inside an OpenMP parallel
+   region are ignored.
+*/
+
+#pragma once
+#ifndef _PROF_HPP
+#define _PROF_HPP
+
+#include "common.hpp"
+#include <string>
+
+namespace saamge
+{
+
+/* Functions */
+/*! \brief Turns profiling on or off.
+
+    \param on (IN) Whether regions and counters are recorded.
+
+    \warning Must not be called while a region is open.
+*/
+void prof_enable(bool on);
+
+/*! \brief Whether profiling is on.
+*/
+bool prof_enabled();
+
+/*! \brief Drops all recorded regions and counters.
+
+    \warning Must not be called while a region is open.
+*/
+void prof_reset();
+
+/*! \brief Enters a region nested in the current one.
+
+    \param name (IN) The name of the region, unique among its siblings.
+*/
+void prof_begin(const char *name);
+
+/*! \brief Enters a region nested in the current one.
+
+    \param name (IN) The name of the region, unique among its siblings.
+*/
+void prof_begin(const std::string& name);
+
+/*! \brief Leaves the current region.
+*/
+void prof_end();
+
+/*! \brief Adds to a counter of the current region.
+
+    \param name (IN) The name of the counter.
+    \param amount (IN) What to add.
+*/
+void prof_count(const char *name, double amount=1.);
+
+/*! \brief Prints the regions, reduced over all processes, on process 0.
+
+    Collective over PROC_COMM.
+
+    \param out (IN/OUT) The stream to print to (used on process 0 only).
+*/
+void prof_print(std::ostream& out);
+
+/*! \brief Returns the regions, reduced over all processes, as JSON.
+
+    Collective over PROC_COMM. Every region is an object with its name, the
+    number of processes that entered it, min, max and average over those
+    processes of its time, entries and counters, the time imbalance (max
+    over average) and its child regions.
+
+    \param prettify (IN) Whether to indent the output.
+
+    \returns The JSON text on process 0, an empty string elsewhere.
+*/
+std::string prof_to_json(bool prettify);
+
+/*! \brief Writes the regions, reduced over all processes, as JSON.
+
+    Collective over PROC_COMM. Process 0 writes \a filename, see
+    \b prof_to_json for the contents.
+
+    \param filename (IN) The file to write.
+
+    \returns Whether the file was written (on process 0; true elsewhere).
+*/
+bool prof_write_json(const char *filename);
+
+/* Classes */
+/**
+   Scope guard for prof_begin/prof_end.
+*/
+class ProfScope
+{
+public:
+    explicit ProfScope(const char *name) { prof_begin(name); }
+    explicit ProfScope(const std::string& name) { prof_begin(name); }
+    ~ProfScope() { prof_end(); }
+private:
+    ProfScope(const ProfScope&);
+    ProfScope& operator=(const ProfScope&);
+};
+
+/* Macros */
+#define SA_PROF_CONCAT_(a, b) a ## b
+#define SA_PROF_CONCAT(a, b) SA_PROF_CONCAT_(a, b)
+
+/*! Profiles the rest of the enclosing block as region \a name. */
+#define SA_PROF_SCOPE(name) \
+    saamge::ProfScope SA_PROF_CONCAT(sa_prof_scope_, __LINE__)(name)
+
+} // namespace saamge
+
+#endif // _PROF_HPP
@@ -44,11 +44,14 @@
 #include <helpers.hpp>
 #include <interp.hpp>
 #include <levels.hpp>
+#include <lobpcg.hpp>
 #include <mbox.hpp>
 #include <ml.hpp>
+#include <mlcache.hpp>
 #include <mfem_addons.hpp>
 #include <part.hpp>
 #include <process.hpp>
+#include <prof.hpp>
 #include <smpr.hpp>
 #include <solve.hpp>
 #include <spectral.hpp>
@@ -60,6 +60,10 @@ public:
     bool Make(const std::shared_ptr<mfem::HypreParMatrix>  &A,
               mfem::SparseMatrix &Al);
 
+    /// Distributed version, the AEs and their matrices come from the
+    /// local rows of A and the rows they couple to on other processes.
+    bool Make(const std::shared_ptr<mfem::HypreParMatrix>  &A);
+
     void Destroy();
 
     void Mult(const mfem::Vector &x, mfem::Vector &y) const override;
@@ -71,6 +75,8 @@ public:
     }
 
 private:
+    bool MakeSolver(const std::shared_ptr<mfem::HypreParMatrix>  &A);
+
     std::vector<int> nparts_arr;
 
     int num_levels;
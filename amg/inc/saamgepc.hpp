@@ -50,7 +50,7 @@ namespace saamge
 {
 
 /// @todo this and SpectralAMGSolver are basically the same thing
-class SAAMGePC : public mfem::Solver
+class SAAMGePC : public mfem::Solver, public BlockSolver
 {
 public:
     SAAMGePC(const std::shared_ptr<mfem::ParFiniteElementSpace> &fe, 
@@ -67,10 +67,22 @@ public:
               const std::shared_ptr<mfem::HypreParMatrix>  &A,
               mfem::SparseMatrix &Al);
 
+    /// New values (e.g. coefficients) for the matrix given to Make(), on
+    /// the same space. Keeps the partitioning and communication patterns
+    /// and only rebuilds the spaces and operators, see
+    /// ml_update_coefficients(). Same as Make() if there is nothing to update.
+    bool Update(const std::shared_ptr<mfem::ParBilinearForm> &a,
+                const std::shared_ptr<mfem::HypreParMatrix>  &A,
+                mfem::SparseMatrix &Al);
+
     void Destroy();
 
     void Mult(const mfem::Vector &x, mfem::Vector &y) const override;
     void MultTranspose(const mfem::Vector &x, mfem::Vector &y) const override;
+    /// One cycle for all columns of \a B together, e.g. as the
+    /// preconditioner of solve_block_pcg().
+    void MultBlock(const mfem::DenseMatrix &B,
+                   mfem::DenseMatrix &X) const override;
 
     inline void SetOperator(const Operator &op) override {
         // Can be implemented once Al and a are not needed anymore
@@ -100,6 +112,7 @@ private:
     bool has_stuff_to_destroy;
 
     ml_data_t *ml_data;
+    std::shared_ptr<MultilevelParameters> mlp;
     ElementMatrixProvider * emp;
     std::shared_ptr<VCycleSolver> Bprec;
     std::shared_ptr<mfem::HypreParMatrix> A;
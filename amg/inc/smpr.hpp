@@ -80,10 +80,26 @@ typedef enum {
     SMPR_POLY_SAS, /*!< The "smoothed aggregation smoothing (SAS)"
                             polynomial. */
     SMPR_POLY_INVX, /*!< The best uniform approximation of 1/x. */
+    SMPR_POLY_CHEBYSHEV, /*!< Chebyshev polynomial on
+                              [\a param * lambda_max, lambda_max], where
+                              lambda_max is estimated for \f$D^{-1}A\f$. */
 
     SMPR_POLY_MAX /*!< Sentinel. */
 } smpr_poly_t;
 
+/*! \brief The relaxation used on a level of the hierarchy.
+*/
+typedef enum {
+    SMPR_RELAX_POLY, /*!< \b smpr_sym_poly with the default (SAS)
+                          polynomial. */
+    SMPR_RELAX_CHEBYSHEV, /*!< \b smpr_sym_poly with a Chebyshev polynomial
+                               (see \b smpr_chebyshev_poly_init). */
+    SMPR_RELAX_L1GS, /*!< \b smpr_gauss_seidel, i.e. hypre's l1
+                          Gauss-Seidel. */
+
+    SMPR_RELAX_MAX /*!< Sentinel. */
+} smpr_relax_t;
+
 /*! \brief The data for the polynomial smoother.
 */
 typedef struct {
@@ -105,6 +121,23 @@ typedef struct {
                                needed) */
     double param; /*!< A real (double) parameter (polynomial smoother
                        specific) */
+
+    double *work; /*!< Persistent workspace of the fused smoother kernel. It
+                       is (re)allocated on demand and never shared between
+                       copies of the structure. */
+    int work_size; /*!< The number of entries allocated in \a work. */
+    double *block_work; /*!< Persistent workspace of the block smoother, grown
+                             with the number of columns. Not shared between
+                             copies of the structure either. */
+    int block_work_size; /*!< The number of entries allocated in
+                              \a block_work. */
+    double lambda_max; /*!< Estimate of the largest eigenvalue of
+                            \f$D^{-1}A\f$ (Chebyshev only, 0 otherwise). */
+    mfem::HypreSmoother *l1gs; /*!< The l1 Gauss-Seidel smoother of
+                                    \b smpr_gauss_seidel, built on first use
+                                    and kept until \a A changes. */
+    const mfem::HypreParMatrix *l1gs_A; /*!< The matrix \a l1gs is set up
+                                             with. */
 } smpr_poly_data_t;
 
 /* Functions */
@@ -146,6 +179,53 @@ double smpr_cheb_firstkind(int n, double x);
 */
 void smpr_sym_poly(mfem::HypreParMatrix& A, const mfem::Vector& b, mfem::Vector& x, void *data);
 
+/*! \brief Block version of \b smpr_sym_poly.
+
+    Smooths the systems with the right-hand sides in the columns of \a B
+    together. Every root step forms the residuals of all of them with one
+    \b mbox_block_mult_parallel, so the matrix is streamed and the halo is
+    exchanged once per step instead of once per right-hand side.
+
+    \param A (IN) The matrix.
+    \param B (IN) The right-hand sides, one per column.
+    \param X (IN/OUT) The iterates, one per column.
+    \param data (IN) Must be of type \b smpr_poly_data_t.
+*/
+void smpr_sym_poly_block(mfem::HypreParMatrix& A, const mfem::DenseMatrix& B,
+                         mfem::DenseMatrix& X, void *data);
+
+/*! \brief Fused, allocation-free version of \b smpr_compute_poly.
+
+    Computes the same iterate as \b smpr_compute_poly, but each root step is
+    a single sweep over the local CSR blocks of \a A that forms the residual,
+    scales it by \f$-D^{-1}\f$ and updates the iterate. The halo exchange of
+    every step is started first and overlapped with the rows that have no
+    off-processor entries. All temporaries live in \a poly_data->work.
+
+    \param A (IN) The matrix.
+    \param b (IN) The right-hand side.
+    \param x (IN/OUT) \f$\mathbf{x} += M^{-1}(\mathbf{b} - A\mathbf{x})\f$.
+    \param degree (IN) The degree of the polynomial.
+    \param roots (IN) The roots of the polynomial.
+    \param poly_data (IN/OUT) Provides \f$-D^{-1}\f$ and the workspace.
+*/
+void smpr_compute_poly_fused(mfem::HypreParMatrix& A, const mfem::Vector& b,
+                             mfem::Vector& x, int degree, const double *roots,
+                             smpr_poly_data_t *poly_data);
+
+/*! \brief Three sweeps of hypre's l1 Gauss-Seidel as a smoother.
+
+    It computes \f$\mathbf{x} += M^{-1}(\mathbf{b} - A\mathbf{x})\f$, where M
+    is the l1 Gauss-Seidel smoother. The hypre smoother is set up the first
+    time it is applied with a given \a A and is then reused.
+
+    \param A (IN) The matrix.
+    \param b (IN) The right-hand side.
+    \param x (IN/OUT) \f$\mathbf{x} += M^{-1}(\mathbf{b} - A\mathbf{x})\f$.
+    \param data (IN/OUT) Of type \b smpr_poly_data_t, keeps the smoother and
+                         the workspace. If NULL, a temporary smoother is
+                         built for this application only.
+*/
 void smpr_gauss_seidel(mfem::HypreParMatrix& A, const mfem::Vector& b, mfem::Vector& x, void *data);
 
 /*! \brief The two-grid SA-\f$\rho\f$AMGe is used as a preconditioner.
@@ -229,6 +309,56 @@ double *smpr_sas_poly_roots(int& nu, int *degree);
 */
 void smpr_invx_poly_init(int nu, double a, smpr_poly_data_t *poly_data);
 
+/*! \brief Estimates the largest eigenvalue of \f$D^{-1}A\f$.
+
+    Runs \a steps Lanczos iterations on the symmetric
+    \f$D^{-1/2}AD^{-1/2}\f$ and returns the largest Ritz value. The start
+    vector depends only on global indices, so the estimate does not depend on
+    the number of processes (up to roundoff).
+
+    \param A (IN) The global (among all processes) matrix.
+    \param Dinv_neg (IN) \f$-D^{-1}\f$.
+    \param steps (IN) The number of Lanczos steps.
+
+    \returns The estimate (from below) of the largest eigenvalue.
+*/
+double smpr_estimate_lambda_max(mfem::HypreParMatrix& A,
+                                const mfem::HypreParVector& Dinv_neg,
+                                int steps);
+
+/*! \brief Computes roots for the Chebyshev polynomial smoother.
+
+    The roots of the scaled and shifted Chebyshev polynomial of degree
+    \a degree that is smallest on [\a lower, \a upper] and equals 1 at 0:
+        \f$\tau_{i-1} = \frac{u + l}{2} - \frac{u - l}{2}
+                        \cos\left( \frac{2i - 1}{2d} \pi \right)\f$,
+    for i = 1, ..., d.
+
+    \param degree (IN) The degree d of the polynomial.
+    \param lower (IN) The lower end l of the interval.
+    \param upper (IN) The upper end u of the interval.
+
+    \returns An array of the roots.
+
+    \warning The returned array must be freed by the caller.
+*/
+double *smpr_chebyshev_poly_roots(int degree, double lower, double upper);
+
+/*! \brief Turns the polynomial smoother into a Chebyshev smoother.
+
+    Estimates \f$\lambda_{max}\f$ of \f$D^{-1}A\f$ once and replaces the
+    roots in \a poly_data with those of a Chebyshev polynomial on
+    [\a frac * lambda_max, lambda_max]. The degree is 3 * nu + 1, that is, the
+    cost of an application is the same as for the default SAS smoother.
+
+    \param A (IN) The global (among all processes) matrix.
+    \param frac (IN) The lower end of the interval relative to
+                     \f$\lambda_{max}\f$. If not positive, 0.3 is used.
+    \param poly_data (IN/OUT) Initialized polynomial smoother data.
+*/
+void smpr_chebyshev_poly_init(mfem::HypreParMatrix& A, double frac,
+                              smpr_poly_data_t *poly_data);
+
 /*! \brief Bulds/updates Dinv_neg.
 
     \param A (IN) the global (among all processes) stiffness matrix.
@@ -246,15 +376,15 @@ mfem::HypreParVector *smpr_update_Dinv_neg(mfem::HypreParMatrix& A,
     \param A (IN) The global (among all processes) stiffness matrix.
     \param nu (IN) A parameter for the polynomial smoother (case dependant).
     \param param (IN) A parameter for the polynomial smoother (case dependant).
+    \param smpr_poly (IN) The type of the polynomial.
 
     \returns A pointer to the polynomial smoother data.
 
     \warning The returned structure must be freed by the caller using
              \b smpr_free_poly_data.
-    \warning It uses the option \b smpr_poly to determine the type of the
-             polynomial smoother for relaxation.
 */
-smpr_poly_data_t *smpr_init_poly_data(mfem::HypreParMatrix& A, int nu, double param);
+smpr_poly_data_t *smpr_init_poly_data(mfem::HypreParMatrix& A, int nu, double param,
+                                      smpr_poly_t smpr_poly=SMPR_POLY_SAS);
 
 /*! \brief Frees the structure for the polynomial smoother.
 
@@ -118,6 +118,20 @@ private:
     int iters_coeff; /*!< multiply by matrix size for max iterations */
 };
 
+/**
+   Interface of preconditioners that can be applied to several vectors at
+   once, see solve_block_pcg().
+
+   The local parts of the vectors are the columns of a DenseMatrix.
+*/
+class BlockSolver
+{
+public:
+    virtual ~BlockSolver() {}
+    virtual void MultBlock(const mfem::DenseMatrix &B,
+                           mfem::DenseMatrix &X) const = 0;
+};
+
 /**
    @brief Does a V-cycle with the given tg_data struct
 
@@ -126,18 +140,126 @@ private:
 
    Replaces solve_spd_Vcycle()
 */
-class VCycleSolver : public mfem::Solver
+class VCycleSolver : public mfem::Solver, public BlockSolver
 {
 public:
     VCycleSolver(tg_data_t * tg_data, bool iterative_mode);
     ~VCycleSolver();
     virtual void SetOperator(const mfem::Operator &op);
     virtual void Mult(const mfem::Vector &x, mfem::Vector &y) const;
+    /// V-cycle for all columns of \a B together, see tg_cycle_atb_block().
+    virtual void MultBlock(const mfem::DenseMatrix &B,
+                           mfem::DenseMatrix &X) const;
 private:
     tg_data_t * tg_data;
     mfem::HypreParMatrix * A;
 };
 
+/**
+   V-, W-, F- or K-cycle over the whole hierarchy, see ml_cycle().
+
+   Unlike VCycleSolver this does not go through the coarse_solver
+   of every level, only the coarsest one.
+
+   The K-cycle is a nonlinear preconditioner and the F-cycle is not
+   symmetric, so with ML_CYCLE_K or ML_CYCLE_F this must be used in a
+   flexible Krylov method (kalchev_pcg() with flexible set), not in
+   plain CG.
+*/
+class MLCycleSolver : public mfem::Solver
+{
+public:
+    MLCycleSolver(ml_data_t& ml_data, ml_cycle_t cycle, bool iterative_mode);
+    ~MLCycleSolver();
+    virtual void SetOperator(const mfem::Operator &op);
+    virtual void Mult(const mfem::Vector &x, mfem::Vector &y) const;
+private:
+    ml_data_t& ml_data;
+    ml_cycle_t cycle;
+    mfem::HypreParMatrix * A;
+};
+
+/**
+   @brief Exact solver for a small parallel matrix.
+
+   The whole matrix is gathered once on every process of its
+   communicator and factored there, redundantly: dense Cholesky (LAPACK)
+   up to dense_max rows, UMFPACK on the gathered sparse matrix above
+   that or if the matrix turns out not to be s.p.d. Mult() is then one
+   MPI_Allgatherv of the right-hand side and a local solve, so the cost
+   is fixed and does not depend on any iteration count.
+
+   Unlike HypreDirect this works on any number of processes.
+*/
+class GatheredDirectSolver : public mfem::Solver
+{
+public:
+    GatheredDirectSolver(mfem::HypreParMatrix& A, int dense_max=2000);
+    ~GatheredDirectSolver();
+    virtual void SetOperator(const mfem::Operator &op) {};
+    virtual void Mult(const mfem::Vector &x, mfem::Vector &y) const;
+private:
+    MPI_Comm comm;
+    int offset; /*!< First global row of this process. */
+    int *counts; /*!< Rows on every process. */
+    int *displs; /*!< First global row of every process. */
+    mfem::DenseMatrix *factor; /*!< Dense Cholesky factor or NULL. */
+    mfem::SparseMatrix *mat; /*!< Gathered matrix, if not dense. */
+    mfem::UMFPackSolver *sparse_solver;
+    mutable mfem::Vector global_b;
+    mutable mfem::Vector global_x;
+};
+
+/**
+   @brief Runs a coarse solver on the first few processes only.
+
+   The operator is moved, with a parallel permutation matrix, onto a
+   sub-communicator of the first nactive processes and the actual
+   solver, given by SetSolver(), works there. The other processes own
+   no rows of the moved operator, so they skip the solve and only take
+   part in moving the right-hand side in and the solution back.
+
+   Used on the coarsest level, where every process has just a few rows
+   and the coarse solve is otherwise all latency. Only the coarsest solve
+   is moved: the levels above it keep their smoothers, restriction and
+   interpolation on the full communicator.
+*/
+class RedistributedSolver : public mfem::Solver
+{
+public:
+    RedistributedSolver(mfem::HypreParMatrix& A, int nactive);
+    ~RedistributedSolver();
+    virtual void SetOperator(const mfem::Operator &op) {};
+    virtual void Mult(const mfem::Vector &x, mfem::Vector &y) const;
+    /// Takes ownership; only called on the active processes.
+    void SetSolver(mfem::Solver *solver);
+    /// Whether this process works on the moved operator.
+    bool IsActive() const {return (MPI_COMM_NULL != subcomm);}
+    /// The moved operator on the sub-communicator, NULL if not IsActive().
+    mfem::HypreParMatrix *GetSubOperator() {return subA;}
+    /**
+       Moves an interpolant into the space of the operator, e.g. the one
+       of a CorrectNullspace solver, onto the sub-communicator: its rows as
+       the operator, its columns in even pieces over the same processes.
+       Collective on all processes; keeps ownership and returns NULL if not
+       IsActive(). Can be called once.
+    */
+    mfem::HypreParMatrix *MoveInterpolant(mfem::HypreParMatrix& P);
+    int GetNumActive() const {return nactive;}
+private:
+    int nactive;
+    HYPRE_Int begin; /*!< First moved row of this process. */
+    HYPRE_Int end; /*!< One past the last moved row of this process. */
+    MPI_Comm subcomm;
+    mfem::HypreParMatrix *redist; /*!< Original to moved rows. */
+    mfem::HypreParMatrix *redist_t; /*!< Moved to original rows. */
+    mfem::HypreParMatrix *subA;
+    mfem::HypreParMatrix *subP; /*!< See MoveInterpolant(). */
+    mfem::Solver *solver;
+    mutable mfem::Vector rb; /*!< Moved right-hand side. */
+    mutable mfem::Vector rx; /*!< Moved solution. */
+};
+
 /**
    @brief Encapsulates and wraps the spectral smoothed aggregation
    spectral element AMG solver in a user-friendly way.
@@ -213,6 +335,35 @@ void solve_spd_Wcycle(
     mfem::HypreParMatrix& A, const mfem::HypreParVector& b,
     mfem::HypreParVector& x, void *data);
 
+/*! \brief Block PCG solver.
+
+    Runs one PCG per column of \a B, in lockstep. Every iteration applies
+    \a A and the preconditioner to all columns that have not converged yet
+    as one block, and computes their dot products with a single reduction.
+    Columns that converge are frozen. The convergence test of every column
+    is that of \b kalchev_pcg.
+
+    \param A (IN) The matrix of the systems being solved.
+    \param prec (IN) The preconditioner.
+    \param B (IN) The right-hand sides, one per column.
+    \param X (IN/OUT) The initial approximations as input and the solution
+                      approximations as output, one per column.
+    \param print_iter (IN) Determines the amount of output.
+    \param max_num_iter (IN) The maximal number of iteration to be done.
+    \param RTOLERANCE (IN) Relative tolerance.
+    \param ATOLERANCE (IN) Absolute tolerance.
+    \param iters (OUT) If not NULL, array of \a B.Width() entries with the
+                       iterations done for every column, negative if the column
+                       did not converge.
+
+    \returns The number of iterations done. If some column did not converge,
+             then this number is negative.
+*/
+int solve_block_pcg(mfem::HypreParMatrix& A, const BlockSolver& prec,
+                    const mfem::DenseMatrix& B, mfem::DenseMatrix& X,
+                    int print_iter, int max_num_iter, double RTOLERANCE,
+                    double ATOLERANCE, int *iters=NULL);
+
 } // namespace saamge
 
 #endif // _SOLVE_HPP
@@ -71,6 +71,7 @@
 #include "common.hpp"
 #include <mfem.hpp>
 #include "aggregates.hpp"
+#include "xpacks.hpp"
 
 #include <limits>
 
@@ -108,17 +109,66 @@ public:
        and its implementation will borrow a lot of original code.
 
        aggregate_size is not used and should be removed.
+
+       prev_evects, if given, are the vectors this agglomerate had before
+       its matrix changed (see interp_reset_data). They are used to skip
+       the solve (see SetReuseTolerance) or, for the iterative solver, to
+       start it.
     */
     virtual bool Solve(
         const mfem::SparseMatrix& A, mfem::SparseMatrix *& B, 
         int part, int agg_id, int aggregate_size, double& theta,
-        mfem::DenseMatrix& cut_evects);
+        mfem::DenseMatrix& cut_evects,
+        const mfem::DenseMatrix *prev_evects=NULL);
+
+    /**
+       When Solve() gets previous vectors, first do a Rayleigh-Ritz step
+       with the new matrices on their span. If every Ritz pair with Ritz
+       value below theta has a residual (in the inverse smoother norm)
+       below tol * theta, the Ritz vectors are taken and the eigensolve is
+       skipped. This cannot see eigenvalues that dropped below theta
+       outside the old span, so tol should be small. A tol of 0 (the
+       default) never skips.
+    */
+    void SetReuseTolerance(double tol) {reuse_tol = tol;}
+
+    /**
+       Solve the problems above threshold with LOBPCG (see SolveLOBPCG)
+       rather than ARPACK.
+    */
+    void SetUseLOBPCG(bool use) {use_lobpcg = use;}
+
+    /**
+       Solves the problem of A with the weighted l1-smoother both by LOBPCG
+       (with the block size, tolerance and iteration limit of SolveLOBPCG)
+       and by the direct solver, and returns the largest difference of the
+       lowest eigenvalues that both found. Meant for testing, it does not
+       touch the statistics.
+    */
+    double CompareLOBPCGWithDirect(const mfem::SparseMatrix& A);
 
     void GetStatistics(
         int &o_count_solves, int &o_count_direct_solves,
-        int &o_count_max_used, double &o_smallest_eigenvalue_skipped);
+        int &o_count_max_used, int &o_count_reused,
+        double &o_smallest_eigenvalue_skipped,
+        int &o_count_lobpcg_solves, int &o_count_lobpcg_iterations);
     void PrintStatistics();
 
+    /**
+       Accumulates the statistics of another eigensolver into this one.
+       Used to combine per-thread eigensolvers after a threaded loop over
+       agglomerates.
+    */
+    void MergeStatistics(const Eigensolver& other);
+
+    /**
+       Whether Solve() would dispatch a problem of this size to the
+       ARPACK iterative solver. The iterative solver keeps state between
+       calls and is not thread-safe, so threaded callers must do these
+       problems sequentially and in order.
+    */
+    bool UsesIterative(int problem_size) const;
+
 private:
     /**
        Implements the original method, with dsygvx etc., where
@@ -190,7 +240,8 @@ private:
 
     /**
        Implemented as a sparse iterative eigensolver using
-       ARPACK.
+       ARPACK. If start_evects is given, the sum of its columns is the
+       starting vector.
     */
 #if SAAMGE_USE_ARPACK
     bool SolveIterative(
@@ -198,15 +249,47 @@ private:
         mfem::SparseMatrix *& B, int part, int agg_id, int agg_size,
         double& theta, mfem::DenseMatrix& cut_evects,
         const mfem::DenseMatrix *Tt,
-        bool transf, bool all_eigens);
+        bool transf, bool all_eigens,
+        const mfem::DenseMatrix *start_evects);
 #endif
 
+    /**
+       Sparse LOBPCG, preconditioned by the inverse of the (diagonal)
+       weighted l1-smoother. The block starts at lobpcg_block vectors (or
+       one more than start_evects, which seed it) and doubles, up to
+       max_lobpcg_vectors, while all its Ritz values are below theta.
+       Thread-safe, unlike SolveIterative().
+    */
+    bool SolveLOBPCG(
+        const mfem::SparseMatrix& A, mfem::SparseMatrix *& B, int part,
+        double& theta, mfem::DenseMatrix& cut_evects,
+        const mfem::DenseMatrix *start_evects);
+
+    /**
+       The Rayleigh-Ritz test of SetReuseTolerance(). Returns whether the
+       old vectors were good enough, in which case cut_evects holds the
+       Ritz vectors.
+    */
+    bool SolveReused(
+        const mfem::SparseMatrix& A, const mfem::SparseMatrix& B,
+        const mfem::DenseMatrix& prev_evects, double theta,
+        mfem::DenseMatrix& cut_evects);
+
     const int * aggregates;
     const agg_partitioning_relations_t &agg_part_rels;
     int threshold;
     const bool transf;
     const bool all_eigens;
     int max_arpack_vectors;
+    bool use_lobpcg;
+    int lobpcg_block;
+    int max_lobpcg_vectors;
+    int max_lobpcg_iters;
+    double lobpcg_tol;
+    double reuse_tol;
+
+    //! LAPACK buffers reused by all direct solves of this eigensolver
+    XpacksEigenWorkspace eigen_workspace;
 
     //! total number of eigenvalue problem solves
     int count_solves;
@@ -217,6 +300,15 @@ private:
     //! number of eigenvalue problems where we use all the computed eigenvectors
     int count_max_used;
 
+    //! number of eigenvalue problems skipped by reusing the previous vectors
+    int count_reused;
+
+    //! number of eigenvalue problems solved by LOBPCG
+    int count_lobpcg_solves;
+
+    //! total LOBPCG iterations, over all block sizes
+    int count_lobpcg_iterations;
+
     /** 
         smallest eigenvalue calculated that we do not use in coarse space,
         this is \lambda_{m_T + 1} in Brezina-Vassilevski (16)
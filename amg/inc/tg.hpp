@@ -166,13 +166,61 @@ private:
                       output.
     \param coarse_solver (IN) The solver for the coarse-grid correction.
     \param data (IN/OUT) The data for \a pre_smoother and \a post_smoother.
-    \param mu (IN) 1 for V-cycle, 2 for W-cycle
+    \param ws (IN/OUT) Persistent vectors for the level (see
+                       \b tg_init_cycle_workspace). If NULL, temporary vectors
+                       are allocated for this call.
 */
 void tg_cycle_atb(mfem::HypreParMatrix& A, mfem::HypreParMatrix& Ac,
                   mfem::HypreParMatrix& interp, mfem::HypreParMatrix& restr,
                   const mfem::Vector& b, smpr_ft pre_smoother,
                   smpr_ft post_smoother, mfem::Vector& x,
-                  mfem::Solver& coarse_solver, void *data);
+                  mfem::Solver& coarse_solver, void *data,
+                  tg_cycle_workspace_t *ws=NULL);
+
+/*! \brief Block version of \b tg_cycle_atb.
+
+    Carries the right-hand sides in the columns of \a B through the cycle
+    together. Residuals, restriction and interpolation are done with
+    \b mbox_block_mult_parallel and the polynomial smoother with
+    \b smpr_sym_poly_block. If \a coarse_solver is a \b VCycleSolver, the
+    block continues to the next level; otherwise the coarse systems are solved
+    one at a time.
+
+    \param A (IN) The matrix of the system being solved.
+    \param Ac (IN) The coarse-grid operator.
+    \param interp (IN) The interpolant.
+    \param restr (IN) The restriction operator.
+    \param B (IN) The right-hand sides, one per column.
+    \param pre_smoother (IN) The smoother for the pre-smoothing step.
+    \param post_smoother (IN) The smoother for the post-smoothing step.
+    \param X (IN/OUT) The current iterates as input and the next iterates as
+                      output, one per column.
+    \param coarse_solver (IN) The solver for the coarse-grid correction.
+    \param data (IN/OUT) The data for \a pre_smoother and \a post_smoother.
+    \param ws (IN/OUT) Persistent blocks of the level (see
+                       \b tg_init_cycle_workspace). If NULL, temporary blocks
+                       are allocated for this call.
+*/
+void tg_cycle_atb_block(mfem::HypreParMatrix& A, mfem::HypreParMatrix& Ac,
+                        mfem::HypreParMatrix& interp, mfem::HypreParMatrix& restr,
+                        const mfem::DenseMatrix& B, smpr_ft pre_smoother,
+                        smpr_ft post_smoother, mfem::DenseMatrix& X,
+                        mfem::Solver& coarse_solver, void *data,
+                        tg_cycle_workspace_t *ws=NULL);
+
+/*! \brief (Re)allocates the cycle workspace of a level.
+
+    \param tg_data (IN/OUT) The TG data. \em interp and \em Ac must already be
+                            set.
+    \param krylov (IN) Whether to also allocate the vectors of the K-cycle.
+*/
+void tg_init_cycle_workspace(tg_data_t& tg_data, bool krylov=false);
+
+/*! \brief Frees the cycle workspace of a level (if any).
+
+    \param tg_data (IN/OUT) The TG data.
+*/
+void tg_free_cycle_workspace(tg_data_t& tg_data);
 
 /*! \brief Computes \f$ (B^{-1}\mathbf{r}, \mathbf{r}) \f$.
 
@@ -317,6 +365,8 @@ int tg_solve(mfem::HypreParMatrix& A, mfem::HypreParVector& b, mfem::HypreParVec
                          information.
     \param output (IN) Whether to generate any console output. This way output
                        can be suppressed independent of the global output level.
+    \param pipelined (IN) Whether to use \b pipelined_pcg, with one reduction
+                          per iteration, instead of \b kalchev_pcg.
 
     \returns The number of iterations performed. If a solution was not
              successfully computed (according to the stopping criteria), then
@@ -324,7 +374,7 @@ int tg_solve(mfem::HypreParMatrix& A, mfem::HypreParVector& b, mfem::HypreParVec
 */
 int tg_pcg_solve(mfem::HypreParMatrix& A, mfem::HypreParVector& b, mfem::HypreParVector& x,
                  int maxiter, tg_data_t *tg_data, double rtol/*=10e-12*/, double atol/*=10e-24*/,
-                 bool zero_rhs/*=false*/, bool output=true);
+                 bool zero_rhs/*=false*/, bool output=true, bool pipelined=false);
 
 /*! \brief Executes the TG method.
 
@@ -431,6 +481,19 @@ tg_data_t *tg_init_data(
     int nu_relax, double theta, bool smooth_interp, double smooth_drop_tol,
     bool use_arpack);
 
+/*! \brief Selects the relaxation of a level.
+
+    Sets the pre- and post-smoothers of \a tg_data and, for the Chebyshev
+    smoother, estimates the spectral bound and replaces the polynomial. For
+    \b SMPR_RELAX_POLY the defaults from \b tg_init_data are kept.
+
+    \param A (IN) The matrix of the level.
+    \param tg_data (IN/OUT) TG data initialized by \b tg_init_data.
+    \param relax (IN) The relaxation.
+*/
+void tg_set_relaxation(mfem::HypreParMatrix& A, tg_data_t& tg_data,
+                       smpr_relax_t relax);
+
 /*! \brief Shared code from tg_build_hierarchy functions */
 void tg_assemble_and_smooth(mfem::HypreParMatrix &Ag,
                             tg_data_t& tg_data,
@@ -455,6 +518,20 @@ void tg_build_hierarchy_with_polynomial(
     ElementMatrixProvider *elem_data, int polynomial_order, bool use_spectral,
     bool avoid_ess_bdr_dofs);
 
+/*! \brief Prepares built TG data for a rebuild with new matrix values.
+
+    Everything that depends only on the topology (the partitioning
+    relations, the smoother parameters, the element matrix provider) is
+    kept. The smoother diagonal is updated for \a A, and the coarse space,
+    \em Ac and the coarse solver are dropped. Then \b tg_build_hierarchy
+    (or \b tg_build_hierarchy_with_polynomial) builds the coarse space
+    again.
+
+    \param A (IN) The fine-grid operator with the new values.
+    \param tg_data (IN/OUT) The TG data.
+*/
+void tg_reset_coarse_space(mfem::HypreParMatrix& A, tg_data_t& tg_data);
+
 /*! \brief Builds the coarse level.
 
     TG data must be initialized prior to calling this function (see
@@ -482,8 +559,9 @@ void tg_build_hierarchy(mfem::HypreParMatrix& Ag, tg_data_t& tg_data,
 
 /*! \brief Extends an identity block to top-left of tg_data.interp
 
-  This is a very dirty hack, does not work in parallel, involves way
-  too much deleteion / recreation, is a general mess.
+  This is a very dirty hack, involves way too much deleteion /
+  recreation, is a general mess. In parallel the k new rows and columns
+  go to the process of rank 0.
 
   We use this to for example when we eliminate a degree of freedom
   for a pure Neumann problem, build the hierarchy for the smaller
@@ -508,12 +586,26 @@ void ExtractSubMatrices(
 
 void TestWindowSubMatrices();
 
+/*! \brief For algebraic interface, the window AMG AE matrices.
+
+  For an AE T and the DoFs X just outside it, the AE matrix is
+  \f$ A_{TT} + A_{TX} E \f$, where the extension E spreads X over T in
+  proportion to the couplings of X to T.
+
+  The AEs are independent and are done in parallel by the OpenMP threads,
+  each with its own dense marker arrays of the size of A.
+
+  A and agg_part_rels are input, agglomerate_element_matrices is output.
+*/
 void WindowSubMatrices(
     const mfem::SparseMatrix& A, const agg_partitioning_relations_t& agg_part_rels,
     mfem::Array<mfem::SparseMatrix*>& agglomerate_element_matrices);
 
 /*! \brief Essentially wraps ExtractSubMatrices and
   tg_produce_data, with an algebraic ElementMatrixProvider
+
+  In parallel Alocal must be ExtendedLocalMatrix(Ag), so the AE matrices
+  see the couplings to the neighbouring processes.
 */
 tg_data_t *tg_produce_data_algebraic(
     const mfem::SparseMatrix &Alocal,
@@ -522,6 +614,18 @@ tg_data_t *tg_produce_data_algebraic(
     int polynomial_coarse_arg, bool use_window, bool use_arpack,
     bool avoid_ess_bdr_dofs);
 
+/*! \brief tg_produce_data_algebraic for a distributed Ag (serial works too),
+  with Alocal built from it by ExtendedLocalMatrix().
+
+  agg_part_rels comes from the fem_create_partitioning_from_matrix taking
+  the parallel matrix.
+*/
+tg_data_t *tg_produce_data_algebraic(
+    mfem::HypreParMatrix& Ag, const agg_partitioning_relations_t& agg_part_rels,
+    int nu_pro, int nu_relax, double spectral_tol, bool smooth_interp,
+    int polynomial_coarse_arg, bool use_window, bool use_arpack,
+    bool avoid_ess_bdr_dofs);
+
 /*! \brief Switch from window to diagonal compensation matrices, or vice versa.
 
   We may want to use window AMG for eigenvectors, and diagonal compensation
@@ -611,6 +715,31 @@ void tg_update_coarse_operator(mfem::HypreParMatrix& A, tg_data_t *tg_data,
                                bool perform_solve_init,
                                bool coarse_direct);
 
+/*! \brief Initializes the "coarse solver" for an already computed \em Ac.
+
+    If \em Ac is smaller than \em tg_data->redist_threshold, it is moved onto
+    a subset of the processes and the solver is built there, wrapped in a
+    \b RedistributedSolver. The finer levels stay on all processes.
+
+    \param tg_data (IN/OUT) The TG data. \em Ac must already be set.
+    \param coarse_direct (IN) Use a direct solver on the coarse level.
+*/
+void tg_init_coarse_solver(tg_data_t *tg_data, bool coarse_direct);
+
+/*! \brief Makes a \b CorrectNullspace solver the "coarse solver" of the
+           coarsest level.
+
+    The nullspace level is built from \em Ac and \em scaling_P. Like in
+    \b tg_init_coarse_solver, if \em Ac is smaller than
+    \em tg_data->redist_threshold, both are moved onto a subset of the
+    processes and the solver is built there, wrapped in a
+    \b RedistributedSolver.
+
+    \param tg_data (IN/OUT) The TG data. \em Ac and \em scaling_P must
+                            already be set. The old coarse solver is freed.
+*/
+void tg_init_nullspace_coarse_solver(tg_data_t *tg_data);
+
 /* Inline Functions */
 /*! \brief Smooths the tentative interpolant to produce the final one.
 
@@ -42,6 +42,34 @@
 namespace saamge
 {
 
+/*! \brief Persistent vectors for applying the TG cycle on a level.
+
+    Allocated once by \b tg_init_cycle_workspace so that \b tg_cycle_atb does
+    not touch the heap. The parallel vectors own their data and partitioning,
+    so they survive rebuilding the operators as long as the sizes stay.
+*/
+typedef struct {
+    mfem::Vector *res; /*!< Fine-level residual. */
+    mfem::HypreParVector *resc; /*!< Coarse-level residual. */
+    mfem::HypreParVector *xc; /*!< Coarse-level correction. */
+    mfem::HypreParVector *resc2; /*!< Second coarse-level residual (for
+                                      cycles that revisit the coarse level). */
+
+    /* Coarse-level vectors of the flexible CG in the K-cycle, NULL unless
+       requested in \b tg_init_cycle_workspace. */
+    mfem::HypreParVector *kr; /*!< Residual. */
+    mfem::HypreParVector *kc; /*!< Preconditioned residual. */
+    mfem::HypreParVector *kd; /*!< Search direction. */
+    mfem::HypreParVector *kAd; /*!< Operator times the search direction. */
+    mfem::HypreParVector *kq; /*!< Operator times \a kc. */
+
+    /* Blocks of \b tg_cycle_atb_block. They are sized by the first block
+       cycle and only reallocated when the number of columns grows. */
+    mfem::DenseMatrix *bres; /*!< Fine-level residuals. */
+    mfem::DenseMatrix *bresc; /*!< Coarse-level residuals. */
+    mfem::DenseMatrix *bxc; /*!< Coarse-level corrections. */
+} tg_cycle_workspace_t;
+
 /*! \brief TG data -- interpolation, smoothers etc.
 */
 typedef struct {
@@ -73,6 +101,14 @@ typedef struct {
     smpr_poly_data_t *poly_data; /*< The data for the polynomial smoother. */
 
     bool use_w_cycle; /*!< whether to use W-cycle or V-cycle DEPRECATED */
+    int cycle_mu; /*!< How many times the W- and K-cycles (see \b ml_cycle)
+                       visit the coarse level of this TG per visit of the fine
+                       one. */
+    int redist_threshold; /*!< If positive and the global size of \em Ac is
+                               below it, the coarse solver runs on fewer
+                               processes (see \b tg_init_coarse_solver). */
+    int redist_rows; /*!< Target number of rows per process of the
+                          redistributed coarse operator. */
     /*! -1 indicates usual spectral space, otherwise order of polynomials to include */
     int polynomial_coarse_space;
     bool doing_spectral;
@@ -80,6 +116,9 @@ typedef struct {
     int tag;
 
     ElementMatrixProvider * elem_data; /*!< keep a pointer so tg_data can free this */
+
+    tg_cycle_workspace_t *cycle_ws; /*!< Vectors for \b tg_cycle_atb, NULL
+                                         until \b tg_init_cycle_workspace. */
 } tg_data_t;
 
 }
@@ -35,6 +35,8 @@
 #define _XPACKS_HPP
 
 #include "common.hpp"
+#include <map>
+#include <vector>
 #include <mfem.hpp>
 
 namespace saamge
@@ -240,6 +242,171 @@ void xpack_solve_lls(const mfem::DenseMatrix& A, const mfem::Vector &rhs, mfem::
 void xpack_solve_spd_Cholesky(const mfem::DenseMatrix& A, const mfem::Vector &rhs,
                               mfem::Vector &x);
 
+/*! \brief Cholesky factorization, in place, for repeated solves.
+
+    Uses LAPACK. Only the upper triangle of \a A is referenced and on
+    success it is overwritten by the factor U, \a A = U^T U.
+
+    \param A (IN/OUT) The matrix as input, the factor as output.
+
+    \returns Whether \a A is s.p.d., that is, whether the factorization
+             succeeded.
+*/
+bool xpack_Cholesky_factor(mfem::DenseMatrix& A);
+
+/*! \brief Solves with a factor from \b xpack_Cholesky_factor.
+
+    \param U (IN) The factor.
+    \param x (IN/OUT) The right-hand side as input, the solution as output.
+*/
+void xpack_Cholesky_solve(const mfem::DenseMatrix& U, mfem::Vector& x);
+
+/**
+   Reusable LAPACK workspace for the many small symmetric eigenproblems
+   solved when building the coarse spaces.
+
+   Problems are grouped in size classes (the size rounded up to a multiple
+   of \b size_class_step). The optimal LAPACK workspace size of every size
+   class is queried once, on first use, and then reused for all the problems
+   in the class, so there is no workspace query per problem. There is a
+   single set of buffers, grown to the largest size class seen so far, so
+   the memory is that of the largest problem and not the sum over all size
+   classes.
+
+   Not thread-safe, every thread should have its own workspace.
+*/
+class XpacksEigenWorkspace
+{
+public:
+    XpacksEigenWorkspace() { buffers.capacity = 0; }
+
+    /**
+       The buffers, sized for problems of size up to \b capacity, and the
+       LAPACK workspace sizes of the size class they were last requested for.
+    */
+    struct SizeClass
+    {
+        int capacity;
+        int lwork;
+        int liwork;
+        std::vector<double> a;
+        std::vector<double> w;
+        std::vector<double> z;
+        std::vector<double> work;
+        std::vector<int> iwork;
+        std::vector<int> isuppz;
+        std::vector<double> scale;
+    };
+
+    /**
+       Returns the buffers for problems of size n, growing them and querying
+       the workspace size of the size class if needed. The returned reference
+       is only valid until the next call.
+    */
+    SizeClass& GetSizeClass(int n);
+
+    /**
+       Number of size classes set up so far.
+    */
+    int NumSizeClasses() const { return workspace_sizes.size(); }
+
+    static const int size_class_step = 16;
+
+private:
+    SizeClass buffers;
+    /// (lwork, liwork) for every size class, by capacity
+    std::map<int, std::pair<int, int> > workspace_sizes;
+};
+
+/*! \brief Computes the lower eigenpairs of a sparse matrix w.r.t. a diagonal.
+
+    Computes the eigenvalues in (-1,\a upper] and the corresponding
+    eigenvectors of \f$ A\mathbf{x} = \lambda D \mathbf{x}\f$, where A is
+    symmetric and D is diagonal with positive entries. The problem is
+    scaled to the standard problem for \f$ D^{-1/2} A D^{-1/2} \f$, which
+    is solved by the LAPACK routine dsyevr using the buffers in \a ws, and
+    the eigenvectors are scaled back by \f$ D^{-1/2} \f$. The result is
+    the same (up to rounding) as the one of
+    \b xpacks_calc_lower_eigens_dense with the dense versions of A and D.
+
+    \param A (IN) This is A.
+    \param diag (IN) The diagonal of D.
+    \param evals (OUT) The eigenvalues.
+    \param evects (OUT) The eigenvectors (D-orthonormal) as columns of a dense
+                        matrix.
+    \param upper (IN) The upper bound for the eigenvalues.
+    \param atleast_one (IN) If set, the eigenpair with the minimal eigenvalue
+                            is computed in case all eigenvalues are above
+                            \a upper.
+    \param ws (IN/OUT) The workspace.
+
+    \returns The number of eigenvalues and eigenvectors computed.
+
+    \warning A is symmetric and the entries of \a diag are positive.
+*/
+int xpacks_calc_lower_eigens_diag(const mfem::SparseMatrix& A,
+                                  const mfem::Vector& diag, mfem::Vector& evals,
+                                  mfem::DenseMatrix& evects, double upper,
+                                  bool atleast_one, XpacksEigenWorkspace& ws);
+
+/**
+   Reusable buffers for a sequence of SVDs by the \b xpack_svd_dense_arr
+   overload taking it. The LAPACK workspace queries are only repeated when
+   the shape changes, so the SVDs should come sorted by shape.
+
+   Not thread-safe, every thread should have its own workspace.
+*/
+class XpacksSVDWorkspace
+{
+public:
+    XpacksSVDWorkspace()
+        : m(0), n(0), lwork(0), gram_n(0), gram_lwork(0),
+          count_gram(0), count_full(0) {}
+
+    int m; //!< rows of the last dgesvd workspace query
+    int n; //!< columns of the last dgesvd workspace query
+    int lwork;
+    int gram_n; //!< size of the last dsyev workspace query
+    int gram_lwork;
+    std::vector<double> a;
+    std::vector<double> work;
+    std::vector<double> gram;
+    std::vector<double> gram_w;
+    std::vector<double> gram_work;
+
+    int count_gram; //!< SVDs done by the Gram matrix shortcut
+    int count_full; //!< SVDs done by dgesvd
+};
+
+/*! The Gram matrix shortcut is tried when there are at least this many
+    times more rows than columns. */
+const int XPACK_SVD_GRAM_RATIO = 4;
+
+/*! The Gram matrix shortcut is used only when all eigenvalues of the Gram
+    matrix are above this times the largest, so that squaring the singular
+    values loses nothing that \b xpack_orth_set would keep. */
+const double XPACK_SVD_GRAM_TOL = 1.e-6;
+
+/*! \brief \b xpack_svd_dense_arr with reused buffers and a Gram shortcut.
+
+    Same result as \b xpack_svd_dense_arr. If the concatenated matrix A has
+    at least \b XPACK_SVD_GRAM_RATIO times more rows than columns, the
+    eigendecomposition of \f$ A^T A \f$ gives the singular values and
+    \f$ A V \Sigma^{-1} \f$ the left singular vectors, at about half the
+    cost of dgesvd. dgesvd is used when A is too close to rank deficient
+    for that (see \b XPACK_SVD_GRAM_TOL).
+
+    \param arr (IN) An array of dense matrices.
+    \param arr_size (IN) The number of entries in the array.
+    \param lsvects (OUT) The left singular vectors as columns of a dense
+                         matrix.
+    \param svals (OUT) The singular values.
+    \param ws (IN/OUT) The reused buffers.
+*/
+void xpack_svd_dense_arr(const mfem::DenseMatrix *arr, int arr_size,
+                         mfem::DenseMatrix& lsvects, mfem::Vector& svals,
+                         XpacksSVDWorkspace& ws);
+
 } // namespace saamge
 
 #endif // _XPACKS_HPP
@@ -53,6 +53,8 @@ cmake \
     -DARPACK_DIR=${HOME}/arpack/arpack-ng-install \
     -DARPACKPP_DIR=${HOME}/arpack/arpackpp \
     \
+    -DUSE_OPENMP=OFF \
+    \
     -DLINK_NETCDF=OFF \
     -DNETCDF_DIR=${HOME}/packages/netcdf \
     \
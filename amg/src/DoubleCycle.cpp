@@ -36,7 +36,7 @@ namespace saamge
 using namespace mfem;
 
 DoubleCycle::DoubleCycle(HypreParMatrix& A, ml_data_t &ml_data) :
-    Solver(A.M(),false), // PCG does not give me an initial guess when this is a preconditioner?
+    Solver(mbox_rows_in_current_process(A),false), // PCG does not give me an initial guess when this is a preconditioner?
     A(A)
 {
     tg_data_t &tg_data = *ml_data.levels_list.finest->tg_data;
@@ -50,12 +50,21 @@ DoubleCycle::DoubleCycle(HypreParMatrix& A, ml_data_t &ml_data) :
     inner_solver = new CorrectNullspace(*Ac, tg_data.scaling_P, 2, false, true, false);
     outer_solver = new VCycleSolver(ml_data.levels_list.finest->coarser->tg_data, false);
     outer_solver->SetOperator(*Ac);
+
+    res = new Vector(mbox_rows_in_current_process(A));
+    RESC = new HypreParVector(*Ac);
+    XC = new HypreParVector(*Ac);
+    RESC2 = new HypreParVector(*Ac);
 }
 
 DoubleCycle::~DoubleCycle()
 {
     delete inner_solver;
     delete outer_solver;
+    delete res;
+    delete RESC;
+    delete XC;
+    delete RESC2;
 }
 
 void DoubleCycle::Mult(const Vector &b, Vector &x) const
@@ -64,36 +73,29 @@ void DoubleCycle::Mult(const Vector &b, Vector &x) const
 
     x = 0.0; // seems I need to do this even if iterative_mode = true;
 
-    Vector res(x.Size()), resc(mbox_rows_in_current_process(*Ac));
-    Vector xc(mbox_rows_in_current_process(*Ac));
-    xc = 0.0; // moved out of coarse_solver.solver for W-cycle
+    *XC = 0.0; // moved out of coarse_solver.solver for W-cycle
 
     pre_smoother(A, b, x, smoother_data);
 
-    A.Mult(x, res);
-    subtract(b, res, res);
-    restr->Mult(res, resc);
-
-    HypreParVector RESC(PROC_COMM, Ac->GetGlobalNumRows(), resc.GetData(),
-                        Ac->GetRowStarts());
-    HypreParVector XC(PROC_COMM, Ac->GetGlobalNumRows(), xc.GetData(), Ac->GetRowStarts());
+    A.Mult(x, *res);
+    subtract(b, *res, *res);
+    restr->Mult(*res, *RESC);
 
-    outer_solver->Mult(RESC, XC);
+    outer_solver->Mult(*RESC, *XC);
 
-    HypreParVector RESC2(RESC);
-    Ac->Mult(XC, RESC2);
-    subtract(RESC, RESC2, RESC2);
-    inner_solver->Mult(RESC2, XC);
+    Ac->Mult(*XC, *RESC2);
+    subtract(*RESC, *RESC2, *RESC2);
+    inner_solver->Mult(*RESC2, *XC);
 
     bool symmetric = true;
     if (symmetric)
     {
-        Ac->Mult(XC, RESC);
-        subtract(RESC2, RESC, RESC);
-        outer_solver->Mult(RESC, XC);
+        Ac->Mult(*XC, *RESC);
+        subtract(*RESC2, *RESC, *RESC);
+        outer_solver->Mult(*RESC, *XC);
     }
 
-    interp->Mult(1.0, XC, 1.0, x);
+    interp->Mult(1.0, *XC, 1.0, x);
 
     post_smoother(A, b, x, smoother_data);    
 }
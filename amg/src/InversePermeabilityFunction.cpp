@@ -36,6 +36,8 @@
  */
 
 #include <fstream>
+#include <cstring>
+#include <algorithm>
 #include <mfem.hpp>
 #include "InversePermeabilityFunction.hpp"
 
@@ -64,9 +66,72 @@ void InversePermeabilityFunction::Set2DSlice(SliceOrientation o, int npos_ )
     npos = npos_;
 }
 
+/// Header of the binary permeability file, followed by the permeability
+/// (not its inverse) as 3 x nz x ny x nx doubles, x running fastest.
+struct PermeabilityFileHeader
+{
+    char magic[8];
+    int version;
+    int nx;
+    int ny;
+    int nz;
+    int reserved[2];
+};
+
+static const char PERMEABILITY_MAGIC[8] = {'S', 'A', 'A', 'M', 'G', 'E', 'K', 'P'};
+static const int PERMEABILITY_VERSION = 1;
+
+void InversePermeabilityFunction::SetWholeBox()
+{
+    i0 = j0 = k0 = 0;
+    ni = Nx;
+    nj = Ny;
+    nk = Nz;
+}
+
+void InversePermeabilityFunction::Locate(const double * x,
+                                         int & i, int & j, int & k)
+{
+    i = j = k = 0;
+
+    switch (orientation)
+    {
+    case NONE:
+        i = Nx-1-(int)floor(x[0]/hx/(1.+3e-16));
+        j = (int)floor(x[1]/hy/(1.+3e-16));
+        k = Nz-1-(int)floor(x[2]/hz/(1.+3e-16));
+        break;
+    case XY:
+        i = Nx-1-(int)floor(x[0]/hx/(1.+3e-16));
+        j = (int)floor(x[1]/hy/(1.+3e-16));
+        k = npos;
+        break;
+    case XZ:
+        i = Nx-1-(int)floor(x[0]/hx/(1.+3e-16));
+        j = npos;
+        k = Nz-1-(int)floor(x[2]/hz/(1.+3e-16));
+        break;
+    case YZ:
+        i = npos;
+        j = (int)floor(x[1]/hy/(1.+3e-16));
+        k = Nz-1-(int)floor(x[2]/hz/(1.+3e-16));
+        break;
+    default:
+        mfem_error("InversePermeabilityFunction::Locate");
+    }
+}
+
+int InversePermeabilityFunction::Index(int i, int j, int k)
+{
+    if (i < i0 || i >= i0+ni || j < j0 || j >= j0+nj || k < k0 || k >= k0+nk)
+        mfem_error("InversePermeabilityFunction: cell outside the loaded box");
+    return nj*ni*(k-k0) + ni*(j-j0) + (i-i0);
+}
+
 void InversePermeabilityFunction::SetConstantInversePermeability(
     double ipx, double ipy, double ipz)
 {
+    SetWholeBox();
     int compSize = Nx*Ny*Nz;
     int size = 3*compSize;
     inversePermeability = new double [size];
@@ -92,6 +157,7 @@ void InversePermeabilityFunction::ReadPermeabilityFile(const std::string fileNam
         mfem_error("File does not exist");
     }
 
+    SetWholeBox();
     inversePermeability = new double [3*Nx*Ny*Nz];
     double *ip = inversePermeability;
     double tmp;
@@ -137,7 +203,10 @@ void InversePermeabilityFunction::ReadPermeabilityFile(const std::string fileNam
     if (myid == 0)
         ReadPermeabilityFile(fileName);
     else
+    {
+        SetWholeBox();
         inversePermeability = new double [3*Nx*Ny*Nz];
+    }
     chrono.Stop();
 
     if (myid==0)
@@ -154,56 +223,166 @@ void InversePermeabilityFunction::ReadPermeabilityFile(const std::string fileNam
 
 }
 
-void InversePermeabilityFunction::InversePermeability(const Vector & x, 
-                                                      Vector & val)
+bool InversePermeabilityFunction::IsBinaryPermeabilityFile(const std::string fileName)
 {
-    val.SetSize(x.Size());
+    std::ifstream permfile(fileName.c_str(), std::ifstream::binary);
+    PermeabilityFileHeader header;
+    if (!permfile.read((char *)&header, sizeof(header)))
+        return false;
+    return !memcmp(header.magic, PERMEABILITY_MAGIC, sizeof(header.magic));
+}
 
-    unsigned int i=0,j=0,k=0;
+void InversePermeabilityFunction::ConvertPermeabilityFile(
+    const std::string textFileName, const std::string binaryFileName)
+{
+    const int nx = 60, ny = 220, nz = 85;
 
-    switch (orientation)
+    std::ifstream permfile(textFileName.c_str());
+    if (!permfile.is_open())
     {
-    case NONE:
-        i = Nx-1-(int)floor(x[0]/hx/(1.+3e-16));
-        j = (int)floor(x[1]/hy/(1.+3e-16));
-        k = Nz-1-(int)floor(x[2]/hz/(1.+3e-16));
-        break;
-    case XY:
-        i = Nx-1-(int)floor(x[0]/hx/(1.+3e-16));
-        j = (int)floor(x[1]/hy/(1.+3e-16));
-        k = npos;
-        break;
-    case XZ:
-        i = Nx-1-(int)floor(x[0]/hx/(1.+3e-16));
-        j = npos;
-        k = Nz-1-(int)floor(x[2]/hz/(1.+3e-16));
-        break;
-    case YZ:
-        i = npos;
-        j = (int)floor(x[1]/hy/(1.+3e-16));
-        k = Nz-1-(int)floor(x[2]/hz/(1.+3e-16));
-        break;
-    default:
-        mfem_error("InversePermeabilityFunction::InversePermeability");
+        std::cout << "Error in opening file " << textFileName << std::endl;
+        mfem_error("File does not exist");
     }
+    Vector perm(3*nx*ny*nz);
+    for (int i = 0; i < perm.Size(); ++i)
+        permfile >> perm(i);
+    if (!permfile)
+        mfem_error("InversePermeabilityFunction::ConvertPermeabilityFile: "
+                   "short permeability file");
+
+    PermeabilityFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PERMEABILITY_MAGIC, sizeof(header.magic));
+    header.version = PERMEABILITY_VERSION;
+    header.nx = nx;
+    header.ny = ny;
+    header.nz = nz;
+
+    std::ofstream binfile(binaryFileName.c_str(), std::ofstream::binary);
+    binfile.write((char *)&header, sizeof(header));
+    binfile.write((char *)perm.GetData(), sizeof(double)*perm.Size());
+    if (!binfile)
+        mfem_error("InversePermeabilityFunction::ConvertPermeabilityFile: "
+                   "cannot write binary file");
+}
+
+void InversePermeabilityFunction::ReadPermeabilityFile(
+    const std::string fileName, MPI_Comm comm, const Mesh & mesh)
+{
+    int myid;
+    MPI_Comm_rank(comm, &myid);
+
+    StopWatch chrono;
+    chrono.Start();
+
+    // Box of cells touched by the local vertices. The index maps are
+    // monotone, so the vertices bound the cells of the local elements.
+    int ilo = Nx, jlo = Ny, klo = Nz, ihi = -1, jhi = -1, khi = -1;
+    for (int v = 0; v < mesh.GetNV(); ++v)
+    {
+        int i, j, k;
+        Locate(mesh.GetVertex(v), i, j, k);
+        i = std::min(std::max(i, 0), Nx-1);
+        j = std::min(std::max(j, 0), Ny-1);
+        k = std::min(std::max(k, 0), Nz-1);
+        ilo = std::min(ilo, i);
+        jlo = std::min(jlo, j);
+        klo = std::min(klo, k);
+        ihi = std::max(ihi, i);
+        jhi = std::max(jhi, j);
+        khi = std::max(khi, k);
+    }
+    if (ihi < 0)
+    {
+        i0 = j0 = k0 = 0;
+        ni = nj = nk = 0;
+    }
+    else
+    {
+        i0 = ilo;
+        j0 = jlo;
+        k0 = klo;
+        ni = ihi - ilo + 1;
+        nj = jhi - jlo + 1;
+        nk = khi - klo + 1;
+    }
+
+    MPI_File fh;
+    if (MPI_File_open(comm, const_cast<char *>(fileName.c_str()),
+                      MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        std::cout << "Error in opening file " << fileName << std::endl;
+        mfem_error("File does not exist");
+    }
+
+    PermeabilityFileHeader header;
+    MPI_File_read_at_all(fh, 0, &header, sizeof(header), MPI_BYTE,
+                         MPI_STATUS_IGNORE);
+    if (memcmp(header.magic, PERMEABILITY_MAGIC, sizeof(header.magic)) ||
+        header.version != PERMEABILITY_VERSION)
+        mfem_error("InversePermeabilityFunction::ReadPermeabilityFile: "
+                   "not a binary permeability file");
+    if (header.nx < Nx || header.ny < Ny || header.nz < Nz)
+        mfem_error("InversePermeabilityFunction::ReadPermeabilityFile: "
+                   "permeability file smaller than the domain");
+
+    const int boxSize = ni*nj*nk;
+    delete[] inversePermeability;
+    inversePermeability = new double [3*boxSize];
+
+    MPI_Datatype filetype = MPI_DOUBLE;
+    if (boxSize > 0)
+    {
+        int sizes[4] = {3, header.nz, header.ny, header.nx};
+        int subsizes[4] = {3, nk, nj, ni};
+        int starts[4] = {0, k0, j0, i0};
+        MPI_Type_create_subarray(4, sizes, subsizes, starts, MPI_ORDER_C,
+                                 MPI_DOUBLE, &filetype);
+        MPI_Type_commit(&filetype);
+    }
+    MPI_File_set_view(fh, sizeof(header), MPI_DOUBLE, filetype,
+                      const_cast<char *>("native"), MPI_INFO_NULL);
+    MPI_File_read_all(fh, inversePermeability, 3*boxSize, MPI_DOUBLE,
+                      MPI_STATUS_IGNORE);
+    if (boxSize > 0)
+        MPI_Type_free(&filetype);
+    MPI_File_close(&fh);
+
+    for (int l = 0; l < 3*boxSize; ++l)
+        inversePermeability[l] = 1./inversePermeability[l];
+
+    chrono.Stop();
+    if (myid==0)
+        std::cout<<"Permeability box read in " << chrono.RealTime() << ".s \n";
+}
+
+void InversePermeabilityFunction::InversePermeability(const Vector & x, 
+                                                      Vector & val)
+{
+    val.SetSize(x.Size());
+
+    int i, j, k;
+    Locate(x.GetData(), i, j, k);
+    const int idx = Index(i, j, k);
+    const int compSize = ni*nj*nk;
 
-    val[0] = inversePermeability[Ny*Nx*k + Nx*j + i];
-    val[1] = inversePermeability[Ny*Nx*k + Nx*j + i + Nx*Ny*Nz];
+    val[0] = inversePermeability[idx];
+    val[1] = inversePermeability[idx + compSize];
 
     if (orientation == NONE)
-        val[2] = inversePermeability[Ny*Nx*k + Nx*j + i + 2*Nx*Ny*Nz];
+        val[2] = inversePermeability[idx + 2*compSize];
 
 }
 
 double InversePermeabilityFunction::PermeabilityXY(Vector &x)
 {
-    unsigned int i=0,j=0,k=0;
+    int i=0,j=0,k=0;
 
     i = Nx-1-(int)floor(x[0]/hx/(1.+3e-16));
     j = (int)floor(x[1]/hy/(1.+3e-16));
     k = npos;
 
-    return 1.0/inversePermeability[Ny*Nx*k + Nx*j + i];
+    return 1.0/inversePermeability[Index(i, j, k)];
 }
 
 void InversePermeabilityFunction::NegativeInversePermeability(const Vector & x,
@@ -276,6 +455,7 @@ double InversePermeabilityFunction::InvNormInf(const Vector & x)
 void InversePermeabilityFunction::ClearMemory()
 {
     delete[] inversePermeability;
+    inversePermeability = NULL;
 }
 
 int InversePermeabilityFunction::Nx(60);
@@ -288,5 +468,11 @@ double * InversePermeabilityFunction::inversePermeability(NULL);
 InversePermeabilityFunction::SliceOrientation InversePermeabilityFunction::orientation( 
     InversePermeabilityFunction::NONE );
 int InversePermeabilityFunction::npos(-1);
+int InversePermeabilityFunction::i0(0);
+int InversePermeabilityFunction::j0(0);
+int InversePermeabilityFunction::k0(0);
+int InversePermeabilityFunction::ni(60);
+int InversePermeabilityFunction::nj(220);
+int InversePermeabilityFunction::nk(85);
 
 } // namespace saamge
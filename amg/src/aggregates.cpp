@@ -39,6 +39,7 @@
 #include "elmat.hpp"
 #include "helpers.hpp"
 #include "mbox.hpp"
+#include "prof.hpp"
 #include "mfem_addons.hpp"
 #include "arbitrator.hpp"
 using std::fabs;
@@ -486,6 +487,132 @@ int agg_construct_aggregate_mises(
     return agg_part_rels.nparts;  // seems fairly unnecessary?
 }
 
+/*! \brief Orders dofs by their (sorted) sets of global AEs.
+
+    Used by \b agg_group_dofs_by_AE_set. Ties are broken by the dof number,
+    so the first dof of every group of equal sets is its smallest one.
+*/
+class AESetLess
+{
+public:
+    AESetLess(const int *sig_I, const int *sig_J, const int *ndiag,
+              const unsigned int *hash)
+        : sig_I(sig_I), sig_J(sig_J), ndiag(ndiag), hash(hash) {}
+
+    /// -1, 0, 1 as the AE set of dof \a a is before, equal or after that of \a b
+    int Compare(int a, int b) const
+    {
+        if (hash[a] != hash[b])
+            return hash[a] < hash[b] ? -1 : 1;
+        if (ndiag[a] != ndiag[b])
+            return ndiag[a] < ndiag[b] ? -1 : 1;
+        const int na = sig_I[a+1] - sig_I[a];
+        const int nb = sig_I[b+1] - sig_I[b];
+        if (na != nb)
+            return na < nb ? -1 : 1;
+        for (int j=0; j<na; ++j)
+        {
+            const int ja = sig_J[sig_I[a] + j];
+            const int jb = sig_J[sig_I[b] + j];
+            if (ja != jb)
+                return ja < jb ? -1 : 1;
+        }
+        return 0;
+    }
+
+    bool operator()(int a, int b) const
+    {
+        const int c = Compare(a, b);
+        return c < 0 || (0 == c && a < b);
+    }
+
+private:
+    const int *sig_I;
+    const int *sig_J;
+    const int *ndiag;
+    const unsigned int *hash;
+};
+
+/*! \brief Groups dofs that belong to exactly the same global AEs.
+
+    The diag and offd column indices of each row of Dof_to_gAE are copied and
+    sorted, hashed, and the dofs are then sorted by (hash, set, dof number).
+    This is O(nnz log nnz) in the number of nonzeros of Dof_to_gAE.
+
+    \param n (IN) The number of local dofs (rows).
+    \param diag_I, diag_J, offd_I, offd_J (IN) The CSR structure of the diag
+                                             and offd parts of Dof_to_gAE.
+    \param group (OUT) The group of every dof (\a n entries). Groups are
+                       numbered in the order of their smallest dof.
+
+    \returns The number of groups.
+*/
+static
+int agg_group_dofs_by_AE_set(int n, const int *diag_I, const int *diag_J,
+                             const int *offd_I, const int *offd_J, int *group)
+{
+    int *sig_I = new int[n+1];
+    int *ndiag = new int[n];
+    unsigned int *hash = new unsigned int[n];
+    sig_I[0] = 0;
+    for (int i=0; i<n; ++i)
+    {
+        ndiag[i] = diag_I[i+1] - diag_I[i];
+        sig_I[i+1] = sig_I[i] + ndiag[i] + offd_I[i+1] - offd_I[i];
+    }
+    int *sig_J = new int[sig_I[n]];
+    for (int i=0; i<n; ++i)
+    {
+        int *row = sig_J + sig_I[i];
+        std::copy(diag_J + diag_I[i], diag_J + diag_I[i+1], row);
+        std::sort(row, row + ndiag[i]);
+        std::copy(offd_J + offd_I[i], offd_J + offd_I[i+1], row + ndiag[i]);
+        std::sort(row + ndiag[i], sig_J + sig_I[i+1]);
+
+        // FNV-1a over the set; the diag/offd split goes in via ndiag
+        unsigned int h = 2166136261u ^ (unsigned int)ndiag[i];
+        for (int j=sig_I[i]; j<sig_I[i+1]; ++j)
+            h = (h ^ (unsigned int)sig_J[j]) * 16777619u;
+        hash[i] = h;
+    }
+
+    int *order = new int[n];
+    for (int i=0; i<n; ++i)
+        order[i] = i;
+    AESetLess less(sig_I, sig_J, ndiag, hash);
+    std::sort(order, order + n, less);
+
+    // leader[i] is the smallest dof with the same set as dof i
+    int *leader = new int[n];
+    for (int p=0; p<n; ++p)
+    {
+        if (p > 0 && 0 == less.Compare(order[p-1], order[p]))
+            leader[order[p]] = leader[order[p-1]];
+        else
+            leader[order[p]] = order[p];
+    }
+
+    int num_groups = 0;
+    for (int i=0; i<n; ++i)
+    {
+        if (leader[i] == i)
+            group[i] = num_groups++;
+        else
+        {
+            SA_ASSERT(leader[i] < i);
+            group[i] = group[leader[i]];
+        }
+    }
+
+    delete [] leader;
+    delete [] order;
+    delete [] sig_J;
+    delete [] hash;
+    delete [] ndiag;
+    delete [] sig_I;
+    return num_groups;
+}
+
 /**
    Inspired by serial SAAMGE ATB 1 April 2015
    but now heavily modified to work in parallel
@@ -511,101 +638,42 @@ int agg_construct_mises_local(agg_partitioning_relations_t& agg_part_rels,
     int * Dof_to_gAE_offd_I = hypre_CSRMatrixI(offd);
     int * Dof_to_gAE_offd_J = hypre_CSRMatrixJ(offd);
 
-    // count and distributed should be Arrays?
-    int * count = new int[num_local_ldofs];
-    int * distributed = new int[num_local_ldofs];
-    agg_part_rels.mises = new int[num_local_ldofs];
-
-    memset(count, 0, sizeof(int) * num_local_ldofs);
-    memset(distributed, 0, sizeof(int) * num_local_ldofs);
-
-    HypreParVector ones(*Dof_to_gAE);
-    ones = 1.0;
-    HypreParVector rowsum_vector(*Dof_to_gAE, 1);
-    Dof_to_gAE->Mult(ones, rowsum_vector);
-
-    int * rowsums = new int[num_local_ldofs];
-    for (int i=0; i<num_local_ldofs; ++i)
-        rowsums[i] = floor(rowsum_vector(i) + 0.5);
+    // Two dofs go in the same MIS iff they belong to the same set of global
+    // AEs (the entries of Dof_to_gAE are all 1, see BuildGlobalDofToAE), so
+    // the dofs are grouped by sorting them by that set. The MISes are
+    // numbered by their smallest dof, as the old dof-by-dof scan did.
+    int * mis_of_dof = agg_part_rels.mises = new int[num_local_ldofs];
+    int num_total_rows = agg_group_dofs_by_AE_set(
+        num_local_ldofs, Dof_to_gAE_diag_I, Dof_to_gAE_diag_J,
+        Dof_to_gAE_offd_I, Dof_to_gAE_offd_J, mis_of_dof);
 
     // only use sec here to determine ownership of dofs
     SharedEntityCommunication<DenseMatrix> * sec; // maybe non-pointer is safer and better
     sec = new SharedEntityCommunication<DenseMatrix>(PROC_COMM, *agg_part_rels.Dof_TrueDof);
 
-    std::vector<Array<int>* > rows;
-    std::vector<bool> row_is_true;
-    int num_total_rows = 0;
-    Array<int> mis_master_a;
-
-    // loop over shared local ldofs
-    for (int i=0; i<num_local_ldofs; ++i)
+    std::vector<Array<int>* > rows(num_total_rows);
+    std::vector<bool> row_is_true(num_total_rows, true);
+    Array<int> mis_master_a(num_total_rows);
+    for (int i=0; i<num_total_rows; ++i)
     {
-        // distributed is only set if we did distribution on this processor
-        if (distributed[i]) 
-            continue;
-
-        // reset count; this may be necessary if we continue at (a), but not sure it is necessary
-        memset(count, 0, sizeof(int) * num_local_ldofs);
-        // loop over global AE that contain local Dof i on this processor
-        for (int j=Dof_to_gAE_diag_I[i]; j<Dof_to_gAE_diag_I[i+1]; ++j)
-        {
-            // loop over all ldofs (could look at Transpose to try to only get ones belonging to AE)
-            for (int k=0; k<num_local_ldofs; ++k)
-            {
-                // count every AE that dof i and dof k share
-                for (int kj=Dof_to_gAE_diag_I[k]; kj<Dof_to_gAE_diag_I[k+1]; ++kj)
-                    if (Dof_to_gAE_diag_J[kj] == Dof_to_gAE_diag_J[j]) 
-                        count[k]++;
-            }
-        }
-        // loop over AE that contain local Dof i on other processors
-        for (int j=Dof_to_gAE_offd_I[i]; j<Dof_to_gAE_offd_I[i+1]; ++j)
-        {
-            // loop over all ldofs (here we have no choice, transpose not accessible)
-            for (int k=0; k<num_local_ldofs; ++k)
-            {
-                // count every AE that dof i and dof k share
-                for (int kj=Dof_to_gAE_offd_I[k]; kj<Dof_to_gAE_offd_I[k+1]; ++kj)
-                    if (Dof_to_gAE_offd_J[kj] == Dof_to_gAE_offd_J[j]) 
-                        count[k]++;
-            }
-        }
-
-        Array<int>* newrow = new Array<int>;
-        bool false_mis = false;
-        for (int k=0; k<num_local_ldofs; ++k)
-        {
-            // all dof k that belong in the same MIS, go in the same MIS
-            if ((count[k] == rowsums[k]) && (count[k] == rowsums[i]))
-            {
-                // check which processors share this MIS, and particularly if 
-                // the owner should be a different processor
-                int master_proc = sec->Owner(k);
-                if (newrow->Size() == 0)
-                    mis_master_a.Append(master_proc);
-                else if (master_proc < mis_master_a.Last())
-                {
-                    mis_master_a.Last() = master_proc;
-                }
-                if (master_proc < PROC_RANK)
-                {
-                    false_mis = true;
-                }
-                newrow->Append(k);
-            }
-        }
-        for (int k=0; k<newrow->Size(); ++k)
-        {
-            distributed[newrow->GetData()[k]] = true;
-            agg_part_rels.mises[newrow->GetData()[k]] = rows.size();
-        }
-        SortByTrueDof(*newrow, *agg_part_rels.Dof_TrueDof);
-
-        num_total_rows++;
-        rows.push_back(newrow);
-        row_is_true.push_back(!false_mis);
+        rows[i] = new Array<int>;
+        mis_master_a[i] = PROC_NUM;
+    }
+    for (int k=0; k<num_local_ldofs; ++k)
+    {
+        // check which processors share this MIS, and particularly if
+        // the owner should be a different processor
+        const int mis = mis_of_dof[k];
+        const int master_proc = sec->Owner(k);
+        if (master_proc < mis_master_a[mis])
+            mis_master_a[mis] = master_proc;
+        if (master_proc < PROC_RANK)
+            row_is_true[mis] = false;
+        rows[mis]->Append(k);
     }
     delete sec;
+    for (int i=0; i<num_total_rows; ++i)
+        SortByTrueDof(*rows[i], *agg_part_rels.Dof_TrueDof);
 
     SA_ASSERT(num_total_rows >= 0 && ((unsigned int) num_total_rows == rows.size()));
     int num_true_rows = 0;
@@ -642,9 +710,6 @@ int agg_construct_mises_local(agg_partitioning_relations_t& agg_part_rels,
     for (int i=0; i<mis_master_a.Size(); ++i)
        agg_part_rels.mis_master[i] = mis_master_a[i];
 
-    delete[] count;
-    delete[] distributed;
-    delete[] rowsums;
     for (int i=0; i<num_total_rows; ++i)
        delete rows[i];
 
@@ -833,6 +898,7 @@ void agg_produce_mises(HypreParMatrix& Aglobal,
                        const agg_dof_status_t *bdr_dofs,
                        bool do_aggregates)
 {
+    SA_PROF_SCOPE("MIS");
     SA_ASSERT(agg_part_rels.AE_to_dof);
     SA_ASSERT(agg_part_rels.dof_to_AE);
 
@@ -847,6 +913,7 @@ void agg_produce_mises(HypreParMatrix& Aglobal,
         *(agg_part_rels.dof_to_AE), 
         agg_part_rels.mises, agg_part_rels.mises_size,
         bdr_dofs, do_aggregates);
+    prof_count("owned MISes", agg_part_rels.num_owned_mises);
 
     SA_RPRINTF_L(0, 5, "Total number of MISes = %d\n",
                  agg_part_rels.mis_truemis->GetGlobalNumRows());
@@ -1085,6 +1152,209 @@ SparseMatrix *agg_build_AE_stiffm(
     return AE_stiffm;
 }
 
+SparseMatrix *agg_build_AE_stiffm_from_arena(
+    int part, const agg_partitioning_relations_t& agg_part_rels,
+    const double *arena, const int *arena_offsets, const int *elem_AE_dofs,
+    bool symmetrize)
+{
+    SA_ASSERT(arena && arena_offsets && elem_AE_dofs);
+    const int * const AEelems = agg_part_rels.AE_to_elem->GetRow(part);
+    const int num_AEelems = agg_part_rels.AE_to_elem->RowSize(part);
+    const int num_AEdofs = agg_part_rels.AE_to_dof->RowSize(part);
+    const int * const elem_I = agg_part_rels.elem_to_dof->GetI();
+    int *touch_I = new int[num_AEdofs+1];
+    int *pos = new int[num_AEdofs];
+    int num_touch = 0, bound = 0;
+
+    SA_ASSERT(num_AEelems > 0);
+
+    // Sort the (element, element row) pairs of the AE by the local DoF they
+    // refer to, so that the AE matrix can be built row by row.
+    std::memset(touch_I, 0, sizeof(*touch_I)*(num_AEdofs+1));
+    for (int e=0; e < num_AEelems; ++e)
+    {
+        const int elem = AEelems[e];
+        SA_ASSERT(agg_part_rels.partitioning[elem] == part);
+        const int n = elem_I[elem+1] - elem_I[elem];
+        for (int k=0; k < n; ++k)
+        {
+            SA_ASSERT(0 <= elem_AE_dofs[elem_I[elem] + k] &&
+                      elem_AE_dofs[elem_I[elem] + k] < num_AEdofs);
+            ++touch_I[elem_AE_dofs[elem_I[elem] + k] + 1];
+        }
+        num_touch += n;
+        bound += n*n;
+    }
+    for (int r=0; r < num_AEdofs; ++r)
+    {
+        touch_I[r+1] += touch_I[r];
+        pos[r] = touch_I[r];
+    }
+    int *touch_elem = new int[num_touch];
+    int *touch_k = new int[num_touch];
+    for (int e=0; e < num_AEelems; ++e)
+    {
+        const int elem = AEelems[e];
+        const int n = elem_I[elem+1] - elem_I[elem];
+        for (int k=0; k < n; ++k)
+        {
+            const int r = elem_AE_dofs[elem_I[elem] + k];
+            touch_elem[pos[r]] = elem;
+            touch_k[pos[r]] = k;
+            ++pos[r];
+        }
+    }
+
+    // Accumulate the rows. pos[c] is the position of column c in the CSR
+    // arrays and belongs to the current row iff pos[c] >= I[r].
+    int *I = new int[num_AEdofs+1];
+    int *J = new int[bound];
+    double *data = new double[bound];
+    int nnz = 0;
+    for (int r=0; r < num_AEdofs; ++r)
+        pos[r] = -1;
+    for (int r=0; r < num_AEdofs; ++r)
+    {
+        I[r] = nnz;
+        for (int t=touch_I[r]; t < touch_I[r+1]; ++t)
+        {
+            const int elem = touch_elem[t];
+            const int k = touch_k[t];
+            const int n = elem_I[elem+1] - elem_I[elem];
+            const int * const map = elem_AE_dofs + elem_I[elem];
+            const double * const elmat = arena + arena_offsets[elem];
+            for (int j=0; j < n; ++j)
+            {
+                const int c = map[j];
+                // Element matrices are stored column-major.
+                const double el = (symmetrize && c < r) ? elmat[j + n*k] :
+                                                          elmat[k + n*j];
+                if (0. == el)
+                    continue;
+                if (pos[c] < I[r])
+                {
+                    pos[c] = nnz;
+                    J[nnz] = c;
+                    data[nnz] = 0.;
+                    ++nnz;
+                }
+                data[pos[c]] += el;
+            }
+        }
+    }
+    I[num_AEdofs] = nnz;
+
+    delete [] touch_k;
+    delete [] touch_elem;
+    delete [] pos;
+    delete [] touch_I;
+
+    int *Jfit = new int[nnz];
+    double *datafit = new double[nnz];
+    std::memcpy(Jfit, J, sizeof(*J)*nnz);
+    std::memcpy(datafit, data, sizeof(*data)*nnz);
+    delete [] data;
+    delete [] J;
+
+    return new SparseMatrix(I, Jfit, datafit, num_AEdofs, num_AEdofs);
+}
+
+SparseMatrix *agg_build_AE_stiffm_with_global_from_arena(
+    const SparseMatrix& A, int part,
+    const agg_partitioning_relations_t& agg_part_rels,
+    const double *arena, const int *arena_offsets, const int *elem_AE_dofs,
+    int *glob_to_AE, bool bdr_cond_imposed, bool assemble_ess_diag)
+{
+    const int * const row = agg_part_rels.AE_to_dof->GetRow(part);
+    const int rs = agg_part_rels.AE_to_dof->RowSize(part);
+    const int * const AI = A.GetI();
+    const int * const AJ = A.GetJ();
+    const double * const Adata = A.GetData();
+
+    SA_ASSERT(agg_part_rels.agg_flags);
+    SA_ASSERT(glob_to_AE);
+
+    // The values between AEs come from the element matrices. Using the
+    // upper triangle for both halves mirrors agg_build_AE_stiffm_with_global.
+    SparseMatrix *elem_sum =
+        agg_build_AE_stiffm_from_arena(part, agg_part_rels, arena,
+                                       arena_offsets, elem_AE_dofs, true);
+    const int * const EI = elem_sum->GetI();
+    const int * const EJ = elem_sum->GetJ();
+    const double * const Edata = elem_sum->GetData();
+
+    int bound = 0;
+    for (int i=0; i < rs; ++i)
+    {
+        SA_ASSERT(0 <= row[i] && row[i] < agg_part_rels.ND);
+        SA_ASSERT(glob_to_AE[row[i]] < 0);
+        glob_to_AE[row[i]] = i;
+        bound += AI[row[i]+1] - AI[row[i]];
+    }
+
+    double *elem_row = new double[rs];
+    int *I = new int[rs+1];
+    int *J = new int[bound];
+    double *data = new double[bound];
+    int nnz = 0;
+    std::memset(elem_row, 0, sizeof(*elem_row)*rs);
+    for (int i=0; i < rs; ++i)
+    {
+        const int glob_dof = row[i];
+        I[i] = nnz;
+        for (int j=EI[i]; j < EI[i+1]; ++j)
+            elem_row[EJ[j]] = Edata[j];
+        for (int j=AI[glob_dof]; j < AI[glob_dof+1]; ++j)
+        {
+            const int glob_neigh = AJ[j];
+            SA_ASSERT(0 <= glob_neigh && glob_neigh < agg_part_rels.ND);
+            const int local_neigh = glob_to_AE[glob_neigh];
+            if (local_neigh < 0)
+                continue;
+            SA_ASSERT(local_neigh ==
+                      agg_map_id_glob_to_AE(glob_neigh, part, agg_part_rels));
+
+            double value;
+            if (SA_IS_SET_A_FLAG(agg_part_rels.agg_flags[glob_dof], AGG_BETWEEN_AES_FLAG) &&
+                SA_IS_SET_A_FLAG(agg_part_rels.agg_flags[glob_neigh], AGG_BETWEEN_AES_FLAG) &&
+
+                !(bdr_cond_imposed &&
+                  (SA_IS_SET_A_FLAG(agg_part_rels.agg_flags[glob_dof],
+                                    AGG_ON_ESS_DOMAIN_BORDER_FLAG) ||
+                   SA_IS_SET_A_FLAG(agg_part_rels.agg_flags[glob_neigh],
+                                    AGG_ON_ESS_DOMAIN_BORDER_FLAG)) &&
+                  !(assemble_ess_diag && glob_neigh == glob_dof))
+                )
+                value = elem_row[local_neigh];
+            else
+                value = Adata[j];
+            if (0. != value)
+            {
+                J[nnz] = local_neigh;
+                data[nnz] = value;
+                ++nnz;
+            }
+        }
+        for (int j=EI[i]; j < EI[i+1]; ++j)
+            elem_row[EJ[j]] = 0.;
+    }
+    I[rs] = nnz;
+
+    for (int i=0; i < rs; ++i)
+        glob_to_AE[row[i]] = -1;
+    delete [] elem_row;
+    delete elem_sum;
+
+    int *Jfit = new int[nnz];
+    double *datafit = new double[nnz];
+    std::memcpy(Jfit, J, sizeof(*J)*nnz);
+    std::memcpy(datafit, data, sizeof(*data)*nnz);
+    delete [] data;
+    delete [] J;
+
+    return new SparseMatrix(I, Jfit, datafit, rs, rs);
+}
+
 
 /**
   agglomerate restrict to aggregate (not confusing at all)
@@ -1255,6 +1525,7 @@ agg_create_partitioning_fine_isolate(
     HypreParMatrix *dof_truedof,
     const Array<int>& isolated_cells)
 {
+    SA_PROF_SCOPE("partitioning");
     agg_partitioning_relations_t *agg_part_rels =
         new agg_partitioning_relations_t;
     memset(agg_part_rels, 0, sizeof(*agg_part_rels));
@@ -1319,6 +1590,7 @@ agg_create_partitioning_fine(
     int *partitioning, const agg_dof_status_t *bdr_dofs, int *nparts,
     HypreParMatrix *dof_truedof, bool do_aggregates, bool testmesh)
 {
+    SA_PROF_SCOPE("partitioning");
     agg_partitioning_relations_t *agg_part_rels =
         new agg_partitioning_relations_t;
     memset(agg_part_rels, 0, sizeof(*agg_part_rels));
@@ -1601,6 +1873,21 @@ void agg_create_rels_except_elem_coarse(
 #endif
 }
 
+void agg_broadcast_mis_tent_interps(
+    const agg_partitioning_relations_t &agg_part_rels_fine,
+    int * mis_numcoarsedof, DenseMatrix ** mis_tent_interps)
+{
+    SharedEntityCommunication<DenseMatrix> sec(PROC_COMM,
+                                               *agg_part_rels_fine.mis_truemis);
+    sec.Broadcast(mis_tent_interps);
+
+    for (int mis=0; mis < agg_part_rels_fine.num_mises; ++mis)
+    {
+        if (agg_part_rels_fine.mis_master[mis] != PROC_RANK)
+            mis_numcoarsedof[mis] = mis_tent_interps[mis]->Width();
+    }
+}
+
 /**
    This routine separated from contrib_mises ATB 30 April 2015
 
@@ -1743,6 +2030,7 @@ agg_create_partitioning_coarse(
     int *nparts,
     bool do_aggregates)
 {
+    SA_PROF_SCOPE("partitioning");
     SA_ASSERT(interp);
     SA_ASSERT(&agg_part_rels_fine);
     agg_partitioning_relations_t *agg_part_rels =
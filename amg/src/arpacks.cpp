@@ -223,7 +223,8 @@ int arpacks_calc_portion_eigens_sparse_diag(const SparseMatrix& Ain,
                                             const SparseMatrix& Bin,
                                             int num_evects, bool lower/*=true*/,
                                             int max_iters/*=0*/, int ncv/*=0*/,
-                                            int tol/*=0.*/)
+                                            int tol/*=0.*/,
+                                            double *resid/*=NULL*/)
 {
     SA_ASSERT(num_evects > 0);
     SA_ASSERT(num_evects <= Ain.Size());
@@ -232,7 +233,7 @@ int arpacks_calc_portion_eigens_sparse_diag(const SparseMatrix& Ain,
     ARSymGenEig<double, arpacks_diag_rhs, arpacks_diag_rhs>
         eigprob(Ain.Size(), num_evects, &matrices, &arpacks_diag_rhs::MultOP,
                 &matrices, &arpacks_diag_rhs::MultB, (lower?"SM":"LM"), ncv,
-                tol, max_iters);
+                tol, max_iters, resid);
     evects.SetSize(Ain.Size(), num_evects);
     evals.SetSize(num_evects);
     double *evects_data = evects.Data();
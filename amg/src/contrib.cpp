@@ -32,9 +32,15 @@
 #include "common.hpp"
 #include "contrib.hpp"
 #include <mfem.hpp>
+#include <vector>
+#include <algorithm>
 #include "aggregates.hpp"
 #include "xpacks.hpp"
 #include "mbox.hpp"
+#include "prof.hpp"
+#if SAAMGE_USE_OPENMP
+#include <omp.h>
+#endif
 
 namespace saamge
 {
@@ -489,7 +495,7 @@ void ContribTent::contrib_ones(const agg_partitioning_relations_t& agg_part_rels
     delete [] row_sizes;
 }
 
-DenseMatrix ** ContribTent::CommunicateEigenvectors(
+void ContribTent::SendEigenvectors(
     const agg_partitioning_relations_t& agg_part_rels,
     DenseMatrix * const *cut_evects_arr,
     SharedEntityCommunication<DenseMatrix>& sec)
@@ -545,140 +551,221 @@ DenseMatrix ** ContribTent::CommunicateEigenvectors(
         sec.ReduceSend(mis,send_mat);
     }
     delete [] restricted_evects_array;
+}
+
+DenseMatrix ** ContribTent::CommunicateEigenvectors(
+    const agg_partitioning_relations_t& agg_part_rels,
+    DenseMatrix * const *cut_evects_arr,
+    SharedEntityCommunication<DenseMatrix>& sec)
+{
+    SendEigenvectors(agg_part_rels, cut_evects_arr, sec);
     return sec.Collect();
 }
 
-void ContribTent::SVDInsert(const agg_partitioning_relations_t& agg_part_rels,
-                            DenseMatrix ** received_mats, int * row_sizes,
-                            bool scaling_P)
+void ContribTent::InitMISTentInterps(
+    const agg_partitioning_relations_t& agg_part_rels)
 {
     int num_mises = agg_part_rels.num_mises;
-    DenseMatrix lsvects;
     // TODO: can we make mis_tent_interps a pointer to array of DenseMatrix, not DenseMatrix* ?
     // maybe use a std::vector of mfem::Array or something?
     mis_tent_interps = new DenseMatrix*[num_mises]; 
-    std::memset(mis_tent_interps,0,sizeof(DenseMatrix*) * num_mises);
-    Vector svals;
-    int num_coarse_dofs = 0;
     mis_numcoarsedof = new int[num_mises];
     for (int mis=0; mis<num_mises; ++mis)
     {
-        int owner = agg_part_rels.mis_master[mis];
-        if (owner == PROC_RANK)
-        {
-            // int row_size = sec.NumNeighbors(mis);
-            int row_size = row_sizes[mis];
-            mis_tent_interps[mis] = new DenseMatrix;
-
-            // check to see if all of this MISes DOFs are on essential boundary - copied from contrib_big_aggs()
-            // this only checks the dofs for one AE, but that should be sufficient
-            const int mis_size = agg_part_rels.mises_size[mis];
-            const int dim = received_mats[mis][0].Height();
-            SA_ASSERT(mis_size == dim);
-            if (avoid_ess_bdr_dofs)
-            {
-                bool interior_dofs = false;
-                for (int j=0; j < dim; ++j)
-                {
-                    const int row = agg_part_rels.mis_to_dof->GetRow(mis)[j];
-                    SA_ASSERT(rows > row);
-                    if (!agg_is_dof_on_essential_border(agg_part_rels, row))
-                    {
-                        interior_dofs = true;
-                        break;
-                    }
-                }
-                if (!interior_dofs)
-                {
-                    if (SA_IS_OUTPUT_LEVEL(6))
-                        SA_ALERT_PRINTF("All DoFs are on essential boundary."
-                                        " Ignoring the entire contribution"
-                                        " introducing not more than %d vector(s)"
-                                        " on an aggregate of size %d!",
-                                        received_mats[mis][0].Width(), dim);
-                    mis_numcoarsedof[mis] = 0;
-                    // next line makes future assertions and communications cleaner, but is mostly unnecessary
-                    mis_tent_interps[mis]->SetSize(dim, 0); 
-                    delete [] received_mats[mis];
-                    continue; // TODO: remove this, refactor
-                }
-            }
+        // also for the MISes owned elsewhere, so deletion is cleaner at
+        // the end, could avoid it at the cost of more ifs
+        mis_tent_interps[mis] = new DenseMatrix;
+        mis_numcoarsedof[mis] = 0;
+    }
+}
 
-            if (dim == 1) // could think about a kind of identity matrix whenever dim < total width, but I think SVD will take care of this
-            {
-                // see assertion in contrib_tent_insert_from_local: SA_ASSERT(dim > 1 || 1. == a);
-                mis_tent_interps[mis]->SetSize(1,1);
-                mis_tent_interps[mis]->Elem(0,0) = 1.0;
-            }
-            else
-            {
-                int total_num_columns = 0;
-                for (int q=0; q<row_size; ++q)
-                {
-                    contrib_filter_boundary(agg_part_rels,
-                                            received_mats[mis][q],
-                                            agg_part_rels.mis_to_dof->GetRow(mis));
-                    total_num_columns += received_mats[mis][q].Width();
-                }
+void ContribTent::MISTentInterp(
+    const agg_partitioning_relations_t& agg_part_rels, int mis,
+    DenseMatrix * mats, int row_size, XpacksSVDWorkspace& ws)
+{
+    SA_ASSERT(agg_part_rels.mis_master[mis] == PROC_RANK);
+    DenseMatrix& mis_tent_interp = *mis_tent_interps[mis];
+    DenseMatrix lsvects;
+    Vector svals;
 
-                if (total_num_columns == 0)
-                    svals.SetSize(0);
-                else
-                    xpack_svd_dense_arr(received_mats[mis], row_size, lsvects, svals);
-                if (svals.Size() == 0) // we trim (near) zeros out of svals, this means all svals == 0
-                {
-                    SA_PRINTF("WARNING: completely zero contribution on mis %d!\n", mis);
-                    SA_PRINTF("WARNING: dim = %d, row_size = %d\n", dim, row_size);
-                    mis_numcoarsedof[mis] = 0;
-                    mis_tent_interps[mis]->SetSize(dim, 0); // this makes future assertions and communications cleaner, but is mostly unnecessary
-                    delete [] received_mats[mis];
-                    continue; // TODO: remove this, refactor 
-                }
-                xpack_orth_set(lsvects, svals, *mis_tent_interps[mis], svd_eps);
-            }
-            if (agg_part_rels.testmesh)
+    // check to see if all of this MISes DOFs are on essential boundary - copied from contrib_big_aggs()
+    // this only checks the dofs for one AE, but that should be sufficient
+    const int mis_size = agg_part_rels.mises_size[mis];
+    const int dim = mats[0].Height();
+    SA_ASSERT(mis_size == dim);
+    if (avoid_ess_bdr_dofs)
+    {
+        bool interior_dofs = false;
+        for (int j=0; j < dim; ++j)
+        {
+            const int row = agg_part_rels.mis_to_dof->GetRow(mis)[j];
+            SA_ASSERT(rows > row);
+            if (!agg_is_dof_on_essential_border(agg_part_rels, row))
             {
-                std::stringstream filename;
-                filename << "mis_tent_interp_" << mis << "." << PROC_RANK << ".densemat";
-                std::ofstream out(filename.str().c_str());
-                mis_tent_interps[mis]->Print(out);
+                interior_dofs = true;
+                break;
             }
-            int filled_cols_l = filled_cols;
+        }
+        if (!interior_dofs)
+        {
+            if (SA_IS_OUTPUT_LEVEL(6))
+                SA_ALERT_PRINTF("All DoFs are on essential boundary."
+                                " Ignoring the entire contribution"
+                                " introducing not more than %d vector(s)"
+                                " on an aggregate of size %d!",
+                                mats[0].Width(), dim);
+            // next line makes future assertions and communications cleaner, but is mostly unnecessary
+            mis_tent_interp.SetSize(dim, 0); 
+            delete [] mats;
+            return;
+        }
+    }
 
-            contrib_tent_insert_simple(agg_part_rels,
-                                       *mis_tent_interps[mis], 
-                                       agg_part_rels.mis_to_dof->GetRow(mis));
+    if (dim == 1) // could think about a kind of identity matrix whenever dim < total width, but I think SVD will take care of this
+    {
+        // see assertion in contrib_tent_insert_from_local: SA_ASSERT(dim > 1 || 1. == a);
+        mis_tent_interp.SetSize(1,1);
+        mis_tent_interp.Elem(0,0) = 1.0;
+    }
+    else
+    {
+        int total_num_columns = 0;
+        for (int q=0; q<row_size; ++q)
+        {
+            contrib_filter_boundary(agg_part_rels, mats[q],
+                                    agg_part_rels.mis_to_dof->GetRow(mis));
+            total_num_columns += mats[q].Width();
+        }
 
-            filled_cols_l = filled_cols - filled_cols_l;
+        if (total_num_columns == 0)
+            svals.SetSize(0);
+        else
+            xpack_svd_dense_arr(mats, row_size, lsvects, svals, ws);
+        if (svals.Size() == 0) // we trim (near) zeros out of svals, this means all svals == 0
+        {
+            SA_PRINTF("WARNING: completely zero contribution on mis %d!\n", mis);
+            SA_PRINTF("WARNING: dim = %d, row_size = %d\n", dim, row_size);
+            mis_tent_interp.SetSize(dim, 0); // this makes future assertions and communications cleaner, but is mostly unnecessary
+            delete [] mats;
+            return;
+        }
+        xpack_orth_set(lsvects, svals, mis_tent_interp, svd_eps);
+    }
+    if (agg_part_rels.testmesh)
+    {
+        std::stringstream filename;
+        filename << "mis_tent_interp_" << mis << "." << PROC_RANK << ".densemat";
+        std::ofstream out(filename.str().c_str());
+        mis_tent_interp.Print(out);
+    }
+    delete [] mats;
+}
 
-            SA_ASSERT(filled_cols_l == mis_tent_interps[mis]->Width());
-            if (scaling_P && filled_cols_l > 0) 
+void ContribTent::MISTentInterps(
+    const agg_partitioning_relations_t& agg_part_rels,
+    const std::vector<int>& mises, DenseMatrix ** received_mats,
+    const int * row_sizes)
+{
+    const int n = (int)mises.size();
+    if (n == 0)
+        return;
+
+    // Sort by shape, largest first, so that the workspace queries are done
+    // once per shape and the largest SVDs do not end up at the tail of the
+    // loop.
+    std::vector<std::pair<std::pair<int, int>, int> > order(n);
+    for (int k=0; k<n; ++k)
+    {
+        const int mis = mises[k];
+        int cols = 0;
+        for (int q=0; q<row_sizes[mis]; ++q)
+            cols += received_mats[mis][q].Width();
+        order[k] = std::make_pair(
+            std::make_pair(-agg_part_rels.mises_size[mis], -cols), mis);
+    }
+    std::sort(order.begin(), order.end());
+
+    int count_gram = 0;
+    int count_full = 0;
+    // The detailed xpacks output goes through PROC_STR_STREAM, which is
+    // only supported by the sequential loop.
+    bool threaded = false;
+#if SAAMGE_USE_OPENMP
+    threaded = !SA_IS_OUTPUT_LEVEL(9) && omp_get_max_threads() > 1;
+    if (threaded)
+    {
+#pragma omp parallel reduction(+:count_gram,count_full)
+        {
+            XpacksSVDWorkspace ws;
+#pragma omp for schedule(dynamic)
+            for (int k=0; k<n; ++k)
             {
-                Vector x(mis_tent_interps[mis]->Width());  // size of coarse dofs for this MIS
-                Vector b(mis_tent_interps[mis]->Height());
-                b = 1.0;
-                xpack_solve_lls(*mis_tent_interps[mis],b,x);
-                double norm = 0.0;
-                for (int k=0; k<x.Size(); ++k)
-                    norm += x(k)*x(k);
-                norm = std::sqrt(norm);
-                // we can append because the coarse DOF are numbered in exactly this order, by MIS
-                for (int k=0; k<x.Size(); ++k)
-                    local_coarse_one_representation->Append(x(k) / norm);
+                const int mis = order[k].second;
+                MISTentInterp(agg_part_rels, mis, received_mats[mis],
+                              row_sizes[mis], ws);
             }
-            mis_numcoarsedof[mis] = filled_cols_l;
-            num_coarse_dofs += filled_cols_l;
-            delete [] received_mats[mis];
+            count_gram += ws.count_gram;
+            count_full += ws.count_full;
         }
-        else
+    }
+#endif
+    if (!threaded)
+    {
+        XpacksSVDWorkspace ws;
+        for (int k=0; k<n; ++k)
         {
-            mis_numcoarsedof[mis] = 0; 
-            // we only do this new so deletion is cleaner at the end, could avoid it at the cost of more ifs
-            mis_tent_interps[mis] = new DenseMatrix;
-            // tent_int_struct->mis_tent_interps[mis]->SetSize(0,0); // ???
+            const int mis = order[k].second;
+            MISTentInterp(agg_part_rels, mis, received_mats[mis],
+                          row_sizes[mis], ws);
         }
+        count_gram = ws.count_gram;
+        count_full = ws.count_full;
+    }
+    SA_PRINTF_L(9, "MIS SVDs: %d by Gram matrix, %d by dgesvd\n", count_gram,
+                count_full);
+}
+
+void ContribTent::InsertMISTentInterps(
+    const agg_partitioning_relations_t& agg_part_rels, bool scaling_P)
+{
+    int num_mises = agg_part_rels.num_mises;
+    int num_coarse_dofs = 0;
+    for (int mis=0; mis<num_mises; ++mis)
+    {
+        // MISes owned elsewhere, or ignored in MISTentInterp()
+        if (agg_part_rels.mis_master[mis] != PROC_RANK ||
+            mis_tent_interps[mis]->Width() == 0)
+        {
+            mis_numcoarsedof[mis] = 0;
+            continue;
+        }
+
+        int filled_cols_l = filled_cols;
+
+        contrib_tent_insert_simple(agg_part_rels,
+                                   *mis_tent_interps[mis], 
+                                   agg_part_rels.mis_to_dof->GetRow(mis));
+
+        filled_cols_l = filled_cols - filled_cols_l;
+
+        SA_ASSERT(filled_cols_l == mis_tent_interps[mis]->Width());
+        if (scaling_P && filled_cols_l > 0) 
+        {
+            Vector x(mis_tent_interps[mis]->Width());  // size of coarse dofs for this MIS
+            Vector b(mis_tent_interps[mis]->Height());
+            b = 1.0;
+            xpack_solve_lls(*mis_tent_interps[mis],b,x);
+            double norm = 0.0;
+            for (int k=0; k<x.Size(); ++k)
+                norm += x(k)*x(k);
+            norm = std::sqrt(norm);
+            // we can append because the coarse DOF are numbered in exactly this order, by MIS
+            for (int k=0; k<x.Size(); ++k)
+                local_coarse_one_representation->Append(x(k) / norm);
+        }
+        mis_numcoarsedof[mis] = filled_cols_l;
+        num_coarse_dofs += filled_cols_l;
     }
-    delete [] received_mats;
 
     coarse_truedof_offset = 0;
     MPI_Scan(&num_coarse_dofs,&coarse_truedof_offset,1,MPI_INT,MPI_SUM,PROC_COMM);
@@ -686,6 +773,23 @@ void ContribTent::SVDInsert(const agg_partitioning_relations_t& agg_part_rels,
     SA_RPRINTF_L(PROC_NUM-1, 8, "coarse_truedof_offset = %d\n",coarse_truedof_offset);
 }
 
+void ContribTent::SVDInsert(const agg_partitioning_relations_t& agg_part_rels,
+                            DenseMatrix ** received_mats, int * row_sizes,
+                            bool scaling_P)
+{
+    SA_PROF_SCOPE("SVDInsert");
+    InitMISTentInterps(agg_part_rels);
+    std::vector<int> owned;
+    for (int mis=0; mis<agg_part_rels.num_mises; ++mis)
+    {
+        if (agg_part_rels.mis_master[mis] == PROC_RANK)
+            owned.push_back(mis);
+    }
+    MISTentInterps(agg_part_rels, owned, received_mats, row_sizes);
+    delete [] received_mats;
+    InsertMISTentInterps(agg_part_rels, scaling_P);
+}
+
 /**
    Takes solutions to spectral problems on AEs, restricts to MISes, does
    appropriate communication and SVD, and constructs tentative prolongator
@@ -702,15 +806,36 @@ void ContribTent::contrib_mises(
 {
     SharedEntityCommunication<DenseMatrix> sec(PROC_COMM,
                                                *agg_part_rels.mis_truemis);
-    DenseMatrix ** received_mats = CommunicateEigenvectors(agg_part_rels, cut_evects_arr, sec);
-
-    // do SVDs on owned MISes, build tentative interpolator
+    SendEigenvectors(agg_part_rels, cut_evects_arr, sec);
+    DenseMatrix ** received_mats = sec.CollectBegin();
+
+    // do SVDs on owned MISes as their eigenvectors arrive, starting with
+    // those that need nothing from other processes, so the SVDs hide the
+    // latency of the exchange
+    SA_PROF_SCOPE("SVDInsert");
+    InitMISTentInterps(agg_part_rels);
     int num_mises = agg_part_rels.num_mises;
-    int * row_sizes = new int[num_mises];
+    std::vector<int> row_sizes(num_mises);
+    std::vector<int> completed;
     for (int mis=0; mis<num_mises; ++mis)
+    {
         row_sizes[mis] = sec.NumNeighbors(mis);
-    SVDInsert(agg_part_rels, received_mats, row_sizes, scaling_P);
-    delete [] row_sizes;
+        if (sec.Completed(mis))
+            completed.push_back(mis);
+    }
+    MISTentInterps(agg_part_rels, completed, received_mats, &row_sizes[0]);
+    completed.clear();
+    while (sec.CollectSome(completed))
+    {
+        MISTentInterps(agg_part_rels, completed, received_mats,
+                       &row_sizes[0]);
+        completed.clear();
+    }
+    sec.CollectEnd();
+    delete [] received_mats;
+
+    // build tentative interpolator in MIS order
+    InsertMISTentInterps(agg_part_rels, scaling_P);
 }
 
 void ContribTent::contrib_composite(
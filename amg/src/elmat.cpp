@@ -35,6 +35,7 @@
 #include "aggregates.hpp"
 #include "levels.hpp"
 #include "mbox.hpp"
+#include <algorithm>
 
 namespace saamge
 {
@@ -87,6 +88,85 @@ Matrix * ElementMatrixStandardGeometric::GetMatrix(
     return elmat;
 }
 
+ElementMatrixCachedGeometric::ElementMatrixCachedGeometric(
+    const agg_partitioning_relations_t& agg_part_rels,
+    SparseMatrix & assembled_processor_matrix,
+    ParBilinearForm * form)
+    :
+    ElementMatrixStandardGeometric(agg_part_rels, assembled_processor_matrix,
+                                   form)
+{
+    SA_ASSERT(agg_part_rels.elem_to_dof);
+    SA_ASSERT(agg_part_rels.partitioning);
+    const Table& elem_to_dof = *agg_part_rels.elem_to_dof;
+    const int NE = elem_to_dof.Size();
+
+    arena_offsets = new int[NE+1];
+    arena_offsets[0] = 0;
+    for (int elno=0; elno < NE; ++elno)
+    {
+        const int n = elem_to_dof.RowSize(elno);
+        arena_offsets[elno+1] = arena_offsets[elno] + n*n;
+    }
+    arena = new double[arena_offsets[NE]];
+    elem_AE_dofs = new int[elem_to_dof.Size_of_connections()];
+    glob_to_AE = new int[agg_part_rels.ND];
+    for (int i=0; i < agg_part_rels.ND; ++i)
+        glob_to_AE[i] = -1;
+
+    elem_views.SetSize(NE);
+    for (int elno=0; elno < NE; ++elno)
+    {
+        bool free_matr;
+        const int n = elem_to_dof.RowSize(elno);
+        const int * const dofs = elem_to_dof.GetRow(elno);
+        Matrix *matr = ElementMatrixStandardGeometric::GetMatrix(elno,
+                                                                 free_matr);
+        DenseMatrix *elmat = dynamic_cast<DenseMatrix *>(matr);
+        SA_ASSERT(elmat);
+        SA_ASSERT(elmat->Height() == n && elmat->Width() == n);
+        std::copy(elmat->Data(), elmat->Data() + n*n,
+                  arena + arena_offsets[elno]);
+        if (free_matr)
+            delete elmat;
+        elem_views[elno] = new DenseMatrix(arena + arena_offsets[elno], n, n);
+
+        const int part = agg_part_rels.partitioning[elno];
+        int * const map = elem_AE_dofs + elem_to_dof.GetI()[elno];
+        for (int k=0; k < n; ++k)
+        {
+            map[k] = agg_map_id_glob_to_AE(dofs[k], part, agg_part_rels);
+            SA_ASSERT(map[k] >= 0);
+        }
+    }
+}
+
+ElementMatrixCachedGeometric::~ElementMatrixCachedGeometric()
+{
+    for (int elno=0; elno < elem_views.Size(); ++elno)
+        delete elem_views[elno];
+    delete [] glob_to_AE;
+    delete [] elem_AE_dofs;
+    delete [] arena;
+    delete [] arena_offsets;
+}
+
+SparseMatrix * ElementMatrixCachedGeometric::BuildAEStiff(int elno) const
+{
+    return agg_build_AE_stiffm_with_global_from_arena(
+        assembled_processor_matrix_, elno, agg_part_rels, arena,
+        arena_offsets, elem_AE_dofs, glob_to_AE, bdr_cond_imposed_,
+        assemble_ess_diag_);
+}
+
+Matrix * ElementMatrixCachedGeometric::GetMatrix(
+    int elno, bool& free_matr) const
+{
+    SA_ASSERT(0 <= elno && elno < elem_views.Size());
+    free_matr = false;
+    return elem_views[elno];
+}
+
 ElementMatrixParallelCoarse::ElementMatrixParallelCoarse(
     const agg_partitioning_relations_t& agg_part_rels,
     levels_level_t *level) 
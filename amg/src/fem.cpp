@@ -716,49 +716,80 @@ fem_create_partitioning(HypreParMatrix& A, ParFiniteElementSpace& fes,
     return agg_part_rels;
 }
 
+/*! \brief Partitions the cells of an algebraic problem, which are the local
+           rows of \a A.
+
+    \param A (IN) The parallel matrix.
+    \param graph (IN) The connections among the local rows of \a A that the
+                      partitioning follows.
+*/
+static
 agg_partitioning_relations_t *
-fem_create_partitioning_from_matrix(const SparseMatrix& A, int *nparts,
-                                    HypreParMatrix *dof_truedof,
-                                    Array<int>& isolated_cells)
+fem_create_partitioning_from_graph(HypreParMatrix& A, const SparseMatrix& graph,
+                                   int *nparts, HypreParMatrix *dof_truedof,
+                                   Array<int>& isolated_cells)
 {
     const bool do_aggregates = true;
     int *partitioning = NULL;
+    const int NE = graph.Size();
 
     // elem_to_elem should be just the graph of A
     // elem_to_dof should be an identity matrix
     // (should rename to "cell" or "volume" for clarity)
-    Table *elem_to_elem = TableFromSparseMatrix(A);
-    Table *elem_to_dof = IdentityTable(A.Size());
+    Table *elem_to_elem = TableFromSparseMatrix(graph);
+    Table *elem_to_dof = IdentityTable(NE);
     SA_ASSERT(elem_to_dof);
     SA_ASSERT(elem_to_elem);
 
-    char * bdr_dofs = new char[A.Size()];
-    memset(bdr_dofs, 0, sizeof(char) * A.Size());
+    char * bdr_dofs = new char[NE];
+    memset(bdr_dofs, 0, sizeof(char) * NE);
 
     agg_partitioning_relations_t *agg_part_rels;
 
-    HypreParMatrix * fakeAparallel = FakeParallelMatrix(&A);
-    // fakeAparallel->Print("fakeAparallel.mat");
-
     if (isolated_cells.Size() == 0)
     {
         agg_part_rels = agg_create_partitioning_fine(
-            *fakeAparallel, A.Size(), elem_to_dof, elem_to_elem,
+            A, NE, elem_to_dof, elem_to_elem,
             partitioning, bdr_dofs, nparts, dof_truedof, do_aggregates);
     }
     else
     {
         // do_aggregates is always true for this call
         agg_part_rels = agg_create_partitioning_fine_isolate(
-            *fakeAparallel, A.Size(), elem_to_dof, elem_to_elem, partitioning,
+            A, NE, elem_to_dof, elem_to_elem, partitioning,
             bdr_dofs, nparts, dof_truedof, isolated_cells);
     }
     delete[] bdr_dofs;
 
-    delete fakeAparallel;
-    
     SA_ASSERT(agg_part_rels);
     return agg_part_rels;
 }
 
+agg_partitioning_relations_t *
+fem_create_partitioning_from_matrix(const SparseMatrix& A, int *nparts,
+                                    HypreParMatrix *dof_truedof,
+                                    Array<int>& isolated_cells)
+{
+    HypreParMatrix * fakeAparallel = FakeParallelMatrix(&A);
+    // fakeAparallel->Print("fakeAparallel.mat");
+
+    agg_partitioning_relations_t *agg_part_rels =
+        fem_create_partitioning_from_graph(*fakeAparallel, A, nparts,
+                                           dof_truedof, isolated_cells);
+
+    delete fakeAparallel;
+    return agg_part_rels;
+}
+
+agg_partitioning_relations_t *
+fem_create_partitioning_from_matrix(HypreParMatrix& A, int *nparts,
+                                    HypreParMatrix *dof_truedof,
+                                    Array<int>& isolated_cells)
+{
+    SparseMatrix diag;
+    A.GetDiag(diag);
+    return fem_create_partitioning_from_graph(A, diag, nparts, dof_truedof,
+                                              isolated_cells);
+}
+
 } // namespace saamge
@@ -32,6 +32,8 @@
 #include "common.hpp"
 #include "interp.hpp"
 #include <cfloat>
+#include <algorithm>
+#include <vector>
 #include <mfem.hpp>
 #include "aggregates.hpp"
 #include "elmat.hpp"
@@ -40,6 +42,10 @@
 #include "helpers.hpp"
 #include "mbox.hpp"
 #include "process.hpp"
+#include "prof.hpp"
+#if SAAMGE_USE_OPENMP
+#include <omp.h>
+#endif
 
 namespace saamge
 {
@@ -47,40 +53,381 @@ using namespace mfem;
 
 /* Static Functions */
 
-/*! \brief Generates data used for interpolant smoothing.
+/*! \brief Sparse accumulator for the rows of the smoothed interpolant.
+
+    Has a slot for every local column of the interpolant and for every
+    off-processor column that can appear in a row of the product. It is
+    reused for all rows and all smoothing steps.
+*/
+typedef struct {
+    HYPRE_Int first_col; /*!< The first global column owned locally. */
+    int num_diag_cols; /*!< The number of columns owned locally. */
+    std::vector<HYPRE_Int> offd_cols; /*!< The global off-processor columns
+                                           of the current step, sorted. */
+    std::vector<int> marker; /*!< The position of a slot in \em touched, or
+                                  -1 if it is not in the current row. */
+    std::vector<double> values; /*!< The slot values. */
+    std::vector<int> touched; /*!< The slots in the current row. */
+} interp_smooth_accumulator_t;
+
+/*! \brief The accumulator slot of a global column.
+
+    \param acc (IN) The accumulator.
+    \param col (IN) The global column.
+
+    \returns The slot.
+*/
+static inline
+int interp_smooth_slot(const interp_smooth_accumulator_t& acc, HYPRE_Int col)
+{
+    if (acc.first_col <= col && col < acc.first_col + acc.num_diag_cols)
+        return col - acc.first_col;
+    std::vector<HYPRE_Int>::const_iterator it =
+        std::lower_bound(acc.offd_cols.begin(), acc.offd_cols.end(), col);
+    SA_ASSERT(it != acc.offd_cols.end() && *it == col);
+    return acc.num_diag_cols + (int)(it - acc.offd_cols.begin());
+}
+
+/*! \brief Adds a multiple of a row to the current row in the accumulator.
+
+    \param acc (IN/OUT) The accumulator.
+    \param coef (IN) The multiple.
+    \param begin (IN) The start of the row in \a j and \a data.
+    \param end (IN) The end of the row in \a j and \a data.
+    \param j (IN) The columns of the row, mapped through \a col_map if it is
+                  not NULL, and offset by \a offset otherwise.
+    \param data (IN) The values of the row.
+    \param col_map (IN) See \a j.
+    \param offset (IN) See \a j.
+*/
+static inline
+void interp_smooth_axpy(interp_smooth_accumulator_t& acc, double coef,
+                        HYPRE_Int begin, HYPRE_Int end, const HYPRE_Int *j,
+                        const double *data, const HYPRE_Int *col_map,
+                        HYPRE_Int offset)
+{
+    for (HYPRE_Int k=begin; k < end; ++k)
+    {
+        const HYPRE_Int col = col_map ? col_map[j[k]] : j[k] + offset;
+        const int slot = interp_smooth_slot(acc, col);
+        if (acc.marker[slot] < 0)
+        {
+            acc.marker[slot] = (int)acc.touched.size();
+            acc.touched.push_back(slot);
+            acc.values[slot] = coef * data[k];
+        }
+        else
+            acc.values[slot] += coef * data[k];
+    }
+}
+
+/*! \brief One step of interpolant smoothing.
 
-    Computes \f$ -D^{-1}A \f$, where D is a diagonal s.p.d. matrix s.t.
-    \f$ \| I - D^{-1}A \|_A \leq 1 \f$.
+    Computes \f$ P + c S P \f$ for \f$ S = -D^{-1}A \f$ row by row, without
+    forming S or \f$ I + c S \f$. The off-processor rows of P needed by A are
+    fetched once and each row of the result is gathered in the sparse
+    accumulator \a acc. Entries not larger than \a drop_tol in absolute
+    value are dropped as the rows are written out; for \a drop_tol equal to
+    0 nothing is dropped.
 
     \param A (IN) The global (among all processes) stiffness matrix.
     \param Dinv_neg (IN) A diagonal that is precisely \f$ -D^{-1} \f$.
+    \param c (IN) The scaling of S.
+    \param drop_tol (IN) The drop tolerance.
+    \param P (IN) The interpolant to be smoothed.
+    \param acc (IN/OUT) The reused accumulator.
 
-    \returns The result is \f$ -D^{-1}A \f$ to be used for producing the final
-             (actual) interpolant.
+    \returns The smoothed interpolant.
 
     \warning The returned matrix must be freed by the caller.
-    \warning Usually D is the weighted l1-smoother.
 */
-static inline
-HypreParMatrix *interp_simple_smoother(HypreParMatrix& A,
-                                       HypreParVector& Dinv_neg)
+static
+HypreParMatrix *interp_smooth_step(HypreParMatrix& A, HypreParVector& Dinv_neg,
+                                   double c, double drop_tol,
+                                   HypreParMatrix& P,
+                                   interp_smooth_accumulator_t& acc)
 {
-    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    hypre_ParCSRMatrix *hA = (hypre_ParCSRMatrix *)A;
+    hypre_ParCSRMatrix *hP = (hypre_ParCSRMatrix *)P;
+    hypre_CSRMatrix *A_diag = hypre_ParCSRMatrixDiag(hA);
+    hypre_CSRMatrix *A_offd = hypre_ParCSRMatrixOffd(hA);
+    hypre_CSRMatrix *P_diag = hypre_ParCSRMatrixDiag(hP);
+    hypre_CSRMatrix *P_offd = hypre_ParCSRMatrixOffd(hP);
+    const HYPRE_Int *A_diag_i = hypre_CSRMatrixI(A_diag);
+    const HYPRE_Int *A_diag_j = hypre_CSRMatrixJ(A_diag);
+    const double *A_diag_data = hypre_CSRMatrixData(A_diag);
+    const HYPRE_Int *A_offd_i = hypre_CSRMatrixI(A_offd);
+    const HYPRE_Int *A_offd_j = hypre_CSRMatrixJ(A_offd);
+    const double *A_offd_data = hypre_CSRMatrixData(A_offd);
+    const HYPRE_Int *P_diag_i = hypre_CSRMatrixI(P_diag);
+    const HYPRE_Int *P_diag_j = hypre_CSRMatrixJ(P_diag);
+    const double *P_diag_data = hypre_CSRMatrixData(P_diag);
+    const HYPRE_Int *P_offd_i = hypre_CSRMatrixI(P_offd);
+    const HYPRE_Int *P_offd_j = hypre_CSRMatrixJ(P_offd);
+    const double *P_offd_data = hypre_CSRMatrixData(P_offd);
+    const HYPRE_Int *P_col_map = hypre_ParCSRMatrixColMapOffd(hP);
+    const int rows = hypre_CSRMatrixNumRows(A_diag);
+    const int P_offd_cols = hypre_CSRMatrixNumCols(P_offd);
+    const bool have_A_offd = A_offd_i && hypre_CSRMatrixNumCols(A_offd) > 0;
+    const bool have_P_offd = P_offd_i && P_offd_cols > 0;
+    SA_ASSERT(hypre_CSRMatrixNumRows(P_diag) == rows);
+    SA_ASSERT(Dinv_neg.Size() == rows);
+
+    // the rows of P for the off-processor columns of A, collective like
+    // in hypre_ParMatmul
+    hypre_CSRMatrix *P_ext = NULL;
+    const HYPRE_Int *P_ext_i = NULL;
+    const HYPRE_Int *P_ext_j = NULL;
+    const double *P_ext_data = NULL;
+    int num_procs;
+    MPI_Comm_size(hypre_ParCSRMatrixComm(hA), &num_procs);
+    if (num_procs > 1)
+    {
+        if (!hypre_ParCSRMatrixCommPkg(hA))
+            hypre_MatvecCommPkgCreate(hA);
+        P_ext = hypre_ParCSRMatrixExtractBExt(hP, hA, 1);
+        P_ext_i = hypre_CSRMatrixI(P_ext);
+        P_ext_j = hypre_CSRMatrixJ(P_ext);
+        P_ext_data = hypre_CSRMatrixData(P_ext);
+    }
 
-#if (SA_IS_DEBUG_LEVEL(3))
-    for (int i=0; i < Dinv_neg.Size(); ++i)
-        SA_ASSERT(Dinv_neg(i) < 0.);
-#endif
+    acc.first_col = hypre_ParCSRMatrixFirstColDiag(hP);
+    acc.num_diag_cols = hypre_CSRMatrixNumCols(P_diag);
+    acc.offd_cols.clear();
+    if (have_P_offd)
+        acc.offd_cols.assign(P_col_map, P_col_map + P_offd_cols);
+    if (P_ext)
+    {
+        const HYPRE_Int ext_nnz = P_ext_i[hypre_CSRMatrixNumRows(P_ext)];
+        for (HYPRE_Int k=0; k < ext_nnz; ++k)
+        {
+            const HYPRE_Int col = P_ext_j[k];
+            if (col < acc.first_col ||
+                col >= acc.first_col + acc.num_diag_cols)
+                acc.offd_cols.push_back(col);
+        }
+        std::sort(acc.offd_cols.begin(), acc.offd_cols.end());
+        acc.offd_cols.erase(std::unique(acc.offd_cols.begin(),
+                                        acc.offd_cols.end()),
+                            acc.offd_cols.end());
+    }
+    const int num_slots = acc.num_diag_cols + (int)acc.offd_cols.size();
+    acc.marker.assign(num_slots, -1);
+    if ((int)acc.values.size() < num_slots)
+        acc.values.resize(num_slots);
+
+    std::vector<HYPRE_Int> diag_i(rows + 1), offd_i(rows + 1);
+    std::vector<HYPRE_Int> diag_j, offd_j;
+    std::vector<double> diag_data, offd_data;
+    diag_i[0] = offd_i[0] = 0;
+    std::vector<bool> offd_used(acc.offd_cols.size(), false);
+    for (int i=0; i < rows; ++i)
+    {
+        acc.touched.clear();
+        interp_smooth_axpy(acc, 1., P_diag_i[i], P_diag_i[i+1], P_diag_j,
+                           P_diag_data, NULL, acc.first_col);
+        if (have_P_offd)
+            interp_smooth_axpy(acc, 1., P_offd_i[i], P_offd_i[i+1], P_offd_j,
+                               P_offd_data, P_col_map, 0);
+        const double scale = c * Dinv_neg(i);
+        for (HYPRE_Int k=A_diag_i[i]; k < A_diag_i[i+1]; ++k)
+        {
+            const HYPRE_Int r = A_diag_j[k];
+            const double coef = scale * A_diag_data[k];
+            interp_smooth_axpy(acc, coef, P_diag_i[r], P_diag_i[r+1], P_diag_j,
+                               P_diag_data, NULL, acc.first_col);
+            if (have_P_offd)
+                interp_smooth_axpy(acc, coef, P_offd_i[r], P_offd_i[r+1],
+                                   P_offd_j, P_offd_data, P_col_map, 0);
+        }
+        if (have_A_offd)
+        {
+            SA_ASSERT(P_ext);
+            for (HYPRE_Int k=A_offd_i[i]; k < A_offd_i[i+1]; ++k)
+            {
+                const HYPRE_Int r = A_offd_j[k];
+                interp_smooth_axpy(acc, scale * A_offd_data[k], P_ext_i[r],
+                                   P_ext_i[r+1], P_ext_j, P_ext_data, NULL, 0);
+            }
+        }
 
-    HypreParMatrix *Dinv_neg_mat = mbox_create_diag_parallel_matrix(Dinv_neg);
-    SA_ASSERT(A.GetGlobalNumRows() == Dinv_neg_mat->GetGlobalNumCols());
-    HypreParMatrix *smoother = ParMult(Dinv_neg_mat, &A);
-    mbox_make_owner_rowstarts_colstarts(*smoother);
-    delete Dinv_neg_mat;
+        for (unsigned int t=0; t < acc.touched.size(); ++t)
+        {
+            const int slot = acc.touched[t];
+            acc.marker[slot] = -1;
+            const double val = acc.values[slot];
+            if (drop_tol > 0. && fabs(val) <= drop_tol)
+                continue;
+            if (slot < acc.num_diag_cols)
+            {
+                diag_j.push_back(slot);
+                diag_data.push_back(val);
+            }
+            else
+            {
+                offd_used[slot - acc.num_diag_cols] = true;
+                offd_j.push_back(slot - acc.num_diag_cols);
+                offd_data.push_back(val);
+            }
+        }
+        diag_i[i+1] = (HYPRE_Int)diag_j.size();
+        offd_i[i+1] = (HYPRE_Int)offd_j.size();
+    }
+    if (P_ext)
+        hypre_CSRMatrixDestroy(P_ext);
 
-    return smoother;
+    // keep only the off-processor columns that survived
+    std::vector<int> offd_renum(acc.offd_cols.size(), -1);
+    int offd_num_cols = 0;
+    for (unsigned int k=0; k < acc.offd_cols.size(); ++k)
+    {
+        if (offd_used[k])
+            offd_renum[k] = offd_num_cols++;
+    }
+    HYPRE_Int *col_map_offd = new HYPRE_Int[offd_num_cols];
+    for (unsigned int k=0; k < acc.offd_cols.size(); ++k)
+    {
+        if (offd_used[k])
+            col_map_offd[offd_renum[k]] = acc.offd_cols[k];
+    }
+
+    const HYPRE_Int diag_nnz = diag_i[rows];
+    const HYPRE_Int offd_nnz = offd_i[rows];
+    HYPRE_Int *new_diag_i = new HYPRE_Int[rows + 1];
+    HYPRE_Int *new_diag_j = new HYPRE_Int[diag_nnz];
+    double *new_diag_data = new double[diag_nnz];
+    HYPRE_Int *new_offd_i = new HYPRE_Int[rows + 1];
+    HYPRE_Int *new_offd_j = new HYPRE_Int[offd_nnz];
+    double *new_offd_data = new double[offd_nnz];
+    std::copy(diag_i.begin(), diag_i.end(), new_diag_i);
+    std::copy(diag_j.begin(), diag_j.end(), new_diag_j);
+    std::copy(diag_data.begin(), diag_data.end(), new_diag_data);
+    std::copy(offd_i.begin(), offd_i.end(), new_offd_i);
+    for (HYPRE_Int k=0; k < offd_nnz; ++k)
+        new_offd_j[k] = offd_renum[offd_j[k]];
+    std::copy(offd_data.begin(), offd_data.end(), new_offd_data);
+
+    HypreParMatrix *smoothed = new HypreParMatrix(
+        P.GetComm(), P.M(), P.N(),
+        hypre_ParCSRMatrixRowStarts(hP), hypre_ParCSRMatrixColStarts(hP),
+        new_diag_i, new_diag_j, new_diag_data,
+        new_offd_i, new_offd_j, new_offd_data, offd_num_cols, col_map_offd);
+    smoothed->CopyRowStarts();
+    smoothed->CopyColStarts();
+
+    return smoothed;
 }
 
+#if SAAMGE_USE_OPENMP
+/*! \brief Threaded local eigensolves for a hierarchy built from scratch.
+
+    This is the threaded counterpart of the loop over AEs in
+    \b interp_compute_vectors for the case when neither a transformation
+    nor readapting is done. The AE stiffness matrices are assembled
+    sequentially, since the element matrix providers are built on MFEM forms
+    and integrators that are not thread-safe. Then the (dense) eigenproblems
+    are distributed among the threads, each using its own eigensolver whose
+    statistics are merged into \a eigensolver at the end. The problems that
+    go to ARPACK are solved afterwards, sequentially and in order, by
+    \a eigensolver itself.
+
+    Every AE is solved with exactly the same data as in the sequential loop,
+    so the outputs are identical to it.
+
+    \param agg_part_rels (IN) The partitioning relations.
+    \param interp_data (IN/OUT) The cut vectors, the r.h.s. matrices and the
+                                AE stiffness matrices are filled in here.
+    \param elem_data (IN) The element matrix provider.
+    \param theta (IN) The spectral tolerance.
+    \param eigensolver (IN/OUT) The eigensolver collecting the statistics.
+    \param arpack_size_threshold (IN) The threshold given to the per-thread
+                                      eigensolvers.
+    \param theta_locals (OUT) The local theta suggestions, one per AE.
+*/
+static
+void interp_compute_vectors_threaded(
+    const agg_partitioning_relations_t& agg_part_rels,
+    const interp_data_t& interp_data, ElementMatrixProvider *elem_data,
+    double theta, Eigensolver& eigensolver, int arpack_size_threshold,
+    Vector& theta_locals)
+{
+    const int nparts = agg_part_rels.nparts;
+    DenseMatrix ** const cut_evects_arr = interp_data.cut_evects_arr;
+    DenseMatrix ** const prev_evects_arr = interp_data.prev_evects_arr;
+    SparseMatrix ** const rhs_matrices_arr = interp_data.rhs_matrices_arr;
+    SparseMatrix ** const AEs_stiffm = interp_data.AEs_stiffm;
+
+    SA_ASSERT(elem_data);
+    theta_locals.SetSize(nparts);
+    theta_locals = theta;
+
+    prof_begin("AE assembly");
+    for (int i=0; i<nparts; ++i)
+    {
+        SA_ASSERT(!AEs_stiffm[i]); // we demand to assemble these ourselves
+        AEs_stiffm[i] = elem_data->BuildAEStiff(i);
+        SA_ASSERT(AEs_stiffm[i]);
+        SA_ASSERT(!cut_evects_arr[i]);
+        cut_evects_arr[i] = new DenseMatrix;
+        SA_ASSERT(!rhs_matrices_arr[i]);
+        prof_count("AE DoFs", AEs_stiffm[i]->Height());
+    }
+    prof_end();
+
+    SA_PROF_SCOPE("eigensolve");
+    prof_count("local eigenproblems", nparts);
+
+    SA_RPRINTF_L(0, 5, "  solving %d local eigenvalue problems on %d threads\n",
+                 nparts, omp_get_max_threads());
+
+    // Hand out the AEs by decreasing size. Equally sized problems then go
+    // one after another and reuse the same eigensolver workspace size
+    // class, and the largest problems do not end up at the tail of the
+    // loop.
+    std::vector<std::pair<int, int> > order(nparts);
+    for (int i=0; i<nparts; ++i)
+        order[i] = std::make_pair(-AEs_stiffm[i]->Width(), i);
+    std::sort(order.begin(), order.end());
+
+#pragma omp parallel
+    {
+        Eigensolver thread_eigensolver(agg_part_rels.mises, agg_part_rels,
+                                       arpack_size_threshold);
+        thread_eigensolver.SetReuseTolerance(interp_data.reuse_tol);
+        thread_eigensolver.SetUseLOBPCG(interp_data.lobpcg_threshold > 0);
+
+#pragma omp for schedule(dynamic)
+        for (int k=0; k<nparts; ++k)
+        {
+            const int i = order[k].second;
+            if (eigensolver.UsesIterative(AEs_stiffm[i]->Width()))
+                continue;
+            int agg_size = -1;
+            if (agg_part_rels.mises_size != NULL)
+                agg_size = agg_part_rels.mises_size[i];
+            thread_eigensolver.Solve(*AEs_stiffm[i], rhs_matrices_arr[i], i, i,
+                                     agg_size, theta_locals(i),
+                                     *(cut_evects_arr[i]), prev_evects_arr[i]);
+        }
+
+#pragma omp critical
+        eigensolver.MergeStatistics(thread_eigensolver);
+    }
+
+    for (int i=0; i<nparts; ++i)
+    {
+        if (!eigensolver.UsesIterative(AEs_stiffm[i]->Width()))
+            continue;
+        int agg_size = -1;
+        if (agg_part_rels.mises_size != NULL)
+            agg_size = agg_part_rels.mises_size[i];
+        eigensolver.Solve(*AEs_stiffm[i], rhs_matrices_arr[i], i, i, agg_size,
+                          theta_locals(i), *(cut_evects_arr[i]),
+                          prev_evects_arr[i]);
+    }
+}
+#endif
+
 /* Functions */
 
 void AltThresholdLocal(int m, double threshold,
@@ -174,14 +521,18 @@ HypreParMatrix *interp_smooth(
     int times_apply_smoother, HypreParMatrix& A,
     HypreParMatrix& tent, HypreParVector& Dinv_neg)
 {
-    HypreParMatrix *smoother_matr = interp_simple_smoother(A, Dinv_neg);
-    HypreParMatrix *interp, *iter_matr, *new_interp;
+    HypreParMatrix *interp, *new_interp;
 
     SA_ASSERT(0 <= degree);
     SA_ASSERT(roots || 0 == degree);
-    SA_ASSERT(smoother_matr->GetGlobalNumRows() ==
-              smoother_matr->GetGlobalNumCols());
-    SA_ASSERT(smoother_matr->GetGlobalNumCols() == tent.GetGlobalNumRows());
+    SA_ASSERT(0 <= times_apply_smoother);
+    SA_ASSERT(0. <= drop_tol);
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    SA_ASSERT(A.GetGlobalNumCols() == tent.GetGlobalNumRows());
+#if (SA_IS_DEBUG_LEVEL(3))
+    for (int i=0; i < Dinv_neg.Size(); ++i)
+        SA_ASSERT(Dinv_neg(i) < 0.);
+#endif
 
     SA_RPRINTF_L(0, 4, "%s", "Smoothing tentative prolongator...\n");
     if (SA_IS_OUTPUT_LEVEL(5))
@@ -194,38 +545,31 @@ HypreParMatrix *interp_smooth(
         PROC_CLEAR_STR_STREAM;
     }
 
-    interp = mbox_clone_parallel_matrix(&tent);
-    for (int k=0; k < degree; ++k)
+    if (0 == degree || 0 == times_apply_smoother)
     {
-        iter_matr = mbox_scale_clone_parallel_matrix(*smoother_matr,
-                                                     1./roots[k]);
-        mbox_add_diag_parallel_matrix(*iter_matr, 1.);
+        interp = mbox_clone_parallel_matrix(&tent);
+        if (drop_tol == 0.0)
+            return interp;
+        new_interp = AltThreshold(*interp, drop_tol);
+        delete interp;
+        return new_interp;
+    }
 
-        SA_ASSERT(0 <= times_apply_smoother);
+    interp_smooth_accumulator_t acc;
+    interp = &tent;
+    for (int k=0; k < degree; ++k)
+    {
         for (int i=0; i < times_apply_smoother; ++i)
         {
-            new_interp = ParMult(iter_matr, interp);
-            mbox_make_owner_rowstarts_colstarts(*new_interp);
-            delete interp;
+            new_interp = interp_smooth_step(A, Dinv_neg, 1./roots[k],
+                                            drop_tol, *interp, acc);
+            if (interp != &tent)
+                delete interp;
             interp = new_interp;
         }
-        delete iter_matr;
     }
 
-    delete smoother_matr;
-
-    // something is going wrong here in parallel with drop_tol > 0.0
-
-    if (drop_tol == 0.0)
-    {
-        return interp;
-    }
-    else
-    {
-        new_interp = AltThreshold(*interp, drop_tol);
-        delete interp;
-        return new_interp;
-    }
+    return interp;
 }
 
 interp_data_t *interp_init_data(
@@ -241,11 +585,13 @@ interp_data_t *interp_init_data(
     SA_ASSERT(0 < interp_data->nparts);
     interp_data->rhs_matrices_arr = new SparseMatrix*[nparts];
     interp_data->cut_evects_arr = new DenseMatrix*[nparts];
+    interp_data->prev_evects_arr = new DenseMatrix*[nparts];
     interp_data->AEs_stiffm = new SparseMatrix*[nparts];
     for (int i=0; i < nparts; ++i)
     {
         interp_data->rhs_matrices_arr[i] = NULL;
         interp_data->cut_evects_arr[i] = NULL;
+        interp_data->prev_evects_arr[i] = NULL;
         interp_data->AEs_stiffm[i] = NULL;
     }
 
@@ -258,6 +604,9 @@ interp_data_t *interp_init_data(
     interp_data->use_arpack = use_arpack;
     interp_data->scaling_P = scaling_P;
     interp_data->drop_tol = 0.0;
+    interp_data->reuse_evects = false;
+    interp_data->reuse_tol = 0.0;
+    interp_data->lobpcg_threshold = 0;
 
     if (SA_IS_OUTPUT_LEVEL(5))
     {
@@ -297,6 +646,9 @@ void interp_free_data(interp_data_t *interp_data,
         delete [] interp_data->cut_evects_arr;
         delete [] interp_data->AEs_stiffm;
     }
+    for (int i=0; i < interp_data->nparts; ++i)
+        delete interp_data->prev_evects_arr[i];
+    delete [] interp_data->prev_evects_arr;
     delete [] interp_data->interp_smoother_roots;
     delete interp_data->local_coarse_one_representation;
     delete [] interp_data->mis_numcoarsedof;
@@ -307,6 +659,36 @@ void interp_free_data(interp_data_t *interp_data,
     delete interp_data;
 }
 
+void interp_reset_data(interp_data_t& interp_data)
+{
+    for (int i=0; i < interp_data.nparts; ++i)
+    {
+        delete interp_data.rhs_matrices_arr[i];
+        interp_data.rhs_matrices_arr[i] = NULL;
+        delete interp_data.prev_evects_arr[i];
+        interp_data.prev_evects_arr[i] = NULL;
+        if (interp_data.reuse_evects)
+            interp_data.prev_evects_arr[i] = interp_data.cut_evects_arr[i];
+        else
+            delete interp_data.cut_evects_arr[i];
+        interp_data.cut_evects_arr[i] = NULL;
+        delete interp_data.AEs_stiffm[i];
+        interp_data.AEs_stiffm[i] = NULL;
+    }
+
+    delete interp_data.local_coarse_one_representation;
+    interp_data.local_coarse_one_representation = NULL;
+    delete [] interp_data.mis_numcoarsedof;
+    interp_data.mis_numcoarsedof = NULL;
+    if (interp_data.mis_tent_interps)
+    {
+        for (int i=0; i < interp_data.num_mises; ++i)
+            delete interp_data.mis_tent_interps[i];
+        delete [] interp_data.mis_tent_interps;
+        interp_data.mis_tent_interps = NULL;
+    }
+}
+
 interp_data_t *interp_copy_data(const interp_data_t *src)
 {
     if (!src) return NULL;
@@ -317,6 +699,13 @@ interp_data_t *interp_copy_data(const interp_data_t *src)
                                                       src->nparts);
     dst->cut_evects_arr = mbox_copy_dense_matr_arr(src->cut_evects_arr,
                                                    src->nparts);
+    dst->prev_evects_arr = new DenseMatrix*[src->nparts];
+    for (int i=0; i < src->nparts; ++i)
+        dst->prev_evects_arr[i] = src->prev_evects_arr[i] ?
+            new DenseMatrix(*src->prev_evects_arr[i]) : NULL;
+    dst->reuse_evects = src->reuse_evects;
+    dst->reuse_tol = src->reuse_tol;
+    dst->lobpcg_threshold = src->lobpcg_threshold;
     dst->AEs_stiffm = mbox_copy_sparse_matr_arr(src->AEs_stiffm, src->nparts);
 
     // dst->finest_elmat_callback = src->finest_elmat_callback;
@@ -376,15 +765,45 @@ void interp_compute_vectors(
     SA_RPRINTF_L(0, 5, "theta: %g, tol: %g\n", theta, tol);
 
     int arpack_size_threshold;
-    if (interp_data.use_arpack)
+    if (interp_data.lobpcg_threshold > 0)
+        arpack_size_threshold = interp_data.lobpcg_threshold;
+    else if (interp_data.use_arpack)
         arpack_size_threshold = ARPACK_SIZE_THRESHOLD; // ??? 64, but no good reason for that
     else
         arpack_size_threshold = std::numeric_limits<int>::max();
     Eigensolver eigensolver(agg_part_rels.mises, agg_part_rels,
                             arpack_size_threshold);
+    eigensolver.SetReuseTolerance(interp_data.reuse_tol);
+    eigensolver.SetUseLOBPCG(interp_data.lobpcg_threshold > 0);
+
+    // When building from scratch the AEs are independent, so they can be
+    // done by threads. The test hooks and the detailed per-AE output are
+    // only supported by the sequential loop.
+    bool threaded = false;
+#if SAAMGE_USE_OPENMP
+    threaded = !transf && !agg_part_rels.testmesh && !SA_IS_OUTPUT_LEVEL(6) &&
+               omp_get_max_threads() > 1;
+    if (threaded)
+    {
+        Vector theta_locals;
+        interp_compute_vectors_threaded(agg_part_rels, interp_data, elem_data,
+                                        theta, eigensolver,
+                                        arpack_size_threshold, theta_locals);
+
+        // Same order of summation as in the sequential loop.
+        for (int i=0; i<nparts; ++i)
+        {
+            SA_ASSERT(0. <= theta_locals(i));
+            sum_skip += theta_locals(i);
+            ++skipctr;
+            if (theta_locals(i) < min_skip)
+                min_skip = theta_locals(i);
+        }
+    }
+#endif
 
     // Loop over AEs.
-    for (int i=0; i<nparts; ++i)
+    for (int i=0; i<nparts && !threaded; ++i)
     {
         if (nparts < 10 || i % (nparts / 10) == 0)
             SA_RPRINTF_L(0, 5, "  local eigenvalue problem %d / %d\n", i, nparts);
@@ -410,7 +829,10 @@ void interp_compute_vectors(
                 AEs_stiffm[i] = NULL;
             }
             SA_ASSERT(!AEs_stiffm[i]); // we demand to assemble these ourselves
+            prof_begin("AE assembly");
             AEs_stiffm[i] = elem_data->BuildAEStiff(i);
+            prof_count("AE DoFs", AEs_stiffm[i]->Height());
+            prof_end();
         }
         AE_stiffm = AEs_stiffm[i];
         SA_ASSERT(AE_stiffm);
@@ -501,10 +923,14 @@ void interp_compute_vectors(
             int agg_size = -1; // this only has any effect if we are doing the schur eigenproblem...
             if (agg_part_rels.mises_size != NULL)
                 agg_size = agg_part_rels.mises_size[i];
+            prof_begin("eigensolve");
             local_added = eigensolver.Solve(
                 *AE_stiffm, rhs_matrices_arr[i], i, i,
                 agg_size,
-                theta_local, *(cut_evects_arr[i]));
+                theta_local, *(cut_evects_arr[i]),
+                transf ? NULL : interp_data.prev_evects_arr[i]);
+            prof_count("local eigenproblems");
+            prof_end();
         }
 
         // test routine for mltest, put an extra eigenvector on AE 0 [on processor 0]
@@ -590,6 +1016,24 @@ void interp_compute_vectors(
 
     if (SA_IS_OUTPUT_LEVEL(5))
         eigensolver.PrintStatistics();
+
+    if (interp_data.reuse_evects && interp_data.reuse_tol > 0.)
+    {
+        int count_solves, count_direct_solves, count_max_used, count_reused;
+        int count_lobpcg_solves, count_lobpcg_iterations;
+        double smallest_eigenvalue_skipped;
+        eigensolver.GetStatistics(count_solves, count_direct_solves,
+                                  count_max_used, count_reused,
+                                  smallest_eigenvalue_skipped,
+                                  count_lobpcg_solves, count_lobpcg_iterations);
+        int local_counts[2] = {count_reused, count_solves};
+        int global_counts[2];
+        MPI_Allreduce(local_counts, global_counts, 2, MPI_INT, MPI_SUM,
+                      PROC_COMM);
+        SA_RPRINTF_L(0, 5, "Eigenvalue problems skipped by reusing the old "
+                           "eigenvectors: %d of %d.\n",
+                     global_counts[0], global_counts[1]);
+    }
 }
 
 /**
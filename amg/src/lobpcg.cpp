@@ -0,0 +1,281 @@
+/*! \file
+
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.hpp"
+#include "lobpcg.hpp"
+#include <cmath>
+#include <mfem.hpp>
+#include "xpacks.hpp"
+
+namespace saamge
+{
+using namespace mfem;
+
+/* Static Functions */
+
+/*! \brief The inner product \f$ \mathbf{u}^T B \mathbf{v} \f$ for diagonal B.
+
+    \param diagB (IN) The diagonal of B.
+    \param u (IN) The first vector, of size diagB.Size().
+    \param v (IN) The second vector, of size diagB.Size().
+
+    \returns The inner product.
+*/
+static inline
+double lobpcg_b_dot(const Vector& diagB, const double *u, const double *v)
+{
+    const int n = diagB.Size();
+    double dot = 0.;
+    for (int i=0; i < n; ++i)
+        dot += u[i] * diagB(i) * v[i];
+    return dot;
+}
+
+/*! \brief The inner product of column \a p of \a X and column \a q of \a Y.
+*/
+static inline
+double lobpcg_col_dot(const DenseMatrix& X, const DenseMatrix& Y, int p, int q)
+{
+    const int n = X.Height();
+    const double *x = X.Data() + p * n;
+    const double *y = Y.Data() + q * n;
+    double dot = 0.;
+    for (int r=0; r < n; ++r)
+        dot += x[r] * y[r];
+    return dot;
+}
+
+/*! \brief Computes \f$ Y = X C \f$ using the leading parts of the matrices.
+
+    \param X (IN) Its first \a k columns are used.
+    \param C (IN) Its first \a k rows and \a m columns are used.
+    \param k (IN) See above.
+    \param m (IN) See above.
+    \param row0 (IN) The rows of \a C (and columns of \a X) before it are
+                     skipped.
+    \param Y (OUT) Its first \a m columns are set.
+*/
+static inline
+void lobpcg_mult_block(const DenseMatrix& X, const DenseMatrix& C, int k,
+                       int m, int row0, DenseMatrix& Y)
+{
+    const int n = X.Height();
+    SA_ASSERT(Y.Height() == n);
+    SA_ASSERT(Y.Width() >= m);
+    for (int j=0; j < m; ++j)
+    {
+        double *y = Y.Data() + j * n;
+        for (int r=0; r < n; ++r)
+            y[r] = 0.;
+        for (int l=row0; l < k; ++l)
+        {
+            const double c = C(l, j);
+            const double *x = X.Data() + l * n;
+            for (int r=0; r < n; ++r)
+                y[r] += c * x[r];
+        }
+    }
+}
+
+/* Functions */
+
+int lobpcg_b_orthonormalize(const Vector& diagB, DenseMatrix& S, int first,
+                            int last)
+{
+    const int n = S.Height();
+    SA_ASSERT(diagB.Size() == n);
+    SA_ASSERT(0 <= first && first <= last && last <= S.Width());
+
+    int k = first;
+    for (int j=first; j < last; ++j)
+    {
+        double *w = S.Data() + k * n;
+        if (k != j)
+            memcpy(w, S.Data() + j * n, sizeof(double) * n);
+        const double norm_beg = lobpcg_b_dot(diagB, w, w);
+        // twice is enough
+        for (int pass=0; pass < 2; ++pass)
+        {
+            for (int l=0; l < k; ++l)
+            {
+                const double *u = S.Data() + l * n;
+                const double c = lobpcg_b_dot(diagB, u, w);
+                for (int r=0; r < n; ++r)
+                    w[r] -= c * u[r];
+            }
+        }
+        const double norm = lobpcg_b_dot(diagB, w, w);
+        if (norm <= 1.e-12 * norm_beg || norm <= 0.)
+            continue;
+        const double scale = 1. / sqrt(norm);
+        for (int r=0; r < n; ++r)
+            w[r] *= scale;
+        ++k;
+    }
+    return k;
+}
+
+void lobpcg_fill_random(DenseMatrix& X, int first)
+{
+    const int n = X.Height();
+    for (int j=first; j < X.Width(); ++j)
+    {
+        unsigned int state = 2654435761u * (unsigned int)(j + 1);
+        double *x = X.Data() + j * n;
+        for (int r=0; r < n; ++r)
+        {
+            state = 1664525u * state + 1013904223u;
+            x[r] = (double)(state >> 8) / (double)(1u << 24) - 0.5;
+        }
+    }
+}
+
+int lobpcg_calc_lower_eigens_sparse_diag(const SparseMatrix& A,
+                                         const Vector& diagB,
+                                         DenseMatrix& evects,
+                                         Vector& evals,
+                                         int max_iters, double tol)
+{
+    const int n = A.Height();
+    const int m = evects.Width();
+    SA_ASSERT(A.Width() == n);
+    SA_ASSERT(diagB.Size() == n);
+    SA_ASSERT(evects.Height() == n);
+    SA_ASSERT(0 < m && m <= n);
+
+    // The search space [X, W, P] of the current Ritz vectors, the
+    // preconditioned residuals and the previous directions, and A times it.
+    DenseMatrix S(n, 3 * m), AS(n, 3 * m);
+    DenseMatrix AX(n, m), P(n, m), Ak, Ik, Y;
+    Vector ritz, res(m);
+    Array<int> active;
+
+    memcpy(S.Data(), evects.Data(), sizeof(double) * n * m);
+    int ks = lobpcg_b_orthonormalize(diagB, S, 0, m);
+    SA_ASSERT(ks == m);
+
+    int iter = 0;
+    bool have_p = false;
+    for (;;)
+    {
+        // Rayleigh-Ritz on the span of S.
+        for (int j=0; j < ks; ++j)
+        {
+            Vector s(S.Data() + j * n, n);
+            Vector as(AS.Data() + j * n, n);
+            A.Mult(s, as);
+        }
+        Ak.SetSize(ks);
+        Ik.SetSize(ks);
+        Ik = 0.;
+        for (int p=0; p < ks; ++p)
+        {
+            Ik(p, p) = 1.;
+            for (int q=0; q <= p; ++q)
+            {
+                const double pq = lobpcg_col_dot(S, AS, p, q);
+                const double qp = lobpcg_col_dot(S, AS, q, p);
+                Ak(p, q) = Ak(q, p) = 0.5 * (pq + qp);
+            }
+        }
+        xpacks_calc_all_gen_eigens_dense(Ak, ritz, Y, Ik);
+
+        // The new Ritz vectors and, for the next step, the part of their
+        // update that came from W and P.
+        lobpcg_mult_block(S, Y, ks, m, 0, evects);
+        lobpcg_mult_block(AS, Y, ks, m, 0, AX);
+        have_p = (ks > m);
+        if (have_p)
+            lobpcg_mult_block(S, Y, ks, m, m, P);
+
+        // Residuals and the columns that still have to converge.
+        active.SetSize(0);
+        for (int j=0; j < m; ++j)
+        {
+            const double *x = evects.Data() + j * n;
+            const double *ax = AX.Data() + j * n;
+            double r2 = 0.;
+            for (int r=0; r < n; ++r)
+            {
+                const double rr = ax[r] - ritz(j) * diagB(r) * x[r];
+                r2 += rr * rr / diagB(r);
+            }
+            res(j) = sqrt(r2);
+            if (res(j) > tol)
+                active.Append(j);
+        }
+        if (0 == active.Size() || iter >= max_iters)
+            break;
+        ++iter;
+
+        // The next search space [X, B^{-1} R, P] restricted to the active
+        // columns.
+        memcpy(S.Data(), evects.Data(), sizeof(double) * n * m);
+        ks = m;
+        for (int a=0; a < active.Size(); ++a, ++ks)
+        {
+            const int j = active[a];
+            const double *x = evects.Data() + j * n;
+            const double *ax = AX.Data() + j * n;
+            double *w = S.Data() + ks * n;
+            for (int r=0; r < n; ++r)
+                w[r] = (ax[r] - ritz(j) * diagB(r) * x[r]) / diagB(r);
+        }
+        if (have_p)
+        {
+            for (int a=0; a < active.Size(); ++a, ++ks)
+                memcpy(S.Data() + ks * n, P.Data() + active[a] * n,
+                       sizeof(double) * n);
+        }
+        const int ks_beg = ks;
+        ks = lobpcg_b_orthonormalize(diagB, S, m, ks);
+        SA_PRINTF_L(9, "LOBPCG iteration %d: active %d, search space %d of "
+                    "%d\n", iter, active.Size(), ks, ks_beg);
+        if (ks == m)
+            break; // nothing new to search in
+    }
+
+    evals.SetSize(m);
+    for (int j=0; j < m; ++j)
+        evals(j) = ritz(j);
+
+    SA_ALERT_COND_MSG(0 == active.Size(), "LOBPCG: %d of %d Ritz pairs did "
+                      "NOT converge in %d iterations!", active.Size(), m, iter);
+    if (SA_IS_OUTPUT_LEVEL(9))
+    {
+        SA_PRINTF("LOBPCG: size %d, block %d, iterations %d, largest "
+                  "residual %g\n", n, m, iter, res.Normlinf());
+    }
+
+    return iter;
+}
+
+} // namespace saamge
@@ -33,6 +33,13 @@
 #include "mbox.hpp"
 #include <fstream>
 #include <cmath>
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <seq_mv.h>
 #include <_hypre_parcsr_mv.h>
 #include <_hypre_parcsr_ls.h>
@@ -428,6 +435,8 @@ void mbox_write_dense_matr(ofstream& odem, const DenseMatrix& dem)
 {
     int height, width, data_sz;
     SA_ASSERT(odem);
+    height = dem.Height();
+    width = dem.Width();
     odem.write((char *)&height, sizeof(height));
     odem.write((char *)&width, sizeof(width));
     data_sz = height * width;
@@ -482,6 +491,328 @@ void mbox_write_dense_matr_arr(const char *filename, DenseMatrix **arr,
     odem.close();
 }
 
+/*! \brief The header of the memory-mappable binary format (64 bytes).
+*/
+typedef struct {
+    char magic[8];
+    int version;
+    int kind;
+    long long rows;
+    long long cols;
+    long long nnz;
+    long long reserved[3];
+} mbox_mapped_header_t;
+
+enum {
+    MBOX_MAPPED_CSR = 1,
+    MBOX_MAPPED_TABLE = 2,
+    MBOX_MAPPED_DENSE_ARR = 3
+};
+
+static const char MBOX_MAPPED_MAGIC[8] = {'S', 'A', 'A', 'M', 'G', 'E', 'M', 'B'};
+
+static inline
+size_t mbox_mapped_pad(size_t bytes)
+{
+    return (bytes + 7) & ~((size_t)7);
+}
+
+static void mbox_mapped_write_header(ofstream& out, int kind, long long rows,
+                                     long long cols, long long nnz)
+{
+    mbox_mapped_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MBOX_MAPPED_MAGIC, sizeof(header.magic));
+    header.version = MBOX_MAPPED_VERSION;
+    header.kind = kind;
+    header.rows = rows;
+    header.cols = cols;
+    header.nnz = nnz;
+    out.write((char *)&header, sizeof(header));
+}
+
+/*! \brief Writes an array and pads it with zeros up to an 8-byte boundary.
+*/
+static void mbox_mapped_write_arr(ofstream& out, const void *arr, size_t bytes)
+{
+    static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    if (bytes)
+        out.write((const char *)arr, bytes);
+    out.write(zeros, mbox_mapped_pad(bytes) - bytes);
+}
+
+static const mbox_mapped_header_t *mbox_mapped_open(const char *filename,
+                                                    int kind,
+                                                    mbox_mapping_t& mapping)
+{
+    const int fd = open(filename, O_RDONLY);
+    SA_ASSERT(fd >= 0);
+    struct stat st;
+    SA_VERIFY(!fstat(fd, &st));
+    SA_ASSERT((size_t)st.st_size >= sizeof(mbox_mapped_header_t));
+    mapping.size = st.st_size;
+    mapping.addr = mmap(NULL, mapping.size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                        fd, 0);
+    close(fd);
+    SA_ASSERT(MAP_FAILED != mapping.addr);
+
+    const mbox_mapped_header_t *header =
+        (const mbox_mapped_header_t *)mapping.addr;
+    SA_ASSERT(!memcmp(header->magic, MBOX_MAPPED_MAGIC, sizeof(header->magic)));
+    SA_ASSERT(MBOX_MAPPED_VERSION == header->version);
+    SA_ASSERT(kind == header->kind);
+    SA_ASSERT(0 <= header->rows && header->rows < INT_MAX);
+    SA_ASSERT(0 <= header->nnz && header->nnz < INT_MAX);
+    return header;
+}
+
+static void mbox_mapped_close(mbox_mapping_t& mapping)
+{
+    if (mapping.addr)
+        munmap(mapping.addr, mapping.size);
+    mapping.addr = NULL;
+    mapping.size = 0;
+}
+
+bool mbox_is_mapped_format(const char *filename)
+{
+    mbox_mapped_header_t header;
+    std::ifstream in(filename, std::ifstream::binary);
+    if (!in)
+        return false;
+    in.read((char *)&header, sizeof(header));
+    return (in.gcount() == (std::streamsize)sizeof(header) &&
+            !memcmp(header.magic, MBOX_MAPPED_MAGIC, sizeof(header.magic)));
+}
+
+SparseMatrix *mbox_map_sparse_matr(const char *filename,
+                                   mbox_mapping_t& mapping)
+{
+    const mbox_mapped_header_t *header =
+        mbox_mapped_open(filename, MBOX_MAPPED_CSR, mapping);
+    const int size = header->rows;
+    const int width = header->cols;
+    const int nnz = header->nnz;
+
+    char *p = (char *)mapping.addr + sizeof(*header);
+    int *I = (int *)p;
+    p += mbox_mapped_pad(sizeof(*I) * (size + 1));
+    int *J = (int *)p;
+    p += mbox_mapped_pad(sizeof(*J) * nnz);
+    double *data = (double *)p;
+    p += sizeof(*data) * nnz;
+    SA_ASSERT(p <= (char *)mapping.addr + mapping.size);
+    SA_ASSERT(nnz == I[size]);
+
+    return (new SparseMatrix(I, J, data, size, width));
+}
+
+void mbox_unmap_sparse_matr(SparseMatrix *spm, mbox_mapping_t& mapping)
+{
+    if (spm)
+    {
+        spm->LoseData();
+        delete spm;
+    }
+    mbox_mapped_close(mapping);
+}
+
+void mbox_write_mapped_sparse_matr(const char *filename,
+                                   const SparseMatrix& spm)
+{
+    SA_ASSERT(const_cast<SparseMatrix&>(spm).Finalized());
+    const int size = spm.Size();
+    const int nnz = spm.NumNonZeroElems();
+    ofstream ospm(filename, ofstream::binary);
+    SA_ASSERT(ospm);
+    mbox_mapped_write_header(ospm, MBOX_MAPPED_CSR, size, spm.Width(), nnz);
+    mbox_mapped_write_arr(ospm, spm.GetI(), sizeof(int) * (size + 1));
+    mbox_mapped_write_arr(ospm, spm.GetJ(), sizeof(int) * nnz);
+    mbox_mapped_write_arr(ospm, spm.GetData(), sizeof(double) * nnz);
+    ospm.close();
+    SA_ASSERT(ospm);
+}
+
+Table *mbox_map_table(const char *filename, mbox_mapping_t& mapping)
+{
+    const mbox_mapped_header_t *header =
+        mbox_mapped_open(filename, MBOX_MAPPED_TABLE, mapping);
+    const int size = header->rows;
+    const int nnz = header->nnz;
+
+    char *p = (char *)mapping.addr + sizeof(*header);
+    int *I = (int *)p;
+    p += mbox_mapped_pad(sizeof(*I) * (size + 1));
+    int *J = (int *)p;
+    p += sizeof(*J) * nnz;
+    SA_ASSERT(p <= (char *)mapping.addr + mapping.size);
+    SA_ASSERT(nnz == I[size]);
+
+    Table *tbl = new Table;
+    tbl->SetIJ(I, J, size);
+    return tbl;
+}
+
+void mbox_unmap_table(Table *tbl, mbox_mapping_t& mapping)
+{
+    if (tbl)
+    {
+        tbl->LoseData();
+        delete tbl;
+    }
+    mbox_mapped_close(mapping);
+}
+
+void mbox_write_mapped_table(const char *filename, const Table& tbl)
+{
+    const int size = tbl.Size();
+    const int nnz = tbl.Size_of_connections();
+    ofstream otbl(filename, ofstream::binary);
+    SA_ASSERT(otbl);
+    mbox_mapped_write_header(otbl, MBOX_MAPPED_TABLE, size, tbl.Width(), nnz);
+    mbox_mapped_write_arr(otbl, tbl.GetI(), sizeof(int) * (size + 1));
+    mbox_mapped_write_arr(otbl, tbl.GetJ(), sizeof(int) * nnz);
+    otbl.close();
+    SA_ASSERT(otbl);
+}
+
+DenseMatrix **mbox_map_dense_matr_arr(const char *filename, int *n,
+                                      mbox_mapping_t& mapping)
+{
+    const mbox_mapped_header_t *header =
+        mbox_mapped_open(filename, MBOX_MAPPED_DENSE_ARR, mapping);
+    *n = header->rows;
+
+    char *p = (char *)mapping.addr + sizeof(*header);
+    const int *dims = (const int *)p;
+    p += mbox_mapped_pad(sizeof(*dims) * 2 * (*n));
+    double *data = (double *)p;
+    p += sizeof(*data) * header->nnz;
+    SA_ASSERT(p <= (char *)mapping.addr + mapping.size);
+
+    DenseMatrix **arr = new DenseMatrix*[*n];
+    long long offset = 0;
+    for (int i=0; i < *n; ++i)
+    {
+        arr[i] = new DenseMatrix(data + offset, dims[2*i], dims[2*i+1]);
+        offset += (long long)dims[2*i] * dims[2*i+1];
+    }
+    SA_ASSERT(offset == header->nnz);
+    return arr;
+}
+
+void mbox_unmap_dense_matr_arr(DenseMatrix **arr, int n,
+                               mbox_mapping_t& mapping)
+{
+    if (arr)
+    {
+        // The matrices use external data, so deleting them is enough.
+        for (int i=0; i < n; ++i)
+            delete arr[i];
+        delete [] arr;
+    }
+    mbox_mapped_close(mapping);
+}
+
+void mbox_write_mapped_dense_matr_arr(const char *filename, DenseMatrix **arr,
+                                      int n)
+{
+    SA_ASSERT(arr || !n);
+    std::vector<int> dims(2*n);
+    long long total = 0;
+    for (int i=0; i < n; ++i)
+    {
+        dims[2*i] = arr[i]->Height();
+        dims[2*i+1] = arr[i]->Width();
+        total += (long long)dims[2*i] * dims[2*i+1];
+    }
+    ofstream odem(filename, ofstream::binary);
+    SA_ASSERT(odem);
+    mbox_mapped_write_header(odem, MBOX_MAPPED_DENSE_ARR, n, 0, total);
+    mbox_mapped_write_arr(odem, n ? &dims[0] : NULL, sizeof(int) * 2 * n);
+    for (int i=0; i < n; ++i)
+        odem.write((char *)arr[i]->Data(),
+                   sizeof(double) * arr[i]->Height() * arr[i]->Width());
+    odem.close();
+    SA_ASSERT(odem);
+}
+
+static bool mbox_ij_entry_less(const std::pair<int, double>& a,
+                               const std::pair<int, double>& b)
+{
+    return a.first < b.first;
+}
+
+SparseMatrix *mbox_read_ij_sparse_matr(const char *filename)
+{
+    std::ifstream in(filename);
+    SA_ASSERT(in.good());
+
+    int row0, row1, col0, col1;
+    in >> row0 >> row1 >> col0 >> col1;
+    SA_ASSERT(0 == row0);
+    SA_ASSERT(0 == col0);
+    const int height = row1 + 1;
+    const int width = col1 + 1;
+
+    std::vector<int> rows;
+    std::vector<int> cols;
+    std::vector<double> vals;
+    int i, j;
+    double x;
+    while (in >> i >> j >> x)
+    {
+        SA_ASSERT(0 <= i && i < height);
+        SA_ASSERT(0 <= j && j < width);
+        rows.push_back(i);
+        cols.push_back(j);
+        vals.push_back(x);
+    }
+    const int n = rows.size();
+
+    // Bucket the entries by row, keeping the order from the file.
+    int *I = new int[height + 1];
+    std::fill(I, I + height + 1, 0);
+    for (int k=0; k < n; ++k)
+        ++I[rows[k] + 1];
+    for (int r=0; r < height; ++r)
+        I[r+1] += I[r];
+    std::vector<int> pos(I, I + height);
+    std::vector<std::pair<int, double> > entries(n);
+    for (int k=0; k < n; ++k)
+        entries[pos[rows[k]]++] = std::make_pair(cols[k], vals[k]);
+
+    // Sort the rows, sum repeated entries and drop zeros off the diagonal,
+    // like SparseMatrix::Finalize() does.
+    int *J = new int[n];
+    double *data = new double[n];
+    int nnz = 0;
+    for (int r=0; r < height; ++r)
+    {
+        const int row_begin = I[r];
+        const int row_end = I[r+1];
+        std::stable_sort(entries.begin() + row_begin, entries.begin() + row_end,
+                         mbox_ij_entry_less);
+        I[r] = nnz;
+        for (int k=row_begin; k < row_end; )
+        {
+            const int col = entries[k].first;
+            double sum = 0.;
+            for (; k < row_end && entries[k].first == col; ++k)
+                sum += entries[k].second;
+            if (sum != 0. || col == r)
+            {
+                J[nnz] = col;
+                data[nnz] = sum;
+                ++nnz;
+            }
+        }
+    }
+    I[height] = nnz;
+
+    return (new SparseMatrix(I, J, data, height, width));
+}
+
 void mbox_convert_sparse_to_dense(const SparseMatrix& Sp, DenseMatrix& D)
 {
     SA_ASSERT(const_cast<SparseMatrix&>(Sp).Finalized());
@@ -1939,4 +2270,122 @@ void mbox_project_parallel(HypreParMatrix& A, HypreParMatrix& interp,
     delete restr;
 }
 
+void mbox_block_mult_parallel(HypreParMatrix& A, const DenseMatrix& X,
+                              DenseMatrix& Y, double alpha, double beta)
+{
+    hypre_ParCSRMatrix *hA = A;
+    hypre_CSRMatrix *diag = hypre_ParCSRMatrixDiag(hA);
+    hypre_CSRMatrix *offd = hypre_ParCSRMatrixOffd(hA);
+    const int n = hypre_CSRMatrixNumRows(diag);
+    const int k = X.Width();
+    SA_ASSERT(X.Height() == hypre_CSRMatrixNumCols(diag));
+    SA_ASSERT(Y.Height() == n && Y.Width() == k);
+    if (!k)
+        return;
+
+    const HYPRE_Int *diag_i = hypre_CSRMatrixI(diag);
+    const HYPRE_Int *diag_j = hypre_CSRMatrixJ(diag);
+    const double *diag_a = hypre_CSRMatrixData(diag);
+    const HYPRE_Int *offd_i = hypre_CSRMatrixI(offd);
+    const HYPRE_Int *offd_j = hypre_CSRMatrixJ(offd);
+    const double *offd_a = hypre_CSRMatrixData(offd);
+    const int nx = X.Height();
+    const double *xd = X.Data();
+    double *yd = Y.Data();
+
+    if (!hypre_ParCSRMatrixCommPkg(hA))
+        hypre_MatvecCommPkgCreate(hA);
+    hypre_ParCSRCommPkg *comm_pkg = hypre_ParCSRMatrixCommPkg(hA);
+    MPI_Comm comm = hypre_ParCSRCommPkgComm(comm_pkg);
+    const int num_sends = hypre_ParCSRCommPkgNumSends(comm_pkg);
+    const int num_recvs = hypre_ParCSRCommPkgNumRecvs(comm_pkg);
+    const int send_size = hypre_ParCSRCommPkgSendMapStart(comm_pkg, num_sends);
+    const int recv_size = hypre_ParCSRCommPkgRecvVecStart(comm_pkg, num_recvs);
+    const HYPRE_Int *send_map = hypre_ParCSRCommPkgSendMapElmts(comm_pkg);
+
+    // The halo of all k vectors travels in one message per neighbour,
+    // interleaved so that entry v of row j sits at j*k + v.
+    std::vector<double> send_buf((size_t)send_size * k);
+    std::vector<double> x_ext((size_t)recv_size * k);
+    std::vector<MPI_Request> requests(num_sends + num_recvs);
+    for (int p=0; p < num_recvs; ++p)
+    {
+        const int start = hypre_ParCSRCommPkgRecvVecStart(comm_pkg, p);
+        const int end = hypre_ParCSRCommPkgRecvVecStart(comm_pkg, p+1);
+        MPI_Irecv(&x_ext[(size_t)start * k], (end - start) * k, MPI_DOUBLE,
+                  hypre_ParCSRCommPkgRecvProc(comm_pkg, p), 0, comm,
+                  &requests[p]);
+    }
+    for (int j=0; j < send_size; ++j)
+        for (int v=0; v < k; ++v)
+            send_buf[(size_t)j * k + v] = xd[(size_t)v * nx + send_map[j]];
+    for (int p=0; p < num_sends; ++p)
+    {
+        const int start = hypre_ParCSRCommPkgSendMapStart(comm_pkg, p);
+        const int end = hypre_ParCSRCommPkgSendMapStart(comm_pkg, p+1);
+        MPI_Isend(&send_buf[(size_t)start * k], (end - start) * k, MPI_DOUBLE,
+                  hypre_ParCSRCommPkgSendProc(comm_pkg, p), 0, comm,
+                  &requests[num_recvs + p]);
+    }
+
+    // The diagonal block is applied while the halo is in flight. Every
+    // matrix entry is loaded once for all k vectors.
+    std::vector<double> s(k);
+    for (int i=0; i < n; ++i)
+    {
+        for (int v=0; v < k; ++v)
+            s[v] = 0.;
+        for (int l=diag_i[i]; l < diag_i[i+1]; ++l)
+        {
+            const double a = diag_a[l];
+            const double *xc = xd + diag_j[l];
+            for (int v=0; v < k; ++v)
+                s[v] += a * xc[(size_t)v * nx];
+        }
+        for (int v=0; v < k; ++v)
+        {
+            double& y = yd[(size_t)v * n + i];
+            y = (0. == beta ? 0. : beta * y) + alpha * s[v];
+        }
+    }
+
+    MPI_Waitall(num_sends + num_recvs, requests.data(), MPI_STATUSES_IGNORE);
+
+    for (int i=0; i < n; ++i)
+    {
+        if (offd_i[i] == offd_i[i+1])
+            continue;
+        for (int v=0; v < k; ++v)
+            s[v] = 0.;
+        for (int l=offd_i[i]; l < offd_i[i+1]; ++l)
+        {
+            const double a = offd_a[l];
+            const double *xc = &x_ext[(size_t)offd_j[l] * k];
+            for (int v=0; v < k; ++v)
+                s[v] += a * xc[v];
+        }
+        for (int v=0; v < k; ++v)
+            yd[(size_t)v * n + i] += alpha * s[v];
+    }
+}
+
+void mbox_block_inner_products_parallel(const DenseMatrix& X,
+                                        const DenseMatrix& Y, double *dots)
+{
+    SA_ASSERT(X.Height() == Y.Height() && X.Width() == Y.Width());
+    const int n = X.Height();
+    const int k = X.Width();
+    const double *xd = X.Data();
+    const double *yd = Y.Data();
+    std::vector<double> local(k);
+    for (int v=0; v < k; ++v)
+    {
+        double s = 0.;
+        for (int i=0; i < n; ++i)
+            s += xd[(size_t)v * n + i] * yd[(size_t)v * n + i];
+        local[v] = s;
+    }
+    MPI_Allreduce(local.data(), dots, k, MPI_DOUBLE, MPI_SUM, PROC_COMM);
+}
+
 } // namespace saamge
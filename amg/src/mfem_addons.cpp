@@ -32,6 +32,8 @@
 #include "common.hpp"
 #include "mfem_addons.hpp"
 #include <cmath>
+#include <algorithm>
+#include <vector>
 #include <mfem.hpp>
 #include "mbox.hpp"
 using std::pow;
@@ -103,20 +105,308 @@ HypreParMatrix * FakeParallelMatrix(const SparseMatrix *A)
     return out;
 }
 
+HypreParMatrix * DistributeSparseMatrix(const SparseMatrix& A,
+                                       int row_begin, int row_end)
+{
+    SA_ASSERT(A.Finalized());
+    SA_ASSERT(A.Height() == A.Width());
+    SA_ASSERT(0 <= row_begin && row_begin <= row_end && row_end <= A.Height());
+    const int *AI = A.GetI();
+    const int *AJ = A.GetJ();
+    const double *Adata = A.GetData();
+    const int rows = row_end - row_begin;
+
+    // the off-processor columns, sorted
+    std::vector<HYPRE_Int> cmap;
+    for (int k=AI[row_begin]; k < AI[row_end]; ++k)
+    {
+        if (AJ[k] < row_begin || AJ[k] >= row_end)
+            cmap.push_back(AJ[k]);
+    }
+    std::sort(cmap.begin(), cmap.end());
+    cmap.erase(std::unique(cmap.begin(), cmap.end()), cmap.end());
+    const int offd_num_cols = (int)cmap.size();
+
+    int diag_nnz = 0;
+    for (int k=AI[row_begin]; k < AI[row_end]; ++k)
+    {
+        if (row_begin <= AJ[k] && AJ[k] < row_end)
+            ++diag_nnz;
+    }
+    const int offd_nnz = AI[row_end] - AI[row_begin] - diag_nnz;
+
+    HYPRE_Int *diag_i = new HYPRE_Int[rows + 1];
+    HYPRE_Int *diag_j = new HYPRE_Int[diag_nnz];
+    double *diag_data = new double[diag_nnz];
+    HYPRE_Int *offd_i = new HYPRE_Int[rows + 1];
+    HYPRE_Int *offd_j = new HYPRE_Int[offd_nnz];
+    double *offd_data = new double[offd_nnz];
+    HYPRE_Int *col_map_offd = new HYPRE_Int[offd_num_cols];
+    std::copy(cmap.begin(), cmap.end(), col_map_offd);
+
+    int dp = 0, op = 0;
+    diag_i[0] = offd_i[0] = 0;
+    for (int i=0; i < rows; ++i)
+    {
+        const int row = row_begin + i;
+        // hypre wants the diagonal first in the rows of the diagonal block
+        for (int k=AI[row]; k < AI[row+1]; ++k)
+        {
+            if (AJ[k] == row)
+            {
+                diag_j[dp] = i;
+                diag_data[dp++] = Adata[k];
+            }
+        }
+        for (int k=AI[row]; k < AI[row+1]; ++k)
+        {
+            const int col = AJ[k];
+            if (col == row)
+                continue;
+            if (row_begin <= col && col < row_end)
+            {
+                diag_j[dp] = col - row_begin;
+                diag_data[dp++] = Adata[k];
+            }
+            else
+            {
+                offd_j[op] = (HYPRE_Int)(std::lower_bound(cmap.begin(),
+                                                          cmap.end(), col) -
+                                         cmap.begin());
+                offd_data[op++] = Adata[k];
+            }
+        }
+        diag_i[i+1] = dp;
+        offd_i[i+1] = op;
+    }
+    SA_ASSERT(dp == diag_nnz && op == offd_nnz);
+
+    HYPRE_Int starts[2];
+    starts[0] = row_begin;
+    starts[1] = row_end;
+    HypreParMatrix *out = new HypreParMatrix(
+        PROC_COMM, A.Height(), A.Width(), starts, starts,
+        diag_i, diag_j, diag_data, offd_i, offd_j, offd_data,
+        offd_num_cols, col_map_offd);
+    out->CopyRowStarts();
+    out->CopyColStarts();
+    return out;
+}
+
+SparseMatrix * ExtendedLocalMatrix(HypreParMatrix& A)
+{
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    hypre_ParCSRMatrix *hA = (hypre_ParCSRMatrix *)A;
+    hypre_CSRMatrix *diag = hypre_ParCSRMatrixDiag(hA);
+    hypre_CSRMatrix *offd = hypre_ParCSRMatrixOffd(hA);
+    const HYPRE_Int first = hypre_ParCSRMatrixFirstRowIndex(hA);
+    SA_ASSERT(first == hypre_ParCSRMatrixFirstColDiag(hA));
+    const int n = hypre_CSRMatrixNumRows(diag);
+    SA_ASSERT(hypre_CSRMatrixNumCols(diag) == n);
+    const HYPRE_Int *diag_i = hypre_CSRMatrixI(diag);
+    const HYPRE_Int *diag_j = hypre_CSRMatrixJ(diag);
+    const double *diag_data = hypre_CSRMatrixData(diag);
+    const int n_offd = hypre_CSRMatrixNumCols(offd);
+    const HYPRE_Int *offd_i = hypre_CSRMatrixI(offd);
+    const HYPRE_Int *offd_j = hypre_CSRMatrixJ(offd);
+    const double *offd_data = hypre_CSRMatrixData(offd);
+    const HYPRE_Int *cmap = hypre_ParCSRMatrixColMapOffd(hA);
+    const int N = n + n_offd;
+
+    // the rows for the off-processor columns, collective like in
+    // hypre_ParMatmul
+    hypre_CSRMatrix *ext = NULL;
+    int num_procs;
+    MPI_Comm_size(hypre_ParCSRMatrixComm(hA), &num_procs);
+    if (num_procs > 1)
+    {
+        if (!hypre_ParCSRMatrixCommPkg(hA))
+            hypre_MatvecCommPkgCreate(hA);
+        ext = hypre_ParCSRMatrixExtractBExt(hA, hA, 1);
+        SA_ASSERT(hypre_CSRMatrixNumRows(ext) == n_offd);
+    }
+
+    // the local numbering of a global column, -1 if it is not numbered
+    std::vector<int> ext_cols;
+    int ext_nnz = 0;
+    if (ext)
+    {
+        const HYPRE_Int *ext_i = hypre_CSRMatrixI(ext);
+        const HYPRE_Int *ext_j = hypre_CSRMatrixJ(ext);
+        ext_cols.resize(ext_i[n_offd]);
+        for (HYPRE_Int k=0; k < ext_i[n_offd]; ++k)
+        {
+            const HYPRE_Int col = ext_j[k];
+            if (first <= col && col < first + n)
+                ext_cols[k] = col - first;
+            else
+            {
+                const HYPRE_Int *it = std::lower_bound(cmap, cmap + n_offd,
+                                                       col);
+                ext_cols[k] = (it != cmap + n_offd && *it == col) ?
+                              n + (int)(it - cmap) : -1;
+            }
+            if (ext_cols[k] >= 0)
+                ++ext_nnz;
+        }
+    }
+
+    const int nnz = diag_i[n] + (offd_i ? offd_i[n] : 0) + ext_nnz;
+    int *I = new int[N + 1];
+    int *J = new int[nnz];
+    double *data = new double[nnz];
+    int p = 0;
+    I[0] = 0;
+    for (int i=0; i < n; ++i)
+    {
+        for (HYPRE_Int k=diag_i[i]; k < diag_i[i+1]; ++k)
+        {
+            J[p] = diag_j[k];
+            data[p++] = diag_data[k];
+        }
+        if (offd_i)
+        {
+            for (HYPRE_Int k=offd_i[i]; k < offd_i[i+1]; ++k)
+            {
+                J[p] = n + offd_j[k];
+                data[p++] = offd_data[k];
+            }
+        }
+        I[i+1] = p;
+    }
+    if (ext)
+    {
+        const HYPRE_Int *ext_i = hypre_CSRMatrixI(ext);
+        const double *ext_data = hypre_CSRMatrixData(ext);
+        for (int r=0; r < n_offd; ++r)
+        {
+            for (HYPRE_Int k=ext_i[r]; k < ext_i[r+1]; ++k)
+            {
+                if (ext_cols[k] < 0)
+                    continue;
+                J[p] = ext_cols[k];
+                data[p++] = ext_data[k];
+            }
+            I[n+r+1] = p;
+        }
+        hypre_CSRMatrixDestroy(ext);
+    }
+    else
+    {
+        for (int r=0; r < n_offd; ++r)
+            I[n+r+1] = p;
+    }
+    SA_ASSERT(p == nnz);
+
+    return new SparseMatrix(I, J, data, N, N);
+}
+
+/*! \brief Prints one iteration of the PCG variants (rank 0 only).
+
+    With \a zero_rhs, \f$ \| \mathbf{x} \|_A \f$ is printed too and, after
+    the first iteration, its reduction.
+*/
+static void pcg_print_iteration(const char *name, int i, double nom,
+                                bool zero_rhs, double norm_x,
+                                double norm_x_prev)
+{
+    if (0 != PROC_RANK)
+        return;
+    PROC_STR_STREAM << name << " Iteration: " << i << ", (B r, r) = " << nom;
+    if (zero_rhs)
+    {
+        PROC_STR_STREAM << ", || x ||_A = " << norm_x;
+        if (i)
+            PROC_STR_STREAM << ", || x ||_A / || x_prev ||_A = "
+                            << norm_x / norm_x_prev;
+    }
+    PROC_STR_STREAM << "\n";
+    SA_PRINTF("%s", PROC_STR_STREAM.str().c_str());
+    PROC_CLEAR_STR_STREAM;
+}
+
+/*! \brief The stopping threshold of the PCG variants.
+
+    The test is on \f$ (B\mathbf{r}, \mathbf{r}) \f$ or, with \a zero_rhs,
+    on \f$ \| \mathbf{x} \|_A \f$, relative to its initial value.
+
+    \returns \em false if the initial value is already below \a r0.
+*/
+static bool pcg_init_threshold(double nom0, double norm_x_initial,
+                               bool zero_rhs, double RTOLERANCE,
+                               double ATOLERANCE, double& r0)
+{
+    const double initial = zero_rhs ? norm_x_initial : nom0;
+    if ( (r0 = initial * RTOLERANCE) < ATOLERANCE) r0 = ATOLERANCE;
+    return !(initial < r0);
+}
+
+/*! \brief Whether the PCG variants stop, see \b pcg_init_threshold. On
+           convergence the short reports of \a print_iter 2 and 3 are
+           printed.
+*/
+static bool pcg_converged(const char *name, int print_iter, int i, double nom0,
+                          double nom, bool zero_rhs, double norm_x, double r0)
+{
+    if (zero_rhs ? !(norm_x < r0) : !(nom < r0))
+        return false;
+    if (print_iter == 2)
+        SA_PRINTF("Number of %s iterations: %d\n", name, i);
+    else
+        if (print_iter == 3)
+        {
+            SA_PRINTF("(B r_0, r_0) = %g\n", nom0);
+            SA_PRINTF("(B r_N, r_N) = %g\n", nom);
+            SA_PRINTF("Number of %s iterations: %d\n", name, i);
+        }
+    return true;
+}
+
+/*! \brief The final report of the PCG variants after \a its iterations.
+*/
+static void pcg_report_end(const char *name, int print_iter,
+                           bool no_convergence, int its, double nom0,
+                           double nom, bool zero_rhs, double norm_x,
+                           double norm_x_initial)
+{
+    if (no_convergence)
+    {
+        SA_ALERT_PRINTF("%s: No convergence!", name);
+        SA_PRINTF("(B r_0, r_0) = %g\n", nom0);
+        SA_PRINTF("(B r_N, r_N) = %g\n", nom);
+        SA_PRINTF("Number of %s iterations: %d\n", name, its);
+    }
+    if (0 == PROC_RANK && (print_iter >= 1 || no_convergence) && its > 0)
+    {
+        PROC_STR_STREAM << "Average reduction factor = "
+                        << pow(nom/nom0, 0.5/its);
+        if (zero_rhs)
+            PROC_STR_STREAM << " (|| x ||_A / || x_0 ||_A)^(1/i) = "
+                            << pow(norm_x / norm_x_initial, 1./(double)its);
+        PROC_STR_STREAM << "\n";
+        SA_PRINTF("%s", PROC_STR_STREAM.str().c_str());
+        PROC_CLEAR_STR_STREAM;
+    }
+}
+
 int kalchev_pcg(const HypreParMatrix &A, const Operator &B, const HypreParVector &b,
                 HypreParVector &x, int print_iter, int max_num_iter, double RTOLERANCE,
-                double ATOLERANCE, bool zero_rhs)
+                double ATOLERANCE, bool zero_rhs, bool flexible)
 {
     int i, dim = x.Size(), iters=0;
     double r0, den, nom, nom0, betanom=0., alpha, beta;
-    Vector r(dim), d(dim), z(dim);
+    Vector r(dim), d(dim), z(dim), ad_flexible(flexible ? dim : 0);
     Vector tmp(dim);
     double norm_x_prev=0., norm_x=0., norm_x_initial=0.;
+    const char *name = flexible ? "FCG" : "PCG";
+    // A d; the flexible variant still needs it after z = B r
+    Vector &ad = flexible ? ad_flexible : z;
 
     SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
     HypreParVector R(PROC_COMM, A.GetGlobalNumRows(), r.GetData(), A.GetRowStarts());
     HypreParVector D(PROC_COMM, A.GetGlobalNumRows(), d.GetData(), A.GetRowStarts());
     HypreParVector Z(PROC_COMM, A.GetGlobalNumRows(), z.GetData(), A.GetRowStarts());
+    HypreParVector AD(PROC_COMM, A.GetGlobalNumRows(), ad.GetData(), A.GetRowStarts());
     HypreParVector TMP(PROC_COMM, A.GetGlobalNumRows(), tmp.GetData(), A.GetRowStarts());
 
     A.Mult(x, r);
@@ -130,33 +420,18 @@ int kalchev_pcg(const HypreParMatrix &A, const Operator &B, const HypreParVector
     d = z;
     nom0 = nom = mbox_parallel_inner_product(Z, R);
 
-    if (print_iter == 1 && 0 == PROC_RANK)
-    {
-        PROC_STR_STREAM << "PCG Iteration: 0, (B r, r) = " << nom;
-        if (zero_rhs)
-            PROC_STR_STREAM << ", || x ||_A = " << norm_x_prev;
-        PROC_STR_STREAM << "\n";
-        SA_PRINTF("%s", PROC_STR_STREAM.str().c_str());
-        PROC_CLEAR_STR_STREAM;
-    }
+    if (print_iter == 1)
+        pcg_print_iteration(name, 0, nom, zero_rhs, norm_x_initial, 0.);
 
-    if (zero_rhs)
-    {
-        if ( (r0 = norm_x_initial * RTOLERANCE) < ATOLERANCE) r0 = ATOLERANCE;
-        if (norm_x_initial < r0)
-            return -1;
-    } else
-    {
-        if ( (r0 = nom * RTOLERANCE) < ATOLERANCE) r0 = ATOLERANCE;
-        if (nom < r0)
-            return -1;
-    }
+    if (!pcg_init_threshold(nom0, norm_x_initial, zero_rhs, RTOLERANCE,
+                            ATOLERANCE, r0))
+        return -1;
 
-    A.Mult(d, z);
-    den = mbox_parallel_inner_product(Z, D);
+    A.Mult(d, ad);
+    den = mbox_parallel_inner_product(AD, D);
 
     if (den < 0.0)
-        SA_ALERT_PRINTF("Negative denominator in step 0 of PCG: %g", den);
+        SA_ALERT_PRINTF("Negative denominator in step 0 of %s: %g", name, den);
 
     SA_ASSERT(0. != den);
 
@@ -166,9 +441,13 @@ int kalchev_pcg(const HypreParMatrix &A, const Operator &B, const HypreParVector
     //Start iteration
     for (i=1; i <= max_num_iter; i++)
     {
-        alpha = nom/den;
+        // a flexible B changes from call to call, so (d, r) replaces (B r, r)
+        if (flexible)
+            alpha = mbox_parallel_inner_product(D, R) / den;
+        else
+            alpha = nom/den;
         add(x, alpha, d, x);                  //  x = x + alpha d
-        add(r,-alpha, z, r);                  //  r = r - alpha z
+        add(r,-alpha, ad, r);                 //  r = r - alpha A d
 
         B.Mult(r, z);                         //  z = B r
         betanom = mbox_parallel_inner_product(R, Z);
@@ -179,21 +458,10 @@ int kalchev_pcg(const HypreParMatrix &A, const Operator &B, const HypreParVector
             norm_x = sqrt(mbox_parallel_inner_product(x, TMP));
         }
 
-        if (print_iter == 1 && 0 == PROC_RANK)
-        {
-            PROC_STR_STREAM << "PCG Iteration: " << i << ", (B r, r) = "
-                            << betanom;
-            if (zero_rhs)
-            {
-                PROC_STR_STREAM << ", || x ||_A = " << norm_x
-                                << ", || x ||_A / || x_prev ||_A = "
-                                << norm_x / norm_x_prev;
-                norm_x_prev = norm_x;
-            }
-            PROC_STR_STREAM << "\n";
-            SA_PRINTF("%s", PROC_STR_STREAM.str().c_str());
-            PROC_CLEAR_STR_STREAM;
-        }
+        if (print_iter == 1)
+            pcg_print_iteration(name, i, betanom, zero_rhs, norm_x,
+                                norm_x_prev);
+        norm_x_prev = norm_x;
 
         if (betanom < 0.0)
         {
@@ -202,48 +470,149 @@ int kalchev_pcg(const HypreParMatrix &A, const Operator &B, const HypreParVector
             break;
         }
 
-        if ((betanom < r0 && !zero_rhs) || (norm_x < r0 && zero_rhs))
+        if (pcg_converged(name, print_iter, i, nom0, betanom, zero_rhs,
+                          norm_x, r0))
         {
-            if (print_iter == 2)
-                SA_PRINTF("Number of PCG iterations: %d\n", i);
-            else
-                if (print_iter == 3)
-                {
-                    SA_PRINTF("(B r_0, r_0) = %g\n", nom0);
-                    SA_PRINTF("(B r_N, r_N) = %g\n", betanom);
-                    SA_PRINTF("Number of PCG iterations: %d\n", i);
-                }
             iters = i;
             break;
         }
 
-        beta = betanom/nom;
-        add(z, beta, d, d);                   //  d = z + beta d
-        A.Mult(d, z);
-        den = mbox_parallel_inner_product(D, Z);
+        if (flexible)
+        {
+            // Explicit A-orthogonalization of the new direction against the
+            // last one; the short recurrence of CG does not hold here.
+            beta = mbox_parallel_inner_product(Z, AD) / den;
+            add(z, -beta, d, d);              //  d = z - beta d
+        }
+        else
+        {
+            beta = betanom/nom;
+            add(z, beta, d, d);               //  d = z + beta d
+        }
+        A.Mult(d, ad);
+        den = mbox_parallel_inner_product(D, AD);
         nom = betanom;
+        if (flexible && den <= 0.0)
+        {
+            SA_RPRINTF(0,"%s","SPD breakdown!\n");
+            iters = -i;
+            break;
+        }
     }
-    if (i > max_num_iter)
-    {
-        SA_ALERT_PRINTF("%s", "PCG: No convergence!");
-        SA_PRINTF("(B r_0, r_0) = %g\n", nom0);
-        SA_PRINTF("(B r_N, r_N) = %g\n", betanom);
-        SA_PRINTF("Number of PCG iterations: %d\n", i-1);
+    const bool no_convergence = (i > max_num_iter);
+    if (no_convergence)
         iters = -(i-1);
-    }
-    if (0 == PROC_RANK && (print_iter >= 1 || i > max_num_iter))
+    pcg_report_end(name, print_iter, no_convergence, no_convergence ? i-1 : i,
+                   nom0, betanom, zero_rhs, norm_x, norm_x_initial);
+    return iters;
+}
+
+int pipelined_pcg(const HypreParMatrix &A, const Operator &B, const HypreParVector &b,
+                  HypreParVector &x, int print_iter, int max_num_iter, double RTOLERANCE,
+                  double ATOLERANCE, bool zero_rhs)
+{
+    int i, dim = x.Size(), iters=0;
+    double r0=0., gamma=0., gamma_old=0., delta, alpha=0., beta;
+    double nom0=0., norm_x=0., norm_x_initial=0., norm_x_prev=0.;
+    Vector r(dim), u(dim), w(dim), m(dim), n(dim);
+    Vector p(dim), s(dim), q(dim), z(dim);
+    double local[3], global[3];
+    MPI_Request request;
+
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+
+    A.Mult(x, r);
+    if (zero_rhs)
+        r *= -1.;
+    else
+        subtract(b, r, r);
+    B.Mult(r, u);
+    A.Mult(u, w);
+    p = 0.;
+    s = 0.;
+    q = 0.;
+    z = 0.;
+
+    for (i=0; ; i++)
     {
-        if (i > max_num_iter)
-            i--;
-        PROC_STR_STREAM << "Average reduction factor = "
-                        << pow(betanom/nom0, 0.5/i);
+        // All inner products of the iteration travel in one reduction that
+        // is hidden behind the preconditioner and the matvec. With a zero
+        // r.h.s. r = -A x, so || x ||_A^2 = -(x, r) comes along for free.
+        local[0] = r * u;
+        local[1] = w * u;
+        local[2] = zero_rhs ? -(x * r) : 0.;
+        MPI_Iallreduce(local, global, 3, MPI_DOUBLE, MPI_SUM, PROC_COMM,
+                       &request);
+        B.Mult(w, m);                         //  m = B w
+        A.Mult(m, n);                         //  n = A m
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        gamma = global[0];                    //  (B r, r)
+        delta = global[1];                    //  (A B r, B r)
         if (zero_rhs)
-            PROC_STR_STREAM << " (|| x ||_A / || x_0 ||_A)^(1/i) = "
-                            << pow(norm_x / norm_x_initial, 1./(double)i);
-        PROC_STR_STREAM << "\n";
-        SA_PRINTF("%s", PROC_STR_STREAM.str().c_str());
-        PROC_CLEAR_STR_STREAM;
+            norm_x = sqrt(std::max(global[2], 0.));
+
+        if (print_iter == 1)
+            pcg_print_iteration("PCG", i, gamma, zero_rhs, norm_x,
+                                norm_x_prev);
+
+        if (0 == i)
+        {
+            nom0 = gamma;
+            norm_x_initial = norm_x;
+            if (!pcg_init_threshold(nom0, norm_x_initial, zero_rhs,
+                                    RTOLERANCE, ATOLERANCE, r0))
+                return -1;
+        }
+        else
+        {
+            if (gamma < 0.0)
+            {
+                SA_RPRINTF(0,"%s","SPD breakdown!\n");
+                iters = -i;
+                break;
+            }
+            if (pcg_converged("PCG", print_iter, i, nom0, gamma, zero_rhs,
+                              norm_x, r0))
+            {
+                iters = i;
+                break;
+            }
+        }
+        if (i == max_num_iter)
+            break;
+        norm_x_prev = norm_x;
+
+        if (0 == i)
+        {
+            beta = 0.;
+            if (delta < 0.0)
+                SA_ALERT_PRINTF("Negative denominator in step 0 of PCG: %g", delta);
+            SA_ASSERT(0. != delta);
+            if (0. == delta)
+                return -1;
+            alpha = gamma / delta;
+        }
+        else
+        {
+            beta = gamma / gamma_old;
+            alpha = gamma / (delta - beta * gamma / alpha);
+        }
+        gamma_old = gamma;
+
+        add(n, beta, z, z);                   //  z = n + beta z
+        add(m, beta, q, q);                   //  q = m + beta q
+        add(w, beta, s, s);                   //  s = w + beta s
+        add(u, beta, p, p);                   //  p = u + beta p
+        x.Add(alpha, p);                      //  x = x + alpha p
+        r.Add(-alpha, s);                     //  r = r - alpha s
+        u.Add(-alpha, q);                     //  u = u - alpha q
+        w.Add(-alpha, z);                     //  w = w - alpha z
     }
+    const bool no_convergence = (i == max_num_iter && !iters);
+    if (no_convergence)
+        iters = -i;
+    pcg_report_end("PCG", print_iter, no_convergence, i, nom0, gamma,
+                   zero_rhs, norm_x, norm_x_initial);
     return iters;
 }
 
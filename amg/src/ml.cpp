@@ -45,6 +45,7 @@
 #include "tg.hpp"
 #include "elmat.hpp"
 #include "solve.hpp"
+#include "prof.hpp"
 
 namespace saamge
 {
@@ -64,6 +65,11 @@ MultilevelParameters::MultilevelParameters(
     avoid_ess_bdr_dofs(true),
     use_double_cycle(false),
     coarse_direct(false),
+    coarse_redist_threshold(0),
+    coarse_redist_rows(0),
+    reuse_evects(false),
+    reuse_tol(0.0),
+    lobpcg_threshold(0),
     smooth_drop_tol(0.0)
 {
     nparts_arr = new int[num_coarsenings];
@@ -71,12 +77,16 @@ MultilevelParameters::MultilevelParameters(
     nu_relax = new int[num_coarsenings];
     theta = new double[num_coarsenings];
     polynomial_coarse_space = new int[num_coarsenings];
+    relaxation = new smpr_relax_t[num_coarsenings];
+    cycle_mu = new int[num_coarsenings];
 
     nparts_arr[0] = nparts_arr_arg[0];
     nu_pro[0] = first_nu_pro;
     nu_relax[0] = nu_relax_arg;
     theta[0] = first_theta;
     polynomial_coarse_space[0] = polynomial_coarse_space_arg;
+    relaxation[0] = SMPR_RELAX_POLY;
+    cycle_mu[0] = 2;
 
     for (int i=1; i<num_coarsenings; ++i)
     {
@@ -85,6 +95,8 @@ MultilevelParameters::MultilevelParameters(
         nu_relax[i] = nu_relax_arg;
         theta[i] = theta_arg;
         polynomial_coarse_space[i] = polynomial_coarse_space_arg;
+        relaxation[i] = SMPR_RELAX_POLY;
+        cycle_mu[i] = 2;
     }
 }
 
@@ -105,9 +117,68 @@ MultilevelParameters::~MultilevelParameters()
     delete [] nu_relax;
     delete [] theta;
     delete [] polynomial_coarse_space;
+    delete [] relaxation;
+    delete [] cycle_mu;
+}
+
+void MultilevelParameters::set_relaxation(smpr_relax_t relax)
+{
+    for (int i=0; i<num_coarsenings; ++i)
+        relaxation[i] = relax;
 }
 
 
+/*! \brief Connects the levels into a cycle once all of them are built.
+*/
+static void ml_finish_hierarchy(ml_data_t& ml_data,
+                                const MultilevelParameters &mlp)
+{
+    ml_impose_cycle(ml_data,false);
+    if (mlp.get_use_correct_nullspace())
+    {
+        tg_data_t *tg_data = ml_data.levels_list.coarsest->tg_data;
+        SA_ASSERT(tg_data);
+        SA_ASSERT(tg_data->Ac);
+        tg_init_nullspace_coarse_solver(tg_data);
+    }
+}
+
+/*! \brief Builds the coarse space of the finest TG, spectral or polynomial
+           as \a mlp says.
+*/
+static void ml_build_finest_coarse_space(
+    HypreParMatrix& Ag, tg_data_t& tg_data,
+    const agg_partitioning_relations_t& agg_part_rels,
+    ElementMatrixProvider *elem_data_finest, const MultilevelParameters &mlp)
+{
+    if (tg_data.polynomial_coarse_space == 0 ||
+        tg_data.polynomial_coarse_space == 1)
+    {
+        ElementMatrixStandardGeometric * elmat_geom = 
+            dynamic_cast<ElementMatrixStandardGeometric*>(elem_data_finest);
+        SA_ASSERT(elmat_geom);
+        ParBilinearForm * pform = elmat_geom->GetParBilinearForm();
+        ParFiniteElementSpace * pfes = pform->ParFESpace();
+        ParMesh * pmesh = pfes->GetParMesh();
+        // whew, getting that pmesh was a lot of work...
+        bool use_spectral;
+        if (mlp.get_theta(0) <= 0.0)
+            use_spectral = false;
+        else
+            use_spectral = true;
+
+        tg_build_hierarchy_with_polynomial(
+            Ag, *pmesh, tg_data, agg_part_rels,
+            elem_data_finest, tg_data.polynomial_coarse_space,
+            use_spectral, mlp.get_avoid_ess_bdr_dofs());
+    }
+    else
+    {
+        tg_build_hierarchy(Ag, tg_data, agg_part_rels,
+                           elem_data_finest, mlp.get_avoid_ess_bdr_dofs());
+    }
+}
+
 void ml_produce_hierarchy_from_level(
     int coarsenings, int starting_level, ml_data_t& ml_data,
     const MultilevelParameters &mlp)
@@ -133,6 +204,9 @@ void ml_produce_hierarchy_from_level(
         SA_ASSERT(tg_data->Ac);
         HypreParMatrix * A = tg_data->Ac; 
         const int level = ml_data.levels_list.num_levels;
+        std::stringstream level_name;
+        level_name << "level " << level;
+        ProfScope level_scope(level_name.str());
         if (SA_IS_OUTPUT_LEVEL(5))
         {
             SA_RPRINTF(0,"%s","\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/"
@@ -176,8 +250,13 @@ void ml_produce_hierarchy_from_level(
             mlp.get_smooth_drop_tol(), mlp.get_use_arpack());
         SA_ASSERT(tg_data);
         SA_ASSERT(tg_data->interp_data);
+        tg_set_relaxation(*A, *tg_data, mlp.get_relaxation(i));
 
         tg_data->use_w_cycle = false;
+        tg_data->cycle_mu = mlp.get_cycle_mu(i);
+        tg_data->redist_threshold = mlp.get_coarse_redist_threshold();
+        tg_data->redist_rows = mlp.get_coarse_redist_rows();
+        tg_data->interp_data->lobpcg_threshold = mlp.get_lobpcg_threshold();
         tg_data->polynomial_coarse_space = mlp.get_polynomial_coarse_space(i);
 
         if (mlp.get_use_correct_nullspace() &&
@@ -221,18 +300,7 @@ void ml_produce_hierarchy_from_level(
                  "\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/"
                  "\\/\n");
 
-    ml_impose_cycle(ml_data,false);
-    if (mlp.get_use_correct_nullspace())
-    {
-        tg_data = ml_data.levels_list.coarsest->tg_data;
-        SA_ASSERT(tg_data);
-        SA_ASSERT(tg_data->Ac);
-        if (tg_data->coarse_solver)
-            delete tg_data->coarse_solver;
-        tg_data->coarse_solver = new CorrectNullspace(*tg_data->Ac,
-                                                      tg_data->scaling_P,
-                                                      3, false, true, false);
-    }
+    ml_finish_hierarchy(ml_data, mlp);
 }
 
 double ml_compute_OC_from_level(HypreParMatrix& A, const ml_data_t& ml_data,
@@ -370,10 +438,184 @@ void ml_impose_cycle(ml_data_t& ml_data, bool Wcycle)
         level->tg_data->tag = i;
         level->tg_data->coarse_solver = new VCycleSolver(level->coarser->tg_data,false);
         level->tg_data->coarse_solver->SetOperator(*level->tg_data->Ac);
+        tg_init_cycle_workspace(*level->tg_data);
         ++i;
     }
     level = ml_data.levels_list.coarsest;
     level->tg_data->tag = i;
+    tg_init_cycle_workspace(*level->tg_data);
+}
+
+void ml_init_cycle_workspace(ml_data_t& ml_data, ml_cycle_t cycle)
+{
+    const bool krylov = (ML_CYCLE_K == cycle);
+    for (levels_level_t *level = ml_data.levels_list.finest; level;
+         level = level->coarser)
+    {
+        tg_data_t *tg_data = level->tg_data;
+        SA_ASSERT(tg_data);
+        // the coarsest level never runs the flexible CG
+        if (!tg_data->cycle_ws ||
+            (krylov && level->coarser && !tg_data->cycle_ws->kr))
+            tg_init_cycle_workspace(*tg_data, krylov && level->coarser);
+    }
+}
+
+/*! \brief Approximately solves the coarse problem of \a level.
+
+    \a xc is expected to be zero on entry.
+*/
+static
+void ml_coarse_correction(levels_level_t *level, HypreParVector& rc,
+                          HypreParVector& xc, ml_cycle_t cycle);
+
+/*! \brief K-cycle coarse correction: flexible CG with one stored direction.
+
+    Notay's criterion stops it early when the residual dropped enough
+    (\f$\|r\| \le 0.25 \|r_0\|\f$).
+*/
+static
+void ml_kcycle_correction(levels_level_t *level, HypreParVector& rc,
+                          HypreParVector& xc)
+{
+    tg_data_t *tg_data = level->tg_data;
+    tg_cycle_workspace_t *ws = tg_data->cycle_ws;
+    SA_ASSERT(ws && ws->kr);
+    HypreParMatrix& Ac = *tg_data->Ac;
+    HypreParVector& r = *ws->kr;
+    HypreParVector& c = *ws->kc;
+    HypreParVector& d = *ws->kd;
+    HypreParVector& Ad = *ws->kAd;
+    HypreParVector& q = *ws->kq;
+
+    r = rc;
+    const double rr0 = mbox_parallel_inner_product(r, r);
+    double dAd_prev = 0.;
+    for (int k=0; k < tg_data->cycle_mu; ++k)
+    {
+        c = 0.0;
+        ml_cycle(level->coarser, Ac, r, c, ML_CYCLE_K);
+        Ac.Mult(c, q);
+        if (k > 0)
+        {
+            const double beta = mbox_parallel_inner_product(q, d) / dAd_prev;
+            add(c, -beta, d, d);
+            add(q, -beta, Ad, Ad);
+        }
+        else
+        {
+            d = c;
+            Ad = q;
+        }
+        const double dAd = mbox_parallel_inner_product(d, Ad);
+        if (dAd <= 0.)
+            break;
+        const double alpha = mbox_parallel_inner_product(d, r) / dAd;
+        xc.Add(alpha, d);
+        r.Add(-alpha, Ad);
+        dAd_prev = dAd;
+        if (k+1 < tg_data->cycle_mu &&
+            mbox_parallel_inner_product(r, r) <= 0.0625 * rr0)
+            break;
+    }
+}
+
+static
+void ml_coarse_correction(levels_level_t *level, HypreParVector& rc,
+                          HypreParVector& xc, ml_cycle_t cycle)
+{
+    tg_data_t *tg_data = level->tg_data;
+    HypreParMatrix& Ac = *tg_data->Ac;
+    if (!level->coarser)
+    {
+        SA_ASSERT(tg_data->coarse_solver);
+        tg_data->coarse_solver->Mult(rc, xc);
+        return;
+    }
+
+    switch (cycle)
+    {
+        case ML_CYCLE_V:
+            ml_cycle(level->coarser, Ac, rc, xc, ML_CYCLE_V);
+            break;
+        case ML_CYCLE_W:
+            for (int k=0; k < tg_data->cycle_mu; ++k)
+                ml_cycle(level->coarser, Ac, rc, xc, ML_CYCLE_W);
+            break;
+        case ML_CYCLE_F:
+            ml_cycle(level->coarser, Ac, rc, xc, ML_CYCLE_F);
+            ml_cycle(level->coarser, Ac, rc, xc, ML_CYCLE_V);
+            break;
+        case ML_CYCLE_K:
+            ml_kcycle_correction(level, rc, xc);
+            break;
+        default:
+            SA_ASSERT(false);
+    }
+}
+
+void ml_cycle(levels_level_t *level, HypreParMatrix& A, const Vector& b,
+              Vector& x, ml_cycle_t cycle)
+{
+    SA_ASSERT(level && level->tg_data);
+    tg_data_t *tg_data = level->tg_data;
+    tg_cycle_workspace_t *ws = tg_data->cycle_ws;
+    SA_ASSERT(ws);
+    SA_ASSERT(tg_data->Ac && tg_data->interp && tg_data->restr);
+    SA_ASSERT(ws->res->Size() == b.Size());
+
+    prof_begin("smoothing");
+    tg_data->pre_smoother(A, b, x, tg_data->poly_data);
+    prof_end();
+
+    A.Mult(x, *ws->res);
+    subtract(b, *ws->res, *ws->res);
+    tg_data->restr->Mult(*ws->res, *ws->resc);
+    *ws->xc = 0.0;
+
+    prof_begin("coarse solve");
+    ml_coarse_correction(level, *ws->resc, *ws->xc, cycle);
+    prof_end();
+
+    tg_data->interp->Mult(1.0, *ws->xc, 1.0, x);
+
+    prof_begin("smoothing");
+    tg_data->post_smoother(A, b, x, tg_data->poly_data);
+    prof_end();
+}
+
+double ml_predict_cycle_work(HypreParMatrix& A, const ml_data_t& ml_data,
+                             ml_cycle_t cycle)
+{
+    double work = 1.;
+    double visits = 1.;
+    double relative_nnz = 1.;
+    int k = 0;
+    for (levels_level_t *level = ml_data.levels_list.finest; level;
+         level = level->coarser, ++k)
+    {
+        // OC of a coarsening is 1 + nnz(coarse) / nnz(fine); the coarsest
+        // operator is solved once per visit of the level above it
+        relative_nnz *= ml_compute_OC_for_level(A, ml_data, k+1) - 1.;
+        switch (cycle)
+        {
+            case ML_CYCLE_V:
+                break;
+            case ML_CYCLE_W:
+            case ML_CYCLE_K:
+                if (level->coarser)
+                    visits *= level->tg_data->cycle_mu;
+                break;
+            case ML_CYCLE_F:
+                if (level->coarser)
+                    visits = k + 2;
+                break;
+            default:
+                SA_ASSERT(false);
+        }
+        work += visits * relative_nnz;
+    }
+    return work;
 }
 
 ml_data_t * ml_produce_data(
@@ -388,6 +630,9 @@ ml_data_t * ml_produce_data(
     SA_ASSERT(mlp.get_num_coarsenings() > 0);
     SA_ASSERT(agg_part_rels);
 
+    SA_PROF_SCOPE("setup");
+    prof_begin("level 0");
+
     // Coarsen the finest level.
     SA_RPRINTF_L(0,4,"%s", "---------- ml_produce_all { ---------------------\n");
     if (SA_IS_OUTPUT_LEVEL(5))
@@ -407,8 +652,13 @@ ml_data_t * ml_produce_data(
         mlp.get_use_arpack());
     SA_ASSERT(tg_data);
     SA_ASSERT(tg_data->interp_data);
+    tg_set_relaxation(Ag, *tg_data, mlp.get_relaxation(0));
     
     tg_data->use_w_cycle = false;
+    tg_data->cycle_mu = mlp.get_cycle_mu(0);
+    tg_data->redist_threshold = mlp.get_coarse_redist_threshold();
+    tg_data->redist_rows = mlp.get_coarse_redist_rows();
+    tg_data->interp_data->lobpcg_threshold = mlp.get_lobpcg_threshold();
     tg_data->polynomial_coarse_space = mlp.get_polynomial_coarse_space(0);
 
     if (mlp.get_use_correct_nullspace() && 
@@ -417,32 +667,8 @@ ml_data_t * ml_produce_data(
         tg_data->interp_data->scaling_P = true;
     }
 
-    if (tg_data->polynomial_coarse_space == 0 ||
-        tg_data->polynomial_coarse_space == 1)
-    {
-        ElementMatrixStandardGeometric * elmat_geom = 
-            dynamic_cast<ElementMatrixStandardGeometric*>(elem_data_finest);
-        SA_ASSERT(elmat_geom);
-        ParBilinearForm * pform = elmat_geom->GetParBilinearForm();
-        ParFiniteElementSpace * pfes = pform->ParFESpace();
-        ParMesh * pmesh = pfes->GetParMesh();
-        // whew, getting that pmesh was a lot of work...
-        bool use_spectral;
-        if (mlp.get_theta(0) <= 0.0)
-            use_spectral = false;
-        else
-            use_spectral = true;
-
-        tg_build_hierarchy_with_polynomial(
-            Ag, *pmesh, *tg_data, *agg_part_rels,
-            elem_data_finest, tg_data->polynomial_coarse_space,
-            use_spectral, mlp.get_avoid_ess_bdr_dofs());
-    }
-    else
-    {
-        tg_build_hierarchy(Ag, *tg_data, *agg_part_rels,
-                           elem_data_finest, mlp.get_avoid_ess_bdr_dofs());
-    }
+    ml_build_finest_coarse_space(Ag, *tg_data, *agg_part_rels,
+                                 elem_data_finest, mlp);
 
     if (agg_part_rels->testmesh)
     {
@@ -457,6 +683,7 @@ ml_data_t * ml_produce_data(
     levels_list_push_coarse_data(ml_data->levels_list, agg_part_rels, tg_data);
     SA_ASSERT(ml_data->levels_list.finest == ml_data->levels_list.coarsest);
     SA_ASSERT(1 == ml_data->levels_list.num_levels);
+    prof_end();
 
     // Build all other levels.
     ml_produce_hierarchy_from_level(mlp.get_num_coarsenings(), 1, *ml_data, mlp);
@@ -471,6 +698,100 @@ ml_data_t * ml_produce_data(
     return ml_data;
 }
 
+void ml_update_coefficients(
+    HypreParMatrix& Ag, ml_data_t& ml_data,
+    ElementMatrixProvider *elem_data_finest, const MultilevelParameters &mlp)
+{
+    SA_ASSERT(elem_data_finest);
+    SA_ASSERT(ml_data.levels_list.finest);
+    SA_ASSERT(ml_data.levels_list.num_levels == mlp.get_num_coarsenings());
+
+    SA_PROF_SCOPE("update");
+    SA_RPRINTF_L(0,4,"%s", "---------- ml_update_coefficients { --------------\n");
+
+    const tg_cycle_workspace_t *finest_ws =
+        ml_data.levels_list.finest->tg_data->cycle_ws;
+    const bool krylov = (finest_ws && finest_ws->kr);
+
+    HypreParMatrix *A = &Ag;
+    bool rebuilt_coarser = false;
+    int i = 0;
+    for (levels_level_t *level = ml_data.levels_list.finest; level;
+         level = level->coarser, ++i)
+    {
+        tg_data_t *tg_data = level->tg_data;
+        agg_partitioning_relations_t *agg_part_rels = level->agg_part_rels;
+        SA_ASSERT(tg_data);
+        SA_ASSERT(agg_part_rels);
+        std::stringstream level_name;
+        level_name << "level " << i;
+        ProfScope level_scope(level_name.str());
+
+        // the coarser levels can stay only if every MIS gets as many coarse
+        // DoFs as before
+        const int num_mises = agg_part_rels->num_mises;
+        int *old_numcoarsedof = new int[num_mises];
+        memcpy(old_numcoarsedof, tg_data->interp_data->mis_numcoarsedof,
+               sizeof(int) * num_mises);
+
+        tg_data->interp_data->reuse_evects = mlp.get_reuse_evects();
+        tg_data->interp_data->reuse_tol = mlp.get_reuse_tol();
+        tg_reset_coarse_space(*A, *tg_data);
+        tg_set_relaxation(*A, *tg_data, mlp.get_relaxation(i));
+        if (0 == i)
+        {
+            if (tg_data->elem_data != elem_data_finest)
+            {
+                delete tg_data->elem_data;
+                tg_data->elem_data = NULL;
+            }
+            ml_build_finest_coarse_space(Ag, *tg_data, *agg_part_rels,
+                                         elem_data_finest, mlp);
+        }
+        else
+            tg_build_hierarchy(*A, *tg_data, *agg_part_rels,
+                               tg_data->elem_data,
+                               mlp.get_avoid_ess_bdr_dofs());
+        tg_update_coarse_operator(*A, tg_data, NULL == level->coarser,
+                                  mlp.get_coarse_direct());
+
+        int same_space = 1;
+        if (level->coarser)
+        {
+            agg_broadcast_mis_tent_interps(
+                *agg_part_rels, tg_data->interp_data->mis_numcoarsedof,
+                tg_data->interp_data->mis_tent_interps);
+            int same_local = 1;
+            for (int mis=0; mis < num_mises; ++mis)
+                if (old_numcoarsedof[mis] !=
+                    tg_data->interp_data->mis_numcoarsedof[mis])
+                    same_local = 0;
+            MPI_Allreduce(&same_local, &same_space, 1, MPI_INT, MPI_MIN,
+                          PROC_COMM);
+        }
+        delete [] old_numcoarsedof;
+
+        if (!same_space)
+        {
+            SA_RPRINTF_L(0, 4, "Coarse space of level %d changed, building "
+                         "the coarser levels again.\n", i);
+            levels_list_free_level_and_all_coarser(ml_data.levels_list, i+1);
+            // this also connects the levels
+            ml_produce_hierarchy_from_level(mlp.get_num_coarsenings(), i+1,
+                                            ml_data, mlp);
+            rebuilt_coarser = true;
+            break;
+        }
+        A = tg_data->Ac;
+    }
+    if (!rebuilt_coarser)
+        ml_finish_hierarchy(ml_data, mlp);
+    if (krylov)
+        ml_init_cycle_workspace(ml_data, ML_CYCLE_K);
+
+    SA_RPRINTF_L(0,4,"%s", "---------- } ml_update_coefficients --------------\n");
+}
+
 void ml_free_data(ml_data_t *ml_data)
 {
     if (!ml_data) return;
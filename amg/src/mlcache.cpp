@@ -0,0 +1,789 @@
+/*
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+   @file Persistent on-disk cache of a built multilevel hierarchy.
+
+   A shard consists of a fixed header followed by the payload. The payload
+   is, level by level (finest first), the coarse partitioning relations
+   (skipped on the finest level, which the caller owns) and the TG data that
+   is expensive to recompute: the MIS tentative interpolants, the tentative
+   and final interpolants and the coarse operator. Everything that is cheap
+   (smoother diagonals, restrictions, solvers) is rebuilt on reading.
+
+   Arrays are stored with their length in front, a negative length meaning
+   a NULL pointer. Parallel matrices are stored as the local hypre diag and
+   offd blocks together with the column map, so they are restored with
+   exactly the same local layout.
+*/
+
+#include "common.hpp"
+#include "mlcache.hpp"
+#include <mfem.hpp>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "levels.hpp"
+#include "tg.hpp"
+#include "solve.hpp"
+
+namespace saamge
+{
+using namespace mfem;
+
+/* Types */
+/*! \brief The header in front of every shard.
+*/
+typedef struct {
+    char magic[8]; /*!< Always "SAAMGEML". */
+    int version; /*!< \b MLCACHE_VERSION at the time of writing. */
+    int hypre_int_size; /*!< sizeof(HYPRE_Int) at the time of writing. */
+    unsigned long long key; /*!< See \b mlcache_key. */
+    int num_procs; /*!< The number of processes that wrote the hierarchy. */
+    int rank; /*!< The rank of the process that wrote the shard. */
+    int num_levels; /*!< The number of levels (coarsenings) in the shard. */
+    int reserved;
+    unsigned long long payload_bytes; /*!< The size of the payload. */
+    unsigned long long payload_hash; /*!< FNV-1a hash of the payload. */
+} mlcache_header_t;
+
+/*! \brief Sequential writer that keeps track of the payload size and hash.
+*/
+typedef struct {
+    std::ofstream *stream;
+    unsigned long long bytes;
+    unsigned long long hash;
+} mlcache_writer_t;
+
+/*! \brief Sequential reader over a mapped shard.
+*/
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t pos;
+} mlcache_reader_t;
+
+/* Static Variables */
+static const char MLCACHE_MAGIC[8] = {'S', 'A', 'A', 'M', 'G', 'E', 'M', 'L'};
+static const unsigned long long MLCACHE_FNV_OFFSET = 14695981039346656037ULL;
+static const unsigned long long MLCACHE_FNV_PRIME = 1099511628211ULL;
+
+/* Static Functions */
+/*! \brief FNV-1a hashing of \a bytes bytes, continuing from \a h.
+*/
+static inline
+unsigned long long mlcache_hash(unsigned long long h, const void *data,
+                                size_t bytes)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i=0; i < bytes; ++i)
+    {
+        h ^= p[i];
+        h *= MLCACHE_FNV_PRIME;
+    }
+    return h;
+}
+
+template <typename T>
+static inline
+unsigned long long mlcache_hash_val(unsigned long long h, T val)
+{
+    return mlcache_hash(h, &val, sizeof(val));
+}
+
+static unsigned long long mlcache_hash_csr(unsigned long long h,
+                                          hypre_CSRMatrix *csr)
+{
+    const HYPRE_Int nrows = hypre_CSRMatrixNumRows(csr);
+    const HYPRE_Int *I = hypre_CSRMatrixI(csr);
+    const HYPRE_Int nnz = I ? I[nrows] : 0;
+    h = mlcache_hash_val(h, nrows);
+    h = mlcache_hash_val(h, hypre_CSRMatrixNumCols(csr));
+    h = mlcache_hash_val(h, nnz);
+    if (I)
+        h = mlcache_hash(h, I, sizeof(*I) * (nrows + 1));
+    if (nnz)
+    {
+        h = mlcache_hash(h, hypre_CSRMatrixJ(csr), sizeof(HYPRE_Int) * nnz);
+        h = mlcache_hash(h, hypre_CSRMatrixData(csr), sizeof(double) * nnz);
+    }
+    return h;
+}
+
+static std::string mlcache_shard_name(const char *dir, unsigned long long key,
+                                      int rank)
+{
+    std::stringstream name;
+    name << dir << "/saamge_ml_" << std::hex << std::setw(16)
+         << std::setfill('0') << key << std::dec << "." << rank;
+    return name.str();
+}
+
+static inline
+void mlcache_put(mlcache_writer_t& w, const void *data, size_t bytes)
+{
+    if (!bytes)
+        return;
+    w.stream->write((const char *)data, bytes);
+    w.hash = mlcache_hash(w.hash, data, bytes);
+    w.bytes += bytes;
+}
+
+static inline
+void mlcache_put_int(mlcache_writer_t& w, int val)
+{
+    mlcache_put(w, &val, sizeof(val));
+}
+
+/*! \brief Writes \a n and then the array, \a n is ignored if \a arr is NULL.
+*/
+template <typename T>
+static inline
+void mlcache_put_arr(mlcache_writer_t& w, const T *arr, int n)
+{
+    if (!arr)
+        n = -1;
+    mlcache_put_int(w, n);
+    if (n > 0)
+        mlcache_put(w, arr, sizeof(*arr) * n);
+}
+
+static void mlcache_put_table(mlcache_writer_t& w, const Table *tbl)
+{
+    if (!tbl)
+    {
+        mlcache_put_int(w, -1);
+        return;
+    }
+    const int size = tbl->Size();
+    const int nnz = tbl->Size_of_connections();
+    SA_ASSERT(0 <= size && tbl->GetI());
+    mlcache_put_int(w, size);
+    mlcache_put_int(w, nnz);
+    mlcache_put(w, tbl->GetI(), sizeof(int) * (size + 1));
+    mlcache_put(w, tbl->GetJ(), sizeof(int) * nnz);
+}
+
+static void mlcache_put_sparse_matr(mlcache_writer_t& w,
+                                    const SparseMatrix *spm)
+{
+    if (!spm)
+    {
+        mlcache_put_int(w, -1);
+        return;
+    }
+    SA_ASSERT(const_cast<SparseMatrix *>(spm)->Finalized());
+    const int size = spm->Size();
+    const int nnz = spm->NumNonZeroElems();
+    mlcache_put_int(w, size);
+    mlcache_put_int(w, spm->Width());
+    mlcache_put_int(w, nnz);
+    mlcache_put(w, spm->GetI(), sizeof(int) * (size + 1));
+    mlcache_put(w, spm->GetJ(), sizeof(int) * nnz);
+    mlcache_put(w, spm->GetData(), sizeof(double) * nnz);
+}
+
+static void mlcache_put_dense_matr(mlcache_writer_t& w, const DenseMatrix *dem)
+{
+    if (!dem)
+    {
+        mlcache_put_int(w, -1);
+        return;
+    }
+    mlcache_put_int(w, dem->Height());
+    mlcache_put_int(w, dem->Width());
+    mlcache_put(w, dem->Data(), sizeof(double) * dem->Height() * dem->Width());
+}
+
+static void mlcache_put_csr_arrays(mlcache_writer_t& w, hypre_CSRMatrix *csr,
+                                   HYPRE_Int nrows, HYPRE_Int nnz)
+{
+    SA_ASSERT(hypre_CSRMatrixI(csr));
+    mlcache_put(w, hypre_CSRMatrixI(csr), sizeof(HYPRE_Int) * (nrows + 1));
+    mlcache_put(w, hypre_CSRMatrixJ(csr), sizeof(HYPRE_Int) * nnz);
+    mlcache_put(w, hypre_CSRMatrixData(csr), sizeof(double) * nnz);
+}
+
+static void mlcache_put_parallel_matr(mlcache_writer_t& w, HypreParMatrix *A)
+{
+    if (!A)
+    {
+        mlcache_put_int(w, -1);
+        return;
+    }
+    mlcache_put_int(w, 1);
+
+    hypre_ParCSRMatrix *hA = (hypre_ParCSRMatrix *)(*A);
+    hypre_CSRMatrix *diag = hypre_ParCSRMatrixDiag(hA);
+    hypre_CSRMatrix *offd = hypre_ParCSRMatrixOffd(hA);
+    const HYPRE_Int diag_rows = hypre_CSRMatrixNumRows(diag);
+    const HYPRE_Int offd_rows = hypre_CSRMatrixNumRows(offd);
+    HYPRE_Int dims[12];
+    dims[0] = hypre_ParCSRMatrixGlobalNumRows(hA);
+    dims[1] = hypre_ParCSRMatrixGlobalNumCols(hA);
+    dims[2] = hypre_ParCSRMatrixRowStarts(hA)[0];
+    dims[3] = hypre_ParCSRMatrixRowStarts(hA)[1];
+    dims[4] = hypre_ParCSRMatrixColStarts(hA)[0];
+    dims[5] = hypre_ParCSRMatrixColStarts(hA)[1];
+    dims[6] = diag_rows;
+    dims[7] = hypre_CSRMatrixNumCols(diag);
+    dims[8] = hypre_CSRMatrixI(diag)[diag_rows];
+    dims[9] = offd_rows;
+    dims[10] = hypre_CSRMatrixNumCols(offd);
+    dims[11] = hypre_CSRMatrixI(offd) ? hypre_CSRMatrixI(offd)[offd_rows] : 0;
+    mlcache_put(w, dims, sizeof(dims));
+
+    mlcache_put_csr_arrays(w, diag, diag_rows, dims[8]);
+    mlcache_put_csr_arrays(w, offd, offd_rows, dims[11]);
+    mlcache_put(w, hypre_ParCSRMatrixColMapOffd(hA),
+                sizeof(HYPRE_Int) * dims[10]);
+}
+
+static void mlcache_put_agg_part_rels(
+    mlcache_writer_t& w, const agg_partitioning_relations_t& agg_part_rels,
+    int fine_num_mises)
+{
+    const int ND = agg_part_rels.ND;
+    const int num_mises = agg_part_rels.num_mises;
+    const int num_elems = agg_part_rels.elem_to_elem ?
+                              agg_part_rels.elem_to_elem->Size() : -1;
+    const int AE_conns = agg_part_rels.dof_to_AE ?
+                             agg_part_rels.dof_to_AE->Size_of_connections() : -1;
+
+    SA_ASSERT(agg_part_rels.owns_Dof_TrueDof);
+    mlcache_put_int(w, ND);
+    mlcache_put_int(w, agg_part_rels.nparts);
+    mlcache_put_int(w, agg_part_rels.num_owned_mises);
+    mlcache_put_int(w, num_mises);
+    mlcache_put_int(w, agg_part_rels.testmesh);
+
+    mlcache_put_arr(w, agg_part_rels.partitioning, num_elems);
+    mlcache_put_table(w, agg_part_rels.dof_to_elem);
+    mlcache_put_table(w, agg_part_rels.dof_to_dof);
+    mlcache_put_table(w, agg_part_rels.elem_to_dof);
+    mlcache_put_table(w, agg_part_rels.AE_to_elem);
+    mlcache_put_table(w, agg_part_rels.elem_to_AE);
+    mlcache_put_table(w, agg_part_rels.elem_to_elem);
+    mlcache_put_table(w, agg_part_rels.AE_to_dof);
+    mlcache_put_table(w, agg_part_rels.dof_to_AE);
+    mlcache_put_arr(w, agg_part_rels.dof_id_inAE, AE_conns);
+    mlcache_put_arr(w, agg_part_rels.agg_flags, ND);
+
+    mlcache_put_table(w, agg_part_rels.truemis_to_dof);
+    mlcache_put_table(w, agg_part_rels.mis_to_dof);
+    mlcache_put_arr(w, agg_part_rels.mis_master, num_mises);
+    mlcache_put_table(w, agg_part_rels.mis_to_AE);
+    mlcache_put_table(w, agg_part_rels.AE_to_mis);
+    mlcache_put_parallel_matr(w, agg_part_rels.mis_truemis);
+    mlcache_put_arr(w, agg_part_rels.mises, ND);
+    mlcache_put_arr(w, agg_part_rels.mises_size, num_mises);
+
+    mlcache_put_arr(w, agg_part_rels.mis_coarsedofoffsets, fine_num_mises + 1);
+    mlcache_put_arr(w, agg_part_rels.dof_masterproc, ND);
+    mlcache_put_parallel_matr(w, agg_part_rels.Dof_TrueDof);
+}
+
+static void mlcache_put_tg_data(mlcache_writer_t& w, const tg_data_t& tg_data)
+{
+    const interp_data_t *interp_data = tg_data.interp_data;
+    SA_ASSERT(interp_data);
+    const int num_mises = interp_data->num_mises;
+
+    mlcache_put_int(w, interp_data->scaling_P);
+    mlcache_put_int(w, interp_data->coarse_truedof_offset);
+    mlcache_put_int(w, num_mises);
+    mlcache_put_arr(w, interp_data->tent_interp_offsets.GetData(),
+                    interp_data->tent_interp_offsets.Size());
+    mlcache_put_arr(w, interp_data->mis_numcoarsedof, num_mises);
+    if (interp_data->mis_tent_interps)
+    {
+        mlcache_put_int(w, num_mises);
+        for (int i=0; i < num_mises; ++i)
+            mlcache_put_dense_matr(w, interp_data->mis_tent_interps[i]);
+    }
+    else
+        mlcache_put_int(w, -1);
+
+    mlcache_put_sparse_matr(w, tg_data.ltent_interp);
+    mlcache_put_parallel_matr(w, tg_data.tent_interp);
+    mlcache_put_parallel_matr(w, tg_data.interp);
+    mlcache_put_parallel_matr(w, tg_data.scaling_P);
+    mlcache_put_parallel_matr(w, tg_data.Ac);
+}
+
+static inline
+const char *mlcache_get(mlcache_reader_t& r, size_t bytes)
+{
+    SA_ASSERT(r.pos + bytes <= r.size);
+    const char *p = r.data + r.pos;
+    r.pos += bytes;
+    return p;
+}
+
+static inline
+void mlcache_get(mlcache_reader_t& r, void *dst, size_t bytes)
+{
+    if (bytes)
+        memcpy(dst, mlcache_get(r, bytes), bytes);
+}
+
+static inline
+int mlcache_get_int(mlcache_reader_t& r)
+{
+    int val;
+    mlcache_get(r, &val, sizeof(val));
+    return val;
+}
+
+/*! \brief Counterpart of \b mlcache_put_arr. Returns NULL for a NULL array.
+*/
+template <typename T>
+static T *mlcache_get_arr(mlcache_reader_t& r, int *n=NULL)
+{
+    const int size = mlcache_get_int(r);
+    if (n)
+        *n = size;
+    if (size < 0)
+        return NULL;
+    T *arr = new T[size];
+    mlcache_get(r, arr, sizeof(*arr) * size);
+    return arr;
+}
+
+static Table *mlcache_get_table(mlcache_reader_t& r)
+{
+    const int size = mlcache_get_int(r);
+    if (size < 0)
+        return NULL;
+    const int nnz = mlcache_get_int(r);
+    int *I = new int[size + 1];
+    int *J = new int[nnz];
+    mlcache_get(r, I, sizeof(*I) * (size + 1));
+    mlcache_get(r, J, sizeof(*J) * nnz);
+    SA_ASSERT(nnz == I[size]);
+    Table *tbl = new Table;
+    tbl->SetIJ(I, J, size);
+    return tbl;
+}
+
+static SparseMatrix *mlcache_get_sparse_matr(mlcache_reader_t& r)
+{
+    const int size = mlcache_get_int(r);
+    if (size < 0)
+        return NULL;
+    const int width = mlcache_get_int(r);
+    const int nnz = mlcache_get_int(r);
+    int *I = new int[size + 1];
+    int *J = new int[nnz];
+    double *data = new double[nnz];
+    mlcache_get(r, I, sizeof(*I) * (size + 1));
+    mlcache_get(r, J, sizeof(*J) * nnz);
+    mlcache_get(r, data, sizeof(*data) * nnz);
+    SA_ASSERT(nnz == I[size]);
+    return (new SparseMatrix(I, J, data, size, width));
+}
+
+static DenseMatrix *mlcache_get_dense_matr(mlcache_reader_t& r)
+{
+    const int height = mlcache_get_int(r);
+    if (height < 0)
+        return NULL;
+    const int width = mlcache_get_int(r);
+    DenseMatrix *dem = new DenseMatrix(height, width);
+    mlcache_get(r, dem->Data(), sizeof(double) * height * width);
+    return dem;
+}
+
+static void mlcache_get_csr_arrays(mlcache_reader_t& r, hypre_CSRMatrix *csr,
+                                   HYPRE_Int nrows, HYPRE_Int nnz)
+{
+    SA_ASSERT(hypre_CSRMatrixNumRows(csr) == nrows);
+    SA_ASSERT(hypre_CSRMatrixI(csr));
+    mlcache_get(r, hypre_CSRMatrixI(csr), sizeof(HYPRE_Int) * (nrows + 1));
+    if (nnz)
+    {
+        SA_ASSERT(hypre_CSRMatrixJ(csr) && hypre_CSRMatrixData(csr));
+        mlcache_get(r, hypre_CSRMatrixJ(csr), sizeof(HYPRE_Int) * nnz);
+        mlcache_get(r, hypre_CSRMatrixData(csr), sizeof(double) * nnz);
+    }
+}
+
+/*! \brief Counterpart of \b mlcache_put_parallel_matr. Collective.
+*/
+static HypreParMatrix *mlcache_get_parallel_matr(mlcache_reader_t& r)
+{
+    if (mlcache_get_int(r) < 0)
+        return NULL;
+
+    HYPRE_Int dims[12];
+    mlcache_get(r, dims, sizeof(dims));
+
+    HYPRE_Int *row_starts = hypre_CTAlloc(HYPRE_Int, 2);
+    HYPRE_Int *col_starts = hypre_CTAlloc(HYPRE_Int, 2);
+    SA_ASSERT(row_starts && col_starts);
+    row_starts[0] = dims[2];
+    row_starts[1] = dims[3];
+    col_starts[0] = dims[4];
+    col_starts[1] = dims[5];
+
+    hypre_ParCSRMatrix *hA = hypre_ParCSRMatrixCreate(
+        PROC_COMM, dims[0], dims[1], row_starts, col_starts, dims[10],
+        dims[8], dims[11]);
+    hypre_ParCSRMatrixInitialize(hA);
+    SA_ASSERT(hypre_CSRMatrixNumCols(hypre_ParCSRMatrixDiag(hA)) == dims[7]);
+
+    mlcache_get_csr_arrays(r, hypre_ParCSRMatrixDiag(hA), dims[6], dims[8]);
+    mlcache_get_csr_arrays(r, hypre_ParCSRMatrixOffd(hA), dims[9], dims[11]);
+    mlcache_get(r, hypre_ParCSRMatrixColMapOffd(hA),
+                sizeof(HYPRE_Int) * dims[10]);
+
+    hypre_ParCSRMatrixSetNumNonzeros(hA);
+    hypre_MatvecCommPkgCreate(hA);
+
+    return (new HypreParMatrix(hA));
+}
+
+static agg_partitioning_relations_t *mlcache_get_agg_part_rels(
+    mlcache_reader_t& r)
+{
+    agg_partitioning_relations_t *agg_part_rels =
+        new agg_partitioning_relations_t;
+    memset(agg_part_rels, 0, sizeof(*agg_part_rels));
+
+    agg_part_rels->ND = mlcache_get_int(r);
+    agg_part_rels->nparts = mlcache_get_int(r);
+    agg_part_rels->num_owned_mises = mlcache_get_int(r);
+    agg_part_rels->num_mises = mlcache_get_int(r);
+    agg_part_rels->testmesh = mlcache_get_int(r);
+
+    agg_part_rels->partitioning = mlcache_get_arr<int>(r);
+    agg_part_rels->dof_to_elem = mlcache_get_table(r);
+    agg_part_rels->dof_to_dof = mlcache_get_table(r);
+    agg_part_rels->elem_to_dof = mlcache_get_table(r);
+    agg_part_rels->AE_to_elem = mlcache_get_table(r);
+    agg_part_rels->elem_to_AE = mlcache_get_table(r);
+    agg_part_rels->elem_to_elem = mlcache_get_table(r);
+    agg_part_rels->AE_to_dof = mlcache_get_table(r);
+    agg_part_rels->dof_to_AE = mlcache_get_table(r);
+    agg_part_rels->dof_id_inAE = mlcache_get_arr<int>(r);
+    agg_part_rels->agg_flags = mlcache_get_arr<agg_dof_status_t>(r);
+
+    agg_part_rels->truemis_to_dof = mlcache_get_table(r);
+    agg_part_rels->mis_to_dof = mlcache_get_table(r);
+    agg_part_rels->mis_master = mlcache_get_arr<int>(r);
+    agg_part_rels->mis_to_AE = mlcache_get_table(r);
+    agg_part_rels->AE_to_mis = mlcache_get_table(r);
+    agg_part_rels->mis_truemis = mlcache_get_parallel_matr(r);
+    agg_part_rels->mises = mlcache_get_arr<int>(r);
+    agg_part_rels->mises_size = mlcache_get_arr<int>(r);
+
+    agg_part_rels->mis_coarsedofoffsets = mlcache_get_arr<int>(r);
+    agg_part_rels->dof_masterproc = mlcache_get_arr<int>(r);
+    agg_part_rels->Dof_TrueDof = mlcache_get_parallel_matr(r);
+    agg_part_rels->owns_Dof_TrueDof = true;
+
+    return agg_part_rels;
+}
+
+/*! \brief Fills in what \b tg_init_data does not compute.
+*/
+static void mlcache_get_tg_data(mlcache_reader_t& r, tg_data_t& tg_data)
+{
+    interp_data_t *interp_data = tg_data.interp_data;
+    SA_ASSERT(interp_data);
+
+    interp_data->scaling_P = mlcache_get_int(r);
+    interp_data->coarse_truedof_offset = mlcache_get_int(r);
+    interp_data->num_mises = mlcache_get_int(r);
+
+    int n;
+    int *offsets = mlcache_get_arr<int>(r, &n);
+    interp_data->tent_interp_offsets.SetSize(n > 0 ? n : 0);
+    if (n > 0)
+        memcpy(interp_data->tent_interp_offsets.GetData(), offsets,
+               sizeof(*offsets) * n);
+    delete [] offsets;
+
+    interp_data->mis_numcoarsedof = mlcache_get_arr<int>(r);
+    n = mlcache_get_int(r);
+    SA_ASSERT(n < 0 || n == interp_data->num_mises);
+    if (n > 0)
+    {
+        interp_data->mis_tent_interps = new DenseMatrix*[n];
+        for (int i=0; i < n; ++i)
+            interp_data->mis_tent_interps[i] = mlcache_get_dense_matr(r);
+    }
+
+    tg_data.ltent_interp = mlcache_get_sparse_matr(r);
+    tg_data.tent_interp = mlcache_get_parallel_matr(r);
+    tg_data.interp = mlcache_get_parallel_matr(r);
+    tg_data.scaling_P = mlcache_get_parallel_matr(r);
+    tg_data.Ac = mlcache_get_parallel_matr(r);
+    SA_ASSERT(tg_data.interp && tg_data.Ac);
+    tg_data.restr = tg_data.interp->Transpose();
+}
+
+/*! \brief Checks the header and the payload hash of a mapped shard.
+*/
+static bool mlcache_check_shard(const char *data, size_t size,
+                                unsigned long long key, int num_levels)
+{
+    mlcache_header_t header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MLCACHE_MAGIC, sizeof(header.magic)) ||
+        header.version != MLCACHE_VERSION ||
+        header.hypre_int_size != (int)sizeof(HYPRE_Int) ||
+        header.key != key || header.num_procs != PROC_NUM ||
+        header.rank != PROC_RANK || header.num_levels != num_levels ||
+        header.payload_bytes != size - sizeof(header))
+        return false;
+    return (header.payload_hash ==
+            mlcache_hash(MLCACHE_FNV_OFFSET, data + sizeof(header),
+                         size - sizeof(header)));
+}
+
+/* Functions */
+
+unsigned long long mlcache_key(
+    HypreParMatrix& Ag, const agg_partitioning_relations_t& agg_part_rels,
+    const MultilevelParameters& mlp)
+{
+    hypre_ParCSRMatrix *hA = (hypre_ParCSRMatrix *)Ag;
+    unsigned long long h = MLCACHE_FNV_OFFSET;
+
+    // Local part, the rank makes identical local data on different
+    // processes count.
+    h = mlcache_hash_val(h, PROC_RANK);
+    h = mlcache_hash_csr(h, hypre_ParCSRMatrixDiag(hA));
+    h = mlcache_hash_csr(h, hypre_ParCSRMatrixOffd(hA));
+    h = mlcache_hash(h, hypre_ParCSRMatrixColMapOffd(hA), sizeof(HYPRE_Int) *
+                     hypre_CSRMatrixNumCols(hypre_ParCSRMatrixOffd(hA)));
+    h = mlcache_hash(h, hypre_ParCSRMatrixRowStarts(hA), sizeof(HYPRE_Int) * 2);
+    h = mlcache_hash(h, hypre_ParCSRMatrixColStarts(hA), sizeof(HYPRE_Int) * 2);
+    h = mlcache_hash_val(h, agg_part_rels.ND);
+    h = mlcache_hash_val(h, agg_part_rels.nparts);
+    SA_ASSERT(agg_part_rels.AE_to_dof);
+    const Table& AE_to_dof = *agg_part_rels.AE_to_dof;
+    h = mlcache_hash(h, AE_to_dof.GetI(), sizeof(int) * (AE_to_dof.Size() + 1));
+    h = mlcache_hash(h, AE_to_dof.GetJ(),
+                     sizeof(int) * AE_to_dof.Size_of_connections());
+
+    unsigned long long key;
+    MPI_Allreduce(&h, &key, 1, MPI_UNSIGNED_LONG_LONG, MPI_BXOR, PROC_COMM);
+
+    // Global part. The coarse solver is rebuilt on reading, so
+    // coarse_direct does not go into the key.
+    key = mlcache_hash_val(key, PROC_NUM);
+    key = mlcache_hash_val(key, MLCACHE_VERSION);
+    const int coarsenings = mlp.get_num_coarsenings();
+    key = mlcache_hash_val(key, coarsenings);
+    for (int j=0; j < coarsenings; ++j)
+    {
+        key = mlcache_hash_val(key, mlp.get_nparts(j));
+        key = mlcache_hash_val(key, mlp.get_nu_pro(j));
+        key = mlcache_hash_val(key, mlp.get_nu_relax(j));
+        key = mlcache_hash_val(key, mlp.get_theta(j));
+        key = mlcache_hash_val(key, mlp.get_polynomial_coarse_space(j));
+    }
+    key = mlcache_hash_val(key, (int)mlp.get_use_correct_nullspace());
+    key = mlcache_hash_val(key, (int)mlp.get_use_arpack());
+    key = mlcache_hash_val(key, (int)mlp.get_do_aggregates());
+    key = mlcache_hash_val(key, (int)mlp.get_avoid_ess_bdr_dofs());
+    key = mlcache_hash_val(key, (int)mlp.get_use_double_cycle());
+    key = mlcache_hash_val(key, mlp.get_smooth_drop_tol());
+    // only when on, so the keys of existing caches stay valid
+    if (mlp.get_lobpcg_threshold() > 0)
+        key = mlcache_hash_val(key, mlp.get_lobpcg_threshold());
+
+    return key;
+}
+
+bool mlcache_write(
+    const char *dir, HypreParMatrix& Ag,
+    const agg_partitioning_relations_t& agg_part_rels,
+    const MultilevelParameters& mlp, const ml_data_t& ml_data)
+{
+    SA_ASSERT(dir);
+    SA_ASSERT(ml_data.levels_list.num_levels == mlp.get_num_coarsenings());
+    SA_ASSERT(ml_data.levels_list.finest->agg_part_rels == &agg_part_rels);
+
+    const unsigned long long key = mlcache_key(Ag, agg_part_rels, mlp);
+    const std::string filename = mlcache_shard_name(dir, key, PROC_RANK);
+    const std::string tmpname = filename + ".tmp";
+
+    std::ofstream out(tmpname.c_str(), std::ofstream::binary);
+    int ok = out.good();
+    if (ok)
+    {
+        mlcache_header_t header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MLCACHE_MAGIC, sizeof(header.magic));
+        header.version = MLCACHE_VERSION;
+        header.hypre_int_size = sizeof(HYPRE_Int);
+        header.key = key;
+        header.num_procs = PROC_NUM;
+        header.rank = PROC_RANK;
+        header.num_levels = ml_data.levels_list.num_levels;
+        out.write((const char *)&header, sizeof(header));
+
+        mlcache_writer_t w;
+        w.stream = &out;
+        w.bytes = 0;
+        w.hash = MLCACHE_FNV_OFFSET;
+        int i = 0;
+        for (levels_level_t *level = ml_data.levels_list.finest; level;
+             level = level->coarser, ++i)
+        {
+            SA_ASSERT(level->agg_part_rels && level->tg_data);
+            if (i > 0)
+                mlcache_put_agg_part_rels(w, *level->agg_part_rels,
+                                          level->finer->agg_part_rels->num_mises);
+            mlcache_put_tg_data(w, *level->tg_data);
+        }
+
+        header.payload_bytes = w.bytes;
+        header.payload_hash = w.hash;
+        out.seekp(0);
+        out.write((const char *)&header, sizeof(header));
+        out.close();
+        ok = !out.fail() && !rename(tmpname.c_str(), filename.c_str());
+        if (!ok)
+            remove(tmpname.c_str());
+    }
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, PROC_COMM);
+    SA_RPRINTF_L(0, 3, "Hierarchy cache %016llx %s.\n", key,
+                 all_ok ? "written" : "could not be written");
+    return all_ok;
+}
+
+ml_data_t *mlcache_read(
+    const char *dir, HypreParMatrix& Ag,
+    agg_partitioning_relations_t *agg_part_rels,
+    const MultilevelParameters& mlp)
+{
+    SA_ASSERT(dir);
+    SA_ASSERT(agg_part_rels);
+    const int num_levels = mlp.get_num_coarsenings();
+    SA_ASSERT(num_levels > 0);
+
+    const unsigned long long key = mlcache_key(Ag, *agg_part_rels, mlp);
+    const std::string filename = mlcache_shard_name(dir, key, PROC_RANK);
+
+    void *map = MAP_FAILED;
+    size_t size = 0;
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat st;
+        if (!fstat(fd, &st) && st.st_size > 0)
+        {
+            size = st.st_size;
+            map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+    }
+    int valid = (MAP_FAILED != map) &&
+                mlcache_check_shard((const char *)map, size, key, num_levels);
+    int all_valid;
+    MPI_Allreduce(&valid, &all_valid, 1, MPI_INT, MPI_MIN, PROC_COMM);
+    if (!all_valid)
+    {
+        if (MAP_FAILED != map)
+            munmap(map, size);
+        SA_RPRINTF_L(0, 3, "Hierarchy cache %016llx missed.\n", key);
+        return NULL;
+    }
+
+    mlcache_reader_t r;
+    r.data = (const char *)map;
+    r.size = size;
+    r.pos = sizeof(mlcache_header_t);
+
+    ml_data_t *ml_data = new ml_data_t;
+    SA_ASSERT(ml_data);
+    memset(ml_data, 0, sizeof(*ml_data));
+
+    HypreParMatrix *A = &Ag;
+    agg_partitioning_relations_t *rels = agg_part_rels;
+    for (int i=0; i < num_levels; ++i)
+    {
+        if (i > 0)
+            rels = mlcache_get_agg_part_rels(r);
+        tg_data_t *tg_data = tg_init_data(
+            *A, *rels, mlp.get_nu_pro(i), mlp.get_nu_relax(i),
+            mlp.get_theta(i), mlp.get_smooth_interp(i),
+            mlp.get_smooth_drop_tol(), mlp.get_use_arpack());
+        SA_ASSERT(tg_data);
+        tg_set_relaxation(*A, *tg_data, mlp.get_relaxation(i));
+        tg_data->use_w_cycle = false;
+        tg_data->cycle_mu = mlp.get_cycle_mu(i);
+        tg_data->redist_threshold = mlp.get_coarse_redist_threshold();
+        tg_data->redist_rows = mlp.get_coarse_redist_rows();
+        tg_data->interp_data->lobpcg_threshold = mlp.get_lobpcg_threshold();
+        tg_data->polynomial_coarse_space = mlp.get_polynomial_coarse_space(i);
+        mlcache_get_tg_data(r, *tg_data);
+        if (i+1 == num_levels)
+            tg_init_coarse_solver(tg_data, mlp.get_coarse_direct());
+
+        levels_list_push_coarse_data(ml_data->levels_list, rels, tg_data);
+        A = tg_data->Ac;
+    }
+    SA_ASSERT(r.pos == r.size);
+    munmap(map, size);
+    SA_ASSERT(levels_check_list(ml_data->levels_list));
+
+    ml_impose_cycle(*ml_data, false);
+    if (mlp.get_use_correct_nullspace())
+    {
+        tg_data_t *tg_data = ml_data->levels_list.coarsest->tg_data;
+        SA_ASSERT(tg_data);
+        SA_ASSERT(tg_data->Ac);
+        tg_init_nullspace_coarse_solver(tg_data);
+    }
+
+    SA_RPRINTF_L(0, 3, "Hierarchy cache %016llx restored.\n", key);
+    if (SA_IS_OUTPUT_LEVEL(3))
+        ml_print_data(Ag, *ml_data);
+
+    return ml_data;
+}
+
+} // namespace saamge
@@ -0,0 +1,404 @@
+/*
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.hpp"
+#include "prof.hpp"
+#include <mfem.hpp>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "picojson.h"
+#if SAAMGE_USE_OPENMP
+#include <omp.h>
+#endif
+
+namespace saamge
+{
+
+/* Types */
+/*! A region. Node 0 is the (unnamed) root. */
+typedef struct {
+    std::string name;
+    int parent;
+    std::vector<int> children;
+    double start;
+    double time;
+    int entries;
+    std::map<std::string, double> counters;
+} prof_node_t;
+
+/*! A value reduced over the processes that have it. */
+typedef struct {
+    double min;
+    double max;
+    double sum;
+    int procs;
+} prof_stat_t;
+
+/*! A region reduced over all processes. */
+typedef struct {
+    std::string name;
+    std::vector<std::string> children;
+    std::map<std::string, prof_stat_t> values;
+} prof_reduced_t;
+
+/* Variables */
+static bool prof_on = false;
+static std::vector<prof_node_t> prof_nodes;
+static int prof_current = 0;
+
+/* Static Functions */
+static inline
+bool prof_active()
+{
+#if SAAMGE_USE_OPENMP
+    if (omp_in_parallel())
+        return false;
+#endif
+    return prof_on;
+}
+
+static
+void prof_init_root()
+{
+    if (!prof_nodes.empty())
+        return;
+    prof_nodes.resize(1);
+    prof_nodes[0].parent = -1;
+    prof_nodes[0].start = 0.;
+    prof_nodes[0].time = 0.;
+    prof_nodes[0].entries = 0;
+    prof_current = 0;
+}
+
+/*! Serializes the local regions as lines "path\tkey\tvalue", depth first,
+    where key is "time", "entries" or "counter:<name>". */
+static
+void prof_serialize(int node, const std::string& path, std::ostream& out)
+{
+    const prof_node_t& n = prof_nodes[node];
+    if (node)
+    {
+        out << path << "\ttime\t" << n.time << "\n";
+        out << path << "\tentries\t" << n.entries << "\n";
+        for (std::map<std::string, double>::const_iterator it =
+                 n.counters.begin(); it != n.counters.end(); ++it)
+            out << path << "\tcounter:" << it->first << "\t" << it->second
+                << "\n";
+    }
+    for (int i=0; i < (int)n.children.size(); ++i)
+    {
+        const int child = n.children[i];
+        prof_serialize(child, node ? path + "/" + prof_nodes[child].name :
+                                     prof_nodes[child].name, out);
+    }
+}
+
+/*! Gathers the regions of all processes on process 0 and reduces them.
+    The paths are in the order they are first met, so parents come before
+    their children. Collective. */
+static
+void prof_reduce(std::vector<std::string>& order,
+                 std::map<std::string, prof_reduced_t>& regions)
+{
+    SA_ASSERT(!prof_current);
+    prof_init_root();
+
+    std::ostringstream local;
+    local << std::setprecision(17);
+    prof_serialize(0, "", local);
+    const std::string local_str = local.str();
+    int local_len = (int)local_str.size();
+
+    std::vector<int> lens(PROC_RANK ? 0 : PROC_NUM);
+    MPI_Gather(&local_len, 1, MPI_INT, PROC_RANK ? NULL : &lens[0], 1,
+               MPI_INT, 0, PROC_COMM);
+    std::vector<int> displs(PROC_RANK ? 0 : PROC_NUM + 1, 0);
+    for (int i=0; i < (int)lens.size(); ++i)
+        displs[i+1] = displs[i] + lens[i];
+    std::vector<char> all(PROC_RANK ? 1 : displs[PROC_NUM] + 1);
+    MPI_Gatherv(const_cast<char *>(local_str.c_str()), local_len, MPI_CHAR,
+                &all[0], PROC_RANK ? NULL : &lens[0],
+                PROC_RANK ? NULL : &displs[0], MPI_CHAR, 0, PROC_COMM);
+    if (PROC_RANK)
+        return;
+
+    for (int p=0; p < PROC_NUM; ++p)
+    {
+        std::istringstream in(std::string(&all[displs[p]], lens[p]));
+        std::string line;
+        while (std::getline(in, line))
+        {
+            const size_t t1 = line.find('\t');
+            const size_t t2 = line.find('\t', t1 + 1);
+            SA_ASSERT(t1 != std::string::npos && t2 != std::string::npos);
+            const std::string path = line.substr(0, t1);
+            const std::string key = line.substr(t1 + 1, t2 - t1 - 1);
+            const double value = atof(line.c_str() + t2 + 1);
+
+            std::map<std::string, prof_reduced_t>::iterator it =
+                regions.find(path);
+            if (it == regions.end())
+            {
+                const size_t slash = path.rfind('/');
+                prof_reduced_t& r = regions[path];
+                r.name = (slash == std::string::npos) ? path :
+                                                        path.substr(slash + 1);
+                if (slash != std::string::npos)
+                {
+                    SA_ASSERT(regions.count(path.substr(0, slash)));
+                    regions[path.substr(0, slash)].children.push_back(path);
+                }
+                order.push_back(path);
+                it = regions.find(path);
+            }
+
+            std::map<std::string, prof_stat_t>::iterator sit =
+                it->second.values.find(key);
+            if (sit == it->second.values.end())
+            {
+                prof_stat_t& st = it->second.values[key];
+                st.min = st.max = st.sum = value;
+                st.procs = 1;
+            }
+            else
+            {
+                prof_stat_t& st = sit->second;
+                st.min = std::min(st.min, value);
+                st.max = std::max(st.max, value);
+                st.sum += value;
+                ++st.procs;
+            }
+        }
+    }
+}
+
+static
+picojson::value prof_stat_json(const prof_stat_t& st)
+{
+    picojson::object obj;
+    obj["min"] = picojson::value(st.min);
+    obj["max"] = picojson::value(st.max);
+    obj["avg"] = picojson::value(st.sum / st.procs);
+    return picojson::value(obj);
+}
+
+static
+picojson::value prof_region_json(
+    const std::string& path,
+    const std::map<std::string, prof_reduced_t>& regions)
+{
+    const prof_reduced_t& r = regions.find(path)->second;
+    const prof_stat_t& time = r.values.find("time")->second;
+    picojson::object obj;
+    picojson::object counters;
+    picojson::array children;
+
+    obj["name"] = picojson::value(r.name);
+    obj["path"] = picojson::value(path);
+    obj["processors"] = picojson::value((double)time.procs);
+    obj["time"] = prof_stat_json(time);
+    obj["imbalance"] = picojson::value(time.sum > 0. ?
+                                       time.max * time.procs / time.sum : 1.);
+    obj["entries"] = prof_stat_json(r.values.find("entries")->second);
+    for (std::map<std::string, prof_stat_t>::const_iterator it =
+             r.values.begin(); it != r.values.end(); ++it)
+        if (!it->first.compare(0, 8, "counter:"))
+            counters[it->first.substr(8)] = prof_stat_json(it->second);
+    obj["counters"] = picojson::value(counters);
+    for (int i=0; i < (int)r.children.size(); ++i)
+        children.push_back(prof_region_json(r.children[i], regions));
+    obj["children"] = picojson::value(children);
+
+    return picojson::value(obj);
+}
+
+/* Functions */
+
+void prof_enable(bool on)
+{
+    SA_ASSERT(!prof_current);
+    prof_on = on;
+}
+
+bool prof_enabled()
+{
+    return prof_on;
+}
+
+void prof_reset()
+{
+    SA_ASSERT(!prof_current);
+    prof_nodes.clear();
+    prof_current = 0;
+}
+
+void prof_begin(const char *name)
+{
+    if (!prof_active())
+        return;
+    prof_init_root();
+
+    std::vector<int>& children = prof_nodes[prof_current].children;
+    int node = -1;
+    for (int i=0; i < (int)children.size(); ++i)
+    {
+        if (prof_nodes[children[i]].name == name)
+        {
+            node = children[i];
+            break;
+        }
+    }
+    if (node < 0)
+    {
+        node = (int)prof_nodes.size();
+        children.push_back(node);
+        prof_nodes.resize(node + 1);
+        prof_node_t& n = prof_nodes[node];
+        n.name = name;
+        n.parent = prof_current;
+        n.time = 0.;
+        n.entries = 0;
+    }
+
+    prof_current = node;
+    ++prof_nodes[node].entries;
+    prof_nodes[node].start = MPI_Wtime();
+}
+
+void prof_begin(const std::string& name)
+{
+    prof_begin(name.c_str());
+}
+
+void prof_end()
+{
+    if (!prof_active())
+        return;
+    SA_ASSERT(prof_current > 0);
+    prof_node_t& n = prof_nodes[prof_current];
+    n.time += MPI_Wtime() - n.start;
+    prof_current = n.parent;
+}
+
+void prof_count(const char *name, double amount)
+{
+    if (!prof_active())
+        return;
+    prof_init_root();
+    prof_nodes[prof_current].counters[name] += amount;
+}
+
+void prof_print(std::ostream& out)
+{
+    std::vector<std::string> order;
+    std::map<std::string, prof_reduced_t> regions;
+    prof_reduce(order, regions);
+    if (PROC_RANK)
+        return;
+
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize prec = out.precision();
+    out << std::left << std::setw(44) << "region"
+        << std::right << std::setw(12) << "min [s]" << std::setw(12)
+        << "avg [s]" << std::setw(12) << "max [s]" << std::setw(8) << "imb"
+        << std::setw(10) << "entries" << "\n";
+    out << std::fixed;
+    for (int i=0; i < (int)order.size(); ++i)
+    {
+        const prof_reduced_t& r = regions[order[i]];
+        const prof_stat_t& time = r.values.find("time")->second;
+        const prof_stat_t& entries = r.values.find("entries")->second;
+        const int depth = std::count(order[i].begin(), order[i].end(), '/');
+        const double avg = time.sum / time.procs;
+        out << std::left << std::setw(44)
+            << (std::string(2*depth, ' ') + r.name).substr(0, 43)
+            << std::right << std::setprecision(4) << std::setw(12) << time.min
+            << std::setw(12) << avg << std::setw(12) << time.max
+            << std::setprecision(2) << std::setw(8)
+            << (avg > 0. ? time.max / avg : 1.)
+            << std::setprecision(0) << std::setw(10)
+            << entries.sum / entries.procs << "\n";
+        for (std::map<std::string, prof_stat_t>::const_iterator it =
+                 r.values.begin(); it != r.values.end(); ++it)
+        {
+            if (it->first.compare(0, 8, "counter:"))
+                continue;
+            out << std::left << std::setw(44)
+                << (std::string(2*depth + 2, ' ') + "# " +
+                    it->first.substr(8)).substr(0, 43)
+                << std::right << std::setprecision(0) << std::setw(12)
+                << it->second.min << std::setw(12)
+                << it->second.sum / it->second.procs << std::setw(12)
+                << it->second.max << "\n";
+        }
+    }
+    out.flags(flags);
+    out.precision(prec);
+}
+
+std::string prof_to_json(bool prettify)
+{
+    std::vector<std::string> order;
+    std::map<std::string, prof_reduced_t> regions;
+    prof_reduce(order, regions);
+    if (PROC_RANK)
+        return std::string();
+
+    picojson::object root;
+    picojson::array top;
+    root["processors"] = picojson::value((double)PROC_NUM);
+    for (int i=0; i < (int)order.size(); ++i)
+        if (order[i].find('/') == std::string::npos)
+            top.push_back(prof_region_json(order[i], regions));
+    root["regions"] = picojson::value(top);
+
+    return picojson::value(root).serialize(prettify);
+}
+
+bool prof_write_json(const char *filename)
+{
+    const std::string json = prof_to_json(true);
+    if (PROC_RANK)
+        return true;
+
+    std::ofstream out(filename);
+    if (!out)
+        return false;
+    out << json << std::endl;
+    return out.good();
+}
+
+} // namespace saamge
@@ -146,7 +146,56 @@ bool SAAMGeAlgPC::Make(const std::shared_ptr<mfem::HypreParMatrix> &A,
         (nu_pro > 0), polynomial_coarse, window_amg, use_arpack,
         avoid_ess_bdr_dofs);
 
+    return MakeSolver(A);
+}
+
+bool SAAMGeAlgPC::Make(const std::shared_ptr<mfem::HypreParMatrix> &A)
+{
+    using namespace std;
+    using namespace mfem;
+
+    SA_ASSERT(!(correct_nulspace && minimal_coarse));
+
+    Destroy();
+    nparts_arr.resize(num_levels-1);
+
+    // the AEs are per process
+    nparts_arr[0] = A->Height() / first_elems_per_agg;
+    if (nparts_arr[0] < 1) nparts_arr[0] = 1;
+    shared_ptr<SparseMatrix> identity(IdentitySparseMatrix(A->Height()));
+
+    auto dof_truedof = make_shared<HypreParMatrix>(
+        PROC_COMM, A->GetGlobalNumRows(), A->GetRowStarts(), identity.get());
+
+    Array<int> isolated_cells(0);
+
+    agg_part_rels = fem_create_partitioning_from_matrix(
+        *A, &nparts_arr[0], dof_truedof.get(), isolated_cells);
+
+    for (int i = 1; i < num_levels - 1; ++i)
+    {
+        nparts_arr[i] = (int) round((double) nparts_arr[i-1] /
+                                    (double) elems_per_agg);
+        if (nparts_arr[i] < 1) nparts_arr[i] = 1;
+    }
 
+    const bool avoid_ess_bdr_dofs = true;
+    int polynomial_coarse;
+    if (minimal_coarse)
+        polynomial_coarse = 0;
+    else
+        polynomial_coarse = -1;
+
+    tg_data = tg_produce_data_algebraic(
+        *A, *agg_part_rels, first_nu_pro, nu_relax, first_theta,
+        (nu_pro > 0), polynomial_coarse, window_amg, use_arpack,
+        avoid_ess_bdr_dofs);
+
+    return MakeSolver(A);
+}
+
+bool SAAMGeAlgPC::MakeSolver(const std::shared_ptr<mfem::HypreParMatrix> &A)
+{
     tg_fillin_coarse_operator(*A, tg_data, false);
     tg_data->coarse_solver = new AMGSolver(*tg_data->Ac, false);
 
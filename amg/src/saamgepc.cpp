@@ -154,13 +154,13 @@ bool SAAMGePC::Make(const std::shared_ptr<mfem::ParBilinearForm> &a,
         if (nparts_arr[i] < 1) nparts_arr[i] = 1;
     }
 
-    MultilevelParameters mlp(
+    mlp = make_shared<MultilevelParameters>(
         num_levels-1, &nparts_arr[0], first_nu_pro, nu_pro, nu_relax, first_theta,
         theta, polynomial_coarse, correct_nulspace, !direct_eigensolver,
         do_aggregates);
     Print();
     emp = new ElementMatrixStandardGeometric(*agg_part_rels, Al, a.get());
-    ml_data = ml_produce_data(*A, agg_part_rels, emp, mlp);
+    ml_data = ml_produce_data(*A, agg_part_rels, emp, *mlp);
 
     levels_level_t * level = levels_list_get_level(ml_data->levels_list, 0);
     Bprec = make_shared<VCycleSolver>(level->tg_data, false);
@@ -173,11 +173,34 @@ bool SAAMGePC::Make(const std::shared_ptr<mfem::ParBilinearForm> &a,
     return true;
 }
 
+bool SAAMGePC::Update(const std::shared_ptr<mfem::ParBilinearForm> &a,
+                      const std::shared_ptr<mfem::HypreParMatrix> &A,
+                      mfem::SparseMatrix &Al)
+{
+    if (!has_stuff_to_destroy)
+        return Make(a, A, Al);
+
+    // the old emp is freed by the update
+    emp = new ElementMatrixStandardGeometric(*agg_part_rels, Al, a.get());
+    ml_update_coefficients(*A, *ml_data, emp, *mlp);
+    Bprec->SetOperator(*A);
+
+    this->height = A->Height();
+    this->width  = A->Width();
+    return true;
+}
+
 void SAAMGePC::Mult(const mfem::Vector &x, mfem::Vector &y) const
 {
     Bprec->Mult(x, y);
 }
 
+void SAAMGePC::MultBlock(const mfem::DenseMatrix &B,
+                         mfem::DenseMatrix &X) const
+{
+    Bprec->MultBlock(B, X);
+}
+
 void SAAMGePC::MultTranspose(const mfem::Vector &x, mfem::Vector &y) const
 {
     Bprec->MultTranspose(x, y);
@@ -33,6 +33,7 @@
 #include "smpr.hpp"
 #define _USE_MATH_DEFINES
 #include <cmath>
+#include <algorithm>
 #include <mfem.hpp>
 #include "tg.hpp"
 #include "helpers.hpp"
@@ -42,6 +43,7 @@ using std::sin;
 using std::cos;
 using std::pow;
 using std::log;
+using std::fabs;
 
 namespace saamge
 {
@@ -154,6 +156,78 @@ double smpr_compute_tauk(int nu, double a, int k)
     return tauk;
 }
 
+/*! \brief Makes sure the fused smoother workspace fits \a A.
+
+    The layout is [y | r | x_next | send buffer | halo], where the first three
+    parts have the local size of \a A. Creates the communication package of
+    \a A if it is missing.
+
+    \returns The beginning of the workspace (that is, y).
+*/
+static
+double *smpr_poly_workspace(HypreParMatrix& A, smpr_poly_data_t *poly_data)
+{
+    hypre_ParCSRMatrix *hA = A;
+    if (!hypre_ParCSRMatrixCommPkg(hA))
+        hypre_MatvecCommPkgCreate(hA);
+    hypre_ParCSRCommPkg *comm_pkg = hypre_ParCSRMatrixCommPkg(hA);
+    const int num_sends = hypre_ParCSRCommPkgNumSends(comm_pkg);
+    const int n = hypre_CSRMatrixNumRows(hypre_ParCSRMatrixDiag(hA));
+    const int needed = 3*n + hypre_ParCSRCommPkgSendMapStart(comm_pkg, num_sends)
+                       + hypre_CSRMatrixNumCols(hypre_ParCSRMatrixOffd(hA));
+    if (poly_data->work_size < needed)
+    {
+        delete [] poly_data->work;
+        poly_data->work = new double[needed];
+        poly_data->work_size = needed;
+    }
+    return poly_data->work;
+}
+
+/*! \brief The largest eigenvalue of a symmetric tridiagonal matrix.
+
+    Bisection with Sturm sequence counts.
+
+    \param n (IN) The size of the matrix.
+    \param alpha (IN) The diagonal (\a n entries).
+    \param beta (IN) The off-diagonal (the first \a n - 1 entries are used).
+*/
+static
+double smpr_tridiag_max_eig(int n, const double *alpha, const double *beta)
+{
+    SA_ASSERT(n > 0);
+    double lo = alpha[0], hi = alpha[0];
+    for (int i=0; i < n; ++i)
+    {
+        const double r = (i > 0 ? fabs(beta[i-1]) : 0.) +
+                         (i < n-1 ? fabs(beta[i]) : 0.);
+        lo = std::min(lo, alpha[i] - r);
+        hi = std::max(hi, alpha[i] + r);
+    }
+
+    for (int it=0; it < 100 && hi - lo > 1e-10 * fabs(hi); ++it)
+    {
+        const double mid = 0.5 * (lo + hi);
+        // The number of eigenvalues smaller than mid.
+        int count = 0;
+        double d = 1.;
+        for (int i=0; i < n; ++i)
+        {
+            const double b2 = (i > 0 ? beta[i-1] * beta[i-1] : 0.);
+            d = alpha[i] - mid - b2 / d;
+            if (0. == d)
+                d = 1e-300;
+            if (d < 0.)
+                ++count;
+        }
+        if (count == n)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return hi;
+}
+
 /* Functions */
 
 int smpr_nu_from_a(double a)
@@ -191,22 +265,37 @@ double smpr_cheb_firstkind(int n, double x)
     return value;
 }
 
-/// the name here does not *quite* match the implementation
 void smpr_gauss_seidel(HypreParMatrix& A, const Vector& b, Vector& x, void *data)
 {
-    Vector res(x);
-    Vector temp(x);
-    A.Mult(x,res);
-    res *= -1.0;
-    res += b;
+    smpr_poly_data_t *poly_data = (smpr_poly_data_t *)data;
+    if (!poly_data)
+    {
+        Vector res(x.Size());
+        Vector temp(x.Size());
+        A.Mult(x, res);
+        res *= -1.0;
+        res += b;
+        HypreSmoother hsmoother(A, HypreSmoother::l1GS, 3);
+        hsmoother.Mult(res, temp);
+        x += temp;
+        return;
+    }
 
-    // HypreSmoother hsmoother(A, HypreSmoother::l1GS);
-    // HypreSmoother hsmoother(A, HypreSmoother::GS);
-    // HypreSmoother hsmoother(A, HypreSmoother::Chebyshev);
-    HypreSmoother hsmoother(A, HypreSmoother::l1GS, 3);
-    // hsmoother.Mult(b,x);
+    if (!poly_data->l1gs || poly_data->l1gs_A != &A)
+    {
+        delete poly_data->l1gs;
+        poly_data->l1gs = new HypreSmoother(A, HypreSmoother::l1GS, 3);
+        poly_data->l1gs_A = &A;
+    }
 
-    hsmoother.Mult(res,temp);
+    const int n = x.Size();
+    double *work = smpr_poly_workspace(A, poly_data);
+    Vector res(work, n);
+    Vector temp(work + n, n);
+    A.Mult(x, res);
+    res *= -1.0;
+    res += b;
+    poly_data->l1gs->Mult(res, temp);
     x += temp;
 }
 
@@ -215,22 +304,202 @@ void smpr_sym_poly(HypreParMatrix& A, const Vector& b, Vector& x, void *data)
     SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
     smpr_poly_data_t *poly_data = (smpr_poly_data_t *)data;
 
-    Vector y;
+    if (!poly_data->roots2)
+    {
+        smpr_compute_poly_fused(A, b, x, poly_data->degree, poly_data->roots,
+                                poly_data);
+        return;
+    }
+
+    const int n = x.Size();
+    double *yd = smpr_poly_workspace(A, poly_data);
+    double *xd = x.GetData();
+    for (int i=0; i < n; ++i)
+        yd[i] = xd[i];
+    Vector y(yd, n);
+
+    smpr_compute_poly_fused(A, b, x, poly_data->degree, poly_data->roots,
+                            poly_data);
+    smpr_compute_poly_fused(A, b, y, poly_data->degree2, poly_data->roots2,
+                            poly_data);
+
+    const double w = poly_data->weightfirst;
+    for (int i=0; i < n; ++i)
+        xd[i] = w * xd[i] + (1. - w) * yd[i];
+}
+
+void smpr_compute_poly_fused(HypreParMatrix& A, const Vector& b, Vector& x,
+                             int degree, const double *roots,
+                             smpr_poly_data_t *poly_data)
+{
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    SA_ASSERT(poly_data && poly_data->Dinv_neg);
+    SA_ASSERT(A.GetGlobalNumRows() ==
+              mbox_parallel_vector_size(*poly_data->Dinv_neg));
+    SA_ASSERT(degree >= 0);
+    if (!degree)
+        return;
+
+    hypre_ParCSRMatrix *hA = A;
+    hypre_CSRMatrix *diag = hypre_ParCSRMatrixDiag(hA);
+    hypre_CSRMatrix *offd = hypre_ParCSRMatrixOffd(hA);
+    const int n = hypre_CSRMatrixNumRows(diag);
+    const HYPRE_Int *diag_i = hypre_CSRMatrixI(diag);
+    const HYPRE_Int *diag_j = hypre_CSRMatrixJ(diag);
+    const double *diag_a = hypre_CSRMatrixData(diag);
+    const HYPRE_Int *offd_i = hypre_CSRMatrixI(offd);
+    const HYPRE_Int *offd_j = hypre_CSRMatrixJ(offd);
+    const double *offd_a = hypre_CSRMatrixData(offd);
+    SA_ASSERT(x.Size() == n && b.Size() == n);
+    SA_ASSERT(poly_data->Dinv_neg->Size() == n);
+
+    double *work = smpr_poly_workspace(A, poly_data);
+    hypre_ParCSRCommPkg *comm_pkg = hypre_ParCSRMatrixCommPkg(hA);
+    SA_ASSERT(comm_pkg);
+    const int num_sends = hypre_ParCSRCommPkgNumSends(comm_pkg);
+    const int send_size = hypre_ParCSRCommPkgSendMapStart(comm_pkg, num_sends);
+    const HYPRE_Int *send_map = hypre_ParCSRCommPkgSendMapElmts(comm_pkg);
+
+    double *r = work + n;
+    double *xn = work + 2*n;
+    double *send_buf = work + 3*n;
+    double *x_ext = send_buf + send_size;
+    const double *bd = b.GetData();
+    const double *dd = poly_data->Dinv_neg->GetData();
+    double *xd = x.GetData();
+    double *cur = xd;
+    double *nxt = xn;
+
+    for (int step=0; step < degree; ++step)
+    {
+        const double mult = 1. / roots[step];
+
+        for (int j=0; j < send_size; ++j)
+            send_buf[j] = cur[send_map[j]];
+        hypre_ParCSRCommHandle *handle =
+            hypre_ParCSRCommHandleCreate(1, comm_pkg, send_buf, x_ext);
+
+        // Rows without off-processor entries are finished while the halo
+        // is in flight; the others keep their partial residual in r.
+        for (int i=0; i < n; ++i)
+        {
+            double s = -bd[i];
+            for (int k=diag_i[i]; k < diag_i[i+1]; ++k)
+                s += diag_a[k] * cur[diag_j[k]];
+            if (offd_i[i] == offd_i[i+1])
+                nxt[i] = cur[i] + mult * dd[i] * s;
+            else
+                r[i] = s;
+        }
+
+        hypre_ParCSRCommHandleDestroy(handle);
+
+        for (int i=0; i < n; ++i)
+        {
+            if (offd_i[i] == offd_i[i+1])
+                continue;
+            double s = r[i];
+            for (int k=offd_i[i]; k < offd_i[i+1]; ++k)
+                s += offd_a[k] * x_ext[offd_j[k]];
+            nxt[i] = cur[i] + mult * dd[i] * s;
+        }
+
+        double *t = cur;
+        cur = nxt;
+        nxt = t;
+    }
+
+    if (cur != xd)
+    {
+        for (int i=0; i < n; ++i)
+            xd[i] = cur[i];
+    }
+}
+
+/*! \brief The persistent workspace of the block smoother.
+
+    \returns Room for \a blocks blocks of the shape of \a X, reallocated
+             only when that is more than before.
+*/
+static
+double *smpr_poly_block_workspace(const DenseMatrix& X, int blocks,
+                                  smpr_poly_data_t *poly_data)
+{
+    const int needed = blocks * X.Height() * X.Width();
+    if (poly_data->block_work_size < needed)
+    {
+        delete [] poly_data->block_work;
+        poly_data->block_work = new double[needed];
+        poly_data->block_work_size = needed;
+    }
+    return poly_data->block_work;
+}
 
-    if (poly_data->roots2)
-        y = x;
+/*! \brief Applies the root steps of a polynomial to a block of iterates.
 
-    smpr_compute_poly(A, b, x, poly_data->degree, poly_data->roots,
-                      poly_data->Dinv_neg);
+    The block counterpart of \b smpr_compute_poly_fused. \a rwork holds the
+    residuals, as many entries as \a X.
+*/
+static void smpr_compute_poly_block(HypreParMatrix& A, const DenseMatrix& B,
+                                    DenseMatrix& X, int degree,
+                                    const double *roots,
+                                    smpr_poly_data_t *poly_data,
+                                    double *rwork)
+{
+    const int n = X.Height();
+    const int k = X.Width();
+    const double *dd = poly_data->Dinv_neg->GetData();
+    DenseMatrix R(rwork, n, k);
+    const double *bd = B.Data();
+    double *rd = R.Data();
+    double *xd = X.Data();
+    const size_t size = (size_t)n * k;
+
+    for (int step=0; step < degree; ++step)
+    {
+        const double mult = 1. / roots[step];
+        for (size_t i=0; i < size; ++i)
+            rd[i] = bd[i];
+        mbox_block_mult_parallel(A, X, R, 1., -1.);
+        for (int v=0; v < k; ++v)
+            for (int i=0; i < n; ++i)
+                xd[(size_t)v * n + i] += mult * dd[i] * rd[(size_t)v * n + i];
+    }
+}
+
+void smpr_sym_poly_block(HypreParMatrix& A, const DenseMatrix& B,
+                         DenseMatrix& X, void *data)
+{
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    smpr_poly_data_t *poly_data = (smpr_poly_data_t *)data;
+    SA_ASSERT(poly_data && poly_data->Dinv_neg);
+    SA_ASSERT(B.Height() == X.Height() && B.Width() == X.Width());
+    SA_ASSERT(poly_data->Dinv_neg->Size() == X.Height());
 
-    if (poly_data->roots2)
+    if (!poly_data->roots2)
     {
-        smpr_compute_poly(A, b, y, poly_data->degree2, poly_data->roots2,
-                          poly_data->Dinv_neg);
-        x *= poly_data->weightfirst;
-        y *= 1. - poly_data->weightfirst;
-        x += y;
+        double *work = smpr_poly_block_workspace(X, 1, poly_data);
+        smpr_compute_poly_block(A, B, X, poly_data->degree, poly_data->roots,
+                                poly_data, work);
+        return;
     }
+
+    // [R | Y], Y is the iterate of the second polynomial
+    double *work = smpr_poly_block_workspace(X, 2, poly_data);
+    const int size = X.Height() * X.Width();
+    double *xd = X.Data();
+    double *yd = work + size;
+    for (int i=0; i < size; ++i)
+        yd[i] = xd[i];
+    DenseMatrix Y(yd, X.Height(), X.Width());
+    smpr_compute_poly_block(A, B, X, poly_data->degree, poly_data->roots,
+                            poly_data, work);
+    smpr_compute_poly_block(A, B, Y, poly_data->degree2, poly_data->roots2,
+                            poly_data, work);
+
+    const double w = poly_data->weightfirst;
+    for (int i=0; i < size; ++i)
+        xd[i] = w * xd[i] + (1. - w) * yd[i];
 }
 
 void smpr_tg(HypreParMatrix& A, const Vector& b, Vector& x, void *data)
@@ -251,7 +520,8 @@ void smpr_tg(HypreParMatrix& A, const Vector& b, Vector& x, void *data)
 
     tg_cycle_atb(A, *(tg_data->Ac), *(tg_data->interp), *(tg_data->restr), B,
                  tg_data->pre_smoother, tg_data->post_smoother, X,
-                 *tg_data->coarse_solver, tg_data->poly_data);
+                 *tg_data->coarse_solver, tg_data->poly_data,
+                 tg_data->cycle_ws);
 }
 
 double *smpr_oneminusx_poly_roots(int& nu, int *degree)
@@ -346,17 +616,115 @@ void smpr_invx_poly_init(int nu, double a, smpr_poly_data_t *poly_data)
     poly_data->roots2 = roots;
 }
 
+double smpr_estimate_lambda_max(HypreParMatrix& A,
+                                const HypreParVector& Dinv_neg, int steps)
+{
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    SA_ASSERT(steps > 0);
+    const int n = Dinv_neg.Size();
+    const HYPRE_Int first = A.GetRowStarts()[0];
+    double *alpha = new double[steps];
+    double *beta = new double[steps];
+
+    Vector s(n), q(n), q_prev(n), t(n), w(n);
+    HypreParVector Q(PROC_COMM, A.GetGlobalNumRows(), q.GetData(),
+                     A.GetRowStarts());
+    HypreParVector W(PROC_COMM, A.GetGlobalNumRows(), w.GetData(),
+                     A.GetRowStarts());
+    for (int i=0; i < n; ++i)
+    {
+        SA_ASSERT(Dinv_neg(i) < 0.);
+        s(i) = sqrt(-Dinv_neg(i));
+        // A cheap hash of the global index, in [0.5, 1.5).
+        const unsigned int h = (unsigned int)(first + i) * 2654435761u;
+        q(i) = 0.5 + (double)(h >> 8) / (double)(1u << 24);
+    }
+    q *= 1. / sqrt(mbox_parallel_inner_product(Q, Q));
+    q_prev = 0.;
+
+    int k;
+    double beta_prev = 0.;
+    for (k=0; k < steps; ++k)
+    {
+        for (int i=0; i < n; ++i)
+            t(i) = s(i) * q(i);
+        A.Mult(t, w);
+        for (int i=0; i < n; ++i)
+            w(i) = s(i) * w(i) - beta_prev * q_prev(i);
+        alpha[k] = mbox_parallel_inner_product(W, Q);
+        w.Add(-alpha[k], q);
+        beta[k] = sqrt(mbox_parallel_inner_product(W, W));
+        if (beta[k] <= 1e-12 * fabs(alpha[k]))
+        {
+            ++k;
+            break;
+        }
+        q_prev = q;
+        q.Set(1. / beta[k], w);
+        beta_prev = beta[k];
+    }
+
+    const double lambda_max = smpr_tridiag_max_eig(k, alpha, beta);
+    delete [] alpha;
+    delete [] beta;
+    return lambda_max;
+}
+
+double *smpr_chebyshev_poly_roots(int degree, double lower, double upper)
+{
+    SA_ASSERT(degree > 0);
+    SA_ASSERT(0. < lower && lower < upper);
+    double *roots = new double[degree];
+    for (int i=1; i <= degree; ++i)
+        roots[i-1] = 0.5 * (upper + lower) - 0.5 * (upper - lower) *
+                     cos(((2. * (double)i - 1.) * M_PI) / (2. * (double)degree));
+    return roots;
+}
+
+void smpr_chebyshev_poly_init(HypreParMatrix& A, double frac,
+                              smpr_poly_data_t *poly_data)
+{
+    SA_ASSERT(poly_data && poly_data->Dinv_neg);
+    SA_ASSERT(poly_data->nu > 0);
+    if (frac <= 0.)
+        frac = 0.3;
+    SA_ASSERT(frac < 1.);
+
+    // Lanczos approaches lambda_max from below, hence the safety factor. For
+    // the l1 diagonal the spectrum is known to be within (0, 1].
+    const double estimate =
+        smpr_estimate_lambda_max(A, *poly_data->Dinv_neg, 10);
+    poly_data->lambda_max = std::min(1.1 * estimate, 1.);
+
+    delete [] poly_data->roots;
+    delete [] poly_data->roots2;
+    poly_data->param = frac;
+    poly_data->degree = 3 * poly_data->nu + 1;
+    poly_data->roots = smpr_chebyshev_poly_roots(
+        poly_data->degree, frac * poly_data->lambda_max, poly_data->lambda_max);
+    poly_data->weightfirst = 1.;
+    poly_data->degree2 = 0;
+    poly_data->roots2 = NULL;
+
+    SA_RPRINTF_L(0, 5, "Chebyshev smoother: lambda_max estimate %g, degree"
+                 " %d\n", estimate, poly_data->degree);
+}
+
 HypreParVector *smpr_update_Dinv_neg(HypreParMatrix& A,
                                      smpr_poly_data_t *poly_data)
 {
     SA_ASSERT(poly_data);
     delete poly_data->Dinv_neg;
+    delete poly_data->l1gs;
+    poly_data->l1gs = NULL;
+    poly_data->l1gs_A = NULL;
 
     poly_data->Dinv_neg = mbox_build_Dinv_neg_parallel_matrix(A);
     return poly_data->Dinv_neg;
 }
 
-smpr_poly_data_t *smpr_init_poly_data(HypreParMatrix& A, int nu, double param)
+smpr_poly_data_t *smpr_init_poly_data(HypreParMatrix& A, int nu, double param,
+                                      smpr_poly_t smpr_poly)
 {
     smpr_poly_data_t *poly_data = new smpr_poly_data_t;
     SA_ASSERT(poly_data);
@@ -372,8 +740,14 @@ smpr_poly_data_t *smpr_init_poly_data(HypreParMatrix& A, int nu, double param)
     poly_data->degree2 = 0;
     poly_data->roots2 = NULL;
     poly_data->param = param;
+    poly_data->work = NULL;
+    poly_data->work_size = 0;
+    poly_data->block_work = NULL;
+    poly_data->block_work_size = 0;
+    poly_data->lambda_max = 0.;
+    poly_data->l1gs = NULL;
+    poly_data->l1gs_A = NULL;
 
-    const int smpr_poly = SMPR_POLY_SAS;
     switch (smpr_poly)
     {
         case SMPR_POLY_ONEMINUSX:
@@ -396,6 +770,9 @@ smpr_poly_data_t *smpr_init_poly_data(HypreParMatrix& A, int nu, double param)
         case SMPR_POLY_INVX:
             smpr_invx_poly_init(poly_data->nu, param, poly_data);
             break;
+        case SMPR_POLY_CHEBYSHEV:
+            smpr_chebyshev_poly_init(A, param, poly_data);
+            break;
     }
 
     if (SA_IS_OUTPUT_LEVEL(6))
@@ -428,6 +805,9 @@ void smpr_free_poly_data(smpr_poly_data_t *data)
     delete [] data->roots;
     delete data->Dinv_neg;
     delete [] data->roots2;
+    delete [] data->work;
+    delete [] data->block_work;
+    delete data->l1gs;
     delete data;
 }
 
@@ -443,6 +823,13 @@ smpr_poly_data_t *smpr_copy_poly_data(const smpr_poly_data_t *src)
     dst->degree2 = src->degree2;
     dst->roots2 = helpers_copy_dbl_arr(src->roots2, src->degree2);
     dst->param = src->param;
+    dst->work = NULL;
+    dst->work_size = 0;
+    dst->block_work = NULL;
+    dst->block_work_size = 0;
+    dst->lambda_max = src->lambda_max;
+    dst->l1gs = NULL;
+    dst->l1gs_A = NULL;
     return dst;
 }
 
@@ -38,6 +38,9 @@
 #include "levels.hpp"
 #include "fem.hpp"
 #include "mfem_addons.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 namespace saamge
 {
@@ -287,6 +290,363 @@ void AMGSolver::Mult(const Vector &b, Vector &x) const
     cumulative_iterations += thisits;
 }
 
+GatheredDirectSolver::GatheredDirectSolver(HypreParMatrix& A, int dense_max) :
+    Solver(A.Height(), false),
+    comm(A.GetComm()),
+    factor(NULL),
+    mat(NULL),
+    sparse_solver(NULL)
+{
+    hypre_ParCSRMatrix *hA = A;
+    hypre_CSRMatrix *diag = hypre_ParCSRMatrixDiag(hA);
+    hypre_CSRMatrix *offd = hypre_ParCSRMatrixOffd(hA);
+    const int *diag_I = hypre_CSRMatrixI(diag);
+    const int *diag_J = hypre_CSRMatrixJ(diag);
+    const double *diag_data = hypre_CSRMatrixData(diag);
+    const int *offd_I = hypre_CSRMatrixI(offd);
+    const int *offd_J = hypre_CSRMatrixJ(offd);
+    const double *offd_data = hypre_CSRMatrixData(offd);
+    const HYPRE_Int *col_map = hypre_ParCSRMatrixColMapOffd(hA);
+    const int col_begin = hypre_ParCSRMatrixFirstColDiag(hA);
+    const int n = A.GetGlobalNumRows();
+    int nlocal = hypre_CSRMatrixNumRows(diag);
+    int nprocs;
+    MPI_Comm_size(comm, &nprocs);
+    offset = hypre_ParCSRMatrixFirstRowIndex(hA);
+
+    SA_RPRINTF_L(0, 5, "Gathering coarse operator of size %d for a direct "
+                 "solver.\n", n);
+
+    counts = new int[nprocs];
+    displs = new int[nprocs];
+    MPI_Allgather(&nlocal, 1, MPI_INT, counts, 1, MPI_INT, comm);
+    displs[0] = 0;
+    for (int p=1; p < nprocs; ++p)
+        displs[p] = displs[p-1] + counts[p-1];
+    SA_ASSERT(displs[nprocs-1] + counts[nprocs-1] == n);
+
+    // the local rows with global column indices
+    int nnz_local = diag_I[nlocal] + offd_I[nlocal];
+    int *row_nnz = new int[nlocal];
+    int *cols = new int[nnz_local];
+    double *vals = new double[nnz_local];
+    int k = 0;
+    for (int i=0; i < nlocal; ++i)
+    {
+        for (int j=diag_I[i]; j < diag_I[i+1]; ++j, ++k)
+        {
+            cols[k] = col_begin + diag_J[j];
+            vals[k] = diag_data[j];
+        }
+        for (int j=offd_I[i]; j < offd_I[i+1]; ++j, ++k)
+        {
+            cols[k] = col_map[offd_J[j]];
+            vals[k] = offd_data[j];
+        }
+        row_nnz[i] = diag_I[i+1] - diag_I[i] + offd_I[i+1] - offd_I[i];
+    }
+    SA_ASSERT(k == nnz_local);
+
+    int *nnz_counts = new int[nprocs];
+    int *nnz_displs = new int[nprocs];
+    MPI_Allgather(&nnz_local, 1, MPI_INT, nnz_counts, 1, MPI_INT, comm);
+    nnz_displs[0] = 0;
+    for (int p=1; p < nprocs; ++p)
+        nnz_displs[p] = nnz_displs[p-1] + nnz_counts[p-1];
+    const int nnz = nnz_displs[nprocs-1] + nnz_counts[nprocs-1];
+
+    int *I = new int[n+1];
+    int *J = new int[nnz];
+    double *data = new double[nnz];
+    MPI_Allgatherv(row_nnz, nlocal, MPI_INT, I + 1, counts, displs, MPI_INT,
+                   comm);
+    MPI_Allgatherv(cols, nnz_local, MPI_INT, J, nnz_counts, nnz_displs,
+                   MPI_INT, comm);
+    MPI_Allgatherv(vals, nnz_local, MPI_DOUBLE, data, nnz_counts, nnz_displs,
+                   MPI_DOUBLE, comm);
+    I[0] = 0;
+    for (int i=0; i < n; ++i)
+        I[i+1] += I[i];
+    SA_ASSERT(I[n] == nnz);
+    delete [] nnz_displs;
+    delete [] nnz_counts;
+    delete [] vals;
+    delete [] cols;
+    delete [] row_nnz;
+
+    mat = new SparseMatrix(I, J, data, n, n);
+
+    if (n <= dense_max)
+    {
+        factor = new DenseMatrix(n);
+        *factor = 0.0;
+        for (int i=0; i < n; ++i)
+            for (int j=I[i]; j < I[i+1]; ++j)
+                (*factor)(i, J[j]) += data[j];
+        if (xpack_Cholesky_factor(*factor))
+        {
+            delete mat;
+            mat = NULL;
+        }
+        else
+        {
+            SA_RPRINTF(0, "%s", "WARNING: Coarse operator is not s.p.d., "
+                       "using UMFPACK instead of Cholesky.\n");
+            delete factor;
+            factor = NULL;
+        }
+    }
+    if (!factor)
+    {
+        mat->SortColumnIndices();
+        sparse_solver = new UMFPackSolver;
+        sparse_solver->SetOperator(*mat);
+    }
+
+    global_b.SetSize(n);
+    global_x.SetSize(n);
+}
+
+GatheredDirectSolver::~GatheredDirectSolver()
+{
+    delete sparse_solver;
+    delete mat;
+    delete factor;
+    delete [] displs;
+    delete [] counts;
+}
+
+void GatheredDirectSolver::Mult(const Vector &b, Vector &x) const
+{
+    SA_ASSERT(b.Size() == x.Size());
+
+    MPI_Allgatherv(b.GetData(), b.Size(), MPI_DOUBLE, global_b.GetData(),
+                   counts, displs, MPI_DOUBLE, comm);
+    if (factor)
+    {
+        global_x = global_b;
+        xpack_Cholesky_solve(*factor, global_x);
+    }
+    else
+        sparse_solver->Mult(global_b, global_x);
+    for (int i=0; i < x.Size(); ++i)
+        x(i) = global_x(offset + i);
+}
+
+/**
+   Copies the local CSR arrays of \a src into the already initialized
+   \a dst of the same shape.
+*/
+static void solve_copy_csr(hypre_CSRMatrix *src, hypre_CSRMatrix *dst)
+{
+    const int nrows = hypre_CSRMatrixNumRows(src);
+    const int nnz = hypre_CSRMatrixI(src)[nrows];
+    SA_ASSERT(hypre_CSRMatrixNumRows(dst) == nrows);
+    memcpy(hypre_CSRMatrixI(dst), hypre_CSRMatrixI(src),
+           sizeof(int) * (nrows + 1));
+    if (nnz > 0)
+    {
+        memcpy(hypre_CSRMatrixJ(dst), hypre_CSRMatrixJ(src), sizeof(int) * nnz);
+        memcpy(hypre_CSRMatrixData(dst), hypre_CSRMatrixData(src),
+               sizeof(double) * nnz);
+    }
+}
+
+/**
+   The parallel permutation matrix that moves the global rows
+   [\a old_begin, \a old_end) of this process onto even, contiguous pieces
+   of the first \a nactive processes. The global numbering does not change.
+   The new piece of this process is returned in \a begin, \a end.
+*/
+static hypre_ParCSRMatrix *solve_redistribution_matrix(
+    HYPRE_Int N, HYPRE_Int old_begin, HYPRE_Int old_end, int nactive,
+    HYPRE_Int& begin, HYPRE_Int& end)
+{
+    begin = end = N;
+    if (PROC_RANK < nactive)
+    {
+        begin = (HYPRE_Int)(((long long)N * PROC_RANK) / nactive);
+        end = (HYPRE_Int)(((long long)N * (PROC_RANK + 1)) / nactive);
+    }
+    const int nrows = end - begin;
+
+    int ndiag = 0;
+    for (HYPRE_Int g = begin; g < end; ++g)
+        if (old_begin <= g && g < old_end)
+            ++ndiag;
+
+    HYPRE_Int *row_starts = hypre_CTAlloc(HYPRE_Int, 2);
+    HYPRE_Int *col_starts = hypre_CTAlloc(HYPRE_Int, 2);
+    SA_ASSERT(row_starts && col_starts);
+    row_starts[0] = begin;
+    row_starts[1] = end;
+    col_starts[0] = old_begin;
+    col_starts[1] = old_end;
+
+    hypre_ParCSRMatrix *hR = hypre_ParCSRMatrixCreate(
+        PROC_COMM, N, N, row_starts, col_starts, nrows - ndiag, ndiag,
+        nrows - ndiag);
+    hypre_ParCSRMatrixInitialize(hR);
+    int *diag_I = hypre_CSRMatrixI(hypre_ParCSRMatrixDiag(hR));
+    int *diag_J = hypre_CSRMatrixJ(hypre_ParCSRMatrixDiag(hR));
+    double *diag_data = hypre_CSRMatrixData(hypre_ParCSRMatrixDiag(hR));
+    int *offd_I = hypre_CSRMatrixI(hypre_ParCSRMatrixOffd(hR));
+    int *offd_J = hypre_CSRMatrixJ(hypre_ParCSRMatrixOffd(hR));
+    double *offd_data = hypre_CSRMatrixData(hypre_ParCSRMatrixOffd(hR));
+    HYPRE_Int *col_map = hypre_ParCSRMatrixColMapOffd(hR);
+    int kd = 0, ko = 0;
+    diag_I[0] = offd_I[0] = 0;
+    for (int i=0; i < nrows; ++i)
+    {
+        const HYPRE_Int g = begin + i;
+        if (old_begin <= g && g < old_end)
+        {
+            diag_J[kd] = g - old_begin;
+            diag_data[kd++] = 1.0;
+        }
+        else
+        {
+            // increasing, as col_map_offd has to be
+            col_map[ko] = g;
+            offd_J[ko] = ko;
+            offd_data[ko++] = 1.0;
+        }
+        diag_I[i+1] = kd;
+        offd_I[i+1] = ko;
+    }
+    hypre_ParCSRMatrixSetNumNonzeros(hR);
+    hypre_MatvecCommPkgCreate(hR);
+    return hR;
+}
+
+/**
+   Rebuilds the local rows of the moved matrix \a hM on \a subcomm, with
+   rows [\a rbegin, \a rend) and columns [\a cbegin, \a cend) on this
+   process.
+*/
+static HypreParMatrix *solve_copy_to_subcomm(
+    hypre_ParCSRMatrix *hM, MPI_Comm subcomm, HYPRE_Int rbegin,
+    HYPRE_Int rend, HYPRE_Int cbegin, HYPRE_Int cend)
+{
+    hypre_CSRMatrix *mdiag = hypre_ParCSRMatrixDiag(hM);
+    hypre_CSRMatrix *moffd = hypre_ParCSRMatrixOffd(hM);
+    const int nrows = rend - rbegin;
+    const int ncols_offd = hypre_CSRMatrixNumCols(moffd);
+    SA_ASSERT(hypre_CSRMatrixNumRows(mdiag) == nrows);
+
+    HYPRE_Int *sub_row_starts = hypre_CTAlloc(HYPRE_Int, 2);
+    HYPRE_Int *sub_col_starts = hypre_CTAlloc(HYPRE_Int, 2);
+    SA_ASSERT(sub_row_starts && sub_col_starts);
+    sub_row_starts[0] = rbegin;
+    sub_row_starts[1] = rend;
+    sub_col_starts[0] = cbegin;
+    sub_col_starts[1] = cend;
+
+    hypre_ParCSRMatrix *hS = hypre_ParCSRMatrixCreate(
+        subcomm, hypre_ParCSRMatrixGlobalNumRows(hM),
+        hypre_ParCSRMatrixGlobalNumCols(hM), sub_row_starts, sub_col_starts,
+        ncols_offd, hypre_CSRMatrixI(mdiag)[nrows],
+        hypre_CSRMatrixI(moffd)[nrows]);
+    hypre_ParCSRMatrixInitialize(hS);
+    solve_copy_csr(mdiag, hypre_ParCSRMatrixDiag(hS));
+    solve_copy_csr(moffd, hypre_ParCSRMatrixOffd(hS));
+    if (ncols_offd > 0)
+        memcpy(hypre_ParCSRMatrixColMapOffd(hS),
+               hypre_ParCSRMatrixColMapOffd(hM),
+               sizeof(HYPRE_Int) * ncols_offd);
+    hypre_ParCSRMatrixSetNumNonzeros(hS);
+    hypre_MatvecCommPkgCreate(hS);
+    return new HypreParMatrix(hS);
+}
+
+RedistributedSolver::RedistributedSolver(HypreParMatrix& A, int nactive_in) :
+    Solver(A.Height(), false),
+    subcomm(MPI_COMM_NULL),
+    subA(NULL),
+    subP(NULL),
+    solver(NULL)
+{
+    hypre_ParCSRMatrix *hA = A;
+    const HYPRE_Int N = A.M();
+    nactive = std::max(1, std::min(nactive_in, std::min(PROC_NUM, (int)N)));
+    SA_RPRINTF_L(0, 5, "Moving coarse operator of size %d onto %d of %d "
+                 "processes.\n", N, nactive, PROC_NUM);
+
+    const HYPRE_Int old_begin = hypre_ParCSRMatrixFirstRowIndex(hA);
+    const HYPRE_Int old_end = old_begin + mbox_rows_in_current_process(A);
+    redist = new HypreParMatrix(solve_redistribution_matrix(
+        N, old_begin, old_end, nactive, begin, end));
+    redist_t = redist->Transpose();
+
+    HypreParMatrix *movedA = RAP(&A, redist_t);
+    SA_ASSERT(mbox_rows_in_current_process(*movedA) == end - begin);
+
+    MPI_Comm_split(PROC_COMM, (PROC_RANK < nactive) ? 0 : MPI_UNDEFINED,
+                   PROC_RANK, &subcomm);
+    if (IsActive())
+        subA = solve_copy_to_subcomm(*movedA, subcomm, begin, end, begin, end);
+    delete movedA;
+
+    rb.SetSize(end - begin);
+    rx.SetSize(end - begin);
+}
+
+HypreParMatrix *RedistributedSolver::MoveInterpolant(HypreParMatrix& P)
+{
+    SA_ASSERT(P.M() == redist->N());
+    SA_ASSERT(!subP);
+    hypre_ParCSRMatrix *hP = P;
+    const HYPRE_Int Nc = P.N();
+    const HYPRE_Int old_cbegin = hypre_ParCSRMatrixFirstColDiag(hP);
+    const HYPRE_Int old_cend = old_cbegin + mbox_cols_in_current_process(P);
+
+    // the columns go to the same processes, in even pieces
+    HYPRE_Int cbegin, cend;
+    HypreParMatrix *redist_c = new HypreParMatrix(solve_redistribution_matrix(
+        Nc, old_cbegin, old_cend, nactive, cbegin, cend));
+    HypreParMatrix *redist_c_t = redist_c->Transpose();
+    HypreParMatrix *RP = ParMult(redist, &P);
+    HypreParMatrix *movedP = ParMult(RP, redist_c_t);
+
+    if (IsActive())
+        subP = solve_copy_to_subcomm(*movedP, subcomm, begin, end, cbegin,
+                                     cend);
+    delete movedP;
+    delete RP;
+    delete redist_c_t;
+    delete redist_c;
+    return subP;
+}
+
+RedistributedSolver::~RedistributedSolver()
+{
+    delete solver;
+    delete subP;
+    delete subA;
+    delete redist_t;
+    delete redist;
+    if (IsActive())
+        MPI_Comm_free(&subcomm);
+}
+
+void RedistributedSolver::SetSolver(Solver *solver_in)
+{
+    SA_ASSERT(IsActive());
+    delete solver;
+    solver = solver_in;
+}
+
+void RedistributedSolver::Mult(const Vector &b, Vector &x) const
+{
+    SA_ASSERT(solver || !IsActive());
+
+    redist->Mult(1.0, b, 0.0, rb);
+    rx = 0.0;
+    if (IsActive())
+        solver->Mult(rb, rx);
+    redist_t->Mult(1.0, rx, 0.0, x);
+}
+
 VCycleSolver::VCycleSolver(tg_data_t * tg_data_in, bool iterative_mode) :
     Solver(tg_data_in->restr->N(), iterative_mode),
     tg_data(tg_data_in),
@@ -319,7 +679,58 @@ void VCycleSolver::Mult(const Vector &b, Vector &x) const
     SA_ASSERT(tg_data->coarse_solver);
     tg_cycle_atb(*A, *(tg_data->Ac), *(tg_data->interp), *(tg_data->restr), b,
                  tg_data->pre_smoother, tg_data->post_smoother, x,
-                 *tg_data->coarse_solver, tg_data->poly_data);
+                 *tg_data->coarse_solver, tg_data->poly_data,
+                 tg_data->cycle_ws);
+}
+
+void VCycleSolver::MultBlock(const DenseMatrix &B, DenseMatrix &X) const
+{
+    SA_ASSERT(tg_data);
+    SA_ASSERT(A);
+    SA_ASSERT(A->Width() == B.Height());
+    SA_ASSERT(B.Height() == X.Height() && B.Width() == X.Width());
+
+    if (!iterative_mode)
+        X = 0.0;
+
+    SA_ASSERT(tg_data->coarse_solver);
+    tg_cycle_atb_block(*A, *(tg_data->Ac), *(tg_data->interp),
+                       *(tg_data->restr), B, tg_data->pre_smoother,
+                       tg_data->post_smoother, X, *tg_data->coarse_solver,
+                       tg_data->poly_data, tg_data->cycle_ws);
+}
+
+MLCycleSolver::MLCycleSolver(ml_data_t& ml_data_in, ml_cycle_t cycle_in,
+                             bool iterative_mode) :
+    Solver(ml_data_in.levels_list.finest->tg_data->interp->M(), iterative_mode),
+    ml_data(ml_data_in),
+    cycle(cycle_in),
+    A(NULL)
+{
+    ml_init_cycle_workspace(ml_data, cycle);
+}
+
+MLCycleSolver::~MLCycleSolver()
+{
+}
+
+void MLCycleSolver::SetOperator(const Operator &op)
+{
+    A = const_cast<HypreParMatrix *>(dynamic_cast<const HypreParMatrix *>(&op));
+    if (A == NULL)
+        mfem_error("MLCycleSolver::SetOperator : not HypreParMatrix!");
+}
+
+void MLCycleSolver::Mult(const Vector &b, Vector &x) const
+{
+    SA_ASSERT(A);
+    SA_ASSERT(A->Width() == b.Size());
+    SA_ASSERT(b.Size() == x.Size());
+
+    if (!iterative_mode)
+        x = 0.0;
+
+    ml_cycle(ml_data.levels_list.finest, *A, b, x, cycle);
 }
 
 /**
@@ -339,7 +750,8 @@ void solve_spd_Vcycle(HypreParMatrix& A, const HypreParVector& b, HypreParVector
     // x = 0.; // whoever calls this now has to 0 x, ATB 29 May 2015
     tg_cycle_atb(A, *(tg_data->Ac), *(tg_data->interp), *(tg_data->restr), b,
                  tg_data->pre_smoother, tg_data->post_smoother, x,
-                 *tg_data->coarse_solver, tg_data->poly_data);
+                 *tg_data->coarse_solver, tg_data->poly_data,
+                 tg_data->cycle_ws);
 }
 
 void solve_spd_Wcycle(HypreParMatrix& A, const HypreParVector& b, HypreParVector& x,
@@ -359,4 +771,183 @@ void solve_spd_Wcycle(HypreParMatrix& A, const HypreParVector& b, HypreParVector
     */
 }
 
+/*! \brief Copies the columns \a cols of \a A into the columns of \a S.
+*/
+static void solve_gather_columns(const DenseMatrix& A, const std::vector<int>& cols,
+                                 DenseMatrix& S)
+{
+    const int n = A.Height();
+    S.SetSize(n, cols.size());
+    for (size_t c=0; c < cols.size(); ++c)
+        std::memcpy(S.Data() + (size_t)c * n, A.Data() + (size_t)cols[c] * n,
+                    n * sizeof(double));
+}
+
+/*! \brief Copies the columns of \a S into the columns \a cols of \a A.
+*/
+static void solve_scatter_columns(const DenseMatrix& S, const std::vector<int>& cols,
+                                  DenseMatrix& A)
+{
+    const int n = A.Height();
+    SA_ASSERT(S.Height() == n && S.Width() == (int)cols.size());
+    for (size_t c=0; c < cols.size(); ++c)
+        std::memcpy(A.Data() + (size_t)cols[c] * n, S.Data() + (size_t)c * n,
+                    n * sizeof(double));
+}
+
+int solve_block_pcg(HypreParMatrix& A, const BlockSolver& prec,
+                    const DenseMatrix& B, DenseMatrix& X, int print_iter,
+                    int max_num_iter, double RTOLERANCE, double ATOLERANCE,
+                    int *iters)
+{
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    SA_ASSERT(B.Height() == X.Height() && B.Width() == X.Width());
+    const int n = X.Height();
+    const int k = X.Width();
+    SA_ASSERT(k > 0);
+    std::vector<double> nom(k), den(k), r0(k), dots(k);
+    std::vector<int> done(k, 0);
+    std::vector<bool> finished(k, false);
+    std::vector<int> active;
+    DenseMatrix R(B), D(n, k), Z(n, k);
+    DenseMatrix RA, ZA, DA;
+
+    mbox_block_mult_parallel(A, X, R, -1., 1.);
+    prec.MultBlock(R, Z);
+    D = Z;
+    mbox_block_inner_products_parallel(Z, R, nom.data());
+
+    if (print_iter == 1)
+        SA_RPRINTF(0, "Block PCG Iteration: 0, max (B r, r) = %g\n",
+                   *std::max_element(nom.begin(), nom.end()));
+
+    for (int v=0; v < k; ++v)
+    {
+        r0[v] = std::max(nom[v] * RTOLERANCE, ATOLERANCE);
+        if (nom[v] >= r0[v])
+            active.push_back(v);
+        else
+            finished[v] = true;
+    }
+
+    solve_gather_columns(D, active, DA);
+    ZA.SetSize(n, (int)active.size());
+    mbox_block_mult_parallel(A, DA, ZA, 1., 0.);
+    solve_scatter_columns(ZA, active, Z);
+    mbox_block_inner_products_parallel(ZA, DA, dots.data());
+    for (int c=0; c < (int)active.size(); ++c)
+    {
+        den[active[c]] = dots[c];
+        if (dots[c] < 0.0)
+            SA_ALERT_PRINTF("Negative denominator in step 0 of block PCG, "
+                            "column %d: %g", active[c], dots[c]);
+        if (0. == dots[c])
+        {
+            done[active[c]] = -1;
+            finished[active[c]] = true;
+        }
+    }
+
+    int i;
+    for (i=1; i <= max_num_iter && !active.empty(); ++i)
+    {
+        std::vector<int> still;
+        for (int c=0; c < (int)active.size(); ++c)
+        {
+            const int v = active[c];
+            if (finished[v])
+                continue;
+            still.push_back(v);
+            const double alpha = nom[v] / den[v];
+            double *xv = X.Data() + (size_t)v * n;
+            double *rv = R.Data() + (size_t)v * n;
+            const double *dv = D.Data() + (size_t)v * n;
+            const double *zv = Z.Data() + (size_t)v * n;
+            for (int j=0; j < n; ++j)
+            {
+                xv[j] += alpha * dv[j];       //  x = x + alpha d
+                rv[j] -= alpha * zv[j];       //  r = r - alpha z
+            }
+        }
+        active.swap(still);
+        if (active.empty())
+            break;
+
+        solve_gather_columns(R, active, RA);
+        ZA.SetSize(n, (int)active.size());
+        ZA = 0.0;
+        prec.MultBlock(RA, ZA);               //  z = B r
+        solve_scatter_columns(ZA, active, Z);
+        mbox_block_inner_products_parallel(RA, ZA, dots.data());
+
+        if (print_iter == 1)
+            SA_RPRINTF(0, "Block PCG Iteration: %d, max (B r, r) = %g, "
+                       "unconverged = %d\n", i,
+                       *std::max_element(dots.begin(),
+                                         dots.begin() + (int)active.size()),
+                       (int)active.size());
+
+        still.clear();
+        for (int c=0; c < (int)active.size(); ++c)
+        {
+            const int v = active[c];
+            const double betanom = dots[c];
+            if (betanom < 0.0)
+            {
+                SA_RPRINTF(0, "SPD breakdown in column %d!\n", v);
+                done[v] = -i;
+                finished[v] = true;
+                continue;
+            }
+            if (betanom < r0[v])
+            {
+                done[v] = i;
+                finished[v] = true;
+                continue;
+            }
+            still.push_back(v);
+            const double beta = betanom / nom[v];
+            nom[v] = betanom;
+            double *dv = D.Data() + (size_t)v * n;
+            const double *zv = Z.Data() + (size_t)v * n;
+            for (int j=0; j < n; ++j)
+                dv[j] = zv[j] + beta * dv[j]; //  d = z + beta d
+        }
+        active.swap(still);
+
+        solve_gather_columns(D, active, DA);
+        ZA.SetSize(n, (int)active.size());
+        mbox_block_mult_parallel(A, DA, ZA, 1., 0.);
+        solve_scatter_columns(ZA, active, Z);
+        mbox_block_inner_products_parallel(ZA, DA, dots.data());
+        for (int c=0; c < (int)active.size(); ++c)
+        {
+            den[active[c]] = dots[c];
+            if (0. == dots[c])
+            {
+                done[active[c]] = -i;
+                finished[active[c]] = true;
+            }
+        }
+    }
+
+    int result = 0;
+    bool converged = true;
+    for (int v=0; v < k; ++v)
+    {
+        if (!finished[v])
+            done[v] = -(i - 1);
+        if (done[v] < 0)
+            converged = false;
+        result = std::max(result, done[v] < 0 ? -done[v] : done[v]);
+        if (iters)
+            iters[v] = done[v];
+    }
+
+    if (print_iter == 2)
+        SA_RPRINTF(0, "Number of block PCG iterations: %d\n", result);
+
+    return converged ? result : -result;
+}
+
 } // namespace saamge
@@ -32,10 +32,13 @@
 #include "common.hpp"
 #include "spectral.hpp"
 #include <climits>
+#include <cmath>
+#include <algorithm>
 #include <mfem.hpp>
 #include "aggregates.hpp"
 #include "xpacks.hpp"
 #include "arpacks.hpp"
+#include "lobpcg.hpp"
 #include "helpers.hpp"
 #include "mbox.hpp"
 
@@ -43,6 +46,45 @@ namespace saamge
 {
 using namespace mfem;
 
+/* Static Functions */
+
+/*! \brief Extracts the diagonal of a sparse matrix if it is diagonal.
+
+    \param B (IN) The (finalized) sparse matrix.
+    \param diag (OUT) The diagonal of \a B, only valid if \em true is
+                      returned.
+
+    \returns Whether \a B has nonzero entries only on its diagonal.
+*/
+static inline
+bool spect_get_diag(const SparseMatrix& B, Vector& diag)
+{
+    const int n = B.Height();
+    if (!const_cast<SparseMatrix&>(B).Finalized() || B.Width() != n)
+        return false;
+    const int *I = B.GetI();
+    const int *J = B.GetJ();
+    const double *data = B.GetData();
+    diag.SetSize(n);
+    diag = 0.;
+    for (int i=0; i < n; ++i)
+    {
+        for (int k=I[i]; k < I[i+1]; ++k)
+        {
+            if (J[k] != i)
+            {
+                if (0. != data[k])
+                    return false;
+            }
+            else
+                diag(i) += data[k];
+        }
+    }
+    return true;
+}
+
+/* Functions */
+
 Eigensolver::Eigensolver(
     const int * aggregates, 
     const agg_partitioning_relations_t &agg_part_rels,
@@ -54,21 +96,35 @@ Eigensolver::Eigensolver(
     transf(false),
     all_eigens(false),
     max_arpack_vectors(10),
+    use_lobpcg(false),
+    lobpcg_block(4),
+    max_lobpcg_vectors(40),
+    max_lobpcg_iters(200),
+    lobpcg_tol(1.e-6),
+    reuse_tol(0.),
     count_solves(0),
     count_direct_solves(0),
     count_max_used(0),
+    count_reused(0),
+    count_lobpcg_solves(0),
+    count_lobpcg_iterations(0),
     smallest_eigenvalue_skipped(std::numeric_limits<double>::max())
 {
 }
 
 void Eigensolver::GetStatistics(
     int &o_count_solves, int &o_count_direct_solves,
-    int &o_count_max_used, double &o_smallest_eigenvalue_skipped)
+    int &o_count_max_used, int &o_count_reused,
+    double &o_smallest_eigenvalue_skipped,
+    int &o_count_lobpcg_solves, int &o_count_lobpcg_iterations)
 {
     o_count_solves = count_solves;
     o_count_direct_solves = count_direct_solves;
     o_count_max_used = count_max_used;
+    o_count_reused = count_reused;
     o_smallest_eigenvalue_skipped = smallest_eigenvalue_skipped;
+    o_count_lobpcg_solves = count_lobpcg_solves;
+    o_count_lobpcg_iterations = count_lobpcg_iterations;
 }
 
 void Eigensolver::PrintStatistics()
@@ -81,18 +137,60 @@ void Eigensolver::PrintStatistics()
                   << count_direct_solves << std::endl;
         std::cout << "  [" << PROC_RANK << "] count_max_used = " 
                   << count_max_used << std::endl;
+        std::cout << "  [" << PROC_RANK << "] count_reused = " 
+                  << count_reused << std::endl;
+        std::cout << "  [" << PROC_RANK << "] count_lobpcg_solves = " 
+                  << count_lobpcg_solves << std::endl;
+        std::cout << "  [" << PROC_RANK << "] count_lobpcg_iterations = " 
+                  << count_lobpcg_iterations << std::endl;
         std::cout << "  [" << PROC_RANK << "] smallest_eigenvalue_skipped = " 
                   << smallest_eigenvalue_skipped << std::endl;
     }
 }
 
+void Eigensolver::MergeStatistics(const Eigensolver& other)
+{
+    count_solves += other.count_solves;
+    count_direct_solves += other.count_direct_solves;
+    count_max_used += other.count_max_used;
+    count_reused += other.count_reused;
+    count_lobpcg_solves += other.count_lobpcg_solves;
+    count_lobpcg_iterations += other.count_lobpcg_iterations;
+    if (other.smallest_eigenvalue_skipped < smallest_eigenvalue_skipped)
+        smallest_eigenvalue_skipped = other.smallest_eigenvalue_skipped;
+}
+
+bool Eigensolver::UsesIterative(int problem_size) const
+{
+#if SAAMGE_USE_ARPACK
+    return (problem_size > threshold && !use_lobpcg);
+#else
+    return false;
+#endif
+}
+
 bool Eigensolver::Solve(
     const mfem::SparseMatrix& A, mfem::SparseMatrix *& B, 
     int part, int agg_id, int aggregate_size, double& theta,
-    mfem::DenseMatrix& cut_evects)
+    mfem::DenseMatrix& cut_evects, const mfem::DenseMatrix *prev_evects)
 {
     int problem_size = A.Width();
     count_solves++;
+    // the old vectors are only of use if the agglomerate kept its DoFs
+    if (prev_evects && (prev_evects->Height() != problem_size ||
+                        prev_evects->Width() == 0))
+        prev_evects = NULL;
+    if (prev_evects && reuse_tol > 0.)
+    {
+        if (!B)
+            B = mbox_snd_D_sparse_from_sparse(A);
+        const int cut_evects_num_beg = cut_evects.Width();
+        if (SolveReused(A, *B, *prev_evects, theta, cut_evects))
+        {
+            count_reused++;
+            return (cut_evects_num_beg < cut_evects.Width());
+        }
+    }
     if (problem_size <= threshold)
     {
         count_direct_solves++;
@@ -100,12 +198,16 @@ bool Eigensolver::Solve(
                            theta, cut_evects, 
                            NULL, transf, all_eigens);
     }
+    else if (use_lobpcg)
+    {
+        return SolveLOBPCG(A, B, part, theta, cut_evects, prev_evects);
+    }
     else
     {
 #if SAAMGE_USE_ARPACK
         return SolveIterative(A, B, part, agg_id, aggregate_size,
                               theta, cut_evects, 
-                              NULL, transf, all_eigens);
+                              NULL, transf, all_eigens, prev_evects);
 #else
         count_direct_solves++;
         return SolveDirect(A, B, part, agg_id, aggregate_size,
@@ -130,7 +232,7 @@ bool Eigensolver::SolveDirect(
 {
     DenseMatrix *cut_ptr, cut_helper;
     DenseMatrix deA, deB;
-    Vector evals;
+    Vector evals, diagB;
     const double lmax = 1.; // Special choice which is good when the weighted
                             // l1-smoother is used
     const int cut_evects_num_beg = cut_evects.Width(); // Number of vectors in
@@ -148,58 +250,71 @@ bool Eigensolver::SolveDirect(
 
     SA_ASSERT(B->Width() == B->Size());
     SA_ASSERT(B->Width() == A.Width());
-    if (transf)
-    {
-        // Transform the matrices for the eigenproblem.
-        SA_ASSERT(Tt);
-        DenseMatrix T(*Tt, 't');
-        mbox_transform_sparse(A, *Tt, deA);
-        mbox_transform_diag(T, *B, deB);
-        cut_ptr = &cut_helper;
-    } 
-    else
+    if (!transf && !all_eigens && spect_get_diag(*B, diagB))
     {
-        // Take the matrices without transforming them.
-        mbox_convert_sparse_to_dense(A, deA);
-        mbox_convert_sparse_to_dense(*B, deB);
+        // The weighted l1-smoother is diagonal, so the problem is solved as
+        // a scaled standard one, without converting to dense and reusing
+        // the LAPACK workspace between the solves.
         cut_ptr = &cut_evects;
+        xpacks_calc_lower_eigens_diag(A, diagB, evals, *cut_ptr, theta * lmax,
+                                      true, eigen_workspace);
     }
-    SA_ASSERT(deA.Width() == deA.Height());
-    SA_ASSERT(deB.Width() == deB.Height());
-    SA_ASSERT(deB.Width() == deA.Width());
-    SA_ASSERT((transf && &cut_helper == cut_ptr) ||
-              (!transf && &cut_evects == cut_ptr));
-
-    if (all_eigens)
+    else
     {
-        DenseMatrix evects;
+        if (transf)
+        {
+            // Transform the matrices for the eigenproblem.
+            SA_ASSERT(Tt);
+            DenseMatrix T(*Tt, 't');
+            mbox_transform_sparse(A, *Tt, deA);
+            mbox_transform_diag(T, *B, deB);
+            cut_ptr = &cut_helper;
+        } 
+        else
+        {
+            // Take the matrices without transforming them.
+            mbox_convert_sparse_to_dense(A, deA);
+            mbox_convert_sparse_to_dense(*B, deB);
+            cut_ptr = &cut_evects;
+        }
+        SA_ASSERT(deA.Width() == deA.Height());
+        SA_ASSERT(deB.Width() == deB.Height());
+        SA_ASSERT(deB.Width() == deA.Width());
+        SA_ASSERT((transf && &cut_helper == cut_ptr) ||
+                  (!transf && &cut_evects == cut_ptr));
 
-        // Solve the local eigenvalue problem computing all eigenvalues and
-        // eigenvectors
-        xpacks_calc_all_gen_eigens_dense(deA, evals, evects, deB);
+        if (all_eigens)
+        {
+            DenseMatrix evects;
+
+            // Solve the local eigenvalue problem computing all eigenvalues and
+            // eigenvectors
+            xpacks_calc_all_gen_eigens_dense(deA, evals, evects, deB);
 #if (SA_IS_DEBUG_LEVEL(12))
-        helpers_write_vector_for_gnuplot(part, evals);
+            helpers_write_vector_for_gnuplot(part, evals);
 #endif
 
-        // Take only the eigenvectors with eigenvalue <= theta * lmax
-        // Store them in *cut_ptr
-        skipped = xpack_cut_evects_small(evals, evects, theta * lmax, *cut_ptr);
-        SA_PRINTF_L(9, "skipped = %g, largest: %g\n", skipped,
-                    evals(evals.Size() - 1));
-        SA_ASSERT(SA_REAL_ALMOST_LE(skipped, lmax));
-        SA_ASSERT(SA_REAL_ALMOST_LE(0., skipped));
-    } 
-    else
-    {
-        // Solve the local eigenvalue problem computing the necessary
-        // eigenvalues and eigenvectors
-        xpacks_calc_lower_eigens_dense(deA, evals, *cut_ptr, deB, theta * lmax,
-                                       true);
+            // Take only the eigenvectors with eigenvalue <= theta * lmax
+            // Store them in *cut_ptr
+            skipped = xpack_cut_evects_small(evals, evects, theta * lmax, *cut_ptr);
+            SA_PRINTF_L(9, "skipped = %g, largest: %g\n", skipped,
+                        evals(evals.Size() - 1));
+            SA_ASSERT(SA_REAL_ALMOST_LE(skipped, lmax));
+            SA_ASSERT(SA_REAL_ALMOST_LE(0., skipped));
+        } 
+        else
+        {
+            // Solve the local eigenvalue problem computing the necessary
+            // eigenvalues and eigenvectors
+            xpacks_calc_lower_eigens_dense(deA, evals, *cut_ptr, deB, theta * lmax,
+                                           true);
+        }
     }
     if (SA_IS_OUTPUT_LEVEL(9))
     {
         SA_PRINTF("theta * lmax: %g\n", theta * lmax);
-        SA_PRINTF("total eigens: %d, taken: %d\n", deA.Size(),
+        SA_PRINTF("total eigens: %d, taken: %d\n",
+                  transf ? deA.Size() : A.Width(),
                   cut_ptr->Width());
         // SA_PRINTF("%s","evalues: ");
         // for (int j=0; j<cut_ptr->Width(); ++j)
@@ -236,13 +351,225 @@ bool Eigensolver::SolveDirect(
     return vector_added;
 }
 
+bool Eigensolver::SolveReused(
+    const mfem::SparseMatrix& A, const mfem::SparseMatrix& B,
+    const mfem::DenseMatrix& prev_evects, double theta,
+    mfem::DenseMatrix& cut_evects)
+{
+    const double lmax = 1.; // Special choice which is good when the weighted
+                            // l1-smoother is used
+    const double upper = theta * lmax;
+    const int n = A.Height();
+    Vector diagB;
+
+    SA_ASSERT(prev_evects.Height() == n);
+    if (!spect_get_diag(B, diagB))
+        return false;
+
+    // B-orthonormalize the old vectors, dropping the ones that became
+    // dependent.
+    DenseMatrix W(prev_evects);
+    const int k = lobpcg_b_orthonormalize(diagB, W, 0, W.Width());
+    if (0 == k)
+        return false;
+
+    // Rayleigh-Ritz with the new matrix on the span of the old vectors.
+    DenseMatrix AW(n, k), Ak(k), Ik(k), Y;
+    Vector ritz;
+    for (int j=0; j < k; ++j)
+    {
+        Vector w(W.Data() + j * n, n);
+        Vector aw(AW.Data() + j * n, n);
+        A.Mult(w, aw);
+    }
+    Ik = 0.;
+    for (int p=0; p < k; ++p)
+    {
+        Ik(p, p) = 1.;
+        for (int q=0; q <= p; ++q)
+        {
+            double pq = 0., qp = 0.;
+            for (int r=0; r < n; ++r)
+            {
+                pq += W(r, p) * AW(r, q);
+                qp += W(r, q) * AW(r, p);
+            }
+            Ak(p, q) = Ak(q, p) = 0.5 * (pq + qp);
+        }
+    }
+    xpacks_calc_all_gen_eigens_dense(Ak, ritz, Y, Ik);
+
+    // Take the Ritz pairs below the threshold (at least one, as the direct
+    // solver does), all of which must be accurate.
+    int m = 1;
+    while (m < k && ritz(m) <= upper)
+        ++m;
+    const double max_res = reuse_tol * upper;
+    Vector x(n), ax(n);
+    for (int c=0; c < m; ++c)
+    {
+        x = 0.;
+        ax = 0.;
+        for (int l=0; l < k; ++l)
+        {
+            const double y = Y(l, c);
+            for (int r=0; r < n; ++r)
+            {
+                x(r) += y * W(r, l);
+                ax(r) += y * AW(r, l);
+            }
+        }
+        double res = 0.;
+        for (int r=0; r < n; ++r)
+        {
+            const double rr = ax(r) - ritz(c) * diagB(r) * x(r);
+            res += rr * rr / diagB(r);
+        }
+        if (sqrt(res) > max_res)
+        {
+            SA_PRINTF_L(9, "Ritz pair %d of %d: value %g, residual %g > %g\n",
+                        c, m, ritz(c), sqrt(res), max_res);
+            return false;
+        }
+    }
+
+    cut_evects.SetSize(n, m);
+    cut_evects = 0.;
+    for (int c=0; c < m; ++c)
+        for (int l=0; l < k; ++l)
+        {
+            const double y = Y(l, c);
+            for (int r=0; r < n; ++r)
+                cut_evects(r, c) += y * W(r, l);
+        }
+    SA_PRINTF_L(9, "Reused %d old vectors, taken: %d\n", k, m);
+
+    return true;
+}
+
+bool Eigensolver::SolveLOBPCG(
+    const mfem::SparseMatrix& A, mfem::SparseMatrix *& B, int part,
+    double& theta, mfem::DenseMatrix& cut_evects,
+    const mfem::DenseMatrix *start_evects)
+{
+    const double lmax = 1.; // Special choice which is good when the weighted
+                            // l1-smoother is used
+    const int n = A.Height();
+    const int cut_evects_num_beg = cut_evects.Width(); // Number of vectors in
+                                                       // old basis (w/o xbad)
+    Vector diagB, evals;
+
+    SA_ASSERT(A.Width() == n);
+    SA_ASSERT(SA_REAL_ALMOST_LE(theta, lmax));
+    SA_ASSERT(theta >= 0.);
+    // Build the weighted l1-smoother for the eigenvalue problem if not given.
+    if (!B)
+        B = mbox_snd_D_sparse_from_sparse(A);
+    if (!spect_get_diag(*B, diagB))
+    {
+        count_direct_solves++;
+        return SolveDirect(A, B, part, part, -1, theta, cut_evects, NULL,
+                           transf, all_eigens);
+    }
+
+    // Start with the old vectors and one more, if there are any, and grow
+    // the block while all of its Ritz values are below theta * lmax.
+    const int max_block = std::max(1, std::min(n / 3, max_lobpcg_vectors));
+    int block = start_evects ? start_evects->Width() + 1 : lobpcg_block;
+    block = std::min(block, max_block);
+    int filled = 0;
+    DenseMatrix X(n, block);
+    if (start_evects)
+    {
+        SA_ASSERT(start_evects->Height() == n);
+        filled = std::min(start_evects->Width(), block);
+        memcpy(X.Data(), start_evects->Data(), sizeof(double) * n * filled);
+    }
+    lobpcg_fill_random(X, filled);
+
+    int below;
+    count_lobpcg_solves++;
+    for (;;)
+    {
+        count_lobpcg_iterations += lobpcg_calc_lower_eigens_sparse_diag(
+            A, diagB, X, evals, max_lobpcg_iters, lobpcg_tol);
+        below = 0;
+        while (below < block && evals(below) <= theta * lmax)
+            ++below;
+        if (below < block || block == max_block)
+            break;
+        const int grown = std::min(2 * block, max_block);
+        SA_PRINTF_L(9, "LOBPCG: all %d Ritz values below theta, block %d\n",
+                    block, grown);
+        DenseMatrix Xg(n, grown);
+        memcpy(Xg.Data(), X.Data(), sizeof(double) * n * block);
+        lobpcg_fill_random(Xg, block);
+        X = Xg;
+        block = grown;
+    }
+
+    // As the direct solver, take at least one vector.
+    const int vectors_got = std::max(below, 1);
+    if (vectors_got == block)
+    {
+        count_max_used++;
+    }
+    else
+    {
+        smallest_eigenvalue_skipped =
+            std::min(smallest_eigenvalue_skipped, evals(vectors_got));
+    }
+    cut_evects.SetSize(n, vectors_got);
+    memcpy(cut_evects.Data(), X.Data(), sizeof(double) * n * vectors_got);
+
+    if (SA_IS_OUTPUT_LEVEL(9))
+    {
+        SA_PRINTF("theta * lmax: %g\n", theta * lmax);
+        SA_PRINTF("system size: %d, block: %d, eigens taken: %d\n",
+                  n, block, vectors_got);
+    }
+
+    return (cut_evects_num_beg < vectors_got);
+}
+
+double Eigensolver::CompareLOBPCGWithDirect(const mfem::SparseMatrix& A)
+{
+    const int n = A.Height();
+    SA_ASSERT(A.Width() == n);
+    SparseMatrix *B = mbox_snd_D_sparse_from_sparse(A);
+    Vector diagB;
+    const bool diagonal = spect_get_diag(*B, diagB);
+    delete B;
+    SA_ASSERT(diagonal);
+    if (!diagonal)
+        return -1.;
+
+    Vector lobpcg_evals, direct_evals;
+    DenseMatrix X(n, std::max(1, std::min(lobpcg_block, n / 3)));
+    lobpcg_fill_random(X, 0);
+    lobpcg_calc_lower_eigens_sparse_diag(A, diagB, X, lobpcg_evals,
+                                         max_lobpcg_iters, lobpcg_tol);
+
+    // the weighted l1-smoother bounds the spectrum by 1
+    DenseMatrix direct_evects;
+    xpacks_calc_lower_eigens_diag(A, diagB, direct_evals, direct_evects, 1.,
+                                  true, eigen_workspace);
+
+    const int compared = std::min(lobpcg_evals.Size(), direct_evals.Size());
+    double diff = 0.;
+    for (int i=0; i < compared; ++i)
+        diff = std::max(diff, std::fabs(lobpcg_evals(i) - direct_evals(i)));
+    return diff;
+}
+
 #if SAAMGE_USE_ARPACK
 bool Eigensolver::SolveIterative(
     const mfem::SparseMatrix& A,
     mfem::SparseMatrix *& B, int part, int agg_id, int agg_size,
     double& theta, mfem::DenseMatrix& cut_evects,
     const mfem::DenseMatrix *Tt,
-    bool transf, bool all_eigens)
+    bool transf, bool all_eigens,
+    const mfem::DenseMatrix *start_evects)
 {
     SA_ASSERT(!transf); // not implemented, but possible if you want
     SA_ASSERT(!all_eigens); // not implemented, and difficult with ARPACK
@@ -274,9 +601,22 @@ bool Eigensolver::SolveIterative(
     int num_arnoldi = (A.Width() < 4*max_arpack_vectors) ? A.Width() : 4*max_arpack_vectors;
     if (A.Width() < max_arpack_vectors) max_arpack_vectors = A.Width();
     cut_ptr = &cut_helper;
+
+    // Start the Arnoldi process in the span of the old vectors, if any.
+    Vector start;
+    if (start_evects)
+    {
+        SA_ASSERT(start_evects->Height() == A.Height());
+        start.SetSize(A.Height());
+        start = 0.;
+        for (int j=0; j < start_evects->Width(); ++j)
+            for (int r=0; r < A.Height(); ++r)
+                start(r) += (*start_evects)(r, j);
+    }
     int numvectors = arpacks_calc_portion_eigens_sparse_diag(
         A, evals, *cut_ptr, *B, max_arpack_vectors, true,
-        max_arpack_its, num_arnoldi, arpack_tol);
+        max_arpack_its, num_arnoldi, arpack_tol,
+        start_evects ? start.GetData() : NULL);
     int vectors_got = min_vectors;
     for (int ev=min_vectors; ev<max_arpack_vectors; ++ev)
     {
@@ -529,7 +869,8 @@ bool spect_schur_local_prob_solve_sparse(
     if (SA_IS_OUTPUT_LEVEL(9))
     {
         SA_PRINTF("theta * lmax: %g, bound: %g\n", theta * lmax, bound);
-        SA_PRINTF("total eigens: %d, taken: %d\n", deA.Size(),
+        SA_PRINTF("total eigens: %d, taken: %d\n",
+                  transf ? deA.Size() : A.Width(),
                   cut_ptr->Width());
     }
 
@@ -32,12 +32,18 @@
 #include "common.hpp"
 #include "tg.hpp"
 #include <mfem.hpp>
+#include <algorithm>
+#include <vector>
 #include "smpr.hpp"
 #include "solve.hpp"
 #include "helpers.hpp"
 #include "interp.hpp"
 #include "adapt.hpp"
 #include "mfem_addons.hpp"
+#include "prof.hpp"
+#if SAAMGE_USE_OPENMP
+#include <omp.h>
+#endif
 
 namespace saamge
 {
@@ -91,7 +97,7 @@ void HypreDirect::Mult(const mfem::Vector &x, mfem::Vector &y) const
 void tg_cycle_atb(HypreParMatrix& A, HypreParMatrix& Ac, HypreParMatrix& interp,
                   HypreParMatrix& restr, const Vector& b, smpr_ft pre_smoother,
                   smpr_ft post_smoother, Vector& x, Solver& coarse_solver,
-                  void *data)
+                  void *data, tg_cycle_workspace_t *ws)
 {
     SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
     SA_ASSERT(Ac.GetGlobalNumRows() == Ac.GetGlobalNumCols());
@@ -106,29 +112,225 @@ void tg_cycle_atb(HypreParMatrix& A, HypreParMatrix& Ac, HypreParMatrix& interp,
     SA_ASSERT(post_smoother);
     // SA_ASSERT(coarse_solver.solver);
 
-    Vector res(b.Size()), resc(mbox_rows_in_current_process(restr));
-    Vector xc(mbox_rows_in_current_process(restr));
-    xc = 0.0;
+    Vector *res, *resc, *xc;
+    HypreParVector *RESC, *XC;
+    if (ws)
+    {
+        SA_ASSERT(ws->res->Size() == b.Size());
+        SA_ASSERT(ws->resc->Size() == mbox_rows_in_current_process(restr));
+        res = ws->res;
+        resc = RESC = ws->resc;
+        xc = XC = ws->xc;
+    }
+    else
+    {
+        res = new Vector(b.Size());
+        resc = new Vector(mbox_rows_in_current_process(restr));
+        xc = new Vector(mbox_rows_in_current_process(restr));
+        // the communicator of the level, which may be a subset of the
+        // processes (see RedistributedSolver::MoveInterpolant)
+        RESC = new HypreParVector(restr.GetComm(), restr.GetGlobalNumRows(),
+                                  resc->GetData(), restr.GetRowStarts());
+        XC = new HypreParVector(restr.GetComm(), restr.GetGlobalNumRows(),
+                                xc->GetData(), restr.GetRowStarts());
+    }
+    *xc = 0.0;
 
+    prof_begin("smoothing");
     pre_smoother(A, b, x, data);
+    prof_end();
 
-    A.Mult(x, res);
-    subtract(b, res, res);
-    restr.Mult(res, resc);
-
-    HypreParVector RESC(PROC_COMM, restr.GetGlobalNumRows(), resc.GetData(),
-                        restr.GetRowStarts());
-    HypreParVector XC(PROC_COMM, restr.GetGlobalNumRows(), xc.GetData(),
-                      restr.GetRowStarts());
+    A.Mult(x, *res);
+    subtract(b, *res, *res);
+    restr.Mult(*res, *resc);
 
     // could repeat this for W-cycle...
     // coarse_solver.solver(Ac, RESC, XC, coarse_solver.data);
-    coarse_solver.Mult(RESC, XC);
+    prof_begin("coarse solve");
+    coarse_solver.Mult(*RESC, *XC);
+    prof_end();
 
     // interp.Mult(XC, x, 1., 1.);
-    interp.Mult(1.0, XC, 1.0, x);
+    interp.Mult(1.0, *XC, 1.0, x);
 
+    prof_begin("smoothing");
     post_smoother(A, b, x, data);
+    prof_end();
+
+    if (!ws)
+    {
+        delete XC;
+        delete RESC;
+        delete xc;
+        delete resc;
+        delete res;
+    }
+}
+
+/*! \brief Applies a smoother to a block of iterates.
+
+    The polynomial smoother has a block version. Any other smoother is applied
+    to the columns one at a time.
+*/
+static void tg_smooth_block(smpr_ft smoother, HypreParMatrix& A,
+                            const DenseMatrix& B, DenseMatrix& X, void *data)
+{
+    if (smpr_sym_poly == smoother && data)
+    {
+        smpr_sym_poly_block(A, B, X, data);
+        return;
+    }
+    const int n = X.Height();
+    for (int v=0; v < X.Width(); ++v)
+    {
+        Vector b(const_cast<double *>(B.Data()) + (size_t)v * n, n);
+        Vector x(X.Data() + (size_t)v * n, n);
+        smoother(A, b, x, data);
+    }
+}
+
+void tg_cycle_atb_block(HypreParMatrix& A, HypreParMatrix& Ac,
+                        HypreParMatrix& interp, HypreParMatrix& restr,
+                        const DenseMatrix& B, smpr_ft pre_smoother,
+                        smpr_ft post_smoother, DenseMatrix& X,
+                        Solver& coarse_solver, void *data,
+                        tg_cycle_workspace_t *ws)
+{
+    SA_ASSERT(A.GetGlobalNumRows() == A.GetGlobalNumCols());
+    SA_ASSERT(Ac.GetGlobalNumRows() == Ac.GetGlobalNumCols());
+    SA_ASSERT(interp.GetGlobalNumRows() == A.GetGlobalNumRows());
+    SA_ASSERT(restr.GetGlobalNumCols() == A.GetGlobalNumCols());
+    SA_ASSERT(interp.GetGlobalNumCols() == restr.GetGlobalNumRows());
+    SA_ASSERT(restr.GetGlobalNumRows() == Ac.GetGlobalNumRows());
+    SA_ASSERT(B.Height() == X.Height() && B.Width() == X.Width());
+    SA_ASSERT(pre_smoother);
+    SA_ASSERT(post_smoother);
+
+    const int k = B.Width();
+    const int nc = mbox_rows_in_current_process(restr);
+
+    prof_begin("smoothing");
+    tg_smooth_block(pre_smoother, A, B, X, data);
+    prof_end();
+
+    DenseMatrix *res, *resc, *xc;
+    if (ws)
+    {
+        res = ws->bres;
+        resc = ws->bresc;
+        xc = ws->bxc;
+    }
+    else
+    {
+        res = new DenseMatrix;
+        resc = new DenseMatrix;
+        xc = new DenseMatrix;
+    }
+    DenseMatrix& R = *res;
+    DenseMatrix& RC = *resc;
+    DenseMatrix& XC = *xc;
+    R = B;
+    mbox_block_mult_parallel(A, X, R, -1., 1.);
+    RC.SetSize(nc, k);
+    mbox_block_mult_parallel(restr, R, RC, 1., 0.);
+
+    prof_begin("coarse solve");
+    XC.SetSize(nc, k);
+    XC = 0.0;
+    VCycleSolver *vcycle = dynamic_cast<VCycleSolver *>(&coarse_solver);
+    if (vcycle)
+        vcycle->MultBlock(RC, XC);
+    else
+    {
+        for (int v=0; v < k; ++v)
+        {
+            HypreParVector RESC(restr.GetComm(), restr.GetGlobalNumRows(),
+                                RC.Data() + (size_t)v * nc,
+                                restr.GetRowStarts());
+            HypreParVector XCV(restr.GetComm(), restr.GetGlobalNumRows(),
+                               XC.Data() + (size_t)v * nc,
+                               restr.GetRowStarts());
+            coarse_solver.Mult(RESC, XCV);
+        }
+    }
+    prof_end();
+
+    mbox_block_mult_parallel(interp, XC, X, 1., 1.);
+
+    prof_begin("smoothing");
+    tg_smooth_block(post_smoother, A, B, X, data);
+    prof_end();
+
+    if (!ws)
+    {
+        delete xc;
+        delete resc;
+        delete res;
+    }
+}
+
+/*! \brief A parallel vector with the row layout of \a A that owns its data
+           and partitioning.
+*/
+static
+HypreParVector *tg_new_row_vector(HypreParMatrix& A)
+{
+    Vector l;
+    mbox_vector_initialize_for_hypre(l, mbox_rows_in_current_process(A));
+    l = 0.0;
+    double *p;
+    l.StealData(&p);
+    HypreParVector *v = new HypreParVector(PROC_COMM, A.GetGlobalNumRows(), p,
+                                           A.GetRowStarts());
+    mbox_make_owner_data(*v);
+    mbox_make_owner_partitioning(*v);
+    return v;
+}
+
+void tg_init_cycle_workspace(tg_data_t& tg_data, bool krylov)
+{
+    SA_ASSERT(tg_data.interp);
+    SA_ASSERT(tg_data.Ac);
+    tg_free_cycle_workspace(tg_data);
+
+    tg_cycle_workspace_t *ws = new tg_cycle_workspace_t;
+    ws->res = new Vector(mbox_rows_in_current_process(*tg_data.interp));
+    ws->resc = tg_new_row_vector(*tg_data.Ac);
+    ws->xc = tg_new_row_vector(*tg_data.Ac);
+    ws->resc2 = tg_new_row_vector(*tg_data.Ac);
+    ws->kr = ws->kc = ws->kd = ws->kAd = ws->kq = NULL;
+    if (krylov)
+    {
+        ws->kr = tg_new_row_vector(*tg_data.Ac);
+        ws->kc = tg_new_row_vector(*tg_data.Ac);
+        ws->kd = tg_new_row_vector(*tg_data.Ac);
+        ws->kAd = tg_new_row_vector(*tg_data.Ac);
+        ws->kq = tg_new_row_vector(*tg_data.Ac);
+    }
+    ws->bres = new DenseMatrix;
+    ws->bresc = new DenseMatrix;
+    ws->bxc = new DenseMatrix;
+    tg_data.cycle_ws = ws;
+}
+
+void tg_free_cycle_workspace(tg_data_t& tg_data)
+{
+    tg_cycle_workspace_t *ws = tg_data.cycle_ws;
+    if (!ws) return;
+    delete ws->res;
+    delete ws->resc;
+    delete ws->xc;
+    delete ws->resc2;
+    delete ws->kr;
+    delete ws->kc;
+    delete ws->kd;
+    delete ws->kAd;
+    delete ws->kq;
+    delete ws->bres;
+    delete ws->bresc;
+    delete ws->bxc;
+    delete ws;
+    tg_data.cycle_ws = NULL;
 }
 
 double tg_calc_res_tgprod(HypreParMatrix& A, HypreParVector& b,
@@ -158,7 +360,8 @@ double tg_calc_res_tgprod(HypreParMatrix& A, HypreParVector& b,
 
     tg_cycle_atb(A, *(tg_data->Ac), *(tg_data->interp), *(tg_data->restr), *res,
                  tg_data->pre_smoother, tg_data->post_smoother, *psres,
-                 *tg_data->coarse_solver, tg_data->poly_data);
+                 *tg_data->coarse_solver, tg_data->poly_data,
+                 tg_data->cycle_ws);
 
     mbox_make_owner_data(*res);
     mbox_make_owner_partitioning(*res);
@@ -204,7 +407,8 @@ double tg_fullrecalc_res_tgprod(HypreParMatrix& A, HypreParVector& b,
     psres = 0.;
     tg_cycle_atb(A, *(tg_data->Ac), *(tg_data->interp), *(tg_data->restr), res,
                  tg_data->pre_smoother, tg_data->post_smoother, psres,
-                 *tg_data->coarse_solver, tg_data->poly_data);
+                 *tg_data->coarse_solver, tg_data->poly_data,
+                 tg_data->cycle_ws);
     rr = mbox_parallel_inner_product(psres, res);
     A.Mult(x, res);
     subtract(b, res, res);
@@ -265,7 +469,8 @@ int tg_solve(HypreParMatrix& A, HypreParVector& b, HypreParVector& x,
         (*x_prev) = x;
         tg_cycle_atb(A, *(tg_data->Ac), *(tg_data->interp), *(tg_data->restr), b,
                      tg_data->pre_smoother, tg_data->post_smoother, x,
-                     *tg_data->coarse_solver, tg_data->poly_data);
+                     *tg_data->coarse_solver, tg_data->poly_data,
+                 tg_data->cycle_ws);
 
         rr_prev = rr;
         rr = tg_recalc_res_tgprod(A, b, x, *x_prev, *res, *psres, tg_data);
@@ -300,13 +505,16 @@ int tg_solve(HypreParMatrix& A, HypreParVector& b, HypreParVector& x,
 
 int tg_pcg_solve(HypreParMatrix& A, HypreParVector& b, HypreParVector& x,
                  int maxiter, tg_data_t *tg_data, double rtol, double atol,
-                 bool zero_rhs, bool output/*=true*/)
+                 bool zero_rhs, bool output/*=true*/, bool pipelined/*=false*/)
 {
     tg_fillin_coarse_operator(A, tg_data, true);
 
     VCycleSolver tg_precond(tg_data,false);
     tg_precond.SetOperator(A);
 
+    if (pipelined)
+        return pipelined_pcg(A, tg_precond, b, x, (int)(output),
+                             maxiter, rtol, atol, zero_rhs);
     return kalchev_pcg(A, tg_precond, b, x, (int)(output),
                        maxiter, rtol, atol, zero_rhs);
 }
@@ -399,6 +607,17 @@ int tg_pcg_run(HypreParMatrix& A,
     return tgiters;
 }
 
+/**
+   Number of nonzeros stored on this process, for the profiling counters.
+*/
+static
+double tg_local_nnz(HypreParMatrix& A)
+{
+    hypre_ParCSRMatrix *hA = A;
+    return (double)hypre_CSRMatrixNumNonzeros(hypre_ParCSRMatrixDiag(hA)) +
+           (double)hypre_CSRMatrixNumNonzeros(hypre_ParCSRMatrixOffd(hA));
+}
+
 tg_data_t *tg_init_data(
     HypreParMatrix& A, const agg_partitioning_relations_t& agg_part_rels, 
     int nu_pro, int nu_relax, double theta, bool smooth_interp, 
@@ -423,21 +642,50 @@ tg_data_t *tg_init_data(
     tg_data->smooth_interp = smooth_interp;
 
     tg_data->tag = -1;
+    tg_data->cycle_mu = 2;
+    tg_data->redist_threshold = 0;
+    tg_data->redist_rows = 0;
 
     tg_data->doing_spectral = false;
 
     return tg_data;
 }
 
+void tg_set_relaxation(HypreParMatrix& A, tg_data_t& tg_data,
+                       smpr_relax_t relax)
+{
+    SA_ASSERT(tg_data.poly_data);
+    switch (relax)
+    {
+        case SMPR_RELAX_POLY:
+            break;
+        case SMPR_RELAX_CHEBYSHEV:
+            smpr_chebyshev_poly_init(A, 0., tg_data.poly_data);
+            tg_data.pre_smoother = smpr_sym_poly;
+            tg_data.post_smoother = smpr_sym_poly;
+            break;
+        case SMPR_RELAX_L1GS:
+            // poly_data stays: its Dinv_neg is used for smoothing the
+            // interpolant and it keeps the set-up hypre smoother.
+            tg_data.pre_smoother = smpr_gauss_seidel;
+            tg_data.post_smoother = smpr_gauss_seidel;
+            break;
+        default:
+            SA_ASSERT(false);
+    }
+}
+
 void tg_assemble_and_smooth(HypreParMatrix &Ag,
                             tg_data_t& tg_data,
                             const agg_partitioning_relations_t& agg_part_rels)
 {
     StopWatch chrono;
     chrono.Start();
+    prof_begin("tent assembly");
     tg_data.tent_interp =
         interp_global_tent_assemble(agg_part_rels, *tg_data.interp_data,
                                     tg_data.ltent_interp);
+    prof_end();
     chrono.Stop();
     SA_RPRINTF_L(0, 5, "Time for global_tent_assemble: %f\n",chrono.RealTime());
 
@@ -455,7 +703,10 @@ void tg_assemble_and_smooth(HypreParMatrix &Ag,
 
     chrono.Clear();
     chrono.Start();
+    prof_begin("smooth interp");
     tg_smooth_interp(Ag, tg_data);
+    prof_count("local interp nonzeros", tg_local_nnz(*tg_data.interp));
+    prof_end();
     chrono.Stop();
     SA_RPRINTF_L(0, 5, "Time for tg_smooth_interp: %f\n",chrono.RealTime());
     if (SA_IS_OUTPUT_LEVEL(3))
@@ -472,6 +723,18 @@ void tg_assemble_and_smooth(HypreParMatrix &Ag,
               tg_data.restr->GetGlobalNumRows());
 }
 
+void tg_reset_coarse_space(HypreParMatrix& A, tg_data_t& tg_data)
+{
+    SA_ASSERT(tg_data.interp_data);
+    SA_ASSERT(tg_data.poly_data);
+
+    smpr_update_Dinv_neg(A, tg_data.poly_data);
+    interp_reset_data(*tg_data.interp_data);
+    delete tg_data.scaling_P;
+    tg_data.scaling_P = NULL;
+    tg_free_coarse_operator(tg_data);
+}
+
 void tg_build_hierarchy_with_polynomial(
     HypreParMatrix& Ag, Mesh& mesh, tg_data_t& tg_data,
     const agg_partitioning_relations_t& agg_part_rels,
@@ -541,42 +804,87 @@ void tg_build_hierarchy(HypreParMatrix& Ag, tg_data_t& tg_data,
 
 void tg_augment_interp_with_identity(tg_data_t& tg_data, int k)
 {
-    SA_ASSERT(PROC_NUM == 1);
-
+    SA_ASSERT(0 <= k);
     hypre_ParCSRMatrix * hInterp = *tg_data.interp;
-    SparseMatrix * new_interp = new SparseMatrix(hInterp->diag->num_rows + k,
-                                                 hInterp->diag->num_cols + k);
-    int * AI = hInterp->diag->i;
-    int * AJ = hInterp->diag->j;
-    double * Adata = hInterp->diag->data;
-    for (int i=0; i<k; ++i)
-        new_interp->Add(i,i,1.0);
-    for (int i=0; i<hInterp->diag->num_rows; ++i)
-        for (int j=AI[i]; j<AI[i+1]; ++j)
-            new_interp->Add(i+k,AJ[j]+k,Adata[j]);
-    new_interp->Finalize();
+    hypre_CSRMatrix * diag = hInterp->diag;
+    hypre_CSRMatrix * offd = hInterp->offd;
+    const int rows = diag->num_rows;
+    const int cols = diag->num_cols;
+    const int offd_cols = offd->num_cols;
+    const HYPRE_Int first_row = hypre_ParCSRMatrixFirstRowIndex(hInterp);
+    const HYPRE_Int first_col = hypre_ParCSRMatrixFirstColDiag(hInterp);
+
+    // the k new rows and columns go first and to the first process, all
+    // other global rows and columns move by k
+    const int kl = (0 == PROC_RANK) ? k : 0;
+    const int diag_nnz = diag->i[rows];
+    const int offd_nnz = offd->i ? offd->i[rows] : 0;
+    HYPRE_Int * diag_i = new HYPRE_Int[rows + kl + 1];
+    HYPRE_Int * diag_j = new HYPRE_Int[diag_nnz + kl];
+    double * diag_data = new double[diag_nnz + kl];
+    HYPRE_Int * offd_i = new HYPRE_Int[rows + kl + 1];
+    HYPRE_Int * offd_j = new HYPRE_Int[offd_nnz];
+    double * offd_data = new double[offd_nnz];
+    HYPRE_Int * col_map_offd = new HYPRE_Int[offd_cols];
+
+    for (int i=0; i<kl; ++i)
+    {
+        diag_i[i] = i;
+        diag_j[i] = i;
+        diag_data[i] = 1.0;
+        offd_i[i] = 0;
+    }
+    for (int i=0; i<=rows; ++i)
+    {
+        diag_i[i+kl] = diag->i[i] + kl;
+        offd_i[i+kl] = offd->i ? offd->i[i] : 0;
+    }
+    for (int j=0; j<diag_nnz; ++j)
+    {
+        diag_j[j+kl] = diag->j[j] + kl;
+        diag_data[j+kl] = diag->data[j];
+    }
+    for (int j=0; j<offd_nnz; ++j)
+    {
+        offd_j[j] = offd->j[j];
+        offd_data[j] = offd->data[j];
+    }
+    for (int j=0; j<offd_cols; ++j)
+        col_map_offd[j] = hInterp->col_map_offd[j] + k;
+
+    HYPRE_Int row_starts[2], col_starts[2];
+    row_starts[0] = first_row + k - kl;
+    row_starts[1] = first_row + k + rows;
+    col_starts[0] = first_col + k - kl;
+    col_starts[1] = first_col + k + cols;
+
+    HypreParMatrix * new_interp = new HypreParMatrix(
+        PROC_COMM, tg_data.interp->M() + k, tg_data.interp->N() + k,
+        row_starts, col_starts, diag_i, diag_j, diag_data,
+        offd_i, offd_j, offd_data, offd_cols, col_map_offd);
+    new_interp->CopyRowStarts();
+    new_interp->CopyColStarts();
 
     delete tg_data.interp;
-    int * row_starts = new int[2];
-    row_starts[0] = 0;
-    row_starts[1] = new_interp->Height();
-    int * col_starts = new int[2];
-    col_starts[0] = 0;
-    col_starts[1] = new_interp->Width();
-
-    tg_data.interp = new HypreParMatrix(
-        PROC_COMM, new_interp->Height(), new_interp->Height(),
-        new_interp->Width(), new_interp->GetI(), new_interp->GetJ(),
-        new_interp->GetData(), row_starts, col_starts);
-    mbox_make_owner_rowstarts_colstarts(*tg_data.interp);
-    delete [] row_starts;
-    delete [] col_starts;
-    delete new_interp;
+    tg_data.interp = new_interp;
 
     delete tg_data.restr;
     tg_data.restr = tg_data.interp->Transpose();
 }
 
+/*! \brief Whether DoF \a dof is in AE \a part.
+
+    In parallel the algebraic Alocal is \b ExtendedLocalMatrix, whose columns
+    past the local DoFs are DoFs of other processes and so in no local AE.
+*/
+static inline
+bool tg_dof_in_AE(int dof, int part,
+                  const agg_partitioning_relations_t& agg_part_rels)
+{
+    return dof < agg_part_rels.dof_to_AE->Size() &&
+           agg_elem_in_col(dof, part, *agg_part_rels.dof_to_AE) >= 0;
+}
+
 void ExtractSubMatrices(const SparseMatrix& A, 
                         const agg_partitioning_relations_t& agg_part_rels,
                         Array<SparseMatrix*>& agglomerate_element_matrices)
@@ -614,7 +922,7 @@ void ExtractSubMatrices(const SparseMatrix& A,
 
                 glob_neigh = neighbours[j];
 
-                if (agg_elem_in_col(glob_neigh, part, *agg_part_rels.dof_to_AE) < 0)
+                if (!tg_dof_in_AE(glob_neigh, part, agg_part_rels))
                     continue;
 
                 local_neigh = agg_map_id_glob_to_AE(glob_neigh, part, agg_part_rels);
@@ -738,126 +1046,203 @@ void TestWindowSubMatrices()
     delete Aglobal;
 }
 
-void WindowSubMatrices(const SparseMatrix& A, 
-                       const agg_partitioning_relations_t& agg_part_rels,
-                       Array<SparseMatrix*>& agglomerate_element_matrices)
-{
-    int nparts = agg_part_rels.nparts;
-    agglomerate_element_matrices.SetSize(nparts);
+/*! \brief The window AE matrix of one AE, see \b WindowSubMatrices.
 
-    for (int part=0; part<nparts; ++part)
+    \param A (IN) The (local or extended local) matrix.
+    \param AE_dof (IN) The DoFs of the AE.
+    \param localsize (IN) The number of DoFs of the AE.
+    \param local_of (IN/OUT) Scratch of size A.Height(), all -1 on entry and
+                             on exit. Maps DoFs to their index in the AE.
+    \param ext_of (IN/OUT) Scratch of size A.Height(), all -1 on entry and
+                           on exit. Maps the DoFs just outside the AE to
+                           their index in the extension.
+
+    \returns The AE matrix.
+*/
+static
+SparseMatrix *tg_window_submatrix(const SparseMatrix& A, const int *AE_dof,
+                                  int localsize, std::vector<int>& local_of,
+                                  std::vector<int>& ext_of)
+{
+    const int *AI = A.GetI();
+    const int *AJ = A.GetJ();
+    const double *Adata = A.GetData();
+
+    for (int i=0; i<localsize; ++i)
+        local_of[AE_dof[i]] = i;
+
+    // the DoFs X just outside T, the denominators of their alpha
+    // coefficients and the couplings A_{T,X} by column
+    std::vector<int> ext_dof;
+    std::vector<int> ext_i(1, 0);
+    for (int i=0; i<localsize; ++i)
     {
-        int localsize = agg_part_rels.AE_to_dof->RowSize(part);
-        if (localsize == 1)
+        const int row = AE_dof[i];
+        for (int k=AI[row]; k<AI[row+1]; ++k)
         {
-            agglomerate_element_matrices[part] = new SparseMatrix(localsize,localsize);
-            agglomerate_element_matrices[part]->Set(0,0,1.0);
-            agglomerate_element_matrices[part]->Finalize();
-            continue;
+            const int col = AJ[k];
+            if (local_of[col] >= 0 || ext_of[col] >= 0)
+                continue;
+            ext_of[col] = (int)ext_dof.size();
+            ext_dof.push_back(col);
+            ext_i.push_back(0);
+        }
+    }
+    const int num_ext = (int)ext_dof.size();
+    std::vector<double> denominators(num_ext);
+    for (int x=0; x<num_ext; ++x)
+    {
+        const int row = ext_dof[x];
+        double value = 0.0;
+        for (int k=AI[row]; k<AI[row+1]; ++k)
+        {
+            if (local_of[AJ[k]] >= 0)
+                value += Adata[k];
         }
-        int * AE_dof = agg_part_rels.AE_to_dof->GetRow(part);
-        // agglomerate_element_matrices[part] = new SparseMatrix(localsize,localsize);
-
-        // let's actually construct the extension mapping
-        // we begin by constructing the denominators of the alpha coefficients, 
-        // and figuring out the size of the extension operator
-        std::map<int, double> denominators;
-        std::map<int, int> globalcol_to_Xnumber;
-        int num_extension_rows = 0;
+        SA_ASSERT(fabs(value) > 0.0);
+        denominators[x] = value;
+    }
+    for (int i=0; i<localsize; ++i)
+    {
+        const int row = AE_dof[i];
+        for (int k=AI[row]; k<AI[row+1]; ++k)
+        {
+            if (ext_of[AJ[k]] >= 0)
+                ext_i[ext_of[AJ[k]] + 1]++;
+        }
+    }
+    for (int x=0; x<num_ext; ++x)
+        ext_i[x+1] += ext_i[x];
+    std::vector<int> ext_j(ext_i[num_ext]);
+    std::vector<double> ext_data(ext_i[num_ext]);
+    {
+        std::vector<int> pos(ext_i.begin(), ext_i.end() - 1);
         for (int i=0; i<localsize; ++i)
         {
-            int glob_dof = AE_dof[i];
-            int row_start = A.GetI()[glob_dof];
-            int *neighbours = &(A.GetJ()[row_start]);
-            int row_size = A.RowSize(glob_dof);
-
-            // loop over fine dof neighbors of fine dof i
-            for (int j=0; j<row_size; ++j)
+            const int row = AE_dof[i];
+            for (int k=AI[row]; k<AI[row+1]; ++k)
             {
-                int glob_neigh = neighbours[j];
-
-                // if this neighbor is outside T, make an entry in the denominators std::map
-                if (!denominators.count(glob_neigh)
-                    &&
-                    agg_elem_in_col(glob_neigh, part, *agg_part_rels.dof_to_AE) < 0)
-                {
-                    double value = 0.0;
-                    int inner_row_start = A.GetI()[glob_neigh];
-                    int * inner_neighbours = &(A.GetJ()[inner_row_start]);
-                    double *inner_data = &(A.GetData()[inner_row_start]);
-                    int inner_row_size = A.RowSize(glob_neigh);
-                    for (int k=0; k<inner_row_size; ++k)
-                    {
-                        // SA_RPRINTF(0,"    k=%d, inner_neighbours[k]=%d, inner_data[k]=%f\n",
-                        //         k, inner_neighbours[k], inner_data[k]);
-                        if (agg_elem_in_col(inner_neighbours[k], part, *agg_part_rels.dof_to_AE) >= 0)
-                            value += inner_data[k];
-                    }
-                    // SA_RPRINTF(0,"  i=%d, j=%d, glob_dof=%d, glob_neigh=%d, value=%f\n",
-                    //         i, j, glob_dof, glob_neigh, value);
-                    SA_ASSERT(fabs(value) > 0.0);
-                    denominators[glob_neigh] = value;
-                    globalcol_to_Xnumber[glob_neigh] = num_extension_rows++;
-                }
+                const int x = ext_of[AJ[k]];
+                if (x < 0)
+                    continue;
+                ext_j[pos[x]] = i;
+                ext_data[pos[x]++] = Adata[k];
             }
         }
-        // now construct the extension mapping and A_{T,\X} (and also A_TT...)
-        SparseMatrix extension(num_extension_rows, localsize);
-        SparseMatrix ATX(localsize, num_extension_rows);
-        SparseMatrix ATT(localsize, localsize);
-        for (int i=0; i<localsize; ++i)
+    }
+
+    // row i of A_TT + A_{T,X} E, where E(x,j) = A(j,x) / denominator(x),
+    // gathered in a dense accumulator
+    std::vector<double> acc(localsize);
+    std::vector<char> in_row(localsize, 0);
+    std::vector<int> cols;
+    int *I = new int[localsize + 1];
+    std::vector<int> J;
+    std::vector<double> data;
+    I[0] = 0;
+    for (int i=0; i<localsize; ++i)
+    {
+        const int row = AE_dof[i];
+        cols.clear();
+        for (int k=AI[row]; k<AI[row+1]; ++k)
         {
-            int glob_dof = AE_dof[i];
-            int row_start = A.GetI()[glob_dof];
-            int * neighbours = &(A.GetJ()[row_start]);
-            double * neigh_data = &(A.GetData()[row_start]);
-            int row_size = A.RowSize(glob_dof);
-
-            // loop over neighbors of i that are not in T, but do appear in denominators
-            for (int j=0; j<row_size; ++j)
+            const int col = AJ[k];
+            const int local = local_of[col];
+            if (local >= 0)
             {
-                int glob_neigh = neighbours[j];
-                if (denominators.count(glob_neigh) // TODO: I think these two conditions are testing the same thing...
-                    &&
-                    agg_elem_in_col(glob_neigh, part, *agg_part_rels.dof_to_AE) < 0)
+                if (!in_row[local])
                 {
-                    ATX.Add(i, globalcol_to_Xnumber[glob_neigh], neigh_data[j]);
-                    extension.Add(globalcol_to_Xnumber[glob_neigh], i, neigh_data[j] / denominators[glob_neigh]);
+                    in_row[local] = 1;
+                    acc[local] = 0.0;
+                    cols.push_back(local);
                 }
-                else
+                acc[local] += Adata[k];
+                continue;
+            }
+            const int x = ext_of[col];
+            SA_ASSERT(x >= 0);
+            const double coef = Adata[k] / denominators[x];
+            for (int q=ext_i[x]; q<ext_i[x+1]; ++q)
+            {
+                const int j = ext_j[q];
+                if (!in_row[j])
                 {
-                    SA_ASSERT(agg_elem_in_col(glob_neigh, part, *agg_part_rels.dof_to_AE) >= 0);
-                    int local_neigh = agg_map_id_glob_to_AE(glob_neigh, part, agg_part_rels);
-                    ATT.Add(i, local_neigh, neigh_data[j]);
+                    in_row[j] = 1;
+                    acc[j] = 0.0;
+                    cols.push_back(j);
                 }
+                acc[j] += coef * ext_data[q];
             }
         }
-        extension.Finalize();
-        ATX.Finalize();
-        ATT.Finalize();
-
-        SparseMatrix * temp;
-        if (num_extension_rows == 0)
+        std::sort(cols.begin(), cols.end());
+        for (unsigned int q=0; q<cols.size(); ++q)
         {
-            temp = new SparseMatrix(ATT.Height(),ATT.Width());
-            temp->Finalize();
-            // temp = 0.0;
+            J.push_back(cols[q]);
+            data.push_back(acc[cols[q]]);
+            in_row[cols[q]] = 0;
         }
-        else
-            temp = Mult(ATX, extension);
-        agglomerate_element_matrices[part] = Add(ATT, *temp);
-        // agglomerate_element_matrices[part] = Add(*temp, ATT);
+        I[i+1] = (int)J.size();
+    }
+
+    for (int i=0; i<localsize; ++i)
+        local_of[AE_dof[i]] = -1;
+    for (int x=0; x<num_ext; ++x)
+        ext_of[ext_dof[x]] = -1;
+
+    const int nnz = I[localsize];
+    int *outJ = new int[nnz];
+    double *outdata = new double[nnz];
+    std::copy(J.begin(), J.end(), outJ);
+    std::copy(data.begin(), data.end(), outdata);
+    return new SparseMatrix(I, outJ, outdata, localsize, localsize);
+}
+
+void WindowSubMatrices(const SparseMatrix& A, 
+                       const agg_partitioning_relations_t& agg_part_rels,
+                       Array<SparseMatrix*>& agglomerate_element_matrices)
+{
+    SA_PROF_SCOPE("WindowSubMatrices");
+    const int nparts = agg_part_rels.nparts;
+    agglomerate_element_matrices.SetSize(nparts);
+
+    // every thread has its own markers, they are reset after each AE
+#if SAAMGE_USE_OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<int> local_of(A.Height(), -1);
+        std::vector<int> ext_of(A.Height(), -1);
+#if SAAMGE_USE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int part=0; part<nparts; ++part)
+        {
+            const int localsize = agg_part_rels.AE_to_dof->RowSize(part);
+            SparseMatrix *mat;
+            if (localsize == 1)
+            {
+                mat = new SparseMatrix(localsize,localsize);
+                mat->Set(0,0,1.0);
+                mat->Finalize();
+            }
+            else
+            {
+                mat = tg_window_submatrix(
+                    A, agg_part_rels.AE_to_dof->GetRow(part), localsize,
+                    local_of, ext_of);
+            }
 #if (SA_IS_DEBUG_LEVEL(3))
-        for (int q=0; q<agglomerate_element_matrices[part]->Height(); ++q)
-            SA_ASSERT(agglomerate_element_matrices[part]->Elem(q,q) > 0.0);
+            for (int q=0; q<mat->Height(); ++q)
+                SA_ASSERT(mat->Elem(q,q) > 0.0);
 #endif
-        delete temp;
+            agglomerate_element_matrices[part] = mat;
+        }
     }
 }
 
 /**
-   In the current implementation, we are assuming serial, and assuming Ag and
-   Alocal are essentially the same matrix.
+   In serial Ag and Alocal are essentially the same matrix, in parallel
+   Alocal is ExtendedLocalMatrix(Ag) (see the overload without it).
 */
 tg_data_t *tg_produce_data_algebraic(
     const SparseMatrix& Alocal,
@@ -866,7 +1251,7 @@ tg_data_t *tg_produce_data_algebraic(
     int polynomial_coarse_arg, bool use_window, bool use_arpack,
     bool avoid_ess_bdr_dofs)
 {
-    SA_ASSERT(PROC_NUM == 1);
+    SA_ASSERT(Alocal.Height() >= agg_part_rels.ND);
 
     Array<SparseMatrix*> agglomerate_element_matrices;
     // only need SubMatrices if !minimal_coarse_arg (may still need them for local correction)
@@ -885,11 +1270,26 @@ tg_data_t *tg_produce_data_algebraic(
     return out;
 }
 
+tg_data_t *tg_produce_data_algebraic(
+    HypreParMatrix& Ag, const agg_partitioning_relations_t& agg_part_rels,
+    int nu_pro, int nu_relax, double spectral_tol, bool smooth_interp,
+    int polynomial_coarse_arg, bool use_window, bool use_arpack,
+    bool avoid_ess_bdr_dofs)
+{
+    SparseMatrix * Alocal = ExtendedLocalMatrix(Ag);
+    tg_data_t * out = tg_produce_data_algebraic(
+        *Alocal, Ag, agg_part_rels, nu_pro, nu_relax, spectral_tol,
+        smooth_interp, polynomial_coarse_arg, use_window, use_arpack,
+        avoid_ess_bdr_dofs);
+    delete Alocal;
+    return out;
+}
+
 void tg_replace_submatrices(tg_data_t &tg_data, const SparseMatrix &Alocal, 
                             const agg_partitioning_relations_t& agg_part_rels,
                             bool use_window)
 {
-    SA_ASSERT(PROC_NUM == 1);
+    SA_ASSERT(Alocal.Height() >= agg_part_rels.ND);
 
     Array<SparseMatrix*> agglomerate_element_matrices;
     if (use_window)
@@ -943,6 +1343,7 @@ void tg_free_data(tg_data_t *tg_data)
     delete tg_data->interp;
     delete tg_data->restr;
     tg_free_coarse_operator(*tg_data);
+    tg_free_cycle_workspace(*tg_data);
     delete tg_data->elem_data;
     delete tg_data;
 }
@@ -966,6 +1367,10 @@ tg_data_t *tg_copy_data(const tg_data_t *src)
     dst->poly_data = smpr_copy_poly_data(src->poly_data);
     dst->smooth_interp = src->smooth_interp;
     dst->theta = src->theta;
+    dst->cycle_ws = NULL;
+    dst->cycle_mu = src->cycle_mu;
+    dst->redist_threshold = src->redist_threshold;
+    dst->redist_rows = src->redist_rows;
 
     return dst;
 }
@@ -985,32 +1390,93 @@ void tg_update_coarse_operator(mfem::HypreParMatrix& A, tg_data_t *tg_data,
 
     tg_free_coarse_operator(*tg_data);
 
+    prof_begin("RAP");
     tg_data->Ac = tg_coarse_matr(A, *(tg_data->interp));
+    prof_count("local coarse nonzeros", tg_local_nnz(*tg_data->Ac));
+    prof_end();
     if (perform_solve_init)
+        tg_init_coarse_solver(tg_data, coarse_direct);
+}
+
+/*! \brief Builds the coarse solver for \a Ac.
+*/
+static mfem::Solver *tg_new_coarse_solver(HypreParMatrix& Ac,
+                                          bool coarse_direct)
+{
+    if (coarse_direct)
     {
-        if (coarse_direct)
-        {
-            if (PROC_NUM == 1)
-            {
-                SA_RPRINTF_L(0, 5, "%s",
-                             "Setting coarse solver as direct UMFPACK solver.\n");
-                tg_data->coarse_solver = new HypreDirect(*tg_data->Ac);
-            } else
-            {
-                SA_RPRINTF_L(0, 5, "%s", "Setting coarse solver as a CG preconditioned "
-                                         "with BoomerAMG.\n");
-                tg_data->coarse_solver = new AMGSolver(*tg_data->Ac, false, 1e-16, 1000);
-            }
-        }
-        else
-        {
-            SA_RPRINTF_L(0, 5, "%s",
-                       "Setting coarse solver as a single BoomerAMG v-cycle.\n");
-            mfem::HypreBoomerAMG * hbamg = new mfem::HypreBoomerAMG(*tg_data->Ac);
-            hbamg->SetPrintLevel(0);
-            tg_data->coarse_solver = hbamg;
-        }
+        SA_RPRINTF_L(0, 5, "%s",
+                     "Setting coarse solver as a gathered direct solver.\n");
+        return new GatheredDirectSolver(Ac);
+    }
+    else
+    {
+        SA_RPRINTF_L(0, 5, "%s",
+                     "Setting coarse solver as a single BoomerAMG v-cycle.\n");
+        mfem::HypreBoomerAMG * hbamg = new mfem::HypreBoomerAMG(Ac);
+        hbamg->SetPrintLevel(0);
+        return hbamg;
+    }
+}
+
+/*! \brief On how many processes the coarse solver of \a tg_data should run.
+*/
+static int tg_coarse_solver_procs(const tg_data_t& tg_data)
+{
+    const int size = tg_data.Ac->M();
+    if (tg_data.redist_threshold <= 0 || size >= tg_data.redist_threshold)
+        return PROC_NUM;
+    int nprocs = 1;
+    if (tg_data.redist_rows > 0)
+        nprocs = size / tg_data.redist_rows;
+    return std::max(1, std::min(nprocs, PROC_NUM));
+}
+
+void tg_init_coarse_solver(tg_data_t *tg_data, bool coarse_direct)
+{
+    SA_PROF_SCOPE("coarse solver setup");
+    SA_ASSERT(tg_data);
+    SA_ASSERT(tg_data->Ac);
+
+    const int nprocs = tg_coarse_solver_procs(*tg_data);
+    if (nprocs < PROC_NUM)
+    {
+        RedistributedSolver *redist =
+            new RedistributedSolver(*tg_data->Ac, nprocs);
+        if (redist->IsActive())
+            redist->SetSolver(tg_new_coarse_solver(*redist->GetSubOperator(),
+                                                   coarse_direct));
+        tg_data->coarse_solver = redist;
+    }
+    else
+        tg_data->coarse_solver = tg_new_coarse_solver(*tg_data->Ac,
+                                                      coarse_direct);
+}
+
+void tg_init_nullspace_coarse_solver(tg_data_t *tg_data)
+{
+    SA_PROF_SCOPE("coarse solver setup");
+    SA_ASSERT(tg_data);
+    SA_ASSERT(tg_data->Ac);
+    SA_ASSERT(tg_data->scaling_P);
+
+    delete tg_data->coarse_solver;
+    const int nprocs = tg_coarse_solver_procs(*tg_data);
+    if (nprocs < PROC_NUM)
+    {
+        RedistributedSolver *redist =
+            new RedistributedSolver(*tg_data->Ac, nprocs);
+        HypreParMatrix *subP = redist->MoveInterpolant(*tg_data->scaling_P);
+        if (redist->IsActive())
+            redist->SetSolver(new CorrectNullspace(*redist->GetSubOperator(),
+                                                   subP, 3, false, true,
+                                                   false));
+        tg_data->coarse_solver = redist;
     }
+    else
+        tg_data->coarse_solver = new CorrectNullspace(*tg_data->Ac,
+                                                      tg_data->scaling_P,
+                                                      3, false, true, false);
 }
 
 } // namespace saamge
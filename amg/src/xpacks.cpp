@@ -40,6 +40,9 @@ extern "C"
     int dpotri_(char *uplo, int *n, double *a, int *
                 lda, int *info);
 
+    int dpotrs_(char *uplo, int *n, int *nrhs, double *a, int *lda,
+                double *b, int *ldb, int *info);
+
     int dsyev_(char *jobz, char *uplo, int *n, double *a, 
                int *lda, double *w, double *work, int *lwork, 
                int *info);
@@ -57,6 +60,12 @@ extern "C"
                 int *ldz, double *work, int *lwork, int *iwork, 
                 int *ifail, int *info);
 
+    int dsyevr_(char *jobz, char *range, char *uplo, int *n,
+                double *a, int *lda, double *vl, double *vu, int *il,
+                int *iu, double *abstol, int *m, double *w, double *z__,
+                int *ldz, int *isuppz, double *work, int *lwork,
+                int *iwork, int *liwork, int *info);
+
     int dgesvd_(char *jobu, char *jobvt, int *m, int *n, 
                 double *a, int *lda, double *s, double *u, int *
                 ldu, double *vt, int *ldvt, double *work, int *lwork, 
@@ -69,6 +78,13 @@ extern "C"
     int dposv_(char *uplo, int *n, int *nrhs, double 
                *a, int *lda, double *b, int *ldb, int *info);
 
+    int dsyrk_(char *uplo, char *trans, int *n, int *k, double *alpha,
+               double *a, int *lda, double *beta, double *c, int *ldc);
+
+    int dgemm_(char *transa, char *transb, int *m, int *n, int *k,
+               double *alpha, double *a, int *lda, double *b, int *ldb,
+               double *beta, double *c, int *ldc);
+
 }
 
 namespace saamge
@@ -493,6 +509,82 @@ double xpack_cut_evects_large(const Vector& evals, const DenseMatrix& evects,
 
 void xpack_svd_dense_arr(const DenseMatrix *arr, int arr_size,
                          DenseMatrix& lsvects, Vector& svals)
+{
+    XpacksSVDWorkspace ws;
+    xpack_svd_dense_arr(arr, arr_size, lsvects, svals, ws);
+}
+
+/*! \brief Computes the SVD of A from the eigendecomposition of its Gram matrix.
+
+    \param a (IN) A, column-major.
+    \param m (IN) The rows of A.
+    \param n (IN) The columns of A, at most \a m.
+    \param lsvects (OUT) The left singular vectors.
+    \param svals (OUT) The singular values, in decreasing order.
+    \param ws (IN/OUT) The reused buffers.
+
+    \returns Whether it worked, that is, whether A is far enough from rank
+             deficient (see \b XPACK_SVD_GRAM_TOL). If not, the outputs are
+             not set.
+*/
+static
+bool xpack_svd_gram(double *a, int m, int n, DenseMatrix& lsvects,
+                    Vector& svals, XpacksSVDWorkspace& ws)
+{
+    char uplo = 'U';
+    char trans = 'T';
+    char notrans = 'N';
+    char jobz = 'V';
+    double one = 1.;
+    double zero = 0.;
+    int info;
+
+    ws.gram.resize(n * n);
+    ws.gram_w.resize(n);
+    dsyrk_(&uplo, &trans, &n, &m, &one, a, &m, &zero, &ws.gram[0], &n);
+
+    if (ws.gram_n != n)
+    {
+        int lwork = -1;
+        double qwork;
+        dsyev_(&jobz, &uplo, &n, &ws.gram[0], &n, &ws.gram_w[0], &qwork,
+               &lwork, &info);
+        SA_ASSERT(!info);
+        ws.gram_lwork = (int)qwork + 1;
+        ws.gram_work.resize(ws.gram_lwork);
+        ws.gram_n = n;
+    }
+    dsyev_(&jobz, &uplo, &n, &ws.gram[0], &n, &ws.gram_w[0], &ws.gram_work[0],
+           &ws.gram_lwork, &info);
+    SA_ASSERT(!info);
+
+    // increasing eigenvalues
+    const double lmax = ws.gram_w[n-1];
+    if (!(lmax > 0.) || ws.gram_w[0] < XPACK_SVD_GRAM_TOL * lmax)
+        return false;
+
+    // V Sigma^{-1}, with the singular values in decreasing order. The dsyev
+    // workspace is free by now.
+    ws.gram_work.resize(std::max(ws.gram_lwork, n * n));
+    double *vs = &ws.gram_work[0];
+    svals.SetSize(n);
+    for (int i=0; i < n; ++i)
+    {
+        const int k = n - 1 - i;
+        svals(i) = sqrt(ws.gram_w[k]);
+        const double scale = 1. / svals(i);
+        for (int r=0; r < n; ++r)
+            vs[i * n + r] = ws.gram[k * n + r] * scale;
+    }
+    lsvects.SetSize(m, n);
+    dgemm_(&notrans, &notrans, &m, &n, &n, &one, a, &m, vs, &n, &zero,
+           lsvects.Data(), &m);
+    return true;
+}
+
+void xpack_svd_dense_arr(const DenseMatrix *arr, int arr_size,
+                         DenseMatrix& lsvects, Vector& svals,
+                         XpacksSVDWorkspace& ws)
 {
     SA_ASSERT(arr);
     SA_ASSERT(0 < arr_size);
@@ -512,10 +604,8 @@ void xpack_svd_dense_arr(const DenseMatrix *arr, int arr_size,
     int ldu = m;
     int ldvt = n;
     double *vt = NULL;
-    int lwork = -1;
     int info;
-    double qwork;
-    double *a = new double[m*n];
+    double *a;
     double *s;
     double *u;
     int minimal = std::min(m, n);
@@ -530,6 +620,9 @@ void xpack_svd_dense_arr(const DenseMatrix *arr, int arr_size,
         SA_PRINTF("%s","ERROR: empty eigenvalue array!\n");
     SA_ASSERT(minimal > 0);
 
+    if ((int)ws.a.size() < m * n)
+        ws.a.resize(m * n);
+    a = &ws.a[0];
     double *ptr = a;
     Vector vect(NULL, m);
     if (SA_IS_OUTPUT_LEVEL(9))
@@ -565,27 +658,41 @@ void xpack_svd_dense_arr(const DenseMatrix *arr, int arr_size,
     }
     minimal = std::min(m, n);
 
+    if (n > 0 && XPACK_SVD_GRAM_RATIO * n <= m &&
+        xpack_svd_gram(a, m, n, lsvects, svals, ws))
+    {
+        ws.count_gram++;
+        return;
+    }
+    ws.count_full++;
+
     svals.SetSize(minimal);
     s = (double *)svals.GetData();
     lsvects.SetSize(m, minimal);
     u = lsvects.Data();
+    ldvt = n;
 
-    dgesvd_(&jobu, &jobvt, &m, &n, a, &lda, s, u, &ldu, vt, &ldvt, &qwork,
-            &lwork, &info);
-    SA_ASSERT(!info);
+    if (ws.m != m || ws.n != n)
+    {
+        int lwork = -1;
+        double qwork;
+        dgesvd_(&jobu, &jobvt, &m, &n, a, &lda, s, u, &ldu, vt, &ldvt, &qwork,
+                &lwork, &info);
+        SA_ASSERT(!info);
 
-    lwork = (int)qwork + 1;
-    SA_ASSERT(lwork >= 1);
-    if (lwork < std::max(3 * minimal + std::max(m, n), 5 * minimal))
-        lwork = std::max(3 * minimal + std::max(m, n), 5 * minimal);
-    double *work = new double[lwork];
+        lwork = (int)qwork + 1;
+        SA_ASSERT(lwork >= 1);
+        if (lwork < std::max(3 * minimal + std::max(m, n), 5 * minimal))
+            lwork = std::max(3 * minimal + std::max(m, n), 5 * minimal);
+        ws.lwork = lwork;
+        ws.work.resize(lwork);
+        ws.m = m;
+        ws.n = n;
+    }
 
-    dgesvd_(&jobu, &jobvt, &m, &n, a, &lda, s, u, &ldu, vt, &ldvt, work,
-            &lwork, &info);
+    dgesvd_(&jobu, &jobvt, &m, &n, a, &lda, s, u, &ldu, vt, &ldvt,
+            &ws.work[0], &ws.lwork, &info);
     SA_ASSERT(!info);
-
-    delete [] work;
-    delete [] a;
 }
 
 void xpack_orth_set(const DenseMatrix& lsvects, const Vector& svals,
@@ -679,4 +786,185 @@ void xpack_solve_spd_Cholesky(const DenseMatrix& A, const Vector &rhs,
     x.MakeDataOwner();
 }
 
+bool xpack_Cholesky_factor(DenseMatrix& A)
+{
+    char uplo = 'U';
+    int n = A.Height();
+    int lda = n;
+    int info;
+
+    SA_ASSERT(A.Width() == A.Height());
+
+    dpotrf_(&uplo, &n, A.Data(), &lda, &info);
+    SA_ASSERT(info >= 0);
+    return (0 == info);
+}
+
+void xpack_Cholesky_solve(const DenseMatrix& U, Vector& x)
+{
+    char uplo = 'U';
+    int n = U.Height();
+    int nrhs = 1;
+    int lda = n;
+    int ldb = n;
+    int info;
+
+    SA_ASSERT(U.Width() == U.Height());
+    SA_ASSERT(x.Size() == n);
+
+    dpotrs_(&uplo, &n, &nrhs, U.Data(), &lda, x.GetData(), &ldb, &info);
+    SA_ASSERT(!info);
+}
+
+XpacksEigenWorkspace::SizeClass& XpacksEigenWorkspace::GetSizeClass(int n)
+{
+    SA_ASSERT(n > 0);
+    const int capacity = ((n + size_class_step - 1) / size_class_step) *
+                         size_class_step;
+    SizeClass& sc = buffers;
+    if (capacity > sc.capacity)
+    {
+        sc.capacity = capacity;
+        sc.a.resize(capacity * capacity);
+        sc.w.resize(capacity);
+        sc.z.resize(capacity * capacity);
+        sc.isuppz.resize(2 * capacity);
+        sc.scale.resize(capacity);
+    }
+
+    std::map<int, std::pair<int, int> >::iterator it =
+        workspace_sizes.find(capacity);
+    if (it == workspace_sizes.end())
+    {
+        // A single workspace query for the largest problem in the class. The
+        // optimal sizes only grow with the problem size, so they are enough
+        // for every problem in the class.
+        char jobz = 'V';
+        char range = 'V';
+        char uplo = 'U';
+        int N = capacity;
+        double vl = -1.;
+        double vu = 1.;
+        char cmach = 'S';
+        double abstol = 2. * dlamch_(&cmach);
+        int m;
+        double qwork;
+        int qiwork;
+        int lwork = -1;
+        int liwork = -1;
+        int info;
+        dsyevr_(&jobz, &range, &uplo, &N, &sc.a[0], &N, &vl, &vu, NULL, NULL,
+                &abstol, &m, &sc.w[0], &sc.z[0], &N, &sc.isuppz[0], &qwork,
+                &lwork, &qiwork, &liwork, &info);
+        SA_ASSERT(!info);
+        it = workspace_sizes.insert(std::make_pair(capacity,
+                 std::make_pair((int)qwork + 1, qiwork))).first;
+    }
+
+    sc.lwork = it->second.first;
+    sc.liwork = it->second.second;
+    if ((int)sc.work.size() < sc.lwork)
+        sc.work.resize(sc.lwork);
+    if ((int)sc.iwork.size() < sc.liwork)
+        sc.iwork.resize(sc.liwork);
+
+    return sc;
+}
+
+/*! \brief Fills in the dense scaled matrix \f$ D^{-1/2} A D^{-1/2} \f$.
+
+    \param A (IN) The sparse matrix.
+    \param scale (IN) The diagonal of \f$ D^{-1/2} \f$.
+    \param a (OUT) The dense (column-major) result, n x n.
+*/
+static inline
+void xpacks_scale_sparse_to_dense(const SparseMatrix& A, const double *scale,
+                                  double *a)
+{
+    const int n = A.Height();
+    const int *I = A.GetI();
+    const int *J = A.GetJ();
+    const double *data = A.GetData();
+
+    memset(a, 0, sizeof(*a) * n * n);
+    for (int i=0; i < n; ++i)
+        for (int k=I[i]; k < I[i+1]; ++k)
+            a[J[k] * n + i] = data[k] * scale[i] * scale[J[k]];
+}
+
+int xpacks_calc_lower_eigens_diag(const SparseMatrix& A, const Vector& diag,
+                                  Vector& evals, DenseMatrix& evects,
+                                  double upper, bool atleast_one,
+                                  XpacksEigenWorkspace& ws)
+{
+    char jobz = 'V';
+    char range = 'V';
+    char uplo = 'U';
+    int n = A.Height();
+    double vl = -1.;
+    double vu = upper;
+    char cmach = 'S';
+    double abstol = 2. * dlamch_(&cmach);
+    int m;
+    int info;
+
+    SA_ASSERT(n > 0);
+    SA_ASSERT(A.Width() == n);
+    SA_ASSERT(diag.Size() == n);
+
+    XpacksEigenWorkspace::SizeClass& sc = ws.GetSizeClass(n);
+    SA_ASSERT(sc.capacity >= n);
+
+    double *scale = &sc.scale[0];
+    for (int i=0; i < n; ++i)
+    {
+        SA_ASSERT(diag(i) > 0.);
+        scale[i] = 1. / sqrt(diag(i));
+    }
+
+    xpacks_scale_sparse_to_dense(A, scale, &sc.a[0]);
+    dsyevr_(&jobz, &range, &uplo, &n, &sc.a[0], &n, &vl, &vu, NULL, NULL,
+            &abstol, &m, &sc.w[0], &sc.z[0], &n, &sc.isuppz[0], &sc.work[0],
+            &sc.lwork, &sc.iwork[0], &sc.liwork, &info);
+    SA_ASSERT(!info);
+
+    if (atleast_one && 0 >= m)
+    {
+#if (SA_IS_DEBUG_LEVEL(6))
+        SA_ALERT(0 < m);
+#endif
+        int il = 1;
+        int iu = 1;
+        range = 'I';
+
+        xpacks_scale_sparse_to_dense(A, scale, &sc.a[0]);
+        dsyevr_(&jobz, &range, &uplo, &n, &sc.a[0], &n, NULL, NULL, &il, &iu,
+                &abstol, &m, &sc.w[0], &sc.z[0], &n, &sc.isuppz[0],
+                &sc.work[0], &sc.lwork, &sc.iwork[0], &sc.liwork, &info);
+        SA_ASSERT(!info);
+        SA_ASSERT(1 == m);
+    }
+
+    evals.SetSize(m);
+    memcpy(evals.GetData(), &sc.w[0], sizeof(double) * m);
+    evects.SetSize(n, m);
+    double *ev = evects.Data();
+    const double *z = &sc.z[0];
+    for (int j=0; j < m; ++j)
+        for (int i=0; i < n; ++i)
+            ev[j * n + i] = z[j * n + i] * scale[i];
+
+    if (SA_IS_OUTPUT_LEVEL(9))
+    {
+        PROC_STR_STREAM << "lower_eigens_diag: Evals = [ ";
+        for (int i=0; i < evals.Size(); ++i)
+            PROC_STR_STREAM << evals(i) << " ";
+        PROC_STR_STREAM << "]\n";
+        SA_PRINTF("%s", PROC_STR_STREAM.str().c_str());
+        PROC_CLEAR_STR_STREAM;
+    }
+
+    return m;
+}
+
 } // namespace saamge
@@ -39,7 +39,7 @@
    * make it work with nu_pro not equal to zero
    * implement multilevel
    * implement correct nulspace
-   * make it work in parallel (non-trivial)
+   * read the matrix in parallel instead of on every process
 
    Andrew T. Barker
    atb@llnl.gov
@@ -53,37 +53,6 @@
 using namespace mfem;
 using namespace saamge;
 
-/**
-   HypreParMatrix has a .Read() method, but I cannot get it
-   to work no matter how hard I try.
-
-   I am reading into a SparseMatrix* here because I want to,
-   but it is not hard to get a HypreParMatrix if you want.
-*/
-SparseMatrix * ReadHypreMat(const char * filename)
-{
-    std::ifstream in(filename);
-    SA_ASSERT(in.good());
-
-    int row0, row1, col0, col1;
-    in >> row0 >> row1 >> col0 >> col1;
-    SA_ASSERT(row0 == 0);
-    SA_ASSERT(col0 == 0);
-    // std::cout << row0 << row1 << col0 << col1 << std::endl;
-    SparseMatrix * out = new SparseMatrix(row1+1,col1+1);
-    while (in)
-    {
-        int i;
-        int j;
-        double x;
-        in >> i >> j >> x;
-        out->Add(i,j,x);
-    }
-    out->Finalize();
-    // out->Print(std::cout);
-    return out;
-}
-
 int main(int argc, char *argv[])
 {
     // Initialize process related stuff.
@@ -116,7 +85,7 @@ int main(int argc, char *argv[])
 
     OptionsParser args(argc, argv);
     args.AddOption(&matrix_file, "-m", "--matrix",
-                   "Matrix file to read.");
+                   "Matrix file to read (hypre IJ text, or binary from matconvert).");
     args.AddOption(
         &nu_pro, "-p", "--nu-pro",
         "Degree of the smoother for the smoothed aggregation for first coarsening.");
@@ -170,14 +139,19 @@ int main(int argc, char *argv[])
 
     MPI_Barrier(PROC_COMM); // try to make MFEM's debug element orientation prints not mess up the parameters above
 
-    int nprocs = PROC_NUM;
-    SA_ASSERT(nprocs == 1); // this algebraic stuff not yet implemented in parallel, should be at some point
-
-    SparseMatrix * mat = ReadHypreMat(matrix_file);
-    int row_starts[2];
-    row_starts[0] = 0;
-    row_starts[1] = mat->Height();
-    HypreParMatrix Ag(PROC_COMM, mat->Height(), row_starts, mat);
+    // The binary format is mapped in place, text is parsed as a fallback.
+    // Every process has the whole matrix and keeps a block of its rows, so
+    // the matrix has to fit in the memory of one process.
+    mbox_mapping_t mat_mapping = {NULL, 0};
+    SparseMatrix * mat;
+    if (mbox_is_mapped_format(matrix_file))
+        mat = mbox_map_sparse_matr(matrix_file, mat_mapping);
+    else
+        mat = mbox_read_ij_sparse_matr(matrix_file);
+    const int row_begin = (int)((long long)mat->Height() * PROC_RANK / PROC_NUM);
+    const int row_end = (int)((long long)mat->Height() * (PROC_RANK + 1) / PROC_NUM);
+    HypreParMatrix * Agp = DistributeSparseMatrix(*mat, row_begin, row_end);
+    HypreParMatrix& Ag = *Agp;
 
     HypreParVector bg(Ag);
     bg = 1.0;
@@ -235,27 +209,29 @@ int main(int argc, char *argv[])
                 Al->Add(i-1,J[j]-1,data[j]);
         }
         Al->Finalize();
-        // delete mat; // would like to, but Ag is using its data
+        // mat is still needed, Al is distributed below
     } 
     else
     {
         Al = mat;
     }
 
-    nparts_arr[0] = Al->Height() / first_elems_per_agg;
-    SparseMatrix * identity = IdentitySparseMatrix(Al->Height());
-    int drow_starts[2];
-    drow_starts[0] = 0;
-    drow_starts[1] = Al->Height();
+    // the same rows as Ag, except for the eliminated ones
+    const int df0 = df0eliminated ? 1 : 0;
+    HypreParMatrix * Alp = DistributeSparseMatrix(
+        *Al, std::max(row_begin - df0, 0), std::max(row_end - df0, 0));
+
+    nparts_arr[0] = std::max(Alp->Height() / first_elems_per_agg, 1);
+    SparseMatrix * identity = IdentitySparseMatrix(Alp->Height());
     HypreParMatrix * dof_truedof = new HypreParMatrix(
-        PROC_COMM, identity->Height(), drow_starts, identity);
+        PROC_COMM, Alp->GetGlobalNumRows(), Alp->GetRowStarts(), identity);
     Array<int> isolated_cells(0);
 
-    if (window_amg)
+    if (window_amg && PROC_NUM == 1)
         TestWindowSubMatrices();
 
     agg_part_rels = fem_create_partitioning_from_matrix(
-        *Al, nparts_arr, dof_truedof, isolated_cells);
+        *Alp, nparts_arr, dof_truedof, isolated_cells);
     for (int i=1; i < num_levels-1; ++i)
     {
         nparts_arr[i] = (int) round((double) nparts_arr[i-1] / (double) elems_per_agg);
@@ -271,9 +247,11 @@ int main(int argc, char *argv[])
         polynomial_coarse = 0;
     else
         polynomial_coarse = -1;
+    SparseMatrix * Alocal = ExtendedLocalMatrix(*Alp);
     tg_data = tg_produce_data_algebraic(
-        *Al, Ag, *agg_part_rels, first_nu_pro, nu_relax, first_theta,
+        *Alocal, Ag, *agg_part_rels, first_nu_pro, nu_relax, first_theta,
         (nu_pro > 0), polynomial_coarse, window_amg, use_arpack, avoid_ess_bdr_dofs);
+    delete Alocal;
 
     if (df0eliminated)
     {
@@ -338,8 +316,13 @@ int main(int argc, char *argv[])
     agg_free_partitioning(agg_part_rels);
 
     if (df0eliminated)
+        delete Al;
+    delete Alp;
+    delete Agp;
+    if (mat_mapping.addr)
+        mbox_unmap_sparse_matr(mat, mat_mapping);
+    else
         delete mat;
-    delete Al;
     delete [] nparts_arr;
     delete identity;
     delete dof_truedof;
@@ -0,0 +1,439 @@
+/*
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   Benchmark driver for the setup and the cycle throughput.
+
+   For every requested size, builds a structured mesh of the unit square
+   (quadrilaterals) or cube (hexahedra) with that many elements per side,
+   assembles a diffusion problem with an isotropic, anisotropic or
+   synthetic SPE10-like (layered, log-normal, high contrast) coefficient,
+   builds the multilevel hierarchy and measures
+     - the setup, together with its profiling regions (see prof.hpp),
+     - the application of the cycle (V by default, see --cycle) and its
+       predicted work from the operator complexities,
+     - PCG preconditioned by the cycle, to a fixed relative tolerance.
+
+   One JSON record per size is written, including the numbers of processes
+   and threads, so that runs on different process and thread counts can be
+   combined into strong and weak scaling studies or compared over time.
+   With --weak the number of elements per side is multiplied by the
+   (rounded) dim-th root of the number of processes.
+*/
+
+#include <mfem.hpp>
+#include <mpi.h>
+#include <saamge.hpp>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "picojson.h"
+#if SAAMGE_USE_OPENMP
+#include <omp.h>
+#endif
+
+using namespace mfem;
+using namespace saamge;
+
+static double anisotropy = 1e-3;
+static double contrast = 6.0;
+static int layers = 10;
+
+double rhs_func(Vector& x)
+{
+    return 1.;
+}
+
+double bdr_cond(Vector& x)
+{
+    return 0.;
+}
+
+/**
+   Diagonal tensor, strong in the first direction.
+*/
+void anisotropic_coef(const Vector& x, DenseMatrix& K)
+{
+    K.SetSize(x.Size());
+    K = 0.;
+    K(0, 0) = 1.;
+    for (int i=1; i < x.Size(); ++i)
+        K(i, i) = anisotropy;
+}
+
+/**
+   Piecewise constant on a 60 x 220 x 85 (SPE10 sized) grid over the unit
+   square or cube: a log-normal field, exp(contrast * z) with z roughly
+   standard normal, whose mean jumps between horizontal layers. The field
+   is generated from a hash of the cell, so it is the same on any number of
+   processes.
+*/
+double spe10like_coef(Vector& x)
+{
+    const int n[3] = {60, 220, 85};
+    unsigned int h = 2166136261u;
+    for (int i=0; i < x.Size(); ++i)
+    {
+        int c = (int)floor(x(i) * n[i]);
+        c = std::min(std::max(c, 0), n[i] - 1);
+        h = (h ^ (unsigned int)c) * 16777619u;
+    }
+    // Sum of uniforms, close to a standard normal.
+    double z = -6.;
+    for (int i=0; i < 12; ++i)
+    {
+        h = h * 1664525u + 1013904223u;
+        z += (h >> 8) / 16777216.;
+    }
+    const int layer =
+        (int)floor(x(x.Size() - 1) * layers) % 2;
+    return exp(contrast * (0.25 * z + (layer ? 0.5 : -0.5)));
+}
+
+/**
+   Wall time since the last barrier, max over processes.
+*/
+double bench_elapsed(double start)
+{
+    double local = MPI_Wtime() - start;
+    double global;
+    MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_MAX, PROC_COMM);
+    return global;
+}
+
+picojson::value bench_run(int n, int dim, const char *problem, int order,
+                          int num_levels, int elems_per_agg, double theta,
+                          int nu_pro, int nu_relax, smpr_relax_t relax,
+                          ml_cycle_t cycle, int vcycles, bool cache_elmats)
+{
+    picojson::object record;
+    double start;
+
+    prof_reset();
+
+    MPI_Barrier(PROC_COMM);
+    start = MPI_Wtime();
+    prof_begin("problem");
+    Mesh *mesh;
+    if (dim == 2)
+        mesh = new Mesh(n, n, Element::QUADRILATERAL, 1);
+    else
+        mesh = new Mesh(n, n, n, Element::HEXAHEDRON, 1);
+    int nprocs = PROC_NUM;
+    int *proc_partitioning = fem_partition_mesh(*mesh, &nprocs);
+    ParMesh *pmesh = new ParMesh(PROC_COMM, *mesh, proc_partitioning);
+    delete [] proc_partitioning;
+    delete mesh;
+
+    FiniteElementCollection *fec = new H1_FECollection(order, dim);
+    ParFiniteElementSpace *fes = new ParFiniteElementSpace(pmesh, fec);
+    Array<int> ess_bdr(pmesh->bdr_attributes.Max());
+    ess_bdr = 1;
+
+    FunctionCoefficient bdr_coeff(bdr_cond);
+    FunctionCoefficient rhs(rhs_func);
+    ParGridFunction x;
+    ParLinearForm *b;
+    ParBilinearForm *a;
+    Coefficient *scalar_coeff = NULL;
+    MatrixFunctionCoefficient *matrix_coeff = NULL;
+    if (!strcmp(problem, "anisotropic"))
+    {
+        matrix_coeff = new MatrixFunctionCoefficient(dim, anisotropic_coef);
+        fem_build_discrete_problem(fes, rhs, bdr_coeff, *matrix_coeff, true,
+                                   x, b, a, &ess_bdr);
+    }
+    else
+    {
+        if (!strcmp(problem, "spe10like"))
+            scalar_coeff = new FunctionCoefficient(spe10like_coef);
+        else
+            scalar_coeff = new ConstantCoefficient(1.0);
+        fem_build_discrete_problem(fes, rhs, bdr_coeff, *scalar_coeff, true,
+                                   x, b, a, &ess_bdr);
+    }
+    SparseMatrix& Al = a->SpMat();
+    HypreParMatrix *Ag = a->ParallelAssemble();
+    HypreParVector *bg = b->ParallelAssemble();
+    HypreParVector *xg = x.ParallelAverage();
+    prof_end();
+    record["problem time"] = picojson::value(bench_elapsed(start));
+    record["elements per side"] = picojson::value((double)n);
+    record["dofs"] = picojson::value((double)Ag->GetGlobalNumRows());
+    record["nonzeros"] = picojson::value((double)Ag->NNZ());
+
+    MPI_Barrier(PROC_COMM);
+    start = MPI_Wtime();
+    int *nparts_arr = new int[num_levels-1];
+    agg_dof_status_t *bdr_dofs = fem_find_bdr_dofs(*fes, &ess_bdr);
+    nparts_arr[0] = std::max(pmesh->GetNE() / elems_per_agg, 1);
+    agg_partitioning_relations_t *agg_part_rels =
+        fem_create_partitioning(*Ag, *fes, bdr_dofs, nparts_arr, false);
+    delete [] bdr_dofs;
+    for (int i=1; i < num_levels-1; ++i)
+        nparts_arr[i] = std::max((int)round((double)nparts_arr[i-1] /
+                                            (double)elems_per_agg), 1);
+    MultilevelParameters mlp(
+        num_levels-1, nparts_arr, nu_pro, nu_pro, nu_relax, theta, theta,
+        -1, false, false, false);
+    mlp.set_relaxation(relax);
+    ElementMatrixProvider *emp;
+    if (cache_elmats)
+        emp = new ElementMatrixCachedGeometric(*agg_part_rels, Al, a);
+    else
+        emp = new ElementMatrixStandardGeometric(*agg_part_rels, Al, a);
+    ml_data_t *ml_data = ml_produce_data(*Ag, agg_part_rels, emp, mlp);
+    record["setup time"] = picojson::value(bench_elapsed(start));
+    record["operator complexity"] =
+        picojson::value(ml_compute_OC(*Ag, *ml_data));
+    Array<int> dims;
+    ml_get_dims(*ml_data, dims);
+    picojson::array level_dims;
+    for (int i=0; i < dims.Size(); ++i)
+        level_dims.push_back(picojson::value((double)dims[i]));
+    record["level dofs"] = picojson::value(level_dims);
+
+    record["predicted cycle work"] =
+        picojson::value(ml_predict_cycle_work(*Ag, *ml_data, cycle));
+
+    levels_level_t *level = levels_list_get_level(ml_data->levels_list, 0);
+    Solver *vcycle;
+    if (ML_CYCLE_V == cycle)
+        vcycle = new VCycleSolver(level->tg_data, false);
+    else
+        vcycle = new MLCycleSolver(*ml_data, cycle, false);
+    vcycle->SetOperator(*Ag);
+
+    Vector r(Ag->Height()), z(Ag->Height());
+    r.Randomize(PROC_RANK + 1);
+    MPI_Barrier(PROC_COMM);
+    start = MPI_Wtime();
+    prof_begin("cycles");
+    for (int i=0; i < vcycles; ++i)
+        vcycle->Mult(r, z);
+    prof_end();
+    record["cycle time"] =
+        picojson::value(bench_elapsed(start) / std::max(vcycles, 1));
+
+    CGSolver pcg(PROC_COMM);
+    pcg.SetOperator(*Ag);
+    pcg.SetRelTol(1e-6);
+    pcg.SetMaxIter(1000);
+    pcg.SetPrintLevel(0);
+    pcg.SetPreconditioner(*vcycle);
+    MPI_Barrier(PROC_COMM);
+    start = MPI_Wtime();
+    prof_begin("solve");
+    pcg.Mult(*bg, *xg);
+    prof_end();
+    record["solve time"] = picojson::value(bench_elapsed(start));
+    record["PCG iterations"] = picojson::value((double)pcg.GetNumIterations());
+    record["PCG converged"] = picojson::value(pcg.GetConverged() != 0);
+
+    picojson::value regions;
+    const std::string prof_json = prof_to_json(false);
+    if (PROC_RANK == 0)
+    {
+        const std::string err = picojson::parse(regions, prof_json);
+        SA_ASSERT(err.empty());
+        record["profile"] = regions;
+    }
+
+    delete vcycle;
+    ml_free_data(ml_data);
+    agg_free_partitioning(agg_part_rels);
+    delete [] nparts_arr;
+    delete xg;
+    delete bg;
+    delete Ag;
+    delete a;
+    delete b;
+    delete matrix_coeff;
+    delete scalar_coeff;
+    delete fes;
+    delete fec;
+    delete pmesh;
+
+    return picojson::value(record);
+}
+
+int main(int argc, char *argv[])
+{
+    // Initialize process related stuff.
+    MPI_Init(&argc, &argv);
+    proc_init(MPI_COMM_WORLD);
+
+    OptionsParser args(argc, argv);
+    const char *sizes = "8 16 32";
+    args.AddOption(&sizes, "-s", "--sizes",
+                   "Elements per side of the generated meshes, e.g. \"8 16 32\".");
+    int dim = 3;
+    args.AddOption(&dim, "-dim", "--dimension",
+                   "Dimension of the generated meshes (2 or 3).");
+    bool weak = false;
+    args.AddOption(&weak, "-weak", "--weak-scaling",
+                   "-strong", "--strong-scaling",
+                   "Scale the sizes with the number of processes.");
+    const char *problem = "isotropic";
+    args.AddOption(&problem, "-pb", "--problem",
+                   "Coefficient: isotropic, anisotropic or spe10like.");
+    double aniso = 1e-3;
+    args.AddOption(&aniso, "-an", "--anisotropy",
+                   "Ratio of the weak to the strong direction for anisotropic.");
+    double log_contrast = 6.0;
+    args.AddOption(&log_contrast, "-lc", "--log-contrast",
+                   "Standard deviation of the log of the coefficient for spe10like.");
+    int order = 1;
+    args.AddOption(&order, "-o", "--order",
+                   "Polynomial order of finite element space.");
+    int num_levels = 3;
+    args.AddOption(&num_levels, "-l", "--num-levels",
+                   "Number of levels in multilevel algorithm.");
+    int elems_per_agg = 64;
+    args.AddOption(&elems_per_agg, "-e", "--elems-per-agg",
+                   "Number of elements per agglomerated element.");
+    double theta = 0.003;
+    args.AddOption(&theta, "-t", "--theta",
+                   "Tolerance for eigenvalue problems.");
+    int nu_pro = 1;
+    args.AddOption(&nu_pro, "-p", "--nu-pro",
+                   "Degree of the smoother for the smoothed aggregation.");
+    int nu_relax = 2;
+    args.AddOption(&nu_relax, "-n", "--nu-relax",
+                   "Degree for smoother in the relaxation.");
+    const char *smoother = "poly";
+    args.AddOption(&smoother, "-sm", "--smoother",
+                   "Relaxation on all levels: poly, chebyshev or l1gs.");
+    const char *cycle_name = "v";
+    args.AddOption(&cycle_name, "-cy", "--cycle",
+                   "Shape of the multilevel cycle: v, w, f or k.");
+    int vcycles = 10;
+    args.AddOption(&vcycles, "-vc", "--vcycles",
+                   "Number of cycle applications to time.");
+    bool cache_elmats = true;
+    args.AddOption(&cache_elmats, "-cem", "--cache-elmats",
+                   "-ncem", "--no-cache-elmats",
+                   "Compute the element matrices once and keep them for AE assembly.");
+    const char *output = "";
+    args.AddOption(&output, "-out", "--output",
+                   "JSON file to write the results to (empty for standard output only).");
+    args.Parse();
+    if (!args.Good() || (dim != 2 && dim != 3) || num_levels < 2)
+    {
+        if (PROC_RANK == 0)
+            args.PrintUsage(cout);
+        MPI_Finalize();
+        return 1;
+    }
+    if (PROC_RANK == 0)
+        args.PrintOptions(cout);
+    anisotropy = aniso;
+    contrast = log_contrast;
+    smpr_relax_t relax = SMPR_RELAX_POLY;
+    if (!strcmp(smoother, "chebyshev"))
+        relax = SMPR_RELAX_CHEBYSHEV;
+    else if (!strcmp(smoother, "l1gs"))
+        relax = SMPR_RELAX_L1GS;
+    ml_cycle_t cycle = ML_CYCLE_V;
+    if (!strcmp(cycle_name, "w"))
+        cycle = ML_CYCLE_W;
+    else if (!strcmp(cycle_name, "f"))
+        cycle = ML_CYCLE_F;
+    else if (!strcmp(cycle_name, "k"))
+        cycle = ML_CYCLE_K;
+
+    int scale = 1;
+    if (weak)
+        scale = std::max((int)round(pow((double)PROC_NUM, 1.0 / dim)), 1);
+    int threads = 1;
+#if SAAMGE_USE_OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    picojson::object root;
+    picojson::object pjargs;
+    root["invocation"] = picojson::value(argv[0]);
+    root["processors"] = picojson::value((double)PROC_NUM);
+    root["threads"] = picojson::value((double)threads);
+    pjargs["dimension"] = picojson::value((double)dim);
+    pjargs["weak-scaling"] = picojson::value(weak);
+    pjargs["problem"] = picojson::value(std::string(problem));
+    pjargs["order"] = picojson::value((double)order);
+    pjargs["num-levels"] = picojson::value((double)num_levels);
+    pjargs["elems-per-agg"] = picojson::value((double)elems_per_agg);
+    pjargs["theta"] = picojson::value(theta);
+    pjargs["nu-pro"] = picojson::value((double)nu_pro);
+    pjargs["nu-relax"] = picojson::value((double)nu_relax);
+    pjargs["smoother"] = picojson::value(std::string(smoother));
+    pjargs["cycle"] = picojson::value(std::string(cycle_name));
+    pjargs["cache-elmats"] = picojson::value(cache_elmats);
+    root["arguments"] = picojson::value(pjargs);
+
+    prof_enable(true);
+    picojson::array runs;
+    std::istringstream size_list(sizes);
+    int n;
+    while (size_list >> n)
+    {
+        picojson::value run = bench_run(
+            n * scale, dim, problem, order, num_levels, elems_per_agg,
+            theta, nu_pro, nu_relax, relax, cycle, vcycles, cache_elmats);
+        if (PROC_RANK == 0)
+        {
+            const picojson::object& r = run.get<picojson::object>();
+            SA_RPRINTF(0, "BENCH: n %d, dofs %.0f, setup %f s, cycle %f s, "
+                       "solve %f s, iterations %.0f\n", n * scale,
+                       r.find("dofs")->second.get<double>(),
+                       r.find("setup time")->second.get<double>(),
+                       r.find("cycle time")->second.get<double>(),
+                       r.find("solve time")->second.get<double>(),
+                       r.find("PCG iterations")->second.get<double>());
+        }
+        runs.push_back(run);
+    }
+    root["runs"] = picojson::value(runs);
+
+    if (PROC_RANK == 0)
+    {
+        const std::string json = picojson::value(root).serialize(true);
+        if (output[0])
+        {
+            std::ofstream out(output);
+            out << json << std::endl;
+        }
+        else
+            std::cout << json << std::endl;
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+    SAAMGE: smoothed aggregation element based algebraic multigrid hierarchies
+            and solvers.
+
+    Copyright (c) 2018, Lawrence Livermore National Security,
+    LLC. Developed under the auspices of the U.S. Department of Energy by
+    Lawrence Livermore National Laboratory under Contract
+    No. DE-AC52-07NA27344. Written by Delyan Kalchev, Andrew T. Barker,
+    and Panayot S. Vassilevski. Released under LLNL-CODE-667453.
+
+    This file is part of SAAMGE. 
+
+    Please also read the full notice of copyright and license in the file
+    LICENSE.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License (as
+    published by the Free Software Foundation) version 2.1 dated February
+    1999.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the IMPLIED WARRANTY OF
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms and
+    conditions of the GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program; if not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   Converts matrices, tables and arrays of dense matrices to the binary
+   format that mbox_map_* reads in place with mmap.
+
+   Sparse matrices are read from hypre IJ text (-f ij) or from the older
+   mbox_write_sparse_matr binary format (-f mbox). Tables and dense matrix
+   arrays are read from the mbox_write_table and mbox_write_dense_matr_arr
+   formats. The SPE10 permeability text file (-k permeability) is converted
+   to the binary format InversePermeabilityFunction reads with MPI-IO.
+*/
+
+#include <mfem.hpp>
+#include <mpi.h>
+#include <saamge.hpp>
+#include <cstring>
+#include "InversePermeabilityFunction.hpp"
+
+using namespace mfem;
+using namespace saamge;
+
+int main(int argc, char *argv[])
+{
+    // Initialize process related stuff.
+    MPI_Init(&argc, &argv);
+    proc_init(MPI_COMM_WORLD);
+
+    const char *input_file = "";
+    const char *output_file = "";
+    const char *kind = "matrix";
+    const char *format = "ij";
+
+    OptionsParser args(argc, argv);
+    args.AddOption(&input_file, "-i", "--input",
+                   "File to convert.");
+    args.AddOption(&output_file, "-o", "--output",
+                   "Binary file to write.");
+    args.AddOption(&kind, "-k", "--kind",
+                   "What the file holds: matrix, table, dense-array or permeability.");
+    args.AddOption(&format, "-f", "--format",
+                   "Input format of a matrix: ij (hypre text) or mbox (binary).");
+    args.Parse();
+    if (!args.Good() || !input_file[0] || !output_file[0])
+    {
+        if (PROC_RANK == 0)
+            args.PrintUsage(cout);
+        MPI_Finalize();
+        return 1;
+    }
+    if (PROC_RANK == 0)
+        args.PrintOptions(cout);
+
+    StopWatch chrono;
+    chrono.Clear();
+    chrono.Start();
+    int ret = 0;
+    if (!strcmp(kind, "matrix"))
+    {
+        SparseMatrix *mat;
+        if (!strcmp(format, "mbox"))
+            mat = mbox_read_sparse_matr(input_file);
+        else
+            mat = mbox_read_ij_sparse_matr(input_file);
+        mbox_write_mapped_sparse_matr(output_file, *mat);
+        SA_RPRINTF(0, "Converted %d x %d matrix with %d nonzeros.\n",
+                   mat->Height(), mat->Width(), mat->NumNonZeroElems());
+        delete mat;
+    }
+    else if (!strcmp(kind, "table"))
+    {
+        Table *tbl = mbox_read_table(input_file);
+        mbox_write_mapped_table(output_file, *tbl);
+        SA_RPRINTF(0, "Converted table with %d rows and %d connections.\n",
+                   tbl->Size(), tbl->Size_of_connections());
+        delete tbl;
+    }
+    else if (!strcmp(kind, "dense-array"))
+    {
+        int n;
+        DenseMatrix **arr = mbox_read_dense_matr_arr(input_file, &n);
+        mbox_write_mapped_dense_matr_arr(output_file, arr, n);
+        SA_RPRINTF(0, "Converted array of %d dense matrices.\n", n);
+        mbox_free_matr_arr((Matrix **)arr, n);
+    }
+    else if (!strcmp(kind, "permeability"))
+    {
+        if (PROC_RANK == 0)
+            InversePermeabilityFunction::ConvertPermeabilityFile(input_file,
+                                                                 output_file);
+        SA_RPRINTF(0, "%s", "Converted permeability field.\n");
+    }
+    else
+    {
+        SA_RPRINTF(0, "Unknown kind \"%s\".\n", kind);
+        ret = 1;
+    }
+    chrono.Stop();
+    SA_RPRINTF(0, "TIMING: conversion %f seconds.\n", chrono.RealTime());
+
+    MPI_Finalize();
+    return ret;
+}
@@ -41,6 +41,10 @@
 
 #include <mfem.hpp>
 #include <mpi.h>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
 #include <saamge.hpp>
 
 #include "InversePermeabilityFunction.hpp"
@@ -373,7 +377,13 @@ int main(int argc, char *argv[])
     bool w_cycle = false;
     args.AddOption(&w_cycle, "-w", "--w-cycle",
                    "-nw", "--no-w-cycle",
-                   "Use a W-cycle (instead of V-cycle).");
+                   "Use a W-cycle (instead of V-cycle), same as --cycle w.");
+    const char *cycle = "v";
+    args.AddOption(&cycle, "-cy", "--cycle",
+                   "Shape of the multilevel cycle: v, w, f or k.");
+    int cycle_mu = 2;
+    args.AddOption(&cycle_mu, "-mu", "--cycle-mu",
+                   "Coarse-level visits per level for the W- and K-cycles.");
     bool zero_rhs = false;
     args.AddOption(&zero_rhs, "-z", "--zero-rhs",
                    "-nz", "--no-zero-rhs",
@@ -398,10 +408,19 @@ int main(int argc, char *argv[])
     args.AddOption(&coarse_direct, "--coarse-direct", "--coarse-direct",
                    "--coarse-amg", "--coarse-amg",
                    "Use a direct solver on coarsest level, rather than default AMG V-cycle.");
+    int redist_threshold = 0;
+    args.AddOption(&redist_threshold, "-rt", "--redist-threshold",
+                   "Solve on fewer processes once the coarsest level is smaller than this (0 to disable).");
+    int redist_rows = 1000;
+    args.AddOption(&redist_rows, "-rr", "--redist-rows",
+                   "Target rows per process of the redistributed coarsest level.");
     bool direct_eigensolver = true;
     args.AddOption(&direct_eigensolver, "-q", "--direct-eigensolver",
                    "-nq", "--no-direct-eigensolver",
                    "Use direct eigensolver from LAPACK instead of default ARPACK.");
+    int lobpcg_threshold = 0;
+    args.AddOption(&lobpcg_threshold, "-lt", "--lobpcg-threshold",
+                   "Solve the local eigenproblems larger than this with LOBPCG (0 to disable).");
     bool do_aggregates = false;
     args.AddOption(&do_aggregates, "-agg", "--do-aggregates",
                    "-nagg", "--no-do-aggregates",
@@ -418,6 +437,45 @@ int main(int argc, char *argv[])
     args.AddOption(&adapt, "-ad", "--adapt",
                    "-nad", "--no-adapt",
                    "Perturbs the matrix and reuses the spaces.");
+    bool update_coefficients = false;
+    args.AddOption(&update_coefficients, "-uc", "--update-coefficients",
+                   "-nuc", "--no-update-coefficients",
+                   "Solve again with a changed coefficient, updating the hierarchy in place.");
+    bool reuse_evects = false;
+    args.AddOption(&reuse_evects, "-re", "--reuse-evects",
+                   "-nre", "--no-reuse-evects",
+                   "With --update-coefficients, start the local eigensolves from the old eigenvectors.");
+    bool check_update = false;
+    args.AddOption(&check_update, "-cu", "--check-update",
+                   "-ncu", "--no-check-update",
+                   "With --update-coefficients, also build the hierarchy from scratch and compare it with the updated one (V-cycle and CG only).");
+    double reuse_tol = 0.0;
+    args.AddOption(&reuse_tol, "-ret", "--reuse-tol",
+                   "Skip the local eigensolves whose old eigenvectors pass a Rayleigh-Ritz test with this tolerance (0 never skips).");
+    const char *hierarchy_cache = "";
+    args.AddOption(&hierarchy_cache, "-hc", "--hierarchy-cache",
+                   "Directory to restore the hierarchy from and save it to (empty for none).");
+    bool cache_elmats = false;
+    args.AddOption(&cache_elmats, "-cem", "--cache-elmats",
+                   "-ncem", "--no-cache-elmats",
+                   "Compute the element matrices once and keep them for AE assembly.");
+    const char *smoother = "poly";
+    args.AddOption(&smoother, "-sm", "--smoother",
+                   "Relaxation on all levels: poly, chebyshev or l1gs.");
+    bool pipelined = false;
+    args.AddOption(&pipelined, "-ppcg", "--pipelined-pcg",
+                   "-nppcg", "--no-pipelined-pcg",
+                   "Use pipelined PCG with one nonblocking reduction per iteration for the outer solve.");
+    int num_rhs = 1;
+    args.AddOption(&num_rhs, "-nr", "--num-rhs",
+                   "Also solve with this many right-hand sides at once by block PCG with a block V-cycle (1 for none).");
+    bool check_smoother = false;
+    args.AddOption(&check_smoother, "-csm", "--check-smoother",
+                   "-ncsm", "--no-check-smoother",
+                   "Compare the fused polynomial smoother of the finest level with the reference implementation.");
+    const char *profile_file = "";
+    args.AddOption(&profile_file, "-prof", "--profile",
+                   "Profile setup and solve, print the regions and write them to this JSON file (empty for none).");
 
     args.Parse();
     if (!args.Good())
@@ -429,11 +487,20 @@ int main(int argc, char *argv[])
     }
     if (PROC_RANK == 0)
         args.PrintOptions(cout);
+    prof_enable(profile_file[0] != '\0');
     if (first_elems_per_agg < 0) first_elems_per_agg = elems_per_agg;
     if (first_theta < 0.0) first_theta = theta;
     if (first_nu_pro < 0) first_nu_pro = nu_pro;
 
-    SA_ASSERT(!w_cycle); // no longer implemented
+    ml_cycle_t cycle_type = ML_CYCLE_V;
+    if (w_cycle || !strcmp(cycle, "w"))
+        cycle_type = ML_CYCLE_W;
+    else if (!strcmp(cycle, "f"))
+        cycle_type = ML_CYCLE_F;
+    else if (!strcmp(cycle, "k"))
+        cycle_type = ML_CYCLE_K;
+    else
+        SA_ASSERT(!strcmp(cycle, "v"));
     SA_ASSERT(!(correct_nulspace && minimal_coarse));
 
     MPI_Barrier(PROC_COMM); // try to make MFEM's debug element orientation prints not mess up the parameters above
@@ -456,7 +523,8 @@ int main(int argc, char *argv[])
 
         InversePermeabilityFunction::SetNumberCells(Nx,Ny,Nz);
         InversePermeabilityFunction::SetMeshSizes(hx, hy, hz);
-        InversePermeabilityFunction::ReadPermeabilityFile(perm_file);
+        if (!InversePermeabilityFunction::IsBinaryPermeabilityFile(perm_file))
+            InversePermeabilityFunction::ReadPermeabilityFile(perm_file);
     }
     else if (generate_mesh > 0)
     {
@@ -504,6 +572,9 @@ int main(int argc, char *argv[])
     pmesh = new ParMesh(MPI_COMM_WORLD, *mesh, proc_partitioning);
     delete [] proc_partitioning;
     fem_refine_mesh_times(times_refine, *pmesh);
+    if (spe10 && InversePermeabilityFunction::IsBinaryPermeabilityFile(perm_file))
+        InversePermeabilityFunction::ReadPermeabilityFile(perm_file, PROC_COMM,
+                                                          *pmesh);
 
     FiniteElementCollection * fec;
     ParFiniteElementSpace *fes;
@@ -710,8 +781,6 @@ int main(int argc, char *argv[])
         fem_parallel_visualize_partitioning(
             *pmesh, agg_part_rels->partitioning, nparts_arr[0]);
     }
-    ElementMatrixProvider * emp =
-        new ElementMatrixStandardGeometric(*agg_part_rels, Al, a);
     int polynomial_coarse;
     if (minimal_coarse)
         polynomial_coarse = 0;
@@ -727,11 +796,104 @@ int main(int argc, char *argv[])
         mlp.set_polynomial_coarse_space(0,1);
     if (coarse_direct)
         mlp.set_coarse_direct(true);
-    ml_data = ml_produce_data(*Ag, agg_part_rels, emp, mlp);
+    mlp.set_coarse_redistribution(redist_threshold, redist_rows);
+    mlp.set_eigenvector_reuse(reuse_evects, reuse_tol);
+    mlp.set_lobpcg_threshold(lobpcg_threshold);
+    if (!strcmp(smoother, "chebyshev"))
+        mlp.set_relaxation(SMPR_RELAX_CHEBYSHEV);
+    else if (!strcmp(smoother, "l1gs"))
+        mlp.set_relaxation(SMPR_RELAX_L1GS);
+    else
+        SA_ASSERT(!strcmp(smoother, "poly"));
+    for (int i=0; i<num_levels-1; ++i)
+        mlp.set_cycle_mu(i, cycle_mu);
+    // the restored hierarchy cannot be adapted or updated
+    const bool use_cache = (hierarchy_cache[0] && !adapt &&
+                            !update_coefficients);
+    ml_data = NULL;
+    if (use_cache)
+        ml_data = mlcache_read(hierarchy_cache, *Ag, agg_part_rels, mlp);
+    if (!ml_data)
+    {
+        ElementMatrixProvider * emp;
+        if (cache_elmats)
+            emp = new ElementMatrixCachedGeometric(*agg_part_rels, Al, a);
+        else
+            emp = new ElementMatrixStandardGeometric(*agg_part_rels, Al, a);
+        ml_data = ml_produce_data(*Ag, agg_part_rels, emp, mlp);
+        if (use_cache)
+            mlcache_write(hierarchy_cache, *Ag, *agg_part_rels, mlp, *ml_data);
+    }
     chrono.Stop();
     SA_RPRINTF(0,"TIMING: multilevel spectral SA-AMGe setup %f seconds.\n",
                chrono.RealTime());
+    SA_RPRINTF(0,"Predicted work per %s-cycle: %f\n", cycle,
+               ml_predict_cycle_work(*Ag, *ml_data, cycle_type));
+
+    if (check_smoother)
+    {
+        // the fused kernel has to give the same iterate as the reference,
+        // up to rounding
+        levels_level_t * level = levels_list_get_level(ml_data->levels_list, 0);
+        smpr_poly_data_t *poly_data = level->tg_data->poly_data;
+        HypreParVector sb(*Ag), sx_ref(*Ag), sx_fused(*Ag);
+        sb.Randomize(1);
+        sx_ref.Randomize(2);
+        sx_fused = sx_ref;
+        smpr_compute_poly(*Ag, sb, sx_ref, poly_data->degree, poly_data->roots,
+                          poly_data->Dinv_neg);
+        smpr_compute_poly_fused(*Ag, sb, sx_fused, poly_data->degree,
+                                poly_data->roots, poly_data);
+        double local[2] = {0.0, 0.0};
+        for (int i=0; i < sx_ref.Size(); ++i)
+        {
+            local[0] = std::max(local[0], std::fabs(sx_ref(i) - sx_fused(i)));
+            local[1] = std::max(local[1], std::fabs(sx_ref(i)));
+        }
+        double global[2];
+        MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_MAX, PROC_COMM);
+        if (global[0] <= 1e-12 * poly_data->degree * global[1])
+            SA_RPRINTF(0, "Fused polynomial smoother agrees with the reference: "
+                          "max difference %g, max entry %g.\n",
+                       global[0], global[1]);
+        else
+            SA_RPRINTF(0, "Fused polynomial smoother differs from the reference: "
+                          "max difference %g, max entry %g!\n",
+                       global[0], global[1]);
+    }
 
+    if (lobpcg_threshold > 0)
+    {
+        // LOBPCG against the direct solver on the largest local AE of the
+        // finest level
+        levels_level_t * level = levels_list_get_level(ml_data->levels_list, 0);
+        const interp_data_t *interp_data = level->tg_data->interp_data;
+        int largest = -1;
+        for (int i=0; i < interp_data->nparts; ++i)
+        {
+            if (interp_data->AEs_stiffm[i] && (largest < 0 ||
+                interp_data->AEs_stiffm[i]->Height() >
+                interp_data->AEs_stiffm[largest]->Height()))
+                largest = i;
+        }
+        double diff = 0.0;
+        if (largest >= 0)
+        {
+            Eigensolver eigensolver(agg_part_rels->mises, *agg_part_rels);
+            diff = eigensolver.CompareLOBPCGWithDirect(
+                *interp_data->AEs_stiffm[largest]);
+        }
+        double global_diff;
+        MPI_Allreduce(&diff, &global_diff, 1, MPI_DOUBLE, MPI_MAX, PROC_COMM);
+        if (0.0 <= global_diff && global_diff <= 1e-6)
+            SA_RPRINTF(0, "LOBPCG eigenvalues agree with the direct solver: "
+                          "max difference %g.\n", global_diff);
+        else
+            SA_RPRINTF(0, "LOBPCG eigenvalues differ from the direct solver: "
+                          "max difference %g!\n", global_diff);
+    }
+
+    HypreParVector *update_guess = NULL;
     bool finished=false;
     while (!finished)
     {
@@ -764,27 +926,179 @@ int main(int argc, char *argv[])
         {
             Bprec = new DoubleCycle(*Ag, *ml_data);
         }
+        else if (cycle_type != ML_CYCLE_V)
+        {
+            Bprec = new MLCycleSolver(*ml_data, cycle_type, false);
+            Bprec->SetOperator(*Ag);
+        }
         else
         {
             levels_level_t * level = levels_list_get_level(ml_data->levels_list, 0);
             Bprec = new VCycleSolver(level->tg_data, false);
             Bprec->SetOperator(*Ag);
         }
-        CGSolver hpcg(MPI_COMM_WORLD);
-        hpcg.SetOperator(*Ag);
-        hpcg.SetRelTol(1e-6); // for some reason MFEM squares this...
-        hpcg.SetMaxIter(1000);
-        hpcg.SetPrintLevel(1);
-        hpcg.SetPreconditioner(*Bprec);
-        hpcg.Mult(*bg,*pxg);
-        iterations = hpcg.GetNumIterations();
-        converged = hpcg.GetConverged();
+        if ((cycle_type == ML_CYCLE_K || cycle_type == ML_CYCLE_F) &&
+            !double_cycle)
+        {
+            // the K-cycle is not a fixed linear operator and the F-cycle is
+            // not symmetric, plain CG needs both
+            prof_begin("solve");
+            iterations = kalchev_pcg(*Ag, *Bprec, *bg, *pxg, 1, 1000,
+                                     1e-12, 1e-24, false, true);
+            converged = iterations >= 0;
+            if (!converged)
+                iterations = -iterations;
+            prof_count("PCG iterations", iterations);
+            prof_end();
+        }
+        else if (pipelined)
+        {
+            prof_begin("solve");
+            // with a zero r.h.s. the test is on || x ||_A, which is not
+            // squared like (B r, r)
+            iterations = pipelined_pcg(*Ag, *Bprec, *bg, *pxg, 1, 1000,
+                                       zero_rhs ? 1e-6 : 1e-12, 1e-24,
+                                       zero_rhs);
+            converged = iterations >= 0;
+            if (!converged)
+                iterations = -iterations;
+            prof_count("PCG iterations", iterations);
+            prof_end();
+        }
+        else
+        {
+            CGSolver hpcg(MPI_COMM_WORLD);
+            hpcg.SetOperator(*Ag);
+            hpcg.SetRelTol(1e-6); // for some reason MFEM squares this...
+            hpcg.SetMaxIter(1000);
+            hpcg.SetPrintLevel(1);
+            hpcg.SetPreconditioner(*Bprec);
+            prof_begin("solve");
+            hpcg.Mult(*bg,*pxg);
+            prof_count("PCG iterations", hpcg.GetNumIterations());
+            prof_end();
+            iterations = hpcg.GetNumIterations();
+            converged = hpcg.GetConverged();
+        }
         delete Bprec;
         if (converged)
             SA_RPRINTF(0, "Outer PCG converged in %d iterations.\n", iterations);
         else
             SA_RPRINTF(0, "Outer PCG failed to converge after %d iterations!\n",
                        iterations);
+        if (update_guess)
+        {
+            // the updated hierarchy against one built from scratch on the
+            // same coefficients, solved from the same initial guess
+            ElementMatrixProvider * emp;
+            if (cache_elmats)
+                emp = new ElementMatrixCachedGeometric(*agg_part_rels, a->SpMat(), a);
+            else
+                emp = new ElementMatrixStandardGeometric(*agg_part_rels, a->SpMat(), a);
+            ml_data_t *rebuilt = ml_produce_data(*Ag, agg_part_rels, emp, mlp);
+            // Vectors reused after a Rayleigh-Ritz test are not exact
+            // eigenvectors, so with --reuse-tol the coarse spaces and the
+            // counts may differ a little.
+            const int nl = ml_data->levels_list.num_levels;
+            bool same = (rebuilt->levels_list.num_levels == nl);
+            double size_diff = 0.0;
+            for (int i=0; same && i < nl; ++i)
+            {
+                levels_level_t * l0 = levels_list_get_level(ml_data->levels_list, i);
+                levels_level_t * l1 = levels_list_get_level(rebuilt->levels_list, i);
+                const int n0 = l0->tg_data->interp->N();
+                const int n1 = l1->tg_data->interp->N();
+                size_diff = std::max(size_diff, (n0 > n1 ? n0 - n1 : n1 - n0) /
+                                                (double)std::max(n1, 1));
+            }
+            levels_level_t * level = levels_list_get_level(rebuilt->levels_list, 0);
+            VCycleSolver rebuilt_prec(level->tg_data, false);
+            rebuilt_prec.SetOperator(*Ag);
+            CGSolver hpcg(MPI_COMM_WORLD);
+            hpcg.SetOperator(*Ag);
+            hpcg.SetRelTol(1e-6);
+            hpcg.SetMaxIter(1000);
+            hpcg.SetPrintLevel(0);
+            hpcg.SetPreconditioner(rebuilt_prec);
+            hpcg.Mult(*bg, *update_guess);
+            const int rebuilt_iterations = hpcg.GetNumIterations();
+            const int iter_diff = (iterations > rebuilt_iterations ?
+                                   iterations - rebuilt_iterations :
+                                   rebuilt_iterations - iterations);
+            SA_RPRINTF(0, "Rebuilt hierarchy: Outer PCG converged in %d "
+                          "iterations, the updated one in %d. Largest relative "
+                          "difference of the coarse sizes: %g.\n",
+                       rebuilt_iterations, iterations, size_diff);
+            same = same && converged && hpcg.GetConverged();
+            if (same && 0. == size_diff && 0 == iter_diff)
+                SA_RPRINTF(0, "%s", "Update matches the rebuilt hierarchy.\n");
+            else if (same && size_diff <= 0.1 &&
+                     iter_diff <= std::max(1, rebuilt_iterations / 10))
+                SA_RPRINTF(0, "%s", "Update agrees with the rebuilt hierarchy "
+                                    "within tolerance.\n");
+            else
+                SA_RPRINTF(0, "%s", "Update differs from the rebuilt hierarchy!\n");
+            ml_free_data(rebuilt);
+            delete update_guess;
+            update_guess = NULL;
+        }
+        if (num_rhs > 1 && cycle_type == ML_CYCLE_V && !double_cycle)
+        {
+            // the first right-hand side is the problem's, the others random
+            levels_level_t * level = levels_list_get_level(ml_data->levels_list, 0);
+            VCycleSolver block_prec(level->tg_data, false);
+            block_prec.SetOperator(*Ag);
+            const int n = bg->Size();
+            DenseMatrix B(n, num_rhs), X(n, num_rhs);
+            for (int v=0; v < num_rhs; ++v)
+            {
+                Vector col(B.Data() + (size_t)v * n, n);
+                if (v)
+                    col.Randomize(v);
+                else
+                    col = *bg;
+            }
+            X = 0.0;
+            std::vector<int> column_iters(num_rhs);
+            prof_begin("block solve");
+            iterations = solve_block_pcg(*Ag, block_prec, B, X, 0, 1000,
+                                         1e-12, 1e-24, &column_iters[0]);
+            prof_end();
+            if (iterations >= 0)
+                SA_RPRINTF(0, "Block PCG converged in %d iterations for %d "
+                              "right-hand sides.\n", iterations, num_rhs);
+            else
+                SA_RPRINTF(0, "Block PCG failed to converge after %d "
+                              "iterations!\n", -iterations);
+
+            // the first column has to behave as the single-vector solve with
+            // the same stopping test
+            HypreParVector x0(*Ag);
+            x0 = 0.0;
+            const int single_iters = kalchev_pcg(*Ag, block_prec, *bg, x0, 0,
+                                                 1000, 1e-12, 1e-24, false);
+            // both do the same arithmetic, so they agree up to rounding
+            const double agree_tol = 1e-8;
+            Vector col(X.Data(), n);
+            double local[2] = {0.0, 0.0};
+            for (int i=0; i < n; ++i)
+            {
+                local[0] = std::max(local[0], std::fabs(col(i) - x0(i)));
+                local[1] = std::max(local[1], std::fabs(x0(i)));
+            }
+            double global[2];
+            MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_MAX, PROC_COMM);
+            if (single_iters >= 0 && column_iters[0] == single_iters &&
+                global[0] <= agree_tol * global[1])
+                SA_RPRINTF(0, "Block PCG column 0 agrees with the single-vector "
+                              "PCG: %d iterations, max difference %g.\n",
+                           single_iters, global[0]);
+            else
+                SA_RPRINTF(0, "Block PCG column 0 took %d iterations, the "
+                              "single-vector PCG %d, max difference %g, "
+                              "|| x ||_inf %g!\n", column_iters[0],
+                           single_iters, global[0], global[1]);
+        }
         x = *pxg;
         if (false)
             fem_parallel_visualize_gf(*pmesh, x);
@@ -799,6 +1113,47 @@ int main(int argc, char *argv[])
             mbox_add_diag_parallel_matrix(*Ag, 1.0);
             adapt_update_operators(*Ag, *ml_data, mlp, true);
         }
+        else if (update_coefficients)
+        {
+            update_coefficients = false;
+            finished = false;
+            SA_ASSERT(conduct_coeff && !elasticity);
+            chrono.Clear();
+            chrono.Start();
+            // a new sample of the coefficient on the same mesh
+            for (int i=0; i < conductivity.Size(); ++i)
+                conductivity(i) *= 1.0 + 0.5 * (i % 3);
+            ParBilinearForm *old_a = a;
+            delete b;
+            delete bg;
+            delete pxg;
+            delete Ag;
+            fem_build_discrete_problem(fes, rhs, bdr_coeff, *conduct_coeff, true,
+                                       x, b, a, &ess_bdr);
+            Ag = a->ParallelAssemble();
+            bg = b->ParallelAssemble();
+            pxg = x.ParallelAverage();
+            if (check_update && cycle_type == ML_CYCLE_V && !double_cycle &&
+                !pipelined && !zero_rhs)
+                update_guess = x.ParallelAverage();
+            ElementMatrixProvider * emp;
+            if (cache_elmats)
+                emp = new ElementMatrixCachedGeometric(*agg_part_rels, a->SpMat(), a);
+            else
+                emp = new ElementMatrixStandardGeometric(*agg_part_rels, a->SpMat(), a);
+            ml_update_coefficients(*Ag, *ml_data, emp, mlp);
+            delete old_a;
+            chrono.Stop();
+            SA_RPRINTF(0,"TIMING: multilevel spectral SA-AMGe update %f seconds.\n",
+                       chrono.RealTime());
+        }
+    }
+
+    if (prof_enabled())
+    {
+        prof_print(cout);
+        if (!prof_write_json(profile_file))
+            SA_RPRINTF(0, "Could not write %s.\n", profile_file);
     }
 
     ml_free_data(ml_data);